@@ -0,0 +1,101 @@
+//===- FuzzerArena.cpp - Corpus storage -----------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// CorpusArena.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerArena.h"
+#include "FuzzerIO.h"
+#include <cstdlib>
+#if LIBFUZZER_POSIX
+#include <sys/mman.h>
+#endif
+
+namespace fuzzer {
+
+static uint8_t *AllocateArenaMemory(size_t Size, bool UseMmap) {
+#if LIBFUZZER_POSIX
+  if (UseMmap) {
+    void *P = mmap(nullptr, Size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return P == MAP_FAILED ? nullptr : static_cast<uint8_t *>(P);
+  }
+#endif
+  return static_cast<uint8_t *>(malloc(Size));
+}
+
+static void FreeArenaMemory(uint8_t *P, size_t Size, bool UseMmap) {
+#if LIBFUZZER_POSIX
+  if (UseMmap) {
+    munmap(P, Size);
+    return;
+  }
+#endif
+  free(P);
+}
+
+CorpusArena::~CorpusArena() {
+  if (Base)
+    FreeArenaMemory(Base, Capacity, UseMmap);
+}
+
+void CorpusArena::Reallocate(size_t NewCapacity) {
+  assert(NewCapacity >= End);
+  uint8_t *NewBase = AllocateArenaMemory(NewCapacity, UseMmap);
+  if (!NewBase) {
+    Printf("ERROR: failed to allocate %zd bytes for the corpus\n",
+           NewCapacity);
+    exit(1);
+  }
+  if (End)
+    memcpy(NewBase, Base, End);
+  if (Base)
+    FreeArenaMemory(Base, Capacity, UseMmap);
+  Base = NewBase;
+  Capacity = NewCapacity;
+}
+
+ArenaSlot CorpusArena::Append(const void *Data, size_t Size) {
+  ArenaSlot Slot;
+  Slot.Size = Size;
+  if (!Size) return Slot;
+  size_t NewEnd = End + AlignedSize(Size);
+  if (NewEnd > Capacity)
+    Reallocate(std::max(NewEnd, std::max(Capacity * 2, kMinCapacity)));
+  Slot.Offset = End;
+  memcpy(Base + End, Data, Size);
+  End = NewEnd;
+  LiveBytes += AlignedSize(Size);
+  return Slot;
+}
+
+void CorpusArena::Compact(const Vector<ArenaSlot *> &Slots) {
+  Vector<ArenaSlot *> Sorted;
+  for (auto Slot : Slots)
+    if (Slot->Size)
+      Sorted.push_back(Slot);
+  std::sort(Sorted.begin(), Sorted.end(),
+            [](const ArenaSlot *A, const ArenaSlot *B) {
+              return A->Offset < B->Offset;
+            });
+  // Every slot moves down or stays, so the ones not moved yet are intact.
+  size_t NewEnd = 0;
+  for (auto Slot : Sorted) {
+    assert(Slot->Offset >= NewEnd);
+    if (Slot->Offset != NewEnd)
+      memmove(Base + NewEnd, Base + Slot->Offset, Slot->Size);
+    Slot->Offset = NewEnd;
+    NewEnd += AlignedSize(Slot->Size);
+  }
+  assert(NewEnd == LiveBytes);
+  End = NewEnd;
+  if (Capacity > kMinCapacity && End < Capacity / 4)
+    Reallocate(std::max(End * 2, kMinCapacity));
+}
+
+}  // namespace fuzzer
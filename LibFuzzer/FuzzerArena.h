@@ -0,0 +1,105 @@
+//===- FuzzerArena.h - Internal header for the Fuzzer -----------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::CorpusArena, contiguous storage for the corpus units and their
+// feature sets.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_ARENA_H
+#define LLVM_FUZZER_ARENA_H
+
+#include "FuzzerDefs.h"
+#include <algorithm>
+
+namespace fuzzer {
+
+// A read-only view of Size elements, like a const Vector<T> without the
+// allocation. Views into a CorpusArena are invalidated by its next change.
+template <class T>
+class Span {
+ public:
+  Span() {}
+  Span(const T *Data, size_t Size) : Data(Data), Size(Size) {}
+  const T *data() const { return Data; }
+  size_t size() const { return Size; }
+  bool empty() const { return Size == 0; }
+  const T *begin() const { return Data; }
+  const T *end() const { return Data + Size; }
+  const T &operator[](size_t Idx) const { return Data[Idx]; }
+  Vector<T> ToVector() const { return Vector<T>(begin(), end()); }
+
+ private:
+  const T *Data = nullptr;
+  size_t Size = 0;
+};
+
+// Where an array lives in the arena. Size is in bytes.
+struct ArenaSlot {
+  size_t Offset = 0;
+  size_t Size = 0;
+};
+
+// An append-only byte arena. Freed slots are only reclaimed by Compact,
+// which slides the live slots down to the start of the arena, so the owner
+// refers to its data by offset rather than by pointer.
+class CorpusArena {
+ public:
+  static const size_t kAlignment = 4;  // Enough for the feature sets.
+
+  // With UseMmap the arena is mapped directly instead of being allocated
+  // from the heap, so that a large corpus neither fragments the heap nor
+  // keeps its pages after shrinking.
+  explicit CorpusArena(bool UseMmap = false) : UseMmap(UseMmap) {}
+  ~CorpusArena();
+
+  ArenaSlot Append(const void *Data, size_t Size);
+  void Free(const ArenaSlot &Slot) {
+    assert(LiveBytes >= AlignedSize(Slot.Size));
+    LiveBytes -= AlignedSize(Slot.Size);
+  }
+
+  template <class T>
+  Span<T> Get(const ArenaSlot &Slot) const {
+    if (!Slot.Size) return Span<T>();
+    return Span<T>(reinterpret_cast<const T *>(Base + Slot.Offset),
+                   Slot.Size / sizeof(T));
+  }
+
+  size_t UsedBytes() const { return End; }
+  size_t LiveBytesCount() const { return LiveBytes; }
+  size_t CapacityBytes() const { return Capacity; }
+
+  // True once the freed bytes outweigh the live ones.
+  bool NeedsCompaction() const {
+    return End - LiveBytes > std::max(LiveBytes, kMinCompaction);
+  }
+
+  // Moves the given slots, which must be all the live ones, to the start of
+  // the arena and updates their offsets. Shrinks the arena if it is mostly
+  // empty afterwards.
+  void Compact(const Vector<ArenaSlot *> &Slots);
+
+ private:
+  static const size_t kMinCapacity = 1 << 16;
+  static const size_t kMinCompaction = 1 << 20;
+
+  static size_t AlignedSize(size_t Size) {
+    return (Size + kAlignment - 1) & ~(kAlignment - 1);
+  }
+  void Reallocate(size_t NewCapacity);
+
+  uint8_t *Base = nullptr;
+  size_t Capacity = 0;
+  size_t End = 0;        // Bytes handed out, live or freed.
+  size_t LiveBytes = 0;  // Bytes in the slots not freed yet.
+  bool UseMmap;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_ARENA_H
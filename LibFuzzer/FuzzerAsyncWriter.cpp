@@ -0,0 +1,184 @@
+//===- FuzzerAsyncWriter.cpp - Background file writer ---------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// The requests go through a bounded lock-free queue (D. Vyukov's bounded
+// MPMC queue, with a single consumer). The writer thread sleeps on a
+// condition variable when the queue is empty; producers only touch the mutex
+// to wake it up.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerAsyncWriter.h"
+#include "FuzzerIO.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+namespace fuzzer {
+
+namespace {
+
+struct WriteRequest {
+  Unit U;
+  std::string Path;
+  bool Remove;
+};
+
+class RequestQueue {
+ public:
+  static const size_t kSize = 1024;  // Power of 2.
+
+  RequestQueue() {
+    for (size_t i = 0; i < kSize; i++)
+      Cells[i].Sequence.store(i, std::memory_order_relaxed);
+  }
+
+  bool Push(WriteRequest *R) {
+    size_t Pos = Tail.load(std::memory_order_relaxed);
+    while (true) {
+      Cell &C = Cells[Pos & (kSize - 1)];
+      size_t Seq = C.Sequence.load(std::memory_order_acquire);
+      intptr_t Diff = (intptr_t)Seq - (intptr_t)Pos;
+      if (Diff == 0) {
+        if (Tail.compare_exchange_weak(Pos, Pos + 1,
+                                       std::memory_order_relaxed)) {
+          C.Request = R;
+          C.Sequence.store(Pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (Diff < 0) {
+        return false;  // Full.
+      } else {
+        Pos = Tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Only called by the writer thread.
+  WriteRequest *Pop() {
+    Cell &C = Cells[Head & (kSize - 1)];
+    size_t Seq = C.Sequence.load(std::memory_order_acquire);
+    if (Seq != Head + 1)
+      return nullptr;  // Empty.
+    WriteRequest *R = C.Request;
+    C.Sequence.store(Head + kSize, std::memory_order_release);
+    Head++;
+    return R;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> Sequence;
+    WriteRequest *Request;
+  };
+  Cell Cells[kSize];
+  std::atomic<size_t> Tail{0};
+  size_t Head = 0;
+};
+
+RequestQueue *Queue;
+FsyncPolicy Policy;
+std::atomic<bool> Started{false};
+std::atomic<size_t> NumQueued{0}, NumDone{0};
+std::atomic<bool> WriterSleeping{false};
+std::mutex WakeUpMutex;
+std::condition_variable WakeUp;
+
+void WriteFile(const Unit &U, const std::string &Path) {
+  FILE *Out = fopen(Path.c_str(), "wb");
+  if (!Out) return;
+  fwrite(U.data(), sizeof(U[0]), U.size(), Out);
+  if (Policy != FSYNC_NONE)
+    SyncFileToDisk(Out);
+  fclose(Out);
+}
+
+void WriterThread() {
+  Vector<std::string> Dirs;  // Changed by the current batch.
+  while (true) {
+    // Carry out everything that is queued, as one batch.
+    while (WriteRequest *R = Queue->Pop()) {
+      if (R->Remove)
+        RemoveFile(R->Path);
+      else
+        WriteFile(R->U, R->Path);
+      if (Policy == FSYNC_FILES_AND_DIRS) {
+        std::string Dir = DirName(R->Path);
+        if (std::find(Dirs.begin(), Dirs.end(), Dir) == Dirs.end())
+          Dirs.push_back(Dir);
+      }
+      delete R;
+      NumDone.fetch_add(1, std::memory_order_release);
+    }
+    for (auto &Dir : Dirs)
+      SyncDirToDisk(Dir);
+    Dirs.clear();
+    std::unique_lock<std::mutex> Lock(WakeUpMutex);
+    WriterSleeping.store(true);
+    // A push that missed the flag is picked up by the timeout.
+    if (NumQueued.load() == NumDone.load(std::memory_order_acquire))
+      WakeUp.wait_for(Lock, std::chrono::milliseconds(100));
+    WriterSleeping.store(false);
+  }
+}
+
+void Enqueue(WriteRequest *R) {
+  NumQueued.fetch_add(1);
+  while (!Queue->Push(R))
+    std::this_thread::yield();  // The writer is behind, wait for it.
+  if (WriterSleeping.load()) {
+    std::lock_guard<std::mutex> Lock(WakeUpMutex);
+    WakeUp.notify_one();
+  }
+}
+
+}  // namespace
+
+void StartAsyncWriter(FsyncPolicy P) {
+  if (Started) return;
+  Policy = P;
+  Queue = new RequestQueue;
+  std::thread T(WriterThread);
+  T.detach();
+  Started = true;
+  std::atexit([] { DrainAsyncWriter(-1); });
+}
+
+void WriteToFileAsync(const Unit &U, const std::string &Path) {
+  if (!Started) {
+    WriteToFile(U, Path);
+    return;
+  }
+  Enqueue(new WriteRequest{U, Path, false});
+}
+
+void RemoveFileAsync(const std::string &Path) {
+  if (!Started) {
+    RemoveFile(Path);
+    return;
+  }
+  Enqueue(new WriteRequest{Unit(), Path, true});
+}
+
+void DrainAsyncWriter(int TimeoutMs) {
+  if (!Started) return;
+  size_t Target = NumQueued.load();
+  for (int Ms = 0; TimeoutMs < 0 || Ms < TimeoutMs; Ms++) {
+    if (NumDone.load(std::memory_order_acquire) >= Target)
+      return;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  Printf("WARNING: %zd pending corpus writes were not finished\n",
+         Target - NumDone.load());
+}
+
+}  // namespace fuzzer
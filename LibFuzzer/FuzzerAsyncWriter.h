@@ -0,0 +1,44 @@
+//===- FuzzerAsyncWriter.h - Internal header for the Fuzzer -----*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Writes corpus files and artifacts in a background thread, so that a slow
+// file system does not stall the fuzzing loop.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_ASYNC_WRITER_H
+#define LLVM_FUZZER_ASYNC_WRITER_H
+
+#include "FuzzerDefs.h"
+
+namespace fuzzer {
+
+enum FsyncPolicy {
+  FSYNC_NONE = 0,
+  FSYNC_FILES = 1,     // Every file written is synced before being closed.
+  FSYNC_FILES_AND_DIRS = 2,  // The dirs changed by a batch are synced too.
+};
+
+// Starts the writer thread. Until then, the functions below do their work
+// synchronously.
+void StartAsyncWriter(FsyncPolicy Policy);
+
+// Queue a request for the writer thread. The requests are carried out in
+// order; if the queue is full the caller waits for a free slot.
+void WriteToFileAsync(const Unit &U, const std::string &Path);
+void RemoveFileAsync(const std::string &Path);
+
+// Waits until the requests queued so far are done, for at most TimeoutMs,
+// or for as long as it takes if TimeoutMs is negative.
+// Takes no locks and does not allocate, so it may be called from the crash
+// and interrupt paths; the requests themselves are carried out by the
+// writer thread.
+void DrainAsyncWriter(int TimeoutMs);
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_ASYNC_WRITER_H
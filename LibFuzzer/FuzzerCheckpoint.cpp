@@ -0,0 +1,74 @@
+//===- FuzzerCheckpoint.cpp - Checkpoint files ----------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Reading and writing the checkpoint files.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerCheckpoint.h"
+#include "FuzzerIO.h"
+#include "FuzzerUtil.h"
+#include <cstdio>
+#include <cstring>
+
+namespace fuzzer {
+
+namespace {
+
+const uint32_t kCheckpointVersion = 1;
+
+struct FileHeader {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t Reserved;
+  UnitDigest Key;
+  UnitDigest PayloadDigest;
+};
+
+static_assert(sizeof(FileHeader) == 48, "unexpected FileHeader layout");
+
+}  // namespace
+
+bool WriteCheckpointFile(const std::string &Path, const UnitDigest &Key,
+                         const Unit &Payload) {
+  FileHeader FH;
+  memcpy(FH.Magic, kCheckpointMagic, sizeof(FH.Magic));
+  FH.Version = kCheckpointVersion;
+  FH.Reserved = 0;
+  FH.Key = Key;
+  FH.PayloadDigest = ComputeDigest(Payload);
+  std::string TmpPath = Path + ".tmp." + std::to_string(GetPid());
+  FILE *Out = fopen(TmpPath.c_str(), "wb");
+  if (!Out) return false;
+  bool Ok = fwrite(&FH, sizeof(FH), 1, Out) == 1;
+  if (!Payload.empty())
+    Ok &= fwrite(Payload.data(), Payload.size(), 1, Out) == 1;
+  Ok &= !fclose(Out);
+  if (!Ok || std::rename(TmpPath.c_str(), Path.c_str())) {
+    RemoveFile(TmpPath);
+    return false;
+  }
+  return true;
+}
+
+bool ReadCheckpointFile(const std::string &Path, const UnitDigest &Key,
+                        Unit *Payload) {
+  if (!IsFile(Path))
+    return false;
+  Unit File = FileToVector(Path, 0, /*ExitOnError=*/false);
+  FileHeader FH;
+  if (File.size() < sizeof(FH))
+    return false;
+  memcpy(&FH, File.data(), sizeof(FH));
+  if (memcmp(FH.Magic, kCheckpointMagic, sizeof(FH.Magic)) ||
+      FH.Version != kCheckpointVersion || FH.Key != Key)
+    return false;
+  Payload->assign(File.begin() + sizeof(FH), File.end());
+  return ComputeDigest(*Payload) == FH.PayloadDigest;
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,146 @@
+//===- FuzzerCheckpoint.h - Internal header for the Fuzzer ------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// -checkpoint: the state of a fuzzer (corpus with its feature tables and
+// stats, dictionaries, length control, observed PCs) saved to a file and
+// restored at the next start instead of executing the corpus again.
+//
+// The file starts with a 48-byte header (kCheckpointMagic, a version, the
+// key of the build, the digest of the payload), followed by the payload.
+// The payload is made of LEB128 varints; sorted sets of integers are stored
+// as deltas, byte strings and sets are prefixed by their length. The layout
+// of the payload is defined by the SaveState/LoadState methods of the
+// classes that own the state.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_CHECKPOINT_H
+#define LLVM_FUZZER_CHECKPOINT_H
+
+#include "FuzzerArena.h"
+#include "FuzzerDefs.h"
+#include "FuzzerDigest.h"
+#include <cstring>
+
+namespace fuzzer {
+
+static const char kCheckpointMagic[8] = {'L', 'F', 'C', 'H',
+                                         'K', 'P', 'N', 'T'};
+
+class CheckpointWriter {
+ public:
+  void Varint(uint64_t V) {
+    do {
+      uint8_t B = V & 0x7f;
+      V >>= 7;
+      Buf.push_back(B | (V ? 0x80 : 0));
+    } while (V);
+  }
+  void Float(float F) {
+    uint32_t Bits;
+    memcpy(&Bits, &F, sizeof(Bits));
+    Varint(Bits);
+  }
+  void Digest(const UnitDigest &D) {
+    Varint(D.Lo);
+    Varint(D.Hi);
+  }
+  void Bytes(const uint8_t *Data, size_t Size) {
+    Varint(Size);
+    Buf.insert(Buf.end(), Data, Data + Size);
+  }
+  void SortedSet(Span<uint32_t> Set) {
+    Varint(Set.size());
+    uint32_t Prev = 0;
+    for (auto X : Set) {
+      assert(X >= Prev);
+      Varint(X - Prev);
+      Prev = X;
+    }
+  }
+  const Unit &Data() const { return Buf; }
+
+ private:
+  Unit Buf;
+};
+
+// Reading past the end or a value out of range makes the reader fail; the
+// readers return 0 or empty data from then on.
+class CheckpointReader {
+ public:
+  CheckpointReader(const uint8_t *Data, size_t Size)
+      : Pos(Data), End(Data + Size) {}
+
+  uint64_t Varint() {
+    uint64_t V = 0;
+    for (unsigned Shift = 0; Shift < 64; Shift += 7) {
+      if (Pos == End) return Fail();
+      uint8_t B = *Pos++;
+      V |= static_cast<uint64_t>(B & 0x7f) << Shift;
+      if (!(B & 0x80)) return V;
+    }
+    return Fail();
+  }
+  // A varint that must be at most Max.
+  uint64_t Varint(uint64_t Max) {
+    uint64_t V = Varint();
+    return V <= Max ? V : Fail();
+  }
+  float Float() {
+    uint32_t Bits = Varint(UINT32_MAX);
+    float F;
+    memcpy(&F, &Bits, sizeof(F));
+    return F;
+  }
+  UnitDigest Digest() {
+    UnitDigest D;
+    D.Lo = Varint();
+    D.Hi = Varint();
+    return D;
+  }
+  Unit Bytes() {
+    size_t Size = Varint(End - Pos);
+    Pos += Size;
+    return Unit(Pos - Size, Pos);
+  }
+  Vector<uint32_t> SortedSet() {
+    // Every element takes at least one byte.
+    size_t Size = Varint(End - Pos);
+    Vector<uint32_t> Res(Size);
+    uint64_t X = 0;
+    for (auto &Elem : Res) {
+      X += Varint();
+      Elem = X <= UINT32_MAX ? X : Fail();
+    }
+    return Res;
+  }
+  bool Failed() const { return HasFailed; }
+  bool AtEnd() const { return Pos == End; }
+
+ private:
+  uint64_t Fail() {
+    HasFailed = true;
+    Pos = End;
+    return 0;
+  }
+
+  const uint8_t *Pos, *End;
+  bool HasFailed = false;
+};
+
+// Writes the checkpoint through a temporary file and a rename, so that the
+// previous checkpoint stays whole if the process dies meanwhile.
+bool WriteCheckpointFile(const std::string &Path, const UnitDigest &Key,
+                         const Unit &Payload);
+// Returns false if there is no checkpoint at Path, or if it was written for
+// another Key or is damaged.
+bool ReadCheckpointFile(const std::string &Path, const UnitDigest &Key,
+                        Unit *Payload);
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_CHECKPOINT_H
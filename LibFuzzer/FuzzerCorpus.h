@@ -12,21 +12,23 @@
 #ifndef LLVM_FUZZER_CORPUS
 #define LLVM_FUZZER_CORPUS
 
+#include "FuzzerArena.h"
+#include "FuzzerAsyncWriter.h"
+#include "FuzzerCheckpoint.h"
 #include "FuzzerDefs.h"
+#include "FuzzerDigest.h"
 #include "FuzzerIO.h"
+#include "FuzzerPackedCorpus.h"
 #include "FuzzerRandom.h"
 #include "FuzzerSHA1.h"
 #include "FuzzerTracePC.h"
 #include <algorithm>
-#include <numeric>
-#include <random>
-#include <unordered_set>
+#include <deque>
 
 namespace fuzzer {
 
 struct InputInfo {
-  Unit U;  // The actual input data.
-  uint8_t Sha1[kSHA1NumBytes];  // Checksum.
+  UnitDigest Digest;  // Identifies U() in the corpus.
   // Number of features that this input has and no smaller input has.
   size_t NumFeatures = 0;
   size_t Tmp = 0; // Used by ValidateFeatureSet.
@@ -35,64 +37,154 @@ struct InputInfo {
   size_t NumSuccessfullMutations = 0;
   bool MayDeleteFile = false;
   bool Reduced = false;
-  Vector<uint32_t> UniqFeatureSet;
   float FeatureFrequencyScore = 1.0;
+  size_t Idx = 0;  // Position in the corpus.
+
+  // The actual input data and the sorted features that this input has and
+  // no smaller input has. Both live in the arena of the corpus and the views
+  // are only valid until the corpus changes.
+  Span<uint8_t> U() const { return Arena->Get<uint8_t>(USlot); }
+  Span<uint32_t> UniqFeatureSet() const {
+    return Arena->Get<uint32_t>(FeatureSlot);
+  }
+
+  // SHA1 of U(), only computed when needed (it names the files).
+  const uint8_t *GetSha1() const {
+    if (!HasSha1) {
+      ComputeSHA1(U().data(), U().size(), Sha1);
+      HasSha1 = true;
+    }
+    return Sha1;
+  }
+
+ private:
+  friend class InputCorpus;
+  const CorpusArena *Arena = nullptr;
+  ArenaSlot USlot, FeatureSlot;
+  mutable uint8_t Sha1[kSHA1NumBytes];
+  mutable bool HasSha1 = false;
+};
+
+// Picks indices with probabilities proportional to their integer weights.
+// The weights are kept in a Fenwick tree: appending, changing a weight and
+// sampling are all O(log N).
+class WeightedSampler {
+ public:
+  size_t size() const { return Weights.size(); }
+  uint64_t Get(size_t Idx) const { return Weights[Idx]; }
+  uint64_t Total() const { return Prefix(size()); }
+
+  void push_back(uint64_t W) {
+    Weights.push_back(W);
+    // The new node covers (N - lowbit(N), N].
+    size_t N = Weights.size();
+    Tree.push_back(W + Prefix(N - 1) - Prefix(N - (N & -N)));
+  }
+
+  void Set(size_t Idx, uint64_t W) {
+    uint64_t Old = Weights[Idx];
+    Weights[Idx] = W;
+    for (size_t I = Idx + 1; I <= Tree.size(); I += I & -I)
+      Tree[I - 1] += W - Old;  // Modular arithmetic handles W < Old.
+  }
+
+  // Returns the Idx such that Prefix(Idx) <= X < Prefix(Idx + 1).
+  // Requires X < Total().
+  size_t Find(uint64_t X) const {
+    assert(X < Total());
+    size_t Pos = 0;
+    size_t Step = 1;
+    while (Step * 2 <= Tree.size())
+      Step *= 2;
+    for (; Step; Step /= 2)
+      if (Pos + Step <= Tree.size() && Tree[Pos + Step - 1] <= X) {
+        Pos += Step;
+        X -= Tree[Pos - 1];
+      }
+    return Pos;
+  }
+
+  // Returns a random index, or a uniformly random one if all weights are 0.
+  size_t Sample(Random &Rand) const {
+    assert(size());
+    uint64_t T = Total();
+    if (!T)
+      return Rand(size());
+    uint64_t X = (static_cast<uint64_t>(Rand.Rand()) << 32) ^ Rand.Rand();
+    return Find(X % T);
+  }
+
+ private:
+  // Sum of the first N weights.
+  uint64_t Prefix(size_t N) const {
+    uint64_t Res = 0;
+    for (; N; N -= N & -N)
+      Res += Tree[N - 1];
+    return Res;
+  }
+
+  Vector<uint64_t> Weights;
+  Vector<uint64_t> Tree;
 };
 
 class InputCorpus {
   static const size_t kFeatureSetSize = 1 << 21;
  public:
-  InputCorpus(const std::string &OutputCorpus) : OutputCorpus(OutputCorpus) {
-    memset(InputSizesPerFeature, 0, sizeof(InputSizesPerFeature));
-    memset(SmallestElementPerFeature, 0, sizeof(SmallestElementPerFeature));
-    memset(FeatureFrequency, 0, sizeof(FeatureFrequency));
+  InputCorpus(const std::string &OutputCorpus, bool MmapArena = false)
+      : Arena(MmapArena), OutputCorpus(OutputCorpus) {
+    if (IsPackedCorpus(OutputCorpus)) {
+      PackedOutput.reset(new PackedCorpusWriter);
+      if (!PackedOutput->Open(OutputCorpus))
+        exit(1);
+    }
   }
   ~InputCorpus() {
-    for (auto II : Inputs)
-      delete II;
+    free(Features);
   }
   size_t size() const { return Inputs.size(); }
-  size_t SizeInBytes() const {
-    size_t Res = 0;
-    for (auto II : Inputs)
-      Res += II->U.size();
-    return Res;
-  }
+  size_t SizeInBytes() const { return UnitBytes; }
   size_t NumActiveUnits() const {
     size_t Res = 0;
     for (auto II : Inputs)
-      Res += !II->U.empty();
+      Res += !II->U().empty();
     return Res;
   }
   size_t MaxInputSize() const {
     size_t Res = 0;
     for (auto II : Inputs)
-        Res = std::max(Res, II->U.size());
+        Res = std::max(Res, II->U().size());
     return Res;
   }
   bool empty() const { return Inputs.empty(); }
-  const Unit &operator[] (size_t Idx) const { return Inputs[Idx]->U; }
+  Span<uint8_t> operator[] (size_t Idx) const { return Inputs[Idx]->U(); }
+  const CorpusArena &GetArena() const { return Arena; }
   void AddToCorpus(const Unit &U, size_t NumFeatures, bool MayDeleteFile,
                    const Vector<uint32_t> &FeatureSet) {
     assert(!U.empty());
     if (FeatureDebug)
       Printf("ADD_TO_CORPUS %zd NF %zd\n", Inputs.size(), NumFeatures);
-    Inputs.push_back(new InputInfo());
+    InputInfos.emplace_back();
+    Inputs.push_back(&InputInfos.back());
     InputInfo &II = *Inputs.back();
-    II.U = U;
+    II.Idx = Inputs.size() - 1;
+    II.Arena = &Arena;
+    SetUnit(&II, U);
     II.NumFeatures = NumFeatures;
     II.MayDeleteFile = MayDeleteFile;
-    II.UniqFeatureSet = FeatureSet;
-    std::sort(II.UniqFeatureSet.begin(), II.UniqFeatureSet.end());
-    ComputeSHA1(U.data(), U.size(), II.Sha1);
-    Hashes.insert(Sha1ToString(II.Sha1));
-    UpdateCorpusDistribution();
+    SortedFeatureSetTmp = FeatureSet;
+    std::sort(SortedFeatureSetTmp.begin(), SortedFeatureSetTmp.end());
+    II.FeatureSlot =
+        Arena.Append(SortedFeatureSetTmp.data(),
+                     SortedFeatureSetTmp.size() * sizeof(uint32_t));
+    Hashes.insert(II.Digest);
+    CorpusDistribution.push_back(0);
+    UpdateWeight(II);
     PrintCorpus();
     // ValidateFeatureSet();
   }
 
   // Debug-only
-  void PrintUnit(const Unit &U) {
+  void PrintUnit(Span<uint8_t> U) {
     if (!FeatureDebug) return;
     for (uint8_t C : U) {
       if (C != 'F' && C != 'U' && C != 'Z')
@@ -102,7 +194,7 @@ class InputCorpus {
   }
 
   // Debug-only
-  void PrintFeatureSet(const Vector<uint32_t> &FeatureSet) {
+  void PrintFeatureSet(Span<uint32_t> FeatureSet) {
     if (!FeatureDebug) return;
     Printf("{");
     for (uint32_t Feature: FeatureSet)
@@ -116,12 +208,13 @@ class InputCorpus {
     Printf("======= CORPUS:\n");
     int i = 0;
     for (auto II : Inputs) {
-      if (std::find(II->U.begin(), II->U.end(), 'F') != II->U.end()) {
+      auto U = II->U();
+      if (std::find(U.begin(), U.end(), 'F') != U.end()) {
         Printf("[%2d] ", i);
-        Printf("%s sz=%zd ", Sha1ToString(II->Sha1).c_str(), II->U.size());
-        PrintUnit(II->U);
+        Printf("%s sz=%zd ", Sha1ToString(II->GetSha1()).c_str(), U.size());
+        PrintUnit(U);
         Printf(" ");
-        PrintFeatureSet(II->UniqFeatureSet);
+        PrintFeatureSet(II->UniqFeatureSet());
         Printf("\n");
       }
       i++;
@@ -129,27 +222,49 @@ class InputCorpus {
   }
 
   void Replace(InputInfo *II, const Unit &U) {
-    assert(II->U.size() > U.size());
-    Hashes.erase(Sha1ToString(II->Sha1));
+    assert(II->U().size() > U.size());
+    Hashes.erase(II->Digest);
     DeleteFile(*II);
-    ComputeSHA1(U.data(), U.size(), II->Sha1);
-    Hashes.insert(Sha1ToString(II->Sha1));
-    II->U = U;
+    FreeUnit(II);
+    SetUnit(II, U);
+    Hashes.insert(II->Digest);
     II->Reduced = true;
-    UpdateCorpusDistribution();
+    MaybeCompactArena();
+  }
+
+  // Computes the SHA1s that are not known yet all at once, which is faster
+  // than computing them one by one on demand.
+  void ComputeMissingSha1s() {
+    Vector<const uint8_t *> Data;
+    Vector<size_t> Sizes;
+    Vector<uint8_t *> Out;
+    for (auto II : Inputs) {
+      if (II->U().empty() || II->HasSha1) continue;
+      Data.push_back(II->U().data());
+      Sizes.push_back(II->U().size());
+      Out.push_back(II->Sha1);
+      II->HasSha1 = true;
+    }
+    ComputeSHA1MultiBuffer(Data.data(), Sizes.data(), Data.size(), Out.data());
   }
 
-  bool HasUnit(const Unit &U) { return Hashes.count(Hash(U)); }
-  bool HasUnit(const std::string &H) { return Hashes.count(H); }
+  bool HasUnit(const Unit &U) { return Hashes.count(ComputeDigest(U)); }
+  // H is a SHA1 in hex. Slow, the SHA1s are computed on demand.
+  bool HasUnit(const std::string &H) {
+    for (auto II : Inputs)
+      if (!II->U().empty() && Sha1ToString(II->GetSha1()) == H)
+        return true;
+    return false;
+  }
   InputInfo &ChooseUnitToMutate(Random &Rand) {
     InputInfo &II = *Inputs[ChooseUnitIdxToMutate(Rand)];
-    assert(!II.U.empty());
+    assert(!II.U().empty());
     return II;
   };
 
   // Returns an index of random unit from the corpus to mutate.
   size_t ChooseUnitIdxToMutate(Random &Rand) {
-    size_t Idx = static_cast<size_t>(CorpusDistribution(Rand));
+    size_t Idx = CorpusDistribution.Sample(Rand);
     assert(Idx < Inputs.size());
     return Idx;
   }
@@ -158,7 +273,7 @@ class InputCorpus {
     for (size_t i = 0; i < Inputs.size(); i++) {
       const auto &II = *Inputs[i];
       Printf("  [%zd %s]\tsz: %zd\truns: %zd\tsucc: %zd\n", i,
-             Sha1ToString(II.Sha1).c_str(), II.U.size(),
+             Sha1ToString(II.GetSha1()).c_str(), II.U().size(),
              II.NumExecutedMutations, II.NumSuccessfullMutations);
     }
   }
@@ -166,7 +281,7 @@ class InputCorpus {
   void PrintFeatureSet() {
     for (size_t i = 0; i < kFeatureSetSize; i++) {
       if(size_t Sz = GetFeature(i))
-        Printf("[%zd: id %zd sz%zd] ", i, SmallestElementPerFeature[i], Sz);
+        Printf("[%zd: id %zd sz%zd] ", i, Features[i].SmallestElement, Sz);
     }
     Printf("\n\t");
     for (size_t i = 0; i < Inputs.size(); i++)
@@ -175,26 +290,38 @@ class InputCorpus {
     Printf("\n");
   }
 
+  // Appends U to the output corpus if it is a packed one. Sha1 is optional.
+  bool WriteToPackedOutput(const Unit &U, const uint8_t *Sha1) {
+    if (!PackedOutput) return false;
+    PackedOutput->Append(U.data(), U.size(), Sha1);
+    return true;
+  }
+
   void DeleteFile(const InputInfo &II) {
-    if (!OutputCorpus.empty() && II.MayDeleteFile)
-      RemoveFile(DirPlusFile(OutputCorpus, Sha1ToString(II.Sha1)));
+    if (OutputCorpus.empty() || !II.MayDeleteFile) return;
+    if (PackedOutput)
+      PackedOutput->Delete(II.GetSha1());
+    else
+      RemoveFileAsync(DirPlusFile(OutputCorpus, Sha1ToString(II.GetSha1())));
   }
 
   void DeleteInput(size_t Idx) {
     InputInfo &II = *Inputs[Idx];
     DeleteFile(II);
-    Unit().swap(II.U);
+    FreeUnit(&II);
+    UpdateWeight(II);
     if (FeatureDebug)
       Printf("EVICTED %zd\n", Idx);
+    MaybeCompactArena();
   }
 
   bool AddFeature(size_t Idx, uint32_t NewSize, bool Shrink) {
     assert(NewSize);
-    Idx = Idx % kFeatureSetSize;
-    uint32_t OldSize = GetFeature(Idx);
+    FeatureInfo &FI = GetFeatureInfo(Idx % kFeatureSetSize);
+    uint32_t OldSize = FI.InputSize;
     if (OldSize == 0 || (Shrink && OldSize > NewSize)) {
       if (OldSize > 0) {
-        size_t OldIdx = SmallestElementPerFeature[Idx];
+        size_t OldIdx = FI.SmallestElement;
         InputInfo &II = *Inputs[OldIdx];
         assert(II.NumFeatures > 0);
         II.NumFeatures--;
@@ -205,43 +332,173 @@ class InputCorpus {
       }
       NumUpdatedFeatures++;
       if (FeatureDebug)
-        Printf("ADD FEATURE %zd sz %d\n", Idx, NewSize);
-      SmallestElementPerFeature[Idx] = Inputs.size();
-      InputSizesPerFeature[Idx] = NewSize;
+        Printf("ADD FEATURE %zd sz %d\n", Idx % kFeatureSetSize, NewSize);
+      FI.SmallestElement = Inputs.size();
+      FI.InputSize = NewSize;
       return true;
     }
     return false;
   }
 
   void UpdateFeatureFrequency(size_t Idx) {
-    FeatureFrequency[Idx % kFeatureSetSize]++;
+    GetFeatureInfo(Idx % kFeatureSetSize).Frequency++;
   }
   float GetFeatureFrequency(size_t Idx) const {
-    return FeatureFrequency[Idx % kFeatureSetSize];
+    return Features ? Features[Idx % kFeatureSetSize].Frequency : 0;
   }
   void UpdateFeatureFrequencyScore(InputInfo *II) {
     const float kMin = 0.01, kMax = 100.;
     II->FeatureFrequencyScore = kMin;
-    for (auto Idx : II->UniqFeatureSet)
+    for (auto Idx : II->UniqFeatureSet())
       II->FeatureFrequencyScore += 1. / (GetFeatureFrequency(Idx) + 1.);
     II->FeatureFrequencyScore = Min(II->FeatureFrequencyScore, kMax);
+    UpdateWeight(*II);
   }
 
   size_t NumFeatures() const { return NumAddedFeatures; }
   size_t NumFeatureUpdates() const { return NumUpdatedFeatures; }
 
+  // -checkpoint: all the inputs, evicted ones included since the feature
+  // table refers to them by index, then the used records of the table.
+  void SaveState(CheckpointWriter *W) const {
+    W->Varint(Inputs.size());
+    for (auto II : Inputs) {
+      W->Bytes(II->U().data(), II->U().size());
+      if (II->U().empty())
+        W->Digest(II->Digest);  // Still in Hashes.
+      W->SortedSet(II->UniqFeatureSet());
+      W->Varint(II->NumFeatures);
+      W->Varint(II->NumExecutedMutations);
+      W->Varint(II->NumSuccessfullMutations);
+      W->Varint(II->MayDeleteFile | II->Reduced << 1);
+      W->Float(II->FeatureFrequencyScore);
+    }
+    W->Varint(NumAddedFeatures);
+    W->Varint(NumUpdatedFeatures);
+    size_t NumRecords = 0;
+    for (size_t i = 0; Features && i < kFeatureSetSize; i++)
+      NumRecords += Features[i].InputSize || Features[i].Frequency;
+    W->Varint(NumRecords);
+    for (size_t i = 0, Prev = 0; NumRecords && i < kFeatureSetSize; i++) {
+      const FeatureInfo &FI = Features[i];
+      if (!FI.InputSize && !FI.Frequency) continue;
+      W->Varint(i - Prev);
+      W->Varint(FI.InputSize);
+      W->Varint(FI.SmallestElement);
+      W->Float(FI.Frequency);
+      Prev = i;
+    }
+  }
+
+  // Restores what SaveState saved into an empty corpus.
+  bool LoadState(CheckpointReader *R) {
+    assert(Inputs.empty());
+    size_t NumInputs = R->Varint(UINT32_MAX);
+    for (size_t i = 0; i < NumInputs && !R->Failed(); i++) {
+      InputInfos.emplace_back();
+      Inputs.push_back(&InputInfos.back());
+      InputInfo &II = *Inputs.back();
+      II.Idx = i;
+      II.Arena = &Arena;
+      Unit U = R->Bytes();
+      if (U.empty()) {
+        II.Digest = R->Digest();
+      } else {
+        SetUnit(&II, U);
+      }
+      auto FeatureSet = R->SortedSet();
+      II.FeatureSlot = Arena.Append(FeatureSet.data(),
+                                    FeatureSet.size() * sizeof(uint32_t));
+      II.NumFeatures = R->Varint();
+      II.NumExecutedMutations = R->Varint();
+      II.NumSuccessfullMutations = R->Varint();
+      size_t Flags = R->Varint(3);
+      II.MayDeleteFile = Flags & 1;
+      II.Reduced = Flags & 2;
+      II.FeatureFrequencyScore = R->Float();
+      Hashes.insert(II.Digest);
+      CorpusDistribution.push_back(0);
+      UpdateWeight(II);
+    }
+    NumAddedFeatures = R->Varint();
+    NumUpdatedFeatures = R->Varint();
+    size_t NumRecords = R->Varint(kFeatureSetSize);
+    for (size_t i = 0, Idx = 0; i < NumRecords && !R->Failed(); i++) {
+      Idx += R->Varint(kFeatureSetSize);
+      if (Idx >= kFeatureSetSize) return false;
+      FeatureInfo &FI = GetFeatureInfo(Idx);
+      FI.InputSize = R->Varint(UINT32_MAX);
+      // AddFeature points at the input about to be added.
+      FI.SmallestElement = R->Varint(NumInputs);
+      FI.Frequency = R->Float();
+    }
+    return !R->Failed();
+  }
+
 private:
 
   static const bool FeatureDebug = false;
 
-  size_t GetFeature(size_t Idx) const { return InputSizesPerFeature[Idx]; }
+  void SetUnit(InputInfo *II, const Unit &U) {
+    II->USlot = Arena.Append(U.data(), U.size());
+    II->Digest = ComputeDigest(U);
+    II->HasSha1 = false;
+    UnitBytes += U.size();
+  }
+
+  void FreeUnit(InputInfo *II) {
+    UnitBytes -= II->USlot.Size;
+    Arena.Free(II->USlot);
+    II->USlot = ArenaSlot();
+  }
+
+  // Slides the live units and feature sets together once the arena is
+  // mostly garbage.
+  void MaybeCompactArena() {
+    if (!Arena.NeedsCompaction()) return;
+    Vector<ArenaSlot *> Slots;
+    for (auto II : Inputs) {
+      Slots.push_back(&II->USlot);
+      Slots.push_back(&II->FeatureSlot);
+    }
+    Arena.Compact(Slots);
+  }
+
+  // Everything the corpus knows about a feature, in one record so that
+  // AddFeature and UpdateFeatureFrequency touch a single cache line.
+  struct FeatureInfo {
+    uint32_t InputSize;        // Size of the smallest input with the feature,
+    uint32_t SmallestElement;  // its index in Inputs.
+    float Frequency;
+    uint32_t Padding;          // Records never straddle cache lines.
+  };
+  static_assert(sizeof(FeatureInfo) == 16, "FeatureInfo must be 16 bytes");
+
+  // The table is allocated on the first update. calloc leaves the pages of
+  // such a large block untouched until they are written, so only the parts
+  // of the feature space actually hit by the target count towards the RSS.
+  FeatureInfo &GetFeatureInfo(size_t Idx) {
+    if (!Features) {
+      Features = static_cast<FeatureInfo *>(
+          calloc(kFeatureSetSize, sizeof(FeatureInfo)));
+      if (!Features) {
+        Printf("ERROR: failed to allocate the feature table\n");
+        exit(1);
+      }
+    }
+    return Features[Idx];
+  }
+
+  size_t GetFeature(size_t Idx) const {
+    return Features ? Features[Idx].InputSize : 0;
+  }
 
   void ValidateFeatureSet() {
     if (FeatureDebug)
       PrintFeatureSet();
     for (size_t Idx = 0; Idx < kFeatureSetSize; Idx++)
       if (GetFeature(Idx))
-        Inputs[SmallestElementPerFeature[Idx]]->Tmp++;
+        Inputs[Features[Idx].SmallestElement]->Tmp++;
     for (auto II: Inputs) {
       if (II->Tmp != II->NumFeatures)
         Printf("ZZZ %zd %zd\n", II->Tmp, II->NumFeatures);
@@ -250,51 +507,39 @@ private:
     }
   }
 
-  // Updates the probability distribution for the units in the corpus.
-  // Must be called whenever the corpus or unit weights are changed.
+  // Updates the weight of II in the probability distribution for the units
+  // in the corpus. Must be called whenever the weight might have changed.
   //
   // Hypothesis: units added to the corpus last are more interesting.
   //
   // Hypothesis: inputs with infrequent features are more interesting.
-  void UpdateCorpusDistribution() {
-    size_t N = Inputs.size();
-    assert(N);
-    Intervals.resize(N + 1);
-    Weights.resize(N);
-    std::iota(Intervals.begin(), Intervals.end(), 0);
-    for (size_t i = 0; i < N; i++)
-      Weights[i] = Inputs[i]->NumFeatures
-                       ? (i + 1) * Inputs[i]->FeatureFrequencyScore
-                       : 0.;
-    if (FeatureDebug) {
-      for (size_t i = 0; i < N; i++)
-        Printf("%zd ", Inputs[i]->NumFeatures);
-      Printf("NUM\n");
-      for (size_t i = 0; i < N; i++)
-        Printf("%f ", Inputs[i]->FeatureFrequencyScore);
-      Printf("SCORE\n");
-      for (size_t i = 0; i < N; i++)
-        Printf("%f ", Weights[i]);
-      Printf("Weights\n");
-    }
-    CorpusDistribution = std::piecewise_constant_distribution<double>(
-        Intervals.begin(), Intervals.end(), Weights.begin());
+  void UpdateWeight(const InputInfo &II) {
+    // Fixed point weights keep the sums of the sampler exact.
+    const double kWeightScale = 1024;
+    uint64_t W = 0;
+    if (II.NumFeatures && !II.U().empty())
+      W = Max<uint64_t>(
+          1, (II.Idx + 1) * II.FeatureFrequencyScore * kWeightScale);
+    CorpusDistribution.Set(II.Idx, W);
+    if (FeatureDebug)
+      Printf("WEIGHT %zd NUM %zd SCORE %f => %zd\n", II.Idx, II.NumFeatures,
+             II.FeatureFrequencyScore, (size_t)W);
   }
-  std::piecewise_constant_distribution<double> CorpusDistribution;
-
-  Vector<double> Intervals;
-  Vector<double> Weights;
+  WeightedSampler CorpusDistribution;
 
-  std::unordered_set<std::string> Hashes;
+  DigestSet Hashes;
+  CorpusArena Arena;  // Holds the units and their feature sets.
+  std::deque<InputInfo> InputInfos;  // Stable addresses for Inputs.
   Vector<InputInfo*> Inputs;
+  Vector<uint32_t> SortedFeatureSetTmp;
+  size_t UnitBytes = 0;  // Sum of the sizes of the units.
 
   size_t NumAddedFeatures = 0;
   size_t NumUpdatedFeatures = 0;
-  uint32_t InputSizesPerFeature[kFeatureSetSize];
-  uint32_t SmallestElementPerFeature[kFeatureSetSize];
-  float FeatureFrequency[kFeatureSetSize];
+  FeatureInfo *Features = nullptr;  // kFeatureSetSize records.
 
   std::string OutputCorpus;
+  std::unique_ptr<PackedCorpusWriter> PackedOutput;
 };
 
 }  // namespace fuzzer
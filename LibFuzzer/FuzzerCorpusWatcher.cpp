@@ -0,0 +1,141 @@
+//===- FuzzerCorpusWatcher.cpp - Corpus dir watcher -----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// CorpusWatcher, implemented with inotify on Linux.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerCorpusWatcher.h"
+#include "FuzzerIO.h"
+#if LIBFUZZER_LINUX
+#include <dirent.h>
+#include <errno.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+#endif
+
+namespace fuzzer {
+
+#if LIBFUZZER_LINUX
+
+// File systems that do not see the changes made by other hosts.
+static bool IsRemoteFileSystem(const std::string &Dir) {
+  struct statfs St;
+  if (statfs(Dir.c_str(), &St))
+    return true;
+  switch (static_cast<unsigned long>(St.f_type)) {
+  case 0x6969:      // NFS
+  case 0x517B:      // SMB
+  case 0xFF534D42:  // CIFS
+  case 0xFE534D42:  // SMB2
+  case 0x65735546:  // FUSE
+  case 0x01021997:  // 9P
+  case 0x47504653:  // GPFS
+  case 0x0BD00BD0:  // Lustre
+  case 0x00C36400:  // CephFS
+    return true;
+  default:
+    return false;
+  }
+}
+
+CorpusWatcher::~CorpusWatcher() {
+  if (Fd >= 0)
+    close(Fd);
+}
+
+// Also reports the files that were in subdirs created before their watch
+// was added.
+void CorpusWatcher::AddWatch(const std::string &Dir,
+                             Vector<std::string> *NewFiles) {
+  int Wd = inotify_add_watch(Fd, Dir.c_str(),
+                             IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE |
+                                 IN_ONLYDIR);
+  if (Wd < 0) return;
+  Dirs[Wd] = Dir;
+  DIR *D = opendir(Dir.c_str());
+  if (!D) return;
+  while (auto E = readdir(D)) {
+    if (*E->d_name == '.') continue;
+    std::string Path = DirPlusFile(Dir, E->d_name);
+    struct stat St;
+    if (stat(Path.c_str(), &St)) continue;
+    if (S_ISDIR(St.st_mode))
+      AddWatch(Path, NewFiles);
+    else if (NewFiles && S_ISREG(St.st_mode))
+      NewFiles->push_back(Path);
+  }
+  closedir(D);
+}
+
+bool CorpusWatcher::Start(const std::string &Dir) {
+  assert(Fd < 0);
+  struct stat St;
+  if (stat(Dir.c_str(), &St) || !S_ISDIR(St.st_mode) ||
+      IsRemoteFileSystem(Dir))
+    return false;
+  Fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (Fd < 0) return false;
+  AddWatch(Dir, nullptr);
+  if (Dirs.empty()) {
+    close(Fd);
+    Fd = -1;
+    return false;
+  }
+  return true;
+}
+
+bool CorpusWatcher::Poll(Vector<std::string> *NewFiles) {
+  bool Complete = true;
+  alignas(struct inotify_event) char Buf[1 << 14];
+  while (true) {
+    ssize_t Len = read(Fd, Buf, sizeof(Buf));
+    if (Len < 0 && errno == EINTR) continue;
+    if (Len <= 0) break;
+    for (ssize_t Pos = 0; Pos < Len;) {
+      auto E = reinterpret_cast<const struct inotify_event *>(Buf + Pos);
+      Pos += sizeof(struct inotify_event) + E->len;
+      if (E->mask & IN_Q_OVERFLOW) {
+        Complete = false;
+        continue;
+      }
+      auto It = Dirs.find(E->wd);
+      if (It == Dirs.end()) continue;
+      if (E->mask & IN_IGNORED) {
+        Dirs.erase(It);
+        continue;
+      }
+      if (!E->len) continue;
+      std::string Path = DirPlusFile(It->second, E->name);
+      if (E->mask & IN_ISDIR) {
+        if (E->mask & (IN_CREATE | IN_MOVED_TO))
+          AddWatch(Path, NewFiles);
+      } else if (E->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        NewFiles->push_back(Path);
+      }
+    }
+  }
+  return Complete;
+}
+
+#else
+
+// TODO: implement for other platforms.
+CorpusWatcher::~CorpusWatcher() {}
+
+void CorpusWatcher::AddWatch(const std::string &Dir,
+                             Vector<std::string> *NewFiles) {}
+
+bool CorpusWatcher::Start(const std::string &Dir) { return false; }
+
+bool CorpusWatcher::Poll(Vector<std::string> *NewFiles) { return false; }
+
+#endif  // LIBFUZZER_LINUX
+
+}  // namespace fuzzer
@@ -0,0 +1,44 @@
+//===- FuzzerCorpusWatcher.h - Internal header for the Fuzzer ---*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::CorpusWatcher reports the files added to a corpus dir by other
+// processes without rescanning the dir.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_CORPUS_WATCHER_H
+#define LLVM_FUZZER_CORPUS_WATCHER_H
+
+#include "FuzzerDefs.h"
+#include <map>
+
+namespace fuzzer {
+
+class CorpusWatcher {
+ public:
+  ~CorpusWatcher();
+
+  // Starts watching Dir and its subdirs. Returns false if that is not
+  // supported for Dir (not Linux, not a dir, or a network file system that
+  // does not report changes made by other hosts); rescan the dir instead.
+  bool Start(const std::string &Dir);
+
+  // Appends to NewFiles the files written or moved into the dir since the
+  // last call; does not block. Returns false if events were lost, in which
+  // case the dir must be rescanned once.
+  bool Poll(Vector<std::string> *NewFiles);
+
+ private:
+  void AddWatch(const std::string &Dir, Vector<std::string> *NewFiles);
+
+  int Fd = -1;
+  std::map<int, std::string> Dirs;  // By watch descriptor.
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_CORPUS_WATCHER_H
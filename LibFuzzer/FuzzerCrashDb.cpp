@@ -0,0 +1,192 @@
+//===- FuzzerCrashDb.cpp - Crash buckets ----------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// CrashDb, locked with flock() on Posix.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerCrashDb.h"
+#include "FuzzerIO.h"
+#include "FuzzerSHA1.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#if LIBFUZZER_POSIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fuzzer {
+
+static bool StartsWith(const std::string &S, const char *Prefix) {
+  return !S.compare(0, strlen(Prefix), Prefix);
+}
+
+// The frames of libFuzzer, of the sanitizer runtimes, of the libc
+// functions that report or forward a crash and of the signal trampolines
+// between a signal handler and the frame that got the signal.
+static bool IsRuntimeFrame(const std::string &Func) {
+  static const char *const kPrefixes[] = {
+      "fuzzer::",        "__sanitizer",     "__asan",
+      "__hwasan",        "__msan",          "__lsan",
+      "__tsan",          "__ubsan",         "__interceptor_",
+      "___interceptor_", "__interception::", "__GI_",
+      "__libc_",         "__pthread_",      "__run_exit_handlers",
+      "__cxa_",          "__cxxabiv1::",    "__gnu_cxx::",
+      "__assert_",       "std::terminate",  "operator new",
+      "operator delete"};
+  static const char *const kNames[] = {
+      "raise",  "abort",   "exit",    "gsignal", "pthread_kill",
+      "malloc", "calloc",  "realloc", "free",    "memcpy",
+      "memmove", "memset", "memcmp",  "strlen",  "strcmp",
+      "strncmp", "strcpy",
+      "__restore_rt", "_sigtramp", "__kernel_rt_sigreturn"};
+  for (auto *P : kPrefixes)
+    if (StartsWith(Func, P))
+      return true;
+  for (auto *N : kNames)
+    if (Func == N)
+      return true;
+  return false;
+}
+
+std::string NormalizeStackTrace(const std::string &Trace, size_t MaxFrames) {
+  std::istringstream IS(Trace);
+  std::string Line, Res;
+  size_t NumFrames = 0;
+  while (NumFrames < MaxFrames && std::getline(IS, Line)) {
+    size_t Pos = Line.find_first_not_of(" \t");
+    if (Pos == std::string::npos || Line[Pos] != '#')
+      continue;
+    // "#N 0xPC in Function Location"; unsymbolized frames have no " in ".
+    size_t In = Line.find(" in ", Pos);
+    if (In == std::string::npos)
+      continue;
+    std::string Func = Line.substr(In + 4);
+    size_t End = Func.rfind(' ');
+    if (End != std::string::npos)
+      Func.resize(End);
+    if (Func.empty())
+      continue;
+    if (IsRuntimeFrame(Func)) {
+      if (NumFrames && StartsWith(Func, "fuzzer::"))
+        break;  // Below LLVMFuzzerTestOneInput.
+      continue;
+    }
+    Res += Func + "\n";
+    NumFrames++;
+  }
+  return Res;
+}
+
+#if LIBFUZZER_POSIX
+
+bool CrashDb::Open(const std::string &Dir) {
+  DIR *D = opendir(Dir.c_str());
+  if (!D)
+    return false;
+  closedir(D);
+  this->Dir = Dir;
+  return true;
+}
+
+// All the lines of a .hits file have this size, so that the number of
+// crashes is the size of the file divided by it.
+static const size_t kHitLineSize = 20 + 1 + 2 * kSHA1NumBytes + 1;
+
+static std::string HitLine(const Unit &U) {
+  char Buf[kHitLineSize + 1];
+  snprintf(Buf, sizeof(Buf), "%20zd %s\n", U.size(), Hash(U).c_str());
+  return Buf;
+}
+
+bool CrashDb::Add(const char *Kind, const std::string &Stack, const Unit &U,
+                  CrashBucket *Bucket, bool *Saved) {
+  Bucket->Name = Kind + Hash(Unit(Stack.begin(), Stack.end()));
+  Bucket->Stack = Stack;
+  Bucket->ReproPath = DirPlusFile(Dir, Bucket->Name);
+  std::string HitsPath = Bucket->ReproPath + ".hits";
+  int Fd = open(HitsPath.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (Fd < 0)
+    return false;
+  if (flock(Fd, LOCK_EX)) {
+    close(Fd);
+    return false;
+  }
+  bool Ok = true;
+  std::string StackPath = Bucket->ReproPath + ".stack";
+  if (!IsFile(StackPath))
+    WriteToFile(Unit(Stack.begin(), Stack.end()), StackPath);
+  *Saved = !IsFile(Bucket->ReproPath) ||
+           U.size() < FileSize(Bucket->ReproPath);
+  if (*Saved) {
+    // Readers never see a partial reproducer.
+    std::string TmpPath =
+        Bucket->ReproPath + ".tmp." + std::to_string(getpid());
+    WriteToFile(U, TmpPath);
+    Ok = FileSize(TmpPath) == U.size() &&
+         !std::rename(TmpPath.c_str(), Bucket->ReproPath.c_str());
+    if (!Ok) {
+      RemoveFile(TmpPath);
+      *Saved = false;
+    }
+  }
+  std::string Hit = HitLine(U);
+  Ok &= write(Fd, Hit.data(), Hit.size()) == (ssize_t)Hit.size();
+  struct stat St;
+  Bucket->NumCrashes = fstat(Fd, &St) ? 0 : St.st_size / kHitLineSize;
+  Bucket->ReproSize = FileSize(Bucket->ReproPath);
+  flock(Fd, LOCK_UN);
+  close(Fd);
+  return Ok;
+}
+
+Vector<CrashBucket> CrashDb::List() const {
+  Vector<std::string> Files;
+  ListFilesInDirRecursive(Dir, nullptr, &Files, /*TopDir*/ true);
+  Vector<CrashBucket> Res;
+  const std::string Suffix = ".hits";
+  for (auto &Path : Files) {
+    if (Path.size() <= Suffix.size() ||
+        Path.compare(Path.size() - Suffix.size(), Suffix.size(), Suffix))
+      continue;
+    CrashBucket B;
+    B.ReproPath = Path.substr(0, Path.size() - Suffix.size());
+    B.Name = B.ReproPath.substr(B.ReproPath.find_last_of(GetSeparator()) + 1);
+    B.Stack = FileToString(B.ReproPath + ".stack");
+    B.NumCrashes = FileSize(Path) / kHitLineSize;
+    B.ReproSize = FileSize(B.ReproPath);
+    Res.push_back(B);
+  }
+  std::sort(Res.begin(), Res.end(),
+            [](const CrashBucket &A, const CrashBucket &B) {
+              if (A.NumCrashes != B.NumCrashes)
+                return A.NumCrashes > B.NumCrashes;
+              return A.Name < B.Name;
+            });
+  return Res;
+}
+
+#else
+
+// TODO: implement for other platforms.
+bool CrashDb::Open(const std::string &Dir) { return false; }
+
+bool CrashDb::Add(const char *Kind, const std::string &Stack, const Unit &U,
+                  CrashBucket *Bucket, bool *Saved) {
+  return false;
+}
+
+Vector<CrashBucket> CrashDb::List() const { return {}; }
+
+#endif  // LIBFUZZER_POSIX
+
+}  // namespace fuzzer
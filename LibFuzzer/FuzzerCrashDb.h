@@ -0,0 +1,70 @@
+//===- FuzzerCrashDb.h - Internal header for the Fuzzer ---------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::CrashDb: -crash_db=DIR buckets the crashes by a hash of their
+// normalized stack trace and keeps the smallest reproducer of every bucket,
+// so that the same bug found again and again is not saved again and again.
+//
+// A bucket is named like an artifact, <kind>-<sha1 of the stack> (e.g.
+// crash-0a1b...), and is made of three files in DIR:
+//   <bucket>        The smallest reproducer so far.
+//   <bucket>.stack  The normalized stack trace, one function per line.
+//   <bucket>.hits   One "<size> <sha1>\n" line per crash, the size padded to
+//                   20 columns: the lines all have the same size.
+// A bucket is updated with its .hits file locked, so the -jobs workers can
+// share DIR.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_CRASH_DB_H
+#define LLVM_FUZZER_CRASH_DB_H
+
+#include "FuzzerDefs.h"
+
+namespace fuzzer {
+
+// The number of target frames a crash is bucketed by.
+static const size_t kCrashStackFrames = 3;
+
+// Extracts the function names of the fuzz target frames from a sanitizer
+// stack trace ("#N 0xPC in Function Location" lines): the libFuzzer,
+// sanitizer and libc frames on top of them are skipped, the trace ends at
+// the first libFuzzer frame below them, and at most MaxFrames are kept.
+// Returns one function per line, or "" if the trace has no target frames.
+std::string NormalizeStackTrace(const std::string &Trace, size_t MaxFrames);
+
+struct CrashBucket {
+  std::string Name;
+  std::string Stack;
+  size_t NumCrashes = 0;
+  size_t ReproSize = 0;
+  std::string ReproPath;
+};
+
+class CrashDb {
+ public:
+  // DIR must exist.
+  bool Open(const std::string &Dir);
+  const std::string &GetDir() const { return Dir; }
+
+  // Adds a crash of U with the normalized Stack to its bucket, Kind being
+  // the artifact prefix ("crash-", "timeout-"). U replaces the reproducer
+  // if it is smaller; *Saved tells whether it did. Returns false on I/O
+  // errors.
+  bool Add(const char *Kind, const std::string &Stack, const Unit &U,
+           CrashBucket *Bucket, bool *Saved);
+
+  // All the buckets, the most frequent first.
+  Vector<CrashBucket> List() const;
+
+ private:
+  std::string Dir;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_CRASH_DB_H
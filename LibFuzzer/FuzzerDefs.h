@@ -130,6 +130,7 @@ struct FuzzingOptions;
 class InputCorpus;
 struct InputInfo;
 struct ExternalFunctions;
+class Command;
 
 // Global interface to functions that may or may not be available.
 extern ExternalFunctions *EF;
@@ -158,7 +159,7 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback);
 struct ScopedDoingMyOwnMemOrStr {
   ScopedDoingMyOwnMemOrStr() { DoingMyOwnMemOrStr++; }
   ~ScopedDoingMyOwnMemOrStr() { DoingMyOwnMemOrStr--; }
-  static int DoingMyOwnMemOrStr;
+  static thread_local int DoingMyOwnMemOrStr;
 };
 
 inline uint8_t  Bswap(uint8_t x)  { return x; }
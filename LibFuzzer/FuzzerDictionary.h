@@ -71,6 +71,10 @@ class DictionaryEntry {
   void IncSuccessCount() { SuccessCount++; }
   size_t GetUseCount() const { return UseCount; }
   size_t GetSuccessCount() const {return SuccessCount; }
+  void SetCounts(size_t Use, size_t Success) {
+    UseCount = Use;
+    SuccessCount = Success;
+  }
 
   void Print(const char *PrintAfter = "\n") {
     PrintASCII(W.data(), W.size());
@@ -0,0 +1,84 @@
+//===- FuzzerDigest.cpp - Fast content hash -------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// MurmurHash3_x64_128, by Austin Appleby, placed in the public domain.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerDigest.h"
+#include <cstring>
+
+namespace fuzzer {
+
+static inline uint64_t Rotl64(uint64_t X, int R) {
+  return (X << R) | (X >> (64 - R));
+}
+
+static inline uint64_t FMix64(uint64_t K) {
+  K ^= K >> 33;
+  K *= 0xff51afd7ed558ccdULL;
+  K ^= K >> 33;
+  K *= 0xc4ceb9fe1a85ec53ULL;
+  K ^= K >> 33;
+  return K;
+}
+
+UnitDigest ComputeDigest(const uint8_t *Data, size_t Size) {
+  const uint64_t C1 = 0x87c37b91114253d5ULL;
+  const uint64_t C2 = 0x4cf5ad432745937fULL;
+  uint64_t H1 = 0, H2 = 0;
+
+  size_t NumBlocks = Size / 16;
+  for (size_t i = 0; i < NumBlocks; i++) {
+    uint64_t K1, K2;
+    memcpy(&K1, Data + i * 16, 8);
+    memcpy(&K2, Data + i * 16 + 8, 8);
+    K1 *= C1; K1 = Rotl64(K1, 31); K1 *= C2; H1 ^= K1;
+    H1 = Rotl64(H1, 27); H1 += H2; H1 = H1 * 5 + 0x52dce729;
+    K2 *= C2; K2 = Rotl64(K2, 33); K2 *= C1; H2 ^= K2;
+    H2 = Rotl64(H2, 31); H2 += H1; H2 = H2 * 5 + 0x38495ab5;
+  }
+
+  const uint8_t *Tail = Data + NumBlocks * 16;
+  uint64_t K1 = 0, K2 = 0;
+  switch (Size & 15) {
+  case 15: K2 ^= uint64_t(Tail[14]) << 48;  // fallthrough
+  case 14: K2 ^= uint64_t(Tail[13]) << 40;  // fallthrough
+  case 13: K2 ^= uint64_t(Tail[12]) << 32;  // fallthrough
+  case 12: K2 ^= uint64_t(Tail[11]) << 24;  // fallthrough
+  case 11: K2 ^= uint64_t(Tail[10]) << 16;  // fallthrough
+  case 10: K2 ^= uint64_t(Tail[9]) << 8;    // fallthrough
+  case 9:  K2 ^= uint64_t(Tail[8]);
+           K2 *= C2; K2 = Rotl64(K2, 33); K2 *= C1; H2 ^= K2;
+           // fallthrough
+  case 8:  K1 ^= uint64_t(Tail[7]) << 56;   // fallthrough
+  case 7:  K1 ^= uint64_t(Tail[6]) << 48;   // fallthrough
+  case 6:  K1 ^= uint64_t(Tail[5]) << 40;   // fallthrough
+  case 5:  K1 ^= uint64_t(Tail[4]) << 32;   // fallthrough
+  case 4:  K1 ^= uint64_t(Tail[3]) << 24;   // fallthrough
+  case 3:  K1 ^= uint64_t(Tail[2]) << 16;   // fallthrough
+  case 2:  K1 ^= uint64_t(Tail[1]) << 8;    // fallthrough
+  case 1:  K1 ^= uint64_t(Tail[0]);
+           K1 *= C1; K1 = Rotl64(K1, 31); K1 *= C2; H1 ^= K1;
+  }
+
+  H1 ^= Size;
+  H2 ^= Size;
+  H1 += H2;
+  H2 += H1;
+  H1 = FMix64(H1);
+  H2 = FMix64(H2);
+  H1 += H2;
+  H2 += H1;
+
+  UnitDigest Res;
+  Res.Lo = H1;
+  Res.Hi = H2;
+  return Res;
+}
+
+}  // namespace fuzzer
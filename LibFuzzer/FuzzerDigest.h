@@ -0,0 +1,120 @@
+//===- FuzzerDigest.h - Internal header for the Fuzzer ----------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::UnitDigest, a fast 128-bit content hash used to tell units apart,
+// and fuzzer::DigestSet.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_DIGEST_H
+#define LLVM_FUZZER_DIGEST_H
+
+#include "FuzzerDefs.h"
+
+namespace fuzzer {
+
+struct UnitDigest {
+  uint64_t Lo = 0, Hi = 0;
+  bool operator==(const UnitDigest &Other) const {
+    return Lo == Other.Lo && Hi == Other.Hi;
+  }
+  bool operator!=(const UnitDigest &Other) const { return !(*this == Other); }
+};
+
+// MurmurHash3_x64_128 of 'Size' bytes in 'Data'. Not a cryptographic hash;
+// file names still use SHA1.
+UnitDigest ComputeDigest(const uint8_t *Data, size_t Size);
+inline UnitDigest ComputeDigest(const Unit &U) {
+  return ComputeDigest(U.data(), U.size());
+}
+
+// A set of digests with open addressing and linear probing. The digests are
+// already uniformly distributed, so their low bits are used as the hash.
+class DigestSet {
+ public:
+  size_t size() const { return NumElements; }
+  bool empty() const { return NumElements == 0; }
+
+  bool count(const UnitDigest &D) const {
+    if (Slots.empty()) return false;
+    for (size_t I = Home(D); Used[I]; I = Next(I))
+      if (Slots[I] == D)
+        return true;
+    return false;
+  }
+
+  // Returns false if D was already in the set.
+  bool insert(const UnitDigest &D) {
+    if ((NumElements + 1) * 2 > Slots.size())
+      Grow();
+    size_t I = Home(D);
+    for (; Used[I]; I = Next(I))
+      if (Slots[I] == D)
+        return false;
+    Slots[I] = D;
+    Used[I] = 1;
+    NumElements++;
+    return true;
+  }
+
+  // Also frees the slots.
+  void clear() {
+    Vector<UnitDigest>().swap(Slots);
+    Vector<uint8_t>().swap(Used);
+    NumElements = 0;
+  }
+
+  // Returns false if D was not in the set.
+  bool erase(const UnitDigest &D) {
+    if (Slots.empty()) return false;
+    size_t I = Home(D);
+    for (; Used[I]; I = Next(I))
+      if (Slots[I] == D)
+        break;
+    if (!Used[I])
+      return false;
+    // Shift the following elements of the cluster back so that no lookup
+    // stops at the hole.
+    for (size_t J = Next(I); Used[J]; J = Next(J)) {
+      size_t K = Home(Slots[J]);
+      // Move J to I unless its home is cyclically in (I, J].
+      bool InRange = I <= J ? (I < K && K <= J) : (I < K || K <= J);
+      if (!InRange) {
+        Slots[I] = Slots[J];
+        I = J;
+      }
+    }
+    Used[I] = 0;
+    NumElements--;
+    return true;
+  }
+
+ private:
+  size_t Home(const UnitDigest &D) const { return D.Lo & (Slots.size() - 1); }
+  size_t Next(size_t I) const { return (I + 1) & (Slots.size() - 1); }
+
+  void Grow() {
+    Vector<UnitDigest> OldSlots;
+    Vector<uint8_t> OldUsed;
+    OldSlots.swap(Slots);
+    OldUsed.swap(Used);
+    Slots.resize(std::max<size_t>(OldSlots.size() * 2, 64));
+    Used.resize(Slots.size());
+    NumElements = 0;
+    for (size_t I = 0; I < OldSlots.size(); I++)
+      if (OldUsed[I])
+        insert(OldSlots[I]);
+  }
+
+  Vector<UnitDigest> Slots;  // Power of 2 size, at most half full.
+  Vector<uint8_t> Used;
+  size_t NumElements = 0;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_DIGEST_H
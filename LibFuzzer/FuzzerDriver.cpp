@@ -10,20 +10,29 @@
 //===----------------------------------------------------------------------===//
 
 #include "FuzzerCommand.h"
+#include "FuzzerAsyncWriter.h"
 #include "FuzzerCorpus.h"
+#include "FuzzerCrashDb.h"
+#include "FuzzerForkServer.h"
 #include "FuzzerIO.h"
 #include "FuzzerInterface.h"
 #include "FuzzerInternal.h"
+#include "FuzzerMerge.h"
 #include "FuzzerMutate.h"
+#include "FuzzerPackedCorpus.h"
 #include "FuzzerRandom.h"
+#include "FuzzerSharedCorpus.h"
 #include "FuzzerShmem.h"
 #include "FuzzerTracePC.h"
+#include "FuzzerWorkerStats.h"
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <mutex>
+#include <sstream>
 #include <string>
 #include <thread>
 
@@ -199,34 +208,275 @@ static void ParseFlags(const Vector<std::string> &Args) {
 
 static std::mutex Mu;
 
-static void PulseThread() {
-  while (true) {
-    SleepSeconds(600);
-    std::lock_guard<std::mutex> Lock(Mu);
-    Printf("pulse...\n");
-  }
+// -jobs: every worker thread runs the jobs one at a time, each in a worker
+// process that reports its progress in the slot of the thread in a
+// WorkerStatsTable. The supervisor thread aggregates the slots, writes
+// the status line and the stats file, and kills the workers that stall;
+// their jobs are started again.
+struct JobSlot {
+  std::atomic<int> Job{-1};  // -1 while the slot is idle.
+  std::atomic<unsigned> NumStarts{0};  // Of worker processes in this slot.
+  std::atomic<bool> Killed{false};
+  // The worker process while it runs, 0 otherwise. The supervisor kills only
+  // this pid, holding PidMutex: the pid can not be reused before it is reset.
+  std::mutex PidMutex;
+  unsigned long Pid = 0;
+  // Only used by the supervisor thread.
+  int SeenJob = -1;
+  unsigned SeenStarts = 0;
+  WorkerStatus Status = WorkerStatus();
+  system_clock::time_point Started, LastProgress;
+  double ExecPerSec = 0;
+  bool Slow = false;
+};
+
+struct JobsState {
+  JobsState(const Command &BaseCmd, unsigned NumWorkers, unsigned NumJobs)
+      : BaseCmd(BaseCmd), NumJobs(NumJobs), Slots(NumWorkers) {}
+
+  const Command &BaseCmd;
+  const unsigned NumJobs;
+  Vector<JobSlot> Slots;
+  WorkerStatsTable Stats;
+  std::string StatsName;  // Empty if the workers do not report stats.
+  // Worker slot i runs on WorkerCpus(Cpus, i, NumThreads), as a list.
+  Vector<unsigned> Cpus;
+  unsigned NumThreads = 1;
+  // The jobs of worker slot i, one after the other, share <Checkpoint>.i.
+  std::string Checkpoint;
+  std::atomic<unsigned> Counter{0};
+  std::atomic<unsigned> NumDone{0};
+  std::atomic<uint64_t> RunsOfDoneJobs{0};
+  std::atomic<bool> HasErrors{false};
+  std::atomic<bool> Finished{false};
+  // Only used by the supervisor thread.
+  WorkerStatus Max = WorkerStatus();
+};
+
+static std::string SlotCpus(JobsState *S, unsigned Slot) {
+  std::string Res;
+  for (auto Cpu : WorkerCpus(S->Cpus, Slot, S->NumThreads))
+    Res += (Res.empty() ? "" : ",") + std::to_string(Cpu);
+  return Res;
 }
 
-static void WorkerThread(const Command &BaseCmd, std::atomic<unsigned> *Counter,
-                         unsigned NumJobs, std::atomic<bool> *HasErrors) {
+static void WorkerThread(JobsState *S, unsigned Slot) {
+  const int kMaxRestarts = 3;
+  JobSlot &JS = S->Slots[Slot];
+  unsigned C = 0;
+  int Restarts = 0;
+  bool Restart = false;
   while (true) {
-    unsigned C = (*Counter)++;
-    if (C >= NumJobs) break;
+    if (!Restart) {
+      C = S->Counter++;
+      if (C >= S->NumJobs) break;
+      Restarts = 0;
+    }
     std::string Log = "fuzz-" + std::to_string(C) + ".log";
-    Command Cmd(BaseCmd);
+    Command Cmd(S->BaseCmd);
     Cmd.setOutputFile(Log);
     Cmd.combineOutAndErr();
+    if (!S->Cpus.empty())
+      Cmd.addFlag("cpu_affinity", SlotCpus(S, Slot));
+    if (!S->Checkpoint.empty())
+      Cmd.addFlag("checkpoint", S->Checkpoint + "." + std::to_string(Slot));
+    if (!S->StatsName.empty()) {
+      Cmd.addFlag("worker_stats", S->StatsName);
+      Cmd.addFlag("worker_slot", std::to_string(Slot));
+      S->Stats.Clear(Slot);
+    }
     if (Flags.verbosity) {
       std::string CommandLine = Cmd.toString();
       Printf("%s\n", CommandLine.c_str());
     }
-    int ExitCode = ExecuteCommand(Cmd);
-    if (ExitCode != 0)
-      *HasErrors = true;
+    JS.Killed = false;
+    JS.Job = C;
+    JS.NumStarts++;
+    int ExitCode = ExecuteCommand(Cmd, [&](unsigned long Pid) {
+      std::lock_guard<std::mutex> Lock(JS.PidMutex);
+      JS.Pid = Pid;
+    });
+    JS.Job = -1;
+    if (!S->StatsName.empty())
+      S->RunsOfDoneJobs += S->Stats.Read(Slot).Runs;
+    // Crashes found in the target are reported with an exit code; a worker
+    // killed by a signal was killed by us or by the system.
+    Restart = (JS.Killed || ExitedOnSignal(ExitCode)) &&
+              Restarts++ < kMaxRestarts;
+    if (!Restart) {
+      S->NumDone++;
+      if (ExitCode != 0)
+        S->HasErrors = true;
+    }
     std::lock_guard<std::mutex> Lock(Mu);
     Printf("================== Job %u exited with exit code %d ============\n",
            C, ExitCode);
     fuzzer::CopyFileToErr(Log);
+    if (Restart)
+      Printf("INFO: job %u was killed, starting it again (%d/%d)\n", C,
+             Restarts, kMaxRestarts);
+  }
+}
+
+// Updates the slots from the stats table and handles the stalled and slow
+// workers.
+static void UpdateJobSlots(JobsState *S) {
+  auto Now = system_clock::now();
+  Vector<double> Rates;
+  for (unsigned i = 0; i < S->Slots.size(); i++) {
+    JobSlot &JS = S->Slots[i];
+    int Job = JS.Job;
+    unsigned NumStarts = JS.NumStarts;
+    if (Job != JS.SeenJob || NumStarts != JS.SeenStarts) {
+      JS.SeenJob = Job;
+      JS.SeenStarts = NumStarts;
+      JS.Status = WorkerStatus();
+      JS.Started = JS.LastProgress = Now;
+      JS.ExecPerSec = 0;
+      JS.Slow = false;
+    }
+    if (Job < 0) continue;
+    WorkerStatus W = S->Stats.Read(i);
+    if (W.Runs > JS.Status.Runs) {
+      // The workers update their slot about once a second.
+      double Seconds = duration<double>(Now - JS.LastProgress).count();
+      double Rate = (W.Runs - JS.Status.Runs) / std::max(Seconds, 1e-3);
+      JS.ExecPerSec = JS.ExecPerSec ? 0.7 * JS.ExecPerSec + 0.3 * Rate : Rate;
+      JS.LastProgress = Now;
+    }
+    JS.Status = W;
+    S->Max.Coverage = std::max(S->Max.Coverage, W.Coverage);
+    S->Max.Features = std::max(S->Max.Features, W.Features);
+    S->Max.CorpusUnits = std::max(S->Max.CorpusUnits, W.CorpusUnits);
+    S->Max.CorpusBytes = std::max(S->Max.CorpusBytes, W.CorpusBytes);
+    S->Max.PeakRssMb = std::max(S->Max.PeakRssMb, W.PeakRssMb);
+    if (JS.ExecPerSec > 0)
+      Rates.push_back(JS.ExecPerSec);
+    // A hanging unit is reported up to 1.5 * -timeout after it started.
+    int StallTimeout = Flags.worker_stall_timeout;
+    if (StallTimeout > 0 && Flags.timeout > 0)
+      StallTimeout = std::max(StallTimeout, 2 * Flags.timeout);
+    if (StallTimeout > 0 && W.Pid && !JS.Killed &&
+        duration_cast<seconds>(Now - JS.LastProgress).count() >=
+            StallTimeout) {
+      std::lock_guard<std::mutex> PidLock(JS.PidMutex);
+      if (JS.Pid) {
+        std::lock_guard<std::mutex> Lock(Mu);
+        Printf("WARNING: job %d (pid %zd) executed nothing for %d seconds, "
+               "killing it\n", Job, (size_t)JS.Pid, StallTimeout);
+        JS.Killed = true;
+        KillProcess(JS.Pid);
+      }
+    }
+  }
+  // A worker much slower than the others is likely stuck in slow inputs.
+  // Give new workers time to load the corpus first.
+  const int kMinSecondsBeforeSlow = 10;
+  if (Rates.size() < 3) return;
+  std::sort(Rates.begin(), Rates.end());
+  double Median = Rates[Rates.size() / 2];
+  for (auto &JS : S->Slots) {
+    bool Slow = JS.SeenJob >= 0 && JS.ExecPerSec > 0 &&
+                JS.ExecPerSec * 8 < Median &&
+                duration_cast<seconds>(Now - JS.Started).count() >=
+                    kMinSecondsBeforeSlow;
+    if (Slow && !JS.Slow) {
+      std::lock_guard<std::mutex> Lock(Mu);
+      Printf("WARNING: job %d runs %zd exec/s, the median is %zd exec/s\n",
+             JS.SeenJob, (size_t)JS.ExecPerSec, (size_t)Median);
+    }
+    JS.Slow = Slow;
+  }
+}
+
+struct JobsTotals {
+  size_t NumRunning = 0;
+  uint64_t Runs = 0;  // Including the runs of the jobs that are done.
+  size_t ExecPerSec = 0;
+};
+
+static JobsTotals SumJobSlots(JobsState *S) {
+  JobsTotals T;
+  T.Runs = S->RunsOfDoneJobs;
+  for (auto &JS : S->Slots) {
+    if (JS.SeenJob < 0) continue;
+    T.NumRunning++;
+    T.Runs += JS.Status.Runs;
+    T.ExecPerSec += JS.ExecPerSec;
+  }
+  return T;
+}
+
+static void PrintJobsStatus(JobsState *S, const char *Where) {
+  JobsTotals T = SumJobSlots(S);
+  std::lock_guard<std::mutex> Lock(Mu);
+  Printf("#%zd\t%s jobs: %zd/%zd done: %u", (size_t)T.Runs, Where,
+         T.NumRunning, S->Slots.size(), S->NumDone.load());
+  if (!S->StatsName.empty()) {
+    Printf(" cov: %zd ft: %zd corp: %zd/%zdb exec/s: %zd rss: %zdMb",
+           (size_t)S->Max.Coverage, (size_t)S->Max.Features,
+           (size_t)S->Max.CorpusUnits, (size_t)S->Max.CorpusBytes,
+           T.ExecPerSec, (size_t)S->Max.PeakRssMb);
+  }
+  Printf("\n");
+}
+
+// Same format as -print_final_stats, plus one line per worker slot.
+static void WriteJobsStatsFile(JobsState *S, const std::string &Path) {
+  std::string Res;
+  char Buf[512];
+  JobsTotals T = SumJobSlots(S);
+  snprintf(Buf, sizeof(Buf),
+           "stat::jobs_running: %zd\nstat::jobs_done: %u\n"
+           "stat::number_of_executed_units: %zd\nstat::exec_per_sec: %zd\n"
+           "stat::coverage: %zd\nstat::features: %zd\n"
+           "stat::corpus_units: %zd\nstat::corpus_bytes: %zd\n"
+           "stat::peak_rss_mb: %zd\n",
+           T.NumRunning, S->NumDone.load(), (size_t)T.Runs, T.ExecPerSec,
+           (size_t)S->Max.Coverage, (size_t)S->Max.Features,
+           (size_t)S->Max.CorpusUnits, (size_t)S->Max.CorpusBytes,
+           (size_t)S->Max.PeakRssMb);
+  Res += Buf;
+  for (size_t i = 0; i < S->Slots.size(); i++) {
+    auto &JS = S->Slots[i];
+    auto &W = JS.Status;
+    const char *State = JS.SeenJob < 0 ? "idle"
+                        : JS.Killed    ? "killed"
+                        : JS.Slow      ? "slow"
+                                       : "running";
+    snprintf(Buf, sizeof(Buf),
+             "worker::%zd: state: %s job: %d pid: %zd cpus: %s runs: %zd"
+             " exec/s: %zd cov: %zd ft: %zd corp: %zd/%zdb rss: %zdMb\n",
+             i, State, JS.SeenJob, (size_t)W.Pid,
+             S->Cpus.empty() ? "-" : SlotCpus(S, i).c_str(), (size_t)W.Runs,
+             (size_t)JS.ExecPerSec, (size_t)W.Coverage, (size_t)W.Features,
+             (size_t)W.CorpusUnits, (size_t)W.CorpusBytes,
+             (size_t)W.PeakRssMb);
+    Res += Buf;
+  }
+  // Readers never see a partial file.
+  std::string Tmp = Path + ".tmp";
+  WriteToFile(Unit(Res.begin(), Res.end()), Tmp);
+  std::rename(Tmp.c_str(), Path.c_str());
+}
+
+static void SupervisorThread(JobsState *S) {
+  const int kStatusIntervalSec = 10;
+  int Ticks = 0;
+  while (!S->Finished) {
+    SleepSeconds(1);
+    if (S->StatsName.empty()) {
+      if (++Ticks % 600 == 0) {
+        std::lock_guard<std::mutex> Lock(Mu);
+        Printf("pulse...\n");
+      }
+      continue;
+    }
+    UpdateJobSlots(S);
+    if (Flags.jobs_stats_file)
+      WriteJobsStatsFile(S, Flags.jobs_stats_file);
+    if (++Ticks % kStatusIntervalSec == 0)
+      PrintJobsStatus(S, "JOBS  ");
   }
 }
 
@@ -242,20 +492,60 @@ std::string CloneArgsWithoutX(const Vector<std::string> &Args,
 }
 
 static int RunInMultipleProcesses(const Vector<std::string> &Args,
-                                  unsigned NumWorkers, unsigned NumJobs) {
-  std::atomic<unsigned> Counter(0);
-  std::atomic<bool> HasErrors(false);
+                                  unsigned NumWorkers, unsigned NumJobs,
+                                  const Vector<unsigned> &Cpus) {
   Command Cmd(Args);
   Cmd.removeFlag("jobs");
   Cmd.removeFlag("workers");
+  Cmd.removeFlag("jobs_stats_file");
+  Cmd.removeFlag("cpu_affinity");
+  Cmd.removeFlag("checkpoint");
+  SharedCorpusRing Ring;
+  std::string RingName;
+  if (Flags.shared_corpus_mb > 0 && NumJobs > 1 && LIBFUZZER_POSIX) {
+    const size_t kDefaultMaxLen = 4096;
+    RingName = "libFuzzerSharedCorpus." + std::to_string(GetPid());
+    if (Ring.Create(RingName.c_str(), (size_t)Flags.shared_corpus_mb << 20,
+                    Flags.max_len > 0 ? Flags.max_len : kDefaultMaxLen)) {
+      Cmd.addFlag("shared_corpus", RingName);
+      if (Flags.verbosity)
+        Printf("INFO: sharing new units through a ring of %zd slots\n",
+               Ring.NumSlots());
+    } else {
+      Printf("WARNING: could not create the shared corpus ring\n");
+      RingName.clear();
+    }
+  }
+  JobsState S(Cmd, NumWorkers, NumJobs);
+  S.Cpus = Cpus;
+  S.NumThreads = std::max(Flags.threads, 1u);
+  if (Flags.checkpoint)
+    S.Checkpoint = Flags.checkpoint;
+  if (LIBFUZZER_POSIX) {
+    S.StatsName = "libFuzzerWorkerStats." + std::to_string(GetPid());
+    if (!S.Stats.Create(S.StatsName.c_str(), NumWorkers)) {
+      Printf("WARNING: could not create the worker stats table\n");
+      S.StatsName.clear();
+    }
+  }
+  std::thread Supervisor(SupervisorThread, &S);
   Vector<std::thread> V;
-  std::thread Pulse(PulseThread);
-  Pulse.detach();
   for (unsigned i = 0; i < NumWorkers; i++)
-    V.push_back(std::thread(WorkerThread, std::ref(Cmd), &Counter, NumJobs, &HasErrors));
+    V.push_back(std::thread(WorkerThread, &S, i));
   for (auto &T : V)
     T.join();
-  return HasErrors ? 1 : 0;
+  S.Finished = true;
+  Supervisor.join();
+  if (!S.StatsName.empty()) {
+    UpdateJobSlots(&S);
+    if (Flags.jobs_stats_file)
+      WriteJobsStatsFile(&S, Flags.jobs_stats_file);
+    PrintJobsStatus(&S, "DONE  ");
+    S.Stats.Destroy(S.StatsName.c_str());
+  }
+  if (!RingName.empty())
+    Ring.Destroy(RingName.c_str());
+  return S.HasErrors ? 1 : 0;
 }
 
 static void RssThread(Fuzzer *F, size_t RssLimitMb) {
@@ -282,10 +572,32 @@ int RunOneTest(Fuzzer *F, const char *InputFilePath, size_t MaxLen) {
   return 0;
 }
 
+static int PrintCrashDb(const char *Dir) {
+  CrashDb Db;
+  if (!Dir || !Db.Open(Dir)) {
+    Printf("ERROR: -print_crash_db=1 needs an existing -crash_db\n");
+    return 1;
+  }
+  auto Buckets = Db.List();
+  size_t NumCrashes = 0;
+  for (auto &B : Buckets)
+    NumCrashes += B.NumCrashes;
+  Printf("CRASH_DB: %zd crashes in %zd buckets in %s\n", NumCrashes,
+         Buckets.size(), Dir);
+  for (auto &B : Buckets) {
+    Printf("CRASH_DB: %s: %zd crashes, reproducer: %s (%zd bytes)\n",
+           B.Name.c_str(), B.NumCrashes, B.ReproPath.c_str(), B.ReproSize);
+    std::istringstream IS(B.Stack);
+    for (std::string Func; std::getline(IS, Func);)
+      Printf("    in %s\n", Func.c_str());
+  }
+  return 0;
+}
+
 static bool AllInputsAreFiles() {
   if (Inputs->empty()) return false;
   for (auto &Path : *Inputs)
-    if (!IsFile(Path))
+    if (!IsFile(Path) || IsPackedCorpus(Path))
       return false;
   return true;
 }
@@ -447,6 +759,101 @@ int MinimizeCrashInput(const Vector<std::string> &Args,
   return 0;
 }
 
+// Minimizes the crash input by delta debugging in this process: every
+// candidate runs in a fork of the already initialized process and is kept if
+// it crashes with the same exit status and dedup token as the input. Returns
+// -1 if this process can not be forked, or if the input does not crash in a
+// fork while leaks are detected, so that the caller can fall back to
+// MinimizeCrashInput. Only the minimized unit is written: the crashes of the
+// candidates are neither artifacts nor -crash_db hits.
+int MinimizeCrashInputInProcess(Fuzzer *F, const Vector<Unit> &Dictionary,
+                                const FuzzingOptions &Options) {
+  if (Inputs->size() != 1) {
+    Printf("ERROR: -minimize_crash should be given one input file\n");
+    exit(1);
+  }
+  std::string InputFilePath = Inputs->at(0);
+  int MaxTotalTimeSec = Options.MaxTotalTimeSec;
+  if (Flags.runs <= 0 && MaxTotalTimeSec == 0) {
+    Printf("INFO: you need to specify -runs=N or "
+           "-max_total_time=N with -minimize_crash=1\n"
+           "INFO: defaulting to -max_total_time=600\n");
+    MaxTotalTimeSec = 600;
+  }
+  auto LogFilePath = DirPlusFile(
+      TmpDir(), "libFuzzerTemp." + std::to_string(GetPid()) + ".txt");
+  int TimerSec =
+      Options.UnitTimeoutSec > 0 ? Options.UnitTimeoutSec / 2 + 1 : 0;
+  auto Run = [&](const Unit &U, std::string *DedupToken) {
+    int Status = ExecuteInForkedChild(
+        [&]() {
+          F->DisableArtifacts();
+          // The threads of this process, the RSS one too, are not forked.
+          StartRssThread(F, Flags.rss_limit_mb);
+          F->ExecuteCallback(U.data(), U.size());
+          F->TryDetectingAMemoryLeak(U.data(), U.size(), true);
+        },
+        LogFilePath, TimerSec);
+    *DedupToken = GetDedupTokenFromFile(LogFilePath);
+    return Status;
+  };
+
+  const Unit Original = FileToVector(InputFilePath);
+  Printf("CRASH_MIN: minimizing crash input: '%s' (%zd bytes) in process\n",
+         InputFilePath.c_str(), Original.size());
+  std::string DedupToken;
+  int CrashStatus = Run(Original, &DedupToken);
+  if (CrashStatus == -1) {
+    RemoveFile(LogFilePath);
+    Printf("WARNING: can not fork\n");
+    return -1;
+  }
+  if (CrashStatus == 0 && Options.DetectLeaks) {
+    // LeakSanitizer may not find the leak in a fork, e.g. if it needs the
+    // leak check at exit.
+    RemoveFile(LogFilePath);
+    Printf("INFO: the input did not crash in a fork\n");
+    return -1;
+  }
+  if (CrashStatus == 0) {
+    CopyFileToErr(LogFilePath);
+    RemoveFile(LogFilePath);
+    Printf("ERROR: the input %s did not crash\n", InputFilePath.c_str());
+    exit(1);
+  }
+  if (!DedupToken.empty())
+    Printf("CRASH_MIN: DedupToken: %s\n", DedupToken.c_str());
+
+  size_t NumRuns = 1;
+  auto StartTime = system_clock::now();
+  auto OutOfBudget = [&]() {
+    if (Flags.runs > 0 && NumRuns >= (size_t)Flags.runs)
+      return true;
+    return MaxTotalTimeSec > 0 &&
+           duration_cast<seconds>(system_clock::now() - StartTime).count() >=
+               MaxTotalTimeSec;
+  };
+  auto SameCrash = [&](const Unit &Candidate) {
+    NumRuns++;
+    std::string Token;
+    return Run(Candidate, &Token) == CrashStatus && Token == DedupToken;
+  };
+
+  Unit U = MinimizeUnit(Original, Dictionary, SameCrash, OutOfBudget);
+  RemoveFile(LogFilePath);
+
+  std::string ArtifactPath =
+      Flags.exact_artifact_path
+          ? Flags.exact_artifact_path
+          : Options.ArtifactPrefix + "minimized-from-" + Hash(Original);
+  WriteToFile(U, ArtifactPath);
+  Printf("CRASH_MIN: minimized '%s' from %zd to %zd bytes in %zd runs, "
+         "written to %s\n",
+         InputFilePath.c_str(), Original.size(), U.size(), NumRuns,
+         ArtifactPath.c_str());
+  return 0;
+}
+
 int MinimizeCrashInputInternalStep(Fuzzer *F, InputCorpus *Corpus) {
   assert(Inputs->size() == 1);
   std::string InputFilePath = Inputs->at(0);
@@ -535,7 +942,8 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   assert(argc && argv && "Argument pointers cannot be nullptr");
   std::string Argv0((*argv)[0]);
   EF = new ExternalFunctions();
-  if (EF->LLVMFuzzerInitialize)
+  // Children of the fork server inherit the initialized target.
+  if (EF->LLVMFuzzerInitialize && !IsForkServerChild())
     EF->LLVMFuzzerInitialize(argc, argv);
   const Vector<std::string> Args(*argv, *argv + *argc);
   assert(!Args.empty());
@@ -555,14 +963,50 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   if (Flags.close_fd_mask & 1)
     CloseStdout();
 
+  if (Flags.pack_corpus)
+    return PackCorpus(Flags.pack_corpus, *Inputs);
+  if (Flags.unpack_corpus)
+    return UnpackCorpus(Flags.unpack_corpus, *Inputs);
+  if (Flags.merge_summaries)
+    return MergeCoverageSummaries(Flags.merge_summaries, *Inputs);
+  if (Flags.print_crash_db)
+    return PrintCrashDb(Flags.crash_db);
+
   if (Flags.jobs > 0 && Flags.workers == 0) {
     Flags.workers = std::min(NumberOfCpuCores() / 2, Flags.jobs);
     if (Flags.workers > 1)
       Printf("Running %u workers\n", Flags.workers);
   }
 
+  if (Flags.fork_server && !IsForkServerChild() &&
+      ((Flags.workers > 0 && Flags.jobs > 0) || Flags.merge ||
+       (Flags.minimize_crash && !Flags.minimize_crash_fork) ||
+       Flags.cleanse_crash)) {
+    if (StartForkServer(*ProgName, Callback))
+      Printf("INFO: running sub-processes in a fork server\n");
+    else
+      Printf("WARNING: could not start the fork server, "
+             "running sub-processes through the shell\n");
+  }
+
+  Vector<unsigned> Cpus;
+  if (Flags.cpu_affinity && !ParseCpuAffinity(Flags.cpu_affinity, &Cpus)) {
+    Printf("ERROR: invalid -cpu_affinity=%s\n", Flags.cpu_affinity);
+    exit(1);
+  }
+
   if (Flags.workers > 0 && Flags.jobs > 0)
-    return RunInMultipleProcesses(Args, Flags.workers, Flags.jobs);
+    return RunInMultipleProcesses(Args, Flags.workers, Flags.jobs, Cpus);
+
+  // Before anything is allocated, so that it is allocated on the local node.
+  if (!Cpus.empty()) {
+    if (PinThreadToCpu(Cpus[0])) {
+      if (Flags.verbosity)
+        Printf("INFO: pinned to CPU %u\n", Cpus[0]);
+    } else {
+      Printf("WARNING: could not pin to CPU %u\n", Cpus[0]);
+    }
+  }
 
   FuzzingOptions Options;
   Options.Verbosity = Flags.verbosity;
@@ -575,6 +1019,7 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   Options.DoCrossOver = Flags.cross_over;
   Options.MutateDepth = Flags.mutate_depth;
   Options.ReduceDepth = Flags.reduce_depth;
+  Options.AdaptiveMutators = Flags.adaptive_mutators;
   Options.UseCounters = Flags.use_counters;
   Options.UseMemmem = Flags.use_memmem;
   Options.UseCmp = Flags.use_cmp;
@@ -583,7 +1028,19 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   Options.ReduceInputs = Flags.reduce_inputs;
   Options.ShuffleAtStartUp = Flags.shuffle;
   Options.PreferSmall = Flags.prefer_small;
+  Options.SeedLoaderThreads = Flags.seed_loader_threads;
+  Options.SeedPrefetch = Flags.seed_prefetch;
+  if (Flags.feature_cache)
+    Options.FeatureCache = Flags.feature_cache;
+  if (Flags.checkpoint)
+    Options.Checkpoint = Flags.checkpoint;
+  Options.CheckpointIntervalSec = Flags.checkpoint_interval;
+  Options.MergeJobs = Max(1U, Flags.merge_jobs);
+  Options.MergeWeighted = Flags.merge_weighted;
+  Options.BinaryCoverageSummary = Flags.binary_coverage_summary;
+  Options.SummaryFileFeatures = Flags.summary_file_features;
   Options.ReloadIntervalSec = Flags.reload;
+  Options.WatchCorpus = Flags.watch_corpus;
   Options.OnlyASCII = Flags.only_ascii;
   Options.DetectLeaks = Flags.detect_leaks;
   Options.PurgeAllocatorIntervalSec = Flags.purge_allocator_interval;
@@ -614,9 +1071,12 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   Options.PrintNewCovFuncs = Flags.print_funcs;
   Options.PrintFinalStats = Flags.print_final_stats;
   Options.PrintCorpusStats = Flags.print_corpus_stats;
+  Options.PrintMutatorStats = Flags.mutator_stats;
   Options.PrintCoverage = Flags.print_coverage;
   Options.DumpCoverage = Flags.dump_coverage;
   Options.UseClangCoverage = Flags.use_clang_coverage;
+  Options.SparseReset = Flags.sparse_reset;
+  Options.MmapCorpus = Flags.mmap_corpus;
   Options.UseFeatureFrequency = Flags.use_feature_frequency;
   if (Flags.exit_on_src_pos)
     Options.ExitOnSrcPos = Flags.exit_on_src_pos;
@@ -631,15 +1091,62 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   if (Flags.verbosity)
     Printf("INFO: Seed: %u\n", Seed);
 
+  if (Flags.threads > TracePC::kMaxNumThreads) {
+    Printf("ERROR: -threads can not exceed %zd\n", TracePC::kMaxNumThreads);
+    exit(1);
+  }
+  if (Flags.threads > 1 && Options.DetectLeaks) {
+    // The malloc/free counting used for leak detection is process-wide.
+    Printf("INFO: leak detection is disabled with -threads=%u\n",
+           Flags.threads);
+    Options.DetectLeaks = false;
+  }
+
   Random Rand(Seed);
   auto *MD = new MutationDispatcher(Rand, Options);
-  auto *Corpus = new InputCorpus(Options.OutputCorpus);
+  auto *Corpus = new InputCorpus(Options.OutputCorpus, Options.MmapCorpus);
   auto *F = new Fuzzer(Callback, *Corpus, *MD, Options);
 
   for (auto &U: Dictionary)
     if (U.size() <= Word::GetMaxSize())
       MD->AddWordToManualDictionary(Word(U.data(), U.size()));
 
+  // Every extra fuzzing thread has its own Fuzzer and MutationDispatcher
+  // (seeded differently) sharing the corpus and the dictionary with F.
+  for (unsigned i = 1; i < Flags.threads; i++) {
+    auto *ThreadMD = new MutationDispatcher(*new Random(Seed + i), Options);
+    for (auto &U: Dictionary)
+      if (U.size() <= Word::GetMaxSize())
+        ThreadMD->AddWordToManualDictionary(Word(U.data(), U.size()));
+    auto *T = new Fuzzer(Callback, *Corpus, *ThreadMD, Options);
+    if (!Cpus.empty())
+      T->SetCpu(Cpus[i % Cpus.size()]);
+    F->AddFuzzingThread(T);
+  }
+
+  if (auto Name = Flags.shared_corpus) {
+    auto *Ring = new SharedCorpusRing;
+    if (Ring->Open(Name))
+      F->SetSharedCorpus(Ring);
+    else
+      Printf("WARNING: can't open the shared corpus ring %s\n", Name);
+  }
+  if (auto Dir = Flags.crash_db) {
+    auto *Db = new CrashDb;
+    if (Db->Open(Dir))
+      F->SetCrashDb(Db);
+    else
+      Printf("WARNING: can't open the crash db %s\n", Dir);
+  }
+  if (auto Name = Flags.worker_stats) {
+    auto *Table = new WorkerStatsTable;
+    if (Table->Open(Name) && Flags.worker_slot >= 0 &&
+        (size_t)Flags.worker_slot < Table->size())
+      F->SetWorkerStats(Table, Flags.worker_slot);
+    else
+      Printf("WARNING: can't open the worker stats table %s\n", Name);
+  }
+
   StartRssThread(F, Flags.rss_limit_mb);
 
   Options.HandleAbrt = Flags.handle_abrt;
@@ -656,8 +1163,23 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
 
   std::atexit(Fuzzer::StaticExitCallback);
 
-  if (Flags.minimize_crash)
+  if (Flags.async_writes) {
+    if (Flags.fsync_writes >= FSYNC_FILES_AND_DIRS && LIBFUZZER_WINDOWS)
+      Printf("WARNING: -fsync_writes=2 can not sync directories on Windows, "
+             "only the files are synced\n");
+    StartAsyncWriter(static_cast<FsyncPolicy>(
+        std::min(std::max(Flags.fsync_writes, 0), 2)));
+  }
+
+  if (Flags.minimize_crash) {
+    if (Flags.minimize_crash_fork) {
+      int Res = MinimizeCrashInputInProcess(F, Dictionary, Options);
+      if (Res >= 0)
+        return Res;
+      Printf("INFO: minimizing in sub-processes\n");
+    }
     return MinimizeCrashInput(Args, Options);
+  }
 
   if (Flags.minimize_crash_internal_step)
     return MinimizeCrashInputInternalStep(F, Corpus);
@@ -722,7 +1244,6 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   }
 
   if (Flags.merge_inner) {
-    const size_t kDefaultMaxMergeLen = 1 << 20;
     if (Options.MaxLen == 0)
       F->SetMaxInputLen(kDefaultMaxMergeLen);
     assert(Flags.merge_control_file);
@@ -0,0 +1,207 @@
+//===- FuzzerFeatureCache.cpp - Per-input feature cache -------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// FeatureCache, locked with flock() on Posix. The file is mapped when it is
+// opened. A truncated tail is cut off in place, so that the records the other
+// processes append to it are kept; only a stale file, whose records no other
+// process can use, is replaced through a temporary file and a rename.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerFeatureCache.h"
+#include "FuzzerIO.h"
+#include "FuzzerUtil.h"
+#include <cstdio>
+#include <cstring>
+#if LIBFUZZER_POSIX
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fuzzer {
+
+namespace {
+
+const uint32_t kFeatureCacheVersion = 1;
+
+struct FileHeader {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t Reserved;
+  UnitDigest Key;
+};
+
+struct RecordHeader {
+  UnitDigest Digest;
+  uint32_t Size;
+  uint32_t NumFeatures;
+};
+
+static_assert(sizeof(FileHeader) == 32, "unexpected FileHeader layout");
+static_assert(sizeof(RecordHeader) == 24, "unexpected RecordHeader layout");
+
+}  // namespace
+
+#if LIBFUZZER_POSIX
+
+FeatureCache::~FeatureCache() {
+  if (MapSize)
+    munmap(const_cast<uint8_t *>(Data), MapSize);
+  if (Fd >= 0)
+    close(Fd);
+}
+
+// Opens Path for appending and locks it, retrying if another process
+// replaced it while we waited for the lock.
+static int OpenLocked(const std::string &Path, struct stat *St) {
+  while (true) {
+    int Fd = open(Path.c_str(), O_RDWR | O_APPEND | O_CREAT, 0644);
+    if (Fd < 0)
+      return -1;
+    struct stat PathSt;
+    if (flock(Fd, LOCK_EX) || fstat(Fd, St) || stat(Path.c_str(), &PathSt)) {
+      close(Fd);
+      return -1;
+    }
+    if (St->st_dev == PathSt.st_dev && St->st_ino == PathSt.st_ino)
+      return Fd;
+    close(Fd);
+  }
+}
+
+bool FeatureCache::Open(const std::string &Path, const UnitDigest &Key) {
+  assert(Fd < 0);
+  struct stat St;
+  Fd = OpenLocked(Path, &St);
+  if (Fd < 0)
+    return false;
+  FileHeader FH;
+  size_t Size = St.st_size;
+  size_t End = 0;  // Of the valid part of Data.
+  if (Size >= sizeof(FH)) {
+    void *Map = mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, Fd, 0);
+    if (Map != MAP_FAILED) {
+      Data = static_cast<const uint8_t *>(Map);
+      MapSize = Size;
+      memcpy(&FH, Data, sizeof(FH));
+      if (!memcmp(FH.Magic, kFeatureCacheMagic, sizeof(FH.Magic)) &&
+          FH.Version == kFeatureCacheVersion && FH.Key == Key)
+        End = sizeof(FH);
+    }
+  }
+  if (End) {
+    RecordHeader RH;
+    while (End + sizeof(RH) <= Size) {
+      memcpy(&RH, Data + End, sizeof(RH));
+      size_t RecordSize = sizeof(RH) + RH.NumFeatures * sizeof(uint32_t);
+      if (RecordSize > Size - End)
+        break;
+      Index[RH.Digest.Lo] = End;
+      Written.insert(RH.Digest);
+      End += RecordSize;
+    }
+  }
+
+  memcpy(FH.Magic, kFeatureCacheMagic, sizeof(FH.Magic));
+  FH.Version = kFeatureCacheVersion;
+  FH.Reserved = 0;
+  FH.Key = Key;
+  bool Ok = true;
+  if (End) {
+    // Truncated: the lock keeps the other processes from appending meanwhile.
+    if (End < Size)
+      Ok = !ftruncate(Fd, End);
+  } else if (!Size) {
+    Ok = write(Fd, &FH, sizeof(FH)) == (ssize_t)sizeof(FH);
+  } else {
+    // Stale: the processes that have it mapped keep their copy.
+    if (MapSize)
+      munmap(const_cast<uint8_t *>(Data), MapSize);
+    Data = nullptr;
+    MapSize = 0;
+    std::string TmpPath = Path + ".tmp." + std::to_string(GetPid());
+    FILE *Tmp = fopen(TmpPath.c_str(), "wb");
+    Ok = Tmp && fwrite(&FH, sizeof(FH), 1, Tmp) == 1;
+    if (Tmp)
+      Ok &= !fclose(Tmp);
+    int NewFd = -1;
+    if (Ok && !std::rename(TmpPath.c_str(), Path.c_str()))
+      NewFd = open(Path.c_str(), O_RDWR | O_APPEND);
+    else
+      RemoveFile(TmpPath);
+    close(Fd);  // Releases the lock of the old file.
+    Fd = NewFd;
+    return Fd >= 0;
+  }
+  flock(Fd, LOCK_UN);
+  return Ok;
+}
+
+#else
+
+// TODO: implement for other platforms.
+FeatureCache::~FeatureCache() {}
+
+bool FeatureCache::Open(const std::string &Path, const UnitDigest &Key) {
+  return false;
+}
+
+#endif  // LIBFUZZER_POSIX
+
+bool FeatureCache::Lookup(const UnitDigest &D, size_t Size,
+                          Vector<uint32_t> *Features) const {
+  auto It = Index.find(D.Lo);
+  if (It == Index.end())
+    return false;
+  RecordHeader RH;
+  memcpy(&RH, Data + It->second, sizeof(RH));
+  if (RH.Digest != D || RH.Size != Size)
+    return false;
+  Features->resize(RH.NumFeatures);
+  memcpy(Features->data(), Data + It->second + sizeof(RH),
+         RH.NumFeatures * sizeof(uint32_t));
+  return true;
+}
+
+void FeatureCache::Append(const UnitDigest &D, size_t Size,
+                          const Vector<uint32_t> &Features) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  if (Fd < 0 || !Written.insert(D))
+    return;
+  RecordHeader RH;
+  RH.Digest = D;
+  RH.Size = Size;
+  RH.NumFeatures = Features.size();
+  Unit Record(sizeof(RH) + Features.size() * sizeof(uint32_t));
+  memcpy(Record.data(), &RH, sizeof(RH));
+  memcpy(Record.data() + sizeof(RH), Features.data(),
+         Features.size() * sizeof(uint32_t));
+#if LIBFUZZER_POSIX
+  if (flock(Fd, LOCK_EX))
+    return;
+  if (write(Fd, Record.data(), Record.size()) != (ssize_t)Record.size())
+    Printf("WARNING: failed to append to the feature cache\n");
+  flock(Fd, LOCK_UN);
+#endif
+}
+
+void FeatureCache::AppendAll(const FeatureCache &Other) {
+  Vector<uint32_t> Features;
+  for (auto &It : Other.Index) {
+    RecordHeader RH;
+    memcpy(&RH, Other.Data + It.second, sizeof(RH));
+    Features.resize(RH.NumFeatures);
+    memcpy(Features.data(), Other.Data + It.second + sizeof(RH),
+           RH.NumFeatures * sizeof(uint32_t));
+    Append(RH.Digest, RH.Size, Features);
+  }
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,69 @@
+//===- FuzzerFeatureCache.h - Internal header for the Fuzzer ----*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::FeatureCache: the features of the corpus inputs, kept in a file
+// across runs so that a restart does not have to execute them again.
+//
+// The file starts with a 32-byte header (kFeatureCacheMagic, a version, the
+// key of the build), followed by records, all in host byte order:
+//   UnitDigest Digest;     // Of the input.
+//   uint32_t Size;         // Of the input.
+//   uint32_t NumFeatures;
+//   NumFeatures uint32_t features, sorted.
+// A truncated last record (e.g. after a crash) is dropped when the file is
+// opened. The file is mapped and shared by all the processes using it; it is
+// only changed under an exclusive flock() on Posix.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_FEATURE_CACHE_H
+#define LLVM_FUZZER_FEATURE_CACHE_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerDigest.h"
+#include <mutex>
+#include <unordered_map>
+
+namespace fuzzer {
+
+static const char kFeatureCacheMagic[8] = {'L', 'F', 'F', 'E',
+                                           'A', 'T', 'C', 'H'};
+
+class FeatureCache {
+ public:
+  ~FeatureCache();
+  // Loads the cache at Path, or creates it. Key identifies the build and
+  // the options the features depend on; a cache written with another key
+  // is stale and is emptied.
+  bool Open(const std::string &Path, const UnitDigest &Key);
+  size_t size() const { return Index.size(); }
+
+  // Gets the features of the input with digest D and Size bytes, if they
+  // were in the file when it was opened.
+  bool Lookup(const UnitDigest &D, size_t Size,
+              Vector<uint32_t> *Features) const;
+  // Appends a record unless D is already known. Thread-safe; the records
+  // are written with one locked write each, so several processes may share
+  // the file.
+  void Append(const UnitDigest &D, size_t Size,
+              const Vector<uint32_t> &Features);
+  // Appends the records that Other had when it was opened.
+  void AppendAll(const FeatureCache &Other);
+
+ private:
+  const uint8_t *Data = nullptr;  // The file as it was opened, mapped.
+  size_t MapSize = 0;
+  // Digest.Lo -> offset of the record in Data.
+  std::unordered_map<uint64_t, size_t> Index;
+  DigestSet Written;
+  int Fd = -1;
+  std::mutex Mutex;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_FEATURE_CACHE_H
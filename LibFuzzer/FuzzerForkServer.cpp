@@ -0,0 +1,321 @@
+//===- FuzzerForkServer.cpp - Fork server ---------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Fork server.
+// The server is forked off the fuzzer process right after the target has been
+// initialized. The client sends it commands over a unix socket, each one
+// together with one end of a result socket pair. For every command the server
+// forks a waiter process, which forks the child that runs FuzzerDriver with
+// the command's arguments and writes its pid to the result socket. Once the
+// child exited, the waiter says so and waits for the client to acknowledge
+// before it reaps the child and writes its wait status: until then the client
+// may kill the pid, which can not be reused.
+// Waiters let the server serve several commands at once (e.g. -workers=N)
+// without waiting for any of them itself.
+//===----------------------------------------------------------------------===//
+#include "FuzzerForkServer.h"
+#include "FuzzerDefs.h"
+#if LIBFUZZER_POSIX
+#include "FuzzerIO.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace fuzzer {
+
+// Client end of the control socket, -1 when there is no fork server.
+static int ControlFd = -1;
+static std::mutex ControlMutex;
+static std::string *ServerProgName;
+static bool ForkServerChild;
+
+static bool SendAll(int Fd, const void *Data, size_t Size) {
+  const char *P = static_cast<const char *>(Data);
+  while (Size) {
+    ssize_t Res = send(Fd, P, Size, MSG_NOSIGNAL);
+    if (Res < 0 && errno == EINTR) continue;
+    if (Res <= 0) return false;
+    P += Res;
+    Size -= Res;
+  }
+  return true;
+}
+
+static bool ReadAll(int Fd, void *Data, size_t Size) {
+  char *P = static_cast<char *>(Data);
+  while (Size) {
+    ssize_t Res = read(Fd, P, Size);
+    if (Res < 0 && errno == EINTR) continue;
+    if (Res <= 0) return false;
+    P += Res;
+    Size -= Res;
+  }
+  return true;
+}
+
+// A request is a list of strings: the output file, "1" if stderr goes to the
+// output too, then the arguments. Each string is prefixed by its length.
+static void AppendString(Vector<char> *Buf, const std::string &S) {
+  uint32_t Size = S.size();
+  Buf->insert(Buf->end(), reinterpret_cast<const char *>(&Size),
+              reinterpret_cast<const char *>(&Size) + sizeof(Size));
+  Buf->insert(Buf->end(), S.begin(), S.end());
+}
+
+static bool ParseStrings(const Vector<char> &Buf, Vector<std::string> *Res) {
+  size_t Pos = 0;
+  while (Pos < Buf.size()) {
+    uint32_t Size;
+    if (Buf.size() - Pos < sizeof(Size)) return false;
+    memcpy(&Size, Buf.data() + Pos, sizeof(Size));
+    Pos += sizeof(Size);
+    if (Buf.size() - Pos < Size) return false;
+    Res->push_back(std::string(Buf.data() + Pos, Size));
+    Pos += Size;
+  }
+  return Res->size() >= 3;
+}
+
+// Sends the payload size along with ResultFd, then the payload.
+static bool SendRequest(int Fd, const Vector<char> &Payload, int ResultFd) {
+  uint32_t Size = Payload.size();
+  struct iovec IOV = {&Size, sizeof(Size)};
+  char Control[CMSG_SPACE(sizeof(int))];
+  memset(Control, 0, sizeof(Control));
+  struct msghdr Msg;
+  memset(&Msg, 0, sizeof(Msg));
+  Msg.msg_iov = &IOV;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+  struct cmsghdr *CMsg = CMSG_FIRSTHDR(&Msg);
+  CMsg->cmsg_level = SOL_SOCKET;
+  CMsg->cmsg_type = SCM_RIGHTS;
+  CMsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(CMsg), &ResultFd, sizeof(int));
+  ssize_t Res;
+  while ((Res = sendmsg(Fd, &Msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {}
+  if (Res <= 0) return false;
+  if (Res < (ssize_t)sizeof(Size) &&
+      !SendAll(Fd, reinterpret_cast<char *>(&Size) + Res, sizeof(Size) - Res))
+    return false;
+  return SendAll(Fd, Payload.data(), Payload.size());
+}
+
+static bool ReceiveRequest(int Fd, Vector<char> *Payload, int *ResultFd) {
+  uint32_t Size;
+  struct iovec IOV = {&Size, sizeof(Size)};
+  char Control[CMSG_SPACE(sizeof(int))];
+  struct msghdr Msg;
+  memset(&Msg, 0, sizeof(Msg));
+  Msg.msg_iov = &IOV;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+  ssize_t Res;
+  while ((Res = recvmsg(Fd, &Msg, 0)) < 0 && errno == EINTR) {}
+  if (Res <= 0) return false;
+  struct cmsghdr *CMsg = CMSG_FIRSTHDR(&Msg);
+  if (!CMsg || CMsg->cmsg_level != SOL_SOCKET ||
+      CMsg->cmsg_type != SCM_RIGHTS)
+    return false;
+  memcpy(ResultFd, CMSG_DATA(CMsg), sizeof(int));
+  if (Res < (ssize_t)sizeof(Size) &&
+      !ReadAll(Fd, reinterpret_cast<char *>(&Size) + Res, sizeof(Size) - Res))
+    return false;
+  Payload->resize(Size);
+  return ReadAll(Fd, Payload->data(), Size);
+}
+
+// Runs in the child forked for a request: sets up the output redirection
+// the way the shell would and enters FuzzerDriver.
+static void RunRequestInChild(const Vector<std::string> &Strings,
+                              UserCallback Callback) {
+  ForkServerChild = true;
+  const std::string &OutputFile = Strings[0];
+  if (!OutputFile.empty()) {
+    int OutFd = open(OutputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (OutFd < 0)
+      _Exit(1);
+    dup2(OutFd, STDOUT_FILENO);
+    close(OutFd);
+  }
+  if (Strings[1] == "1")
+    dup2(STDOUT_FILENO, STDERR_FILENO);
+  int Argc = Strings.size() - 2;
+  char **Argv = new char *[Argc + 1];
+  for (int i = 0; i < Argc; i++)
+    Argv[i] = strdup(Strings[i + 2].c_str());
+  Argv[Argc] = nullptr;
+  exit(FuzzerDriver(&Argc, &Argv, Callback));
+}
+
+static void ServeRequest(const Vector<std::string> &Strings, int ResultFd,
+                         UserCallback Callback) {
+  signal(SIGCHLD, SIG_DFL);
+  pid_t Pid = fork();
+  if (Pid == 0) {
+    close(ResultFd);
+    RunRequestInChild(Strings, Callback);
+  }
+  int32_t ChildPid = Pid > 0 ? Pid : 0;
+  if (!SendAll(ResultFd, &ChildPid, sizeof(ChildPid)))
+    _Exit(1);
+  int Status = -1;
+  if (Pid > 0) {
+    siginfo_t Info;
+    while (waitid(P_PID, Pid, &Info, WEXITED | WNOWAIT) < 0 &&
+           errno == EINTR) {}
+    char Exited = 0, Ack;
+    // The client closing the socket acknowledges too.
+    if (SendAll(ResultFd, &Exited, 1))
+      ReadAll(ResultFd, &Ack, 1);
+    while (waitpid(Pid, &Status, 0) < 0 && errno == EINTR) {}
+  }
+  if (!SendAll(ResultFd, &Status, sizeof(Status)))
+    _Exit(1);
+  _Exit(0);
+}
+
+static void RunForkServer(int Fd, UserCallback Callback) {
+  // Let the kernel reap the waiters.
+  signal(SIGCHLD, SIG_IGN);
+  while (true) {
+    Vector<char> Payload;
+    int ResultFd = -1;
+    if (!ReceiveRequest(Fd, &Payload, &ResultFd))
+      _Exit(0);  // The fuzzer process is gone.
+    Vector<std::string> Strings;
+    if (ParseStrings(Payload, &Strings)) {
+      pid_t Pid = fork();
+      if (Pid == 0) {
+        close(Fd);
+        ServeRequest(Strings, ResultFd, Callback);
+      }
+    }
+    // Without a waiter the client reads EOF from the result socket and gives
+    // up.
+    close(ResultFd);
+  }
+}
+
+bool StartForkServer(const std::string &ProgName, UserCallback Callback) {
+  assert(ControlFd < 0);
+  int Fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, Fds))
+    return false;
+#ifdef SO_NOSIGPIPE
+  int One = 1;
+  setsockopt(Fds[0], SOL_SOCKET, SO_NOSIGPIPE, &One, sizeof(One));
+#endif
+  fflush(stdout);
+  fflush(stderr);
+  pid_t Pid = fork();
+  if (Pid < 0) {
+    close(Fds[0]);
+    close(Fds[1]);
+    return false;
+  }
+  if (Pid == 0) {
+    close(Fds[0]);
+    RunForkServer(Fds[1], Callback);
+  }
+  close(Fds[1]);
+  ControlFd = Fds[0];
+  ServerProgName = new std::string(ProgName);
+  return true;
+}
+
+bool ExecuteCommandInForkServer(
+    const Command &Cmd, int *Status,
+    const std::function<void(unsigned long Pid)> &OnStart) {
+  auto &Args = Cmd.getArguments();
+  if (!ServerProgName || Args.empty() || Args[0] != *ServerProgName)
+    return false;
+  Vector<char> Payload;
+  AppendString(&Payload, Cmd.hasOutputFile() ? Cmd.getOutputFile() : "");
+  AppendString(&Payload, Cmd.isOutAndErrCombined() ? "1" : "0");
+  for (auto &Arg : Args)
+    AppendString(&Payload, Arg);
+
+  int Fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, Fds))
+    return false;
+#ifdef SO_NOSIGPIPE
+  int One = 1;
+  setsockopt(Fds[0], SOL_SOCKET, SO_NOSIGPIPE, &One, sizeof(One));
+#endif
+  bool Sent = false;
+  {
+    std::lock_guard<std::mutex> Lock(ControlMutex);
+    if (ControlFd >= 0) {
+      Sent = SendRequest(ControlFd, Payload, Fds[1]);
+      if (!Sent) {
+        Printf("WARNING: the fork server is gone, running commands directly\n");
+        close(ControlFd);
+        ControlFd = -1;
+      }
+    }
+  }
+  close(Fds[1]);
+  if (Sent) {
+    int32_t Pid = 0;
+    bool Ok = ReadAll(Fds[0], &Pid, sizeof(Pid));
+    if (Ok && Pid) {
+      if (OnStart)
+        OnStart(Pid);
+      char Exited, Ack = 0;
+      Ok = ReadAll(Fds[0], &Exited, 1);
+      if (OnStart)
+        OnStart(0);
+      Ok = Ok && SendAll(Fds[0], &Ack, 1);
+    }
+    if (!Ok || !ReadAll(Fds[0], Status, sizeof(*Status)))
+      *Status = -1;
+  }
+  close(Fds[0]);
+  return Sent;
+}
+
+bool IsForkServerChild() { return ForkServerChild; }
+
+}  // namespace fuzzer
+
+#else
+
+namespace fuzzer {
+
+// TODO: implement for other platforms.
+bool StartForkServer(const std::string &ProgName, UserCallback Callback) {
+  return false;
+}
+
+bool ExecuteCommandInForkServer(
+    const Command &Cmd, int *Status,
+    const std::function<void(unsigned long Pid)> &OnStart) {
+  return false;
+}
+
+bool IsForkServerChild() { return false; }
+
+}  // namespace fuzzer
+
+#endif  // LIBFUZZER_POSIX
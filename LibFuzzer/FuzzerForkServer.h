@@ -0,0 +1,43 @@
+//===- FuzzerForkServer.h - Internal header for the Fuzzer ------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// The fork server runs the sub-processes of -jobs, -merge, -minimize_crash and
+// -cleanse_crash as forks of an already initialized copy of this process
+// instead of starting them through the shell.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_FORK_SERVER_H
+#define LLVM_FUZZER_FORK_SERVER_H
+
+#include "FuzzerCommand.h"
+#include "FuzzerDefs.h"
+#include <functional>
+
+namespace fuzzer {
+
+// Forks the fork server off the current process, which must have finished
+// initializing the target (LLVMFuzzerInitialize) and must not have started
+// any threads yet. Every request forks the server again and runs
+// FuzzerDriver(Callback) with the request's arguments in the child.
+// Returns false if the fork server is not available.
+bool StartForkServer(const std::string &ProgName, UserCallback Callback);
+
+// Runs Cmd in the fork server and stores its wait status (as returned by
+// system()) in *Status. Returns false if Cmd can not be run by the fork
+// server, in which case the caller should run it some other way.
+// If set, OnStart is called as in ExecuteCommand(Cmd, OnStart).
+bool ExecuteCommandInForkServer(
+    const Command &Cmd, int *Status,
+    const std::function<void(unsigned long Pid)> &OnStart = nullptr);
+
+// True in the processes forked by the fork server to serve a request.
+bool IsForkServerChild();
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_FORK_SERVER_H
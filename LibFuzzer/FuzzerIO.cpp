@@ -12,6 +12,7 @@
 #include "FuzzerIO.h"
 #include "FuzzerDefs.h"
 #include "FuzzerExtFunctions.h"
+#include "FuzzerPackedCorpus.h"
 #include <algorithm>
 #include <cstdarg>
 #include <fstream>
@@ -32,6 +33,9 @@ long GetEpoch(const std::string &Path) {
 
 Unit FileToVector(const std::string &Path, size_t MaxSize, bool ExitOnError) {
   std::ifstream T(Path);
+  Unit Packed;
+  if (!T && ReadPackedCorpusEntry(Path, MaxSize, &Packed))
+    return Packed;
   if (ExitOnError && !T) {
     Printf("No such directory: %s; exiting\n", Path.c_str());
     exit(1);
@@ -71,6 +75,20 @@ void WriteToFile(const Unit &U, const std::string &Path) {
 void ReadDirToVectorOfUnits(const char *Path, Vector<Unit> *V,
                             long *Epoch, size_t MaxSize, bool ExitOnError) {
   long E = Epoch ? *Epoch : 0;
+  if (IsPackedCorpus(Path)) {
+    long PackEpoch = GetEpoch(Path);
+    if (Epoch && E && E >= PackEpoch) return;
+    if (Epoch) *Epoch = PackEpoch;
+    // Opened anew: the entries appended since the last read are needed.
+    PackedCorpus PC;
+    if (!PC.Open(Path)) return;
+    for (auto &En : PC.Entries())
+      if (En.Size)
+        V->push_back(Unit(En.Data,
+                          En.Data + (MaxSize ? std::min(En.Size, MaxSize)
+                                             : En.Size)));
+    return;
+  }
   Vector<std::string> Files;
   ListFilesInDirRecursive(Path, Epoch, &Files, /*TopDir*/true);
   size_t NumLoaded = 0;
@@ -88,11 +106,18 @@ void ReadDirToVectorOfUnits(const char *Path, Vector<Unit> *V,
 
 
 void GetSizedFilesFromDir(const std::string &Dir, Vector<SizedFile> *V) {
+  if (IsPackedCorpus(Dir)) {
+    if (auto PC = GetPackedCorpus(Dir))
+      for (auto &E : PC->Entries())
+        if (E.Size)
+          V->push_back({PC->EntryPath(E), E.Size, E.Data});
+    return;
+  }
   Vector<std::string> Files;
   ListFilesInDirRecursive(Dir, 0, &Files, /*TopDir*/true);
   for (auto &File : Files)
     if (size_t Size = FileSize(File))
-      V->push_back({File, Size});
+      V->push_back({File, Size, nullptr});
 }
 
 std::string DirPlusFile(const std::string &DirPath,
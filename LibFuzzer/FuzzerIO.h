@@ -61,9 +61,11 @@ void ListFilesInDirRecursive(const std::string &Dir, long *Epoch,
 struct SizedFile {
   std::string File;
   size_t Size;
+  const uint8_t *Data;  // Set for the inputs of packed corpora.
   bool operator<(const SizedFile &B) const { return Size < B.Size; }
 };
 
+// Dir may also be a packed corpus, see FuzzerPackedCorpus.h.
 void GetSizedFilesFromDir(const std::string &Dir, Vector<SizedFile> *V);
 
 char GetSeparator();
@@ -76,6 +78,12 @@ int DuplicateFile(int Fd);
 
 void RemoveFile(const std::string &Path);
 
+// Flushes F and asks the OS to put its data on disk.
+void SyncFileToDisk(FILE *F);
+
+// Makes the creation and removal of files in Dir durable, where supported.
+void SyncDirToDisk(const std::string &Dir);
+
 void DiscardOutput(int Fd);
 
 intptr_t GetHandleFromFd(int fd);
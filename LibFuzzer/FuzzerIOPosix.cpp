@@ -16,6 +16,7 @@
 #include <cstdarg>
 #include <cstdio>
 #include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
 #include <iterator>
 #include <libgen.h>
@@ -92,6 +93,18 @@ void RemoveFile(const std::string &Path) {
   unlink(Path.c_str());
 }
 
+void SyncFileToDisk(FILE *F) {
+  fflush(F);
+  fsync(fileno(F));
+}
+
+void SyncDirToDisk(const std::string &Dir) {
+  int Fd = open(Dir.c_str(), O_RDONLY);
+  if (Fd < 0) return;
+  fsync(Fd);
+  close(Fd);
+}
+
 void DiscardOutput(int Fd) {
   FILE* Temp = fopen("/dev/null", "w");
   if (!Temp)
@@ -141,6 +141,14 @@ void RemoveFile(const std::string &Path) {
   _unlink(Path.c_str());
 }
 
+void SyncFileToDisk(FILE *F) {
+  fflush(F);
+  _commit(_fileno(F));
+}
+
+// TODO: directories can not be flushed on Windows.
+void SyncDirToDisk(const std::string &Dir) {}
+
 void DiscardOutput(int Fd) {
   FILE* Temp = fopen("nul", "w");
   if (!Temp)
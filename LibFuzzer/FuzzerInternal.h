@@ -12,18 +12,26 @@
 #ifndef LLVM_FUZZER_INTERNAL_H
 #define LLVM_FUZZER_INTERNAL_H
 
+#include "FuzzerCorpusWatcher.h"
+#include "FuzzerCrashDb.h"
 #include "FuzzerDefs.h"
+#include "FuzzerDigest.h"
 #include "FuzzerExtFunctions.h"
+#include "FuzzerFeatureCache.h"
 #include "FuzzerInterface.h"
 #include "FuzzerOptions.h"
 #include "FuzzerSHA1.h"
+#include "FuzzerSharedCorpus.h"
 #include "FuzzerValueBitMap.h"
+#include "FuzzerWorkerStats.h"
 #include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <climits>
 #include <cstdlib>
+#include <memory>
 #include <string.h>
+#include <thread>
 
 namespace fuzzer {
 
@@ -38,7 +46,17 @@ public:
   void Loop(const Vector<std::string> &CorpusDirs);
   void ReadAndExecuteSeedCorpora(const Vector<std::string> &CorpusDirs);
   void MinimizeCrashLoop(const Unit &U);
+  void StartOutputCorpusWatcher();
   void RereadOutputCorpus(size_t MaxSize);
+  void ReadSharedCorpus();
+  void StartFeatureCache();
+  bool ResumeFromCheckpoint();
+  void WriteCheckpoint();
+  void PublishNewUnit(const uint8_t *Data, size_t Size);
+  void CollectAllFeatures();
+  // Identifies the build and the options the features depend on; false if
+  // the features of this build change from run to run.
+  bool GetBuildKey(UnitDigest *Key);
 
   size_t secondsSinceProcessStartUp() {
     return duration_cast<seconds>(system_clock::now() - ProcessStartTime)
@@ -53,10 +71,38 @@ public:
 
   size_t execPerSec() {
     size_t Seconds = secondsSinceProcessStartUp();
-    return Seconds ? TotalNumberOfRuns / Seconds : 0;
+    return Seconds ? getTotalNumberOfRuns() / Seconds : 0;
   }
 
-  size_t getTotalNumberOfRuns() { return TotalNumberOfRuns; }
+  // Count the runs and the new units of all fuzzing threads.
+  size_t getTotalNumberOfRuns();
+  size_t getTotalNumberOfNewUnitsAdded();
+
+  // -threads=N: T will fuzz in its own thread, sharing the corpus with this.
+  void AddFuzzingThread(Fuzzer *T) { FuzzingThreads.push_back(T); }
+  // The fuzzing thread of this Fuzzer will be pinned to Cpu.
+  void SetCpu(int Cpu) { this->Cpu = Cpu; }
+
+  // -jobs: exchange new units with the other workers through R.
+  void SetSharedCorpus(SharedCorpusRing *R) { SharedCorpus = R; }
+  // Adds U to the corpus if Features (sorted) has features that the corpus
+  // does not have, as if U had been executed. Returns true if U was added.
+  bool AddUnitWithKnownFeatures(const Unit &U,
+                                const Vector<uint32_t> &Features);
+  // -crash_db: bucket the crashes in Db instead of writing an artifact for
+  // every one of them.
+  void SetCrashDb(CrashDb *Db) { Crashes = Db; }
+  // -minimize_crash_fork: the crashes of the candidates are expected, only the
+  // minimized unit is an artifact.
+  void DisableArtifacts() {
+    Options.SaveArtifacts = false;
+    Crashes = nullptr;
+  }
+  // -jobs: report progress to the supervisor in the given slot of T.
+  void SetWorkerStats(WorkerStatsTable *T, size_t Slot) {
+    WorkerStats = T;
+    WorkerSlot = Slot;
+  }
 
   static void StaticAlarmCallback();
   static void StaticCrashSignalCallback();
@@ -67,7 +113,8 @@ public:
 
   void ExecuteCallback(const uint8_t *Data, size_t Size);
   bool RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile = false,
-              InputInfo *II = nullptr, bool *FoundUniqFeatures = nullptr);
+              InputInfo *II = nullptr, bool *FoundUniqFeatures = nullptr,
+              size_t *NumNewFeatures = nullptr);
 
   // Merge Corpora[1:] into Corpora[0].
   void Merge(const Vector<std::string> &Corpora);
@@ -93,35 +140,56 @@ public:
 
 private:
   void AlarmCallback();
+  // 0 if no unit is running.
+  size_t SecondsInCurrentUnit() const;
   void CrashCallback();
   void ExitCallback();
   void MaybeExitGracefully();
+  bool RunInnerMerge(const Command &BaseCmd, const std::string &CFPath,
+                     size_t NumAttempts, const std::string &Name);
+  void CollectInnerFeatureCache(const std::string &CFPath);
   void CrashOnOverwrittenData();
   void InterruptCallback();
   void MutateAndTestOne();
+  void UpdateTmpMaxMutationLen();
+  void StartFuzzingThreads();
+  void StopFuzzingThreads();
+  void FuzzingThreadLoop();
   void PurgeAllocator();
   void ReportNewCoverage(InputInfo *II, const Unit &U);
   void PrintPulseAndReportSlowInput(const uint8_t *Data, size_t Size);
-  void WriteToOutputCorpus(const Unit &U);
-  void WriteUnitToFileWithPrefix(const Unit &U, const char *Prefix);
+  void UpdateWorkerStats();
+  // Sha1, if given, is the precomputed SHA1 of U.
+  void WriteToOutputCorpus(const Unit &U, const uint8_t *Sha1 = nullptr);
+  // Artifacts written on the crash paths must not be Async.
+  void WriteUnitToFileWithPrefix(const Unit &U, const char *Prefix,
+                                 bool Async = false);
   void PrintStats(const char *Where, const char *End = "\n", size_t Units = 0);
   void PrintStatusForNewUnit(const Unit &U, const char *Text);
   void CheckExitOnSrcPosOrItem();
 
   static void StaticDeathCallback();
   void DumpCurrentUnit(const char *Prefix);
+  // Returns false if U has to be written as a regular artifact.
+  bool AddToCrashDb(const Unit &U, const char *Prefix);
   void DeathCallback();
 
   void AllocateCurrentUnitData();
   uint8_t *CurrentUnitData = nullptr;
   std::atomic<size_t> CurrentUnitSize;
   uint8_t BaseSha1[kSHA1NumBytes];  // Checksum of the base unit.
-  bool RunningCB = false;
+  // Read by AlarmCallback of the other fuzzing threads.
+  std::atomic<bool> RunningCB{false};
+  // Where AlarmCallback forwards the alarm when this fuzzer's unit hangs.
+  uintptr_t ThreadHandle = 0;
 
   bool GracefulExitRequested = false;
 
   size_t TotalNumberOfRuns = 0;
-  size_t NumberOfNewUnitsAdded = 0;
+  // Copy of TotalNumberOfRuns readable from other threads.
+  std::atomic<size_t> NumberOfRunsInThisThread;
+  // Read by getTotalNumberOfNewUnitsAdded from other threads.
+  std::atomic<size_t> NumberOfNewUnitsAdded;
 
   size_t LastCorpusUpdateRun = 0;
 
@@ -139,6 +207,33 @@ private:
   system_clock::time_point UnitStartTime, UnitStopTime;
   long TimeOfLongestUnitInSeconds = 0;
   long EpochOfLastReadOfOutputCorpus = 0;
+  // Set if the output corpus can be watched instead of rescanned.
+  std::unique_ptr<CorpusWatcher> OutputCorpusWatcher;
+  // Everything reloaded since the last rescan, executed or not.
+  DigestSet ReloadedDigests;
+  // A packed output corpus is reread from where the last reload stopped.
+  bool PackedOutputCorpus = false;
+  size_t PackedOutputCorpusOffset = 0;
+  // Set after a resume: the watcher did not see what was written meanwhile.
+  bool OutputCorpusNeedsRescan = false;
+  system_clock::time_point LastCheckpoint;
+
+  SharedCorpusRing *SharedCorpus = nullptr;
+  // -feature_cache, shared with the fuzzing threads.
+  std::shared_ptr<FeatureCache> InputFeatureCache;
+  // Only the units found by fuzzing are published to the ring and the
+  // feature cache, not the seeds (the other workers read them too, and
+  // ReadAndExecuteSeedCorpora caches them) nor the units read from the
+  // ring.
+  bool PublishNewUnits = false;
+  Vector<SharedUnit> SharedUnitsTmp;
+  Vector<uint32_t> AllFeaturesTmp;
+
+  CrashDb *Crashes = nullptr;
+
+  WorkerStatsTable *WorkerStats = nullptr;
+  size_t WorkerSlot = 0;
+  system_clock::time_point LastWorkerStatsUpdate;
 
   size_t MaxInputLen = 0;
   size_t MaxMutationLen = 0;
@@ -146,6 +241,10 @@ private:
 
   Vector<uint32_t> UniqFeatureSetTmp;
 
+  Vector<Fuzzer *> FuzzingThreads;
+  int Cpu = -1;
+  Vector<std::thread> FuzzingThreadHandles;
+
   // Need to know our own thread.
   static thread_local bool IsMyThread;
 };
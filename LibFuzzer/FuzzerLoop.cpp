@@ -9,11 +9,13 @@
 // Fuzzer's main loop.
 //===----------------------------------------------------------------------===//
 
+#include "FuzzerAsyncWriter.h"
 #include "FuzzerCorpus.h"
 #include "FuzzerIO.h"
 #include "FuzzerInternal.h"
 #include "FuzzerMutate.h"
 #include "FuzzerRandom.h"
+#include "FuzzerSeedLoader.h"
 #include "FuzzerShmem.h"
 #include "FuzzerTracePC.h"
 #include <algorithm>
@@ -38,16 +40,65 @@
 
 namespace fuzzer {
 static const size_t kMaxUnitSizeToPrint = 256;
+// How long the exit paths wait for the queued corpus writes: a normal exit
+// waits for all of them.
+static const int kExitDrainTimeoutMs = -1;
+static const int kCrashDrainTimeoutMs = 1000;
+// Bounds the memory of Fuzzer::ReloadedDigests.
+static const size_t kMaxReloadedDigests = 1 << 18;
 
 thread_local bool Fuzzer::IsMyThread;
 
 SharedMemoryRegion SMR;
 
-// Only one Fuzzer per process.
+// Only one main Fuzzer per process. With -threads=N the other fuzzing threads
+// run Fuzzers of their own, see StartFuzzingThreads().
 static Fuzzer *F;
 
+// The Fuzzer of the current fuzzing thread, or null if it is not one of the
+// -threads=N fuzzing threads.
+static thread_local Fuzzer *ThisThreadFuzzer;
+
+// The Fuzzer to report to from callbacks that may run in any thread.
+static Fuzzer *CurrentFuzzer() {
+  return ThisThreadFuzzer ? ThisThreadFuzzer : F;
+}
+
+// Set before the -threads=N fuzzing threads are started.
+static bool MultiThreaded;
+static std::atomic<bool> FuzzingThreadsShouldStop;
+static std::mutex CorpusMutex;
+
+// Serializes accesses to the shared InputCorpus, its feature tables and
+// TPC's observed PCs between fuzzing threads. No-op with one thread.
+class CorpusLock {
+public:
+  CorpusLock() : Locked(MultiThreaded) {
+    if (Locked)
+      CorpusMutex.lock();
+  }
+  ~CorpusLock() { Unlock(); }
+  void Lock() {
+    if (MultiThreaded && !Locked) {
+      CorpusMutex.lock();
+      Locked = true;
+    }
+  }
+  void Unlock() {
+    if (Locked)
+      CorpusMutex.unlock();
+    Locked = false;
+  }
+
+private:
+  bool Locked;
+};
+
 // Leak detection is expensive, so we first check if there were more mallocs
 // than frees (using the sanitizer malloc hooks) and only then try to call lsan.
+// The counters and the trace level are per thread: only the thread running
+// the unit is traced, not e.g. the seed loader threads that allocate
+// meanwhile.
 struct MallocFreeTracer {
   void Start(int TraceLevel) {
     this->TraceLevel = TraceLevel;
@@ -59,22 +110,25 @@ struct MallocFreeTracer {
   // Returns true if there were more mallocs than frees.
   bool Stop() {
     if (TraceLevel)
-      Printf("MallocFreeTracer: STOP %zd %zd (%s)\n", Mallocs.load(),
-             Frees.load(), Mallocs == Frees ? "same" : "DIFFERENT");
+      Printf("MallocFreeTracer: STOP %zd %zd (%s)\n", Mallocs, Frees,
+             Mallocs == Frees ? "same" : "DIFFERENT");
     bool Result = Mallocs > Frees;
     Mallocs = 0;
     Frees = 0;
     TraceLevel = 0;
     return Result;
   }
-  std::atomic<size_t> Mallocs;
-  std::atomic<size_t> Frees;
-  int TraceLevel = 0;
+  static thread_local size_t Mallocs;
+  static thread_local size_t Frees;
+  static thread_local int TraceLevel;
 
   std::recursive_mutex TraceMutex;
   bool TraceDisabled = false;
 };
 
+thread_local size_t MallocFreeTracer::Mallocs;
+thread_local size_t MallocFreeTracer::Frees;
+thread_local int MallocFreeTracer::TraceLevel;
 static MallocFreeTracer AllocTracer;
 
 // Locks printing and avoids nested hooks triggered from mallocs/frees in
@@ -98,7 +152,7 @@ private:
 ATTRIBUTE_NO_SANITIZE_MEMORY
 void MallocHook(const volatile void *ptr, size_t size) {
   size_t N = AllocTracer.Mallocs++;
-  F->HandleMalloc(size);
+  CurrentFuzzer()->HandleMalloc(size);
   if (int TraceLevel = AllocTracer.TraceLevel) {
     TraceLock Lock;
     if (Lock.IsDisabled())
@@ -140,27 +194,38 @@ void Fuzzer::HandleMalloc(size_t Size) {
 Fuzzer::Fuzzer(UserCallback CB, InputCorpus &Corpus, MutationDispatcher &MD,
                FuzzingOptions Options)
     : CB(CB), Corpus(Corpus), MD(MD), Options(Options) {
+  MaxInputLen = MaxMutationLen = Options.MaxLen;
+  TmpMaxMutationLen = Max(size_t(4), Corpus.MaxInputSize());
+  AllocateCurrentUnitData();
+  CurrentUnitSize = 0;
+  NumberOfRunsInThisThread = 0;
+  NumberOfNewUnitsAdded = 0;
+  memset(BaseSha1, 0, sizeof(BaseSha1));
+  if (F)
+    return; // A -threads=N fuzzer, the process-wide setup is done by F.
   if (EF->__sanitizer_set_death_callback)
     EF->__sanitizer_set_death_callback(StaticDeathCallback);
-  assert(!F);
   F = this;
   TPC.ResetMaps();
   IsMyThread = true;
+  ThreadHandle = GetCurrentThreadHandle();
   if (Options.DetectLeaks && EF->__sanitizer_install_malloc_and_free_hooks)
     EF->__sanitizer_install_malloc_and_free_hooks(MallocHook, FreeHook);
   TPC.SetUseCounters(Options.UseCounters);
   TPC.SetUseValueProfile(Options.UseValueProfile);
   TPC.SetUseClangCoverage(Options.UseClangCoverage);
+  // Custom mutators run instrumented code between CollectFeatures and the
+  // next ResetMaps, the dirty list would miss what they write.
+  TPC.SetUseSparseReset(Options.SparseReset && !EF->LLVMFuzzerCustomMutator &&
+                        !EF->LLVMFuzzerCustomCrossOver);
 
   if (Options.Verbosity)
     TPC.PrintModuleInfo();
-  if (!Options.OutputCorpus.empty() && Options.ReloadIntervalSec)
+  if (!Options.OutputCorpus.empty() && Options.ReloadIntervalSec) {
     EpochOfLastReadOfOutputCorpus = GetEpoch(Options.OutputCorpus);
-  MaxInputLen = MaxMutationLen = Options.MaxLen;
-  TmpMaxMutationLen = Max(size_t(4), Corpus.MaxInputSize());
-  AllocateCurrentUnitData();
-  CurrentUnitSize = 0;
-  memset(BaseSha1, 0, sizeof(BaseSha1));
+    if ((PackedOutputCorpus = IsPackedCorpus(Options.OutputCorpus)))
+      PackedOutputCorpusOffset = FileSize(Options.OutputCorpus);
+  }
 }
 
 Fuzzer::~Fuzzer() {}
@@ -173,7 +238,7 @@ void Fuzzer::AllocateCurrentUnitData() {
 
 void Fuzzer::StaticDeathCallback() {
   assert(F);
-  F->DeathCallback();
+  CurrentFuzzer()->DeathCallback();
 }
 
 void Fuzzer::DumpCurrentUnit(const char *Prefix) {
@@ -186,8 +251,38 @@ void Fuzzer::DumpCurrentUnit(const char *Prefix) {
     PrintHexArray(CurrentUnitData, UnitSize, "\n");
     PrintASCII(CurrentUnitData, UnitSize, "\n");
   }
-  WriteUnitToFileWithPrefix({CurrentUnitData, CurrentUnitData + UnitSize},
-                            Prefix);
+  Unit U(CurrentUnitData, CurrentUnitData + UnitSize);
+  if (!AddToCrashDb(U, Prefix))
+    WriteUnitToFileWithPrefix(U, Prefix);
+  // Give the corpus files queued before the crash a chance to be written.
+  DrainAsyncWriter(kCrashDrainTimeoutMs);
+}
+
+bool Fuzzer::AddToCrashDb(const Unit &U, const char *Prefix) {
+  if (!Crashes || !Options.SaveArtifacts ||
+      !Options.ExactArtifactPath.empty() ||
+      !EF->__sanitizer_print_stack_trace)
+    return false;
+  // Leaks, OOMs, etc. are not found where they are reported.
+  if (strcmp(Prefix, "crash-") && strcmp(Prefix, "timeout-"))
+    return false;
+  auto Trace = CaptureStderr(EF->__sanitizer_print_stack_trace);
+  auto Stack = NormalizeStackTrace(Trace, kCrashStackFrames);
+  if (Stack.empty())
+    return false;
+  CrashBucket B;
+  bool Saved;
+  if (!Crashes->Add(Prefix, Stack, U, &B, &Saved)) {
+    Printf("WARNING: failed to add the crash to %s\n",
+           Crashes->GetDir().c_str());
+    return false;
+  }
+  Printf("INFO: crash bucket %s: %zd crashes, reproducer: %s (%zd bytes)%s\n",
+         B.Name.c_str(), B.NumCrashes, B.ReproPath.c_str(), B.ReproSize,
+         Saved ? "" : "; this input is a duplicate, not saved");
+  if (Saved && U.size() <= kMaxUnitSizeToPrint)
+    Printf("Base64: %s\n", Base64(U).c_str());
+  return true;
 }
 
 NO_SANITIZE_MEMORY
@@ -198,17 +293,17 @@ void Fuzzer::DeathCallback() {
 
 void Fuzzer::StaticAlarmCallback() {
   assert(F);
-  F->AlarmCallback();
+  CurrentFuzzer()->AlarmCallback();
 }
 
 void Fuzzer::StaticCrashSignalCallback() {
   assert(F);
-  F->CrashCallback();
+  CurrentFuzzer()->CrashCallback();
 }
 
 void Fuzzer::StaticExitCallback() {
   assert(F);
-  F->ExitCallback();
+  CurrentFuzzer()->ExitCallback();
 }
 
 void Fuzzer::StaticInterruptCallback() {
@@ -253,15 +348,17 @@ void Fuzzer::ExitCallback() {
 }
 
 void Fuzzer::MaybeExitGracefully() {
-  if (!GracefulExitRequested) return;
+  if (!F->GracefulExitRequested) return;
   Printf("==%lu== INFO: libFuzzer: exiting as requested\n", GetPid());
   PrintFinalStats();
+  DrainAsyncWriter(kExitDrainTimeoutMs);
   _Exit(0);
 }
 
 void Fuzzer::InterruptCallback() {
   Printf("==%lu== libFuzzer: run interrupted; exiting\n", GetPid());
   PrintFinalStats();
+  DrainAsyncWriter(kCrashDrainTimeoutMs);
   _Exit(0); // Stop right now, don't perform any at-exit actions.
 }
 
@@ -273,12 +370,22 @@ void Fuzzer::AlarmCallback() {
   if (!InFuzzingThread())
     return;
 #endif
-  if (!RunningCB)
-    return; // We have not started running units yet.
-  size_t Seconds =
-      duration_cast<seconds>(system_clock::now() - UnitStartTime).count();
-  if (Seconds == 0)
+  size_t Seconds = SecondsInCurrentUnit();
+  if (MultiThreaded && Seconds < (size_t)Options.UnitTimeoutSec) {
+    // The alarm lands in any thread, pass it on to the thread that hangs so
+    // that its unit and stack are the ones reported.
+    Fuzzer *Hung = nullptr;
+    if (F->SecondsInCurrentUnit() >= (size_t)Options.UnitTimeoutSec)
+      Hung = F;
+    for (auto *T : F->FuzzingThreads)
+      if (!Hung && T->SecondsInCurrentUnit() >= (size_t)Options.UnitTimeoutSec)
+        Hung = T;
+    if (Hung && Hung != this && !SendAlarmToThread(Hung->ThreadHandle))
+      Hung->AlarmCallback();
     return;
+  }
+  if (Seconds == 0)
+    return; // We have not started running units yet.
   if (Options.Verbosity >= 2)
     Printf("AlarmCallback %zd\n", Seconds);
   if (Seconds >= (size_t)Options.UnitTimeoutSec) {
@@ -296,6 +403,12 @@ void Fuzzer::AlarmCallback() {
   }
 }
 
+size_t Fuzzer::SecondsInCurrentUnit() const {
+  if (!RunningCB)
+    return 0;
+  return duration_cast<seconds>(system_clock::now() - UnitStartTime).count();
+}
+
 void Fuzzer::RssLimitCallback() {
   Printf(
       "==%lu== ERROR: libFuzzer: out-of-memory (used: %zdMb; limit: %zdMb)\n",
@@ -313,7 +426,7 @@ void Fuzzer::PrintStats(const char *Where, const char *End, size_t Units) {
   size_t ExecPerSec = execPerSec();
   if (!Options.Verbosity)
     return;
-  Printf("#%zd\t%s", TotalNumberOfRuns, Where);
+  Printf("#%zd\t%s", getTotalNumberOfRuns(), Where);
   if (size_t N = TPC.GetTotalPCCoverage())
     Printf(" cov: %zd", N);
   if (size_t N = Corpus.NumFeatures())
@@ -339,6 +452,20 @@ void Fuzzer::PrintStats(const char *Where, const char *End, size_t Units) {
   Printf("%s", End);
 }
 
+// Like PrintStats, expects the corpus lock to be held.
+void Fuzzer::UpdateWorkerStats() {
+  WorkerStatus S;
+  S.Pid = GetPid();
+  S.Runs = getTotalNumberOfRuns();
+  S.Coverage = TPC.GetTotalPCCoverage();
+  S.Features = Corpus.NumFeatures();
+  S.CorpusUnits = Corpus.NumActiveUnits();
+  S.CorpusBytes = Corpus.SizeInBytes();
+  S.PeakRssMb = GetPeakRSSMb();
+  WorkerStats->Write(WorkerSlot, S);
+  LastWorkerStatsUpdate = system_clock::now();
+}
+
 void Fuzzer::PrintFinalStats() {
   if (Options.PrintCoverage)
     TPC.PrintCoverage();
@@ -346,12 +473,15 @@ void Fuzzer::PrintFinalStats() {
     TPC.DumpCoverage();
   if (Options.PrintCorpusStats)
     Corpus.PrintStats();
+  if (Options.PrintMutatorStats)
+    MD.PrintMutatorStats();
   if (!Options.PrintFinalStats)
     return;
   size_t ExecPerSec = execPerSec();
-  Printf("stat::number_of_executed_units: %zd\n", TotalNumberOfRuns);
+  Printf("stat::number_of_executed_units: %zd\n", getTotalNumberOfRuns());
   Printf("stat::average_exec_per_sec:     %zd\n", ExecPerSec);
-  Printf("stat::new_units_added:          %zd\n", NumberOfNewUnitsAdded);
+  Printf("stat::new_units_added:          %zd\n",
+         getTotalNumberOfNewUnitsAdded());
   Printf("stat::slowest_unit_time_sec:    %zd\n", TimeOfLongestUnitInSeconds);
   Printf("stat::peak_rss_mb:              %zd\n", GetPeakRSSMb());
 }
@@ -373,6 +503,9 @@ void Fuzzer::SetMaxMutationLen(size_t MaxMutationLen) {
 }
 
 void Fuzzer::CheckExitOnSrcPosOrItem() {
+  if (Options.ExitOnSrcPos.empty() && Options.ExitOnItem.empty())
+    return;
+  CorpusLock Lock;
   if (!Options.ExitOnSrcPos.empty()) {
     static auto *PCsSet = new Set<uintptr_t>;
     auto HandlePC = [&](uintptr_t PC) {
@@ -382,6 +515,7 @@ void Fuzzer::CheckExitOnSrcPosOrItem() {
       if (Descr.find(Options.ExitOnSrcPos) != std::string::npos) {
         Printf("INFO: found line matching '%s', exiting.\n",
                Options.ExitOnSrcPos.c_str());
+        DrainAsyncWriter(kExitDrainTimeoutMs);
         _Exit(0);
       }
     };
@@ -391,56 +525,290 @@ void Fuzzer::CheckExitOnSrcPosOrItem() {
     if (Corpus.HasUnit(Options.ExitOnItem)) {
       Printf("INFO: found item with checksum '%s', exiting.\n",
              Options.ExitOnItem.c_str());
+      DrainAsyncWriter(kExitDrainTimeoutMs);
       _Exit(0);
     }
   }
 }
 
+void Fuzzer::StartOutputCorpusWatcher() {
+  if (Options.OutputCorpus.empty() || !Options.ReloadIntervalSec ||
+      !Options.WatchCorpus)
+    return;
+  OutputCorpusWatcher.reset(new CorpusWatcher);
+  if (!OutputCorpusWatcher->Start(Options.OutputCorpus))
+    OutputCorpusWatcher.reset();
+  if (Options.Verbosity >= 2)
+    Printf("INFO: %s the corpus dir for new units\n",
+           OutputCorpusWatcher ? "watching" : "rescanning");
+}
+
+bool Fuzzer::GetBuildKey(UnitDigest *Key) {
+  std::string Id = TPC.GetBuildId();
+  if (Id.empty())
+    return false;
+  // The options that change the features of an input.
+  Id += Options.UseCounters ? 'C' : '-';
+  Id += Options.UseValueProfile ? 'V' : '-';
+  Id += Options.UseClangCoverage ? 'L' : '-';
+  *Key = ComputeDigest(reinterpret_cast<const uint8_t *>(Id.data()), Id.size());
+  return true;
+}
+
+void Fuzzer::StartFeatureCache() {
+  if (Options.FeatureCache.empty())
+    return;
+  UnitDigest Key;
+  if (!GetBuildKey(&Key)) {
+    Printf("WARNING: -feature_cache needs -fsanitize-coverage=trace-pc-guard "
+           "or inline-8bit-counters; not using it\n");
+    return;
+  }
+  InputFeatureCache.reset(new FeatureCache);
+  if (!InputFeatureCache->Open(Options.FeatureCache, Key)) {
+    Printf("WARNING: can't open the feature cache %s\n",
+           Options.FeatureCache.c_str());
+    InputFeatureCache.reset();
+    return;
+  }
+  Printf("INFO: feature cache %s: %zd inputs\n", Options.FeatureCache.c_str(),
+         InputFeatureCache->size());
+}
+
+// The payload is the state of this Fuzzer, then of the corpus, of the
+// mutation dispatcher and of TPC.
+void Fuzzer::WriteCheckpoint() {
+  UnitDigest Key;
+  if (!GetBuildKey(&Key))
+    return;
+  CheckpointWriter W;
+  {
+    CorpusLock Lock;
+    W.Varint(MaxInputLen);
+    W.Varint(TmpMaxMutationLen);
+    Corpus.SaveState(&W);
+    MD.SaveState(&W);
+    TPC.SaveState(&W);
+  }
+  if (!WriteCheckpointFile(Options.Checkpoint, Key, W.Data()))
+    Printf("WARNING: failed to write the checkpoint %s\n",
+           Options.Checkpoint.c_str());
+  else if (Options.Verbosity >= 2)
+    Printf("INFO: checkpoint written to %s: %zd bytes\n",
+           Options.Checkpoint.c_str(), W.Data().size());
+  LastCheckpoint = system_clock::now();
+}
+
+bool Fuzzer::ResumeFromCheckpoint() {
+  if (Options.Checkpoint.empty())
+    return false;
+  UnitDigest Key;
+  if (!GetBuildKey(&Key)) {
+    Printf("WARNING: -checkpoint needs -fsanitize-coverage=trace-pc-guard "
+           "or inline-8bit-counters; not using it\n");
+    Options.Checkpoint.clear();
+    return false;
+  }
+  LastCheckpoint = system_clock::now();
+  Unit Payload;
+  if (!ReadCheckpointFile(Options.Checkpoint, Key, &Payload)) {
+    if (IsFile(Options.Checkpoint))
+      Printf("INFO: %s is from another build or damaged, not resuming\n",
+             Options.Checkpoint.c_str());
+    return false;
+  }
+  CheckpointReader R(Payload.data(), Payload.size());
+  size_t SavedMaxInputLen = R.Varint();
+  if (!SavedMaxInputLen || (Options.MaxLen && Options.MaxLen !=
+                                                  SavedMaxInputLen)) {
+    Printf("INFO: %s was written with another -max_len, not resuming\n",
+           Options.Checkpoint.c_str());
+    return false;
+  }
+  if (!Options.MaxLen)
+    SetMaxInputLen(SavedMaxInputLen);
+  TmpMaxMutationLen = Min(MaxMutationLen, (size_t)R.Varint());
+  if (!Corpus.LoadState(&R) || !MD.LoadState(&R) || !TPC.LoadState(&R) ||
+      !R.AtEnd()) {
+    // The payload matched its digest: this checkpoint was written by a
+    // different libFuzzer.
+    Printf("ERROR: can't parse the checkpoint %s\n",
+           Options.Checkpoint.c_str());
+    exit(1);
+  }
+  Printf("INFO: resumed from %s\n", Options.Checkpoint.c_str());
+  // Rescan the output corpus for what was written since.
+  EpochOfLastReadOfOutputCorpus = GetEpoch(Options.Checkpoint);
+  OutputCorpusNeedsRescan = true;
+  PackedOutputCorpusOffset = 0;
+  PrintStats("INITED");
+  return true;
+}
+
 void Fuzzer::RereadOutputCorpus(size_t MaxSize) {
   if (Options.OutputCorpus.empty() || !Options.ReloadIntervalSec)
     return;
   Vector<Unit> AdditionalCorpus;
-  ReadDirToVectorOfUnits(Options.OutputCorpus.c_str(), &AdditionalCorpus,
-                         &EpochOfLastReadOfOutputCorpus, MaxSize,
-                         /*ExitOnError*/ false);
+  Vector<std::string> NewFiles;
+  if (PackedOutputCorpus) {
+    // Only the records appended since the last reload.
+    ReadPackedCorpusTail(Options.OutputCorpus, &PackedOutputCorpusOffset,
+                         MaxSize, &AdditionalCorpus);
+    OutputCorpusNeedsRescan = false;
+  } else if (OutputCorpusWatcher && OutputCorpusWatcher->Poll(&NewFiles) &&
+      !OutputCorpusNeedsRescan) {
+    for (auto &Path : NewFiles) {
+      Unit U = FileToVector(Path, MaxSize, /*ExitOnError*/ false);
+      if (!U.empty())
+        AdditionalCorpus.push_back(std::move(U));
+    }
+  } else {
+    // No watcher, or it lost events: rescan. The rescan skips the files
+    // older than the last one, so their digests are not needed anymore.
+    ReloadedDigests.clear();
+    ReadDirToVectorOfUnits(Options.OutputCorpus.c_str(), &AdditionalCorpus,
+                           &EpochOfLastReadOfOutputCorpus, MaxSize,
+                           /*ExitOnError*/ false);
+    OutputCorpusNeedsRescan = false;
+  }
   if (Options.Verbosity >= 2)
     Printf("Reload: read %zd new units.\n", AdditionalCorpus.size());
+  auto HasUnit = [&](const Unit &U) {
+    CorpusLock Lock;
+    return Corpus.HasUnit(U);
+  };
+  // Without rescans (the watcher, a packed corpus) every unit is read once
+  // anyway, the digests only catch copies of it.
+  if (ReloadedDigests.size() >= kMaxReloadedDigests)
+    ReloadedDigests.clear();
   bool Reloaded = false;
+  // The units of the other workers were published by them already.
+  bool Publish = PublishNewUnits;
+  PublishNewUnits = false;
   for (auto &U : AdditionalCorpus) {
     if (U.size() > MaxSize)
       U.resize(MaxSize);
-    if (!Corpus.HasUnit(U)) {
+    // Most new files are our own or were already copied by another process.
+    if (ReloadedDigests.insert(ComputeDigest(U)) && !HasUnit(U)) {
       if (RunOne(U.data(), U.size())) {
         CheckExitOnSrcPosOrItem();
         Reloaded = true;
       }
     }
   }
-  if (Reloaded)
+  PublishNewUnits = Publish;
+  if (Reloaded) {
+    CorpusLock Lock;
     PrintStats("RELOAD");
+  }
+}
+
+bool Fuzzer::AddUnitWithKnownFeatures(const Unit &U,
+                                      const Vector<uint32_t> &Features) {
+  CorpusLock Lock;
+  if (U.empty() || Corpus.HasUnit(U))
+    return false;
+  UniqFeatureSetTmp.clear();
+  size_t NumUpdatesBefore = Corpus.NumFeatureUpdates();
+  for (auto Feature : Features) {
+    if (Options.UseFeatureFrequency)
+      Corpus.UpdateFeatureFrequency(Feature);
+    if (Corpus.AddFeature(Feature, U.size(), Options.Shrink))
+      UniqFeatureSetTmp.push_back(Feature);
+  }
+  size_t NumNewFeatures = Corpus.NumFeatureUpdates() - NumUpdatesBefore;
+  if (!NumNewFeatures)
+    return false;
+  TPC.UpdateObservedPCs(Features);
+  Corpus.AddToCorpus(U, NumNewFeatures, /*MayDeleteFile*/ false,
+                     UniqFeatureSetTmp);
+  return true;
+}
+
+// Sorted into AllFeaturesTmp. Must be called right after an execution,
+// while the coverage maps still have all of its features.
+void Fuzzer::CollectAllFeatures() {
+  AllFeaturesTmp.clear();
+  TPC.CollectFeatures([&](size_t Feature) {
+    AllFeaturesTmp.push_back(Feature);
+  });
+  std::sort(AllFeaturesTmp.begin(), AllFeaturesTmp.end());
+}
+
+// Called from RunOne, which holds the corpus lock, right after U was
+// executed.
+void Fuzzer::PublishNewUnit(const uint8_t *Data, size_t Size) {
+  bool ToRing = SharedCorpus && Size <= SharedCorpus->MaxUnitSize();
+  if (!ToRing && !InputFeatureCache)
+    return;
+  CollectAllFeatures();
+  if (ToRing)
+    SharedCorpus->Publish(Data, Size, &AllFeaturesTmp);
+  if (InputFeatureCache)
+    InputFeatureCache->Append(ComputeDigest(Data, Size), Size,
+                              AllFeaturesTmp);
+}
+
+void Fuzzer::ReadSharedCorpus() {
+  const size_t kMaxUnitsPerRead = 64;
+  if (!SharedCorpus)
+    return;
+  SharedUnitsTmp.clear();
+  if (!SharedCorpus->Consume(&SharedUnitsTmp, kMaxUnitsPerRead))
+    return;
+  bool Added = false;
+  PublishNewUnits = false;
+  for (auto &SU : SharedUnitsTmp) {
+    if (SU.U.size() > MaxInputLen)
+      continue;
+    if (SU.FeaturesKnown) {
+      Added |= AddUnitWithKnownFeatures(SU.U, SU.Features);
+      continue;
+    }
+    {
+      CorpusLock Lock;
+      if (Corpus.HasUnit(SU.U))
+        continue;
+    }
+    if (RunOne(SU.U.data(), SU.U.size())) {
+      CheckExitOnSrcPosOrItem();
+      Added = true;
+    }
+  }
+  PublishNewUnits = true;
+  if (Added) {
+    CorpusLock Lock;
+    PrintStats("SHARED");
+  }
 }
 
 void Fuzzer::PrintPulseAndReportSlowInput(const uint8_t *Data, size_t Size) {
   auto TimeOfUnit =
       duration_cast<seconds>(UnitStopTime - UnitStartTime).count();
-  if (!(TotalNumberOfRuns & (TotalNumberOfRuns - 1)) &&
+  if (this == F && !(TotalNumberOfRuns & (TotalNumberOfRuns - 1)) &&
       secondsSinceProcessStartUp() >= 2)
     PrintStats("pulse ");
+  if (WorkerStats && this == F &&
+      UnitStopTime - LastWorkerStatsUpdate >= seconds(1))
+    UpdateWorkerStats();
   if (TimeOfUnit > TimeOfLongestUnitInSeconds * 1.1 &&
       TimeOfUnit >= Options.ReportSlowUnits) {
     TimeOfLongestUnitInSeconds = TimeOfUnit;
     Printf("Slowest unit: %zd s:\n", TimeOfLongestUnitInSeconds);
-    WriteUnitToFileWithPrefix({Data, Data + Size}, "slow-unit-");
+    WriteUnitToFileWithPrefix({Data, Data + Size}, "slow-unit-",
+                              /*Async=*/true);
   }
 }
 
 bool Fuzzer::RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile,
-                    InputInfo *II, bool *FoundUniqFeatures) {
+                    InputInfo *II, bool *FoundUniqFeatures,
+                    size_t *NumNewFeatures) {
   if (!Size)
     return false;
 
   ExecuteCallback(Data, Size);
 
+  CorpusLock Lock;
   UniqFeatureSetTmp.clear();
   size_t FoundUniqFeaturesOfII = 0;
   size_t NumUpdatesBefore = Corpus.NumFeatureUpdates();
@@ -450,23 +818,27 @@ bool Fuzzer::RunOne(const uint8_t *Data, size_t Size, bool MayDeleteFile,
     if (Corpus.AddFeature(Feature, Size, Options.Shrink))
       UniqFeatureSetTmp.push_back(Feature);
     if (Options.ReduceInputs && II)
-      if (std::binary_search(II->UniqFeatureSet.begin(),
-                             II->UniqFeatureSet.end(), Feature))
+      if (std::binary_search(II->UniqFeatureSet().begin(),
+                             II->UniqFeatureSet().end(), Feature))
         FoundUniqFeaturesOfII++;
   });
   if (FoundUniqFeatures)
     *FoundUniqFeatures = FoundUniqFeaturesOfII;
   PrintPulseAndReportSlowInput(Data, Size);
-  size_t NumNewFeatures = Corpus.NumFeatureUpdates() - NumUpdatesBefore;
-  if (NumNewFeatures) {
+  size_t NumUpdates = Corpus.NumFeatureUpdates() - NumUpdatesBefore;
+  if (NumNewFeatures)
+    *NumNewFeatures = NumUpdates;
+  if (NumUpdates) {
     TPC.UpdateObservedPCs();
-    Corpus.AddToCorpus({Data, Data + Size}, NumNewFeatures, MayDeleteFile,
+    Corpus.AddToCorpus({Data, Data + Size}, NumUpdates, MayDeleteFile,
                        UniqFeatureSetTmp);
+    if (PublishNewUnits)
+      PublishNewUnit(Data, Size);
     return true;
   }
   if (II && FoundUniqFeaturesOfII &&
-      FoundUniqFeaturesOfII == II->UniqFeatureSet.size() &&
-      II->U.size() > Size) {
+      FoundUniqFeaturesOfII == II->UniqFeatureSet().size() &&
+      II->U().size() > Size) {
     Corpus.Replace(II, {Data, Data + Size});
     return true;
   }
@@ -500,6 +872,7 @@ static bool LooseMemeq(const uint8_t *A, const uint8_t *B, size_t Size) {
 void Fuzzer::ExecuteCallback(const uint8_t *Data, size_t Size) {
   TPC.RecordInitialStack();
   TotalNumberOfRuns++;
+  NumberOfRunsInThisThread.store(TotalNumberOfRuns, std::memory_order_relaxed);
   assert(InFuzzingThread());
   if (SMR.IsClient())
     SMR.WriteByteArray(Data, Size);
@@ -526,24 +899,31 @@ void Fuzzer::ExecuteCallback(const uint8_t *Data, size_t Size) {
   delete[] DataCopy;
 }
 
-void Fuzzer::WriteToOutputCorpus(const Unit &U) {
+void Fuzzer::WriteToOutputCorpus(const Unit &U, const uint8_t *Sha1) {
   if (Options.OnlyASCII)
     assert(IsASCII(U));
   if (Options.OutputCorpus.empty())
     return;
-  std::string Path = DirPlusFile(Options.OutputCorpus, Hash(U));
-  WriteToFile(U, Path);
+  if (Corpus.WriteToPackedOutput(U, Sha1))
+    return;
+  std::string Path = DirPlusFile(Options.OutputCorpus,
+                                 Sha1 ? Sha1ToString(Sha1) : Hash(U));
+  WriteToFileAsync(U, Path);
   if (Options.Verbosity >= 2)
     Printf("Written %zd bytes to %s\n", U.size(), Path.c_str());
 }
 
-void Fuzzer::WriteUnitToFileWithPrefix(const Unit &U, const char *Prefix) {
+void Fuzzer::WriteUnitToFileWithPrefix(const Unit &U, const char *Prefix,
+                                       bool Async) {
   if (!Options.SaveArtifacts)
     return;
   std::string Path = Options.ArtifactPrefix + Prefix + Hash(U);
   if (!Options.ExactArtifactPath.empty())
     Path = Options.ExactArtifactPath; // Overrides ArtifactPrefix.
-  WriteToFile(U, Path);
+  if (Async)
+    WriteToFileAsync(U, Path);
+  else
+    WriteToFile(U, Path);
   Printf("artifact_prefix='%s'; Test unit written to %s\n",
          Options.ArtifactPrefix.c_str(), Path.c_str());
   if (U.size() <= kMaxUnitSizeToPrint)
@@ -562,9 +942,12 @@ void Fuzzer::PrintStatusForNewUnit(const Unit &U, const char *Text) {
 }
 
 void Fuzzer::ReportNewCoverage(InputInfo *II, const Unit &U) {
-  II->NumSuccessfullMutations++;
   MD.RecordSuccessfulMutationSequence();
-  PrintStatusForNewUnit(U, II->Reduced ? "REDUCE" : "NEW   ");
+  {
+    CorpusLock Lock;
+    II->NumSuccessfullMutations++;
+    PrintStatusForNewUnit(U, II->Reduced ? "REDUCE" : "NEW   ");
+  }
   WriteToOutputCorpus(U);
   NumberOfNewUnitsAdded++;
   CheckExitOnSrcPosOrItem(); // Check only after the unit is saved to corpus.
@@ -619,11 +1002,12 @@ void Fuzzer::TryDetectingAMemoryLeak(const uint8_t *Data, size_t Size,
 void Fuzzer::MutateAndTestOne() {
   MD.StartMutationSequence();
 
+  CorpusLock Lock;
   auto &II = Corpus.ChooseUnitToMutate(MD.GetRand());
   if (Options.UseFeatureFrequency)
     Corpus.UpdateFeatureFrequencyScore(&II);
-  const auto &U = II.U;
-  memcpy(BaseSha1, II.Sha1, sizeof(BaseSha1));
+  auto U = II.U();
+  memcpy(BaseSha1, II.GetSha1(), sizeof(BaseSha1));
   assert(CurrentUnitData);
   size_t Size = U.size();
   assert(Size <= MaxInputLen && "Oversized Unit");
@@ -634,21 +1018,24 @@ void Fuzzer::MutateAndTestOne() {
   size_t CurrentMaxMutationLen =
       Min(MaxMutationLen, Max(U.size(), TmpMaxMutationLen));
   assert(CurrentMaxMutationLen > 0);
+  Lock.Unlock();
 
+  size_t NumExecutedMutations = 0;
   for (int i = 0; i < Options.MutateDepth; i++) {
     if (TotalNumberOfRuns >= Options.MaxNumberOfRuns)
       break;
     MaybeExitGracefully();
-    size_t NewSize = 0;
-    NewSize = MD.Mutate(CurrentUnitData, Size, CurrentMaxMutationLen);
+    size_t NewSize = MD.Mutate(CurrentUnitData, Size, CurrentMaxMutationLen);
+    NumExecutedMutations++;
     assert(NewSize > 0 && "Mutator returned empty unit");
     assert(NewSize <= CurrentMaxMutationLen && "Mutator return oversized unit");
     Size = NewSize;
-    II.NumExecutedMutations++;
 
     bool FoundUniqFeatures = false;
+    size_t NumNewFeatures = 0;
     bool NewCov = RunOne(CurrentUnitData, Size, /*MayDeleteFile=*/true, &II,
-                         &FoundUniqFeatures);
+                         &FoundUniqFeatures, &NumNewFeatures);
+    MD.RecordMutationYield(NumNewFeatures);
     TryDetectingAMemoryLeak(CurrentUnitData, Size,
                             /*DuringInitialCorpusExecution*/ false);
     if (NewCov) {
@@ -658,6 +1045,8 @@ void Fuzzer::MutateAndTestOne() {
     if (Options.ReduceDepth && !FoundUniqFeatures)
         break;
   }
+  Lock.Lock();
+  II.NumExecutedMutations += NumExecutedMutations;
 }
 
 void Fuzzer::PurgeAllocator() {
@@ -718,17 +1107,38 @@ void Fuzzer::ReadAndExecuteSeedCorpora(const Vector<std::string> &CorpusDirs) {
       assert(SizedFiles.front().Size <= SizedFiles.back().Size);
     }
 
-    // Load and execute inputs one by one.
-    for (auto &SF : SizedFiles) {
-      auto U = FileToVector(SF.File, MaxInputLen, /*ExitOnError=*/false);
-      assert(U.size() <= MaxInputLen);
-      RunOne(U.data(), U.size());
+    // Load and execute inputs one by one, the loader reading ahead.
+    SeedLoader Loader(SizedFiles, MaxInputLen, Options.SeedLoaderThreads,
+                      Options.SeedPrefetch);
+    const uint8_t *Data;
+    size_t Size;
+    size_t NumCached = 0;
+    while (Loader.Next(&Data, &Size)) {
+      assert(Size <= MaxInputLen);
+      if (InputFeatureCache && Size &&
+          InputFeatureCache->Lookup(Loader.Digest(), Size, &AllFeaturesTmp)) {
+        AddUnitWithKnownFeatures({Data, Data + Size}, AllFeaturesTmp);
+        NumCached++;
+        continue;
+      }
+      RunOne(Data, Size);
+      if (InputFeatureCache && Size) {
+        CollectAllFeatures();
+        InputFeatureCache->Append(Loader.Digest(), Size, AllFeaturesTmp);
+      }
       CheckExitOnSrcPosOrItem();
-      TryDetectingAMemoryLeak(U.data(), U.size(),
+      TryDetectingAMemoryLeak(Data, Size,
                               /*DuringInitialCorpusExecution*/ true);
     }
+    if (Loader.NumDuplicates())
+      Printf("INFO: seed corpus: %zd duplicate inputs skipped\n",
+             Loader.NumDuplicates());
+    if (NumCached)
+      Printf("INFO: seed corpus: %zd inputs not executed, their features "
+             "were cached\n", NumCached);
   }
 
+  Corpus.ComputeMissingSha1s();
   PrintStats("INITED");
   if (Corpus.empty()) {
     Printf("ERROR: no interesting inputs were found. "
@@ -738,47 +1148,133 @@ void Fuzzer::ReadAndExecuteSeedCorpora(const Vector<std::string> &CorpusDirs) {
 }
 
 void Fuzzer::Loop(const Vector<std::string> &CorpusDirs) {
-  ReadAndExecuteSeedCorpora(CorpusDirs);
+  StartOutputCorpusWatcher();
+  StartFeatureCache();
+  if (!ResumeFromCheckpoint())
+    ReadAndExecuteSeedCorpora(CorpusDirs);
   TPC.SetPrintNewPCs(Options.PrintNewCovPcs);
   TPC.SetPrintNewFuncs(Options.PrintNewCovFuncs);
   system_clock::time_point LastCorpusReload = system_clock::now();
-  if (Options.DoCrossOver)
-    MD.SetCorpus(&Corpus);
+  PublishNewUnits = true;
+  StartFuzzingThreads();
   while (true) {
+    ReadSharedCorpus();
     auto Now = system_clock::now();
     if (duration_cast<seconds>(Now - LastCorpusReload).count() >=
         Options.ReloadIntervalSec) {
       RereadOutputCorpus(MaxInputLen);
       LastCorpusReload = system_clock::now();
     }
-    if (TotalNumberOfRuns >= Options.MaxNumberOfRuns)
+    if (!Options.Checkpoint.empty() &&
+        duration_cast<seconds>(Now - LastCheckpoint).count() >=
+            Options.CheckpointIntervalSec)
+      WriteCheckpoint();
+    if (getTotalNumberOfRuns() >= Options.MaxNumberOfRuns)
       break;
     if (TimedOut())
       break;
 
-    // Update TmpMaxMutationLen
-    if (Options.LenControl) {
-      if (TmpMaxMutationLen < MaxMutationLen &&
-          TotalNumberOfRuns - LastCorpusUpdateRun >
-              Options.LenControl * Log(TmpMaxMutationLen)) {
-        TmpMaxMutationLen =
-            Min(MaxMutationLen, TmpMaxMutationLen + Log(TmpMaxMutationLen));
-        LastCorpusUpdateRun = TotalNumberOfRuns;
-      }
-    } else {
-      TmpMaxMutationLen = MaxMutationLen;
-    }
+    UpdateTmpMaxMutationLen();
 
     // Perform several mutations and runs.
     MutateAndTestOne();
 
     PurgeAllocator();
   }
+  StopFuzzingThreads();
+  if (!Options.Checkpoint.empty())
+    WriteCheckpoint();
 
   PrintStats("DONE  ", "\n");
+  if (WorkerStats)
+    UpdateWorkerStats();
   MD.PrintRecommendedDictionary();
 }
 
+void Fuzzer::UpdateTmpMaxMutationLen() {
+  if (Options.LenControl) {
+    if (TmpMaxMutationLen < MaxMutationLen &&
+        TotalNumberOfRuns - LastCorpusUpdateRun >
+            Options.LenControl * Log(TmpMaxMutationLen)) {
+      TmpMaxMutationLen =
+          Min(MaxMutationLen, TmpMaxMutationLen + Log(TmpMaxMutationLen));
+      LastCorpusUpdateRun = TotalNumberOfRuns;
+    }
+  } else {
+    TmpMaxMutationLen = MaxMutationLen;
+  }
+}
+
+size_t Fuzzer::getTotalNumberOfRuns() {
+  if (!MultiThreaded)
+    return TotalNumberOfRuns;
+  size_t Res = F->NumberOfRunsInThisThread.load(std::memory_order_relaxed);
+  for (auto *T : F->FuzzingThreads)
+    Res += T->NumberOfRunsInThisThread.load(std::memory_order_relaxed);
+  return Res;
+}
+
+size_t Fuzzer::getTotalNumberOfNewUnitsAdded() {
+  if (!MultiThreaded)
+    return NumberOfNewUnitsAdded;
+  size_t Res = F->NumberOfNewUnitsAdded.load(std::memory_order_relaxed);
+  for (auto *T : F->FuzzingThreads)
+    Res += T->NumberOfNewUnitsAdded.load(std::memory_order_relaxed);
+  return Res;
+}
+
+void Fuzzer::StartFuzzingThreads() {
+  if (Options.DoCrossOver)
+    MD.SetCorpus(&Corpus);
+  if (FuzzingThreads.empty())
+    return;
+  if (!TPC.SupportsThreadShards()) {
+    Printf("WARNING: -threads=%zd needs -fsanitize-coverage=trace-pc-guard or "
+           "trace-pc; fuzzing in one thread\n", FuzzingThreads.size() + 1);
+    FuzzingThreads.clear();
+    return;
+  }
+  Printf("INFO: fuzzing in %zd threads\n", FuzzingThreads.size() + 1);
+  MultiThreaded = true;
+  if (Options.DoCrossOver)
+    MD.SetCorpus(&Corpus, &CorpusMutex);
+  for (auto *T : FuzzingThreads) {
+    T->MaxInputLen = MaxInputLen;
+    T->MaxMutationLen = MaxMutationLen;
+    T->TmpMaxMutationLen = TmpMaxMutationLen;
+    T->AllocateCurrentUnitData();
+    T->SharedCorpus = SharedCorpus;
+    T->Crashes = Crashes;
+    T->InputFeatureCache = InputFeatureCache;
+    T->PublishNewUnits = PublishNewUnits;
+    if (Options.DoCrossOver)
+      T->MD.SetCorpus(&Corpus, &CorpusMutex);
+    FuzzingThreadHandles.push_back(
+        std::thread([T]() { T->FuzzingThreadLoop(); }));
+  }
+}
+
+void Fuzzer::StopFuzzingThreads() {
+  FuzzingThreadsShouldStop = true;
+  for (auto &T : FuzzingThreadHandles)
+    T.join();
+  FuzzingThreadHandles.clear();
+}
+
+void Fuzzer::FuzzingThreadLoop() {
+  ThisThreadFuzzer = this;
+  IsMyThread = true;
+  ThreadHandle = GetCurrentThreadHandle();
+  // Before the shard is allocated, so that it is on the local node.
+  if (Cpu >= 0 && !PinThreadToCpu(Cpu))
+    Printf("WARNING: could not pin a fuzzing thread to CPU %d\n", Cpu);
+  TPC.CreateThreadShard();
+  while (!FuzzingThreadsShouldStop) {
+    UpdateTmpMaxMutationLen();
+    MutateAndTestOne();
+  }
+}
+
 void Fuzzer::MinimizeCrashLoop(const Unit &U) {
   if (U.size() <= 1)
     return;
@@ -827,7 +1323,7 @@ extern "C" {
 __attribute__((visibility("default"))) size_t
 LLVMFuzzerMutate(uint8_t *Data, size_t Size, size_t MaxSize) {
   assert(fuzzer::F);
-  return fuzzer::F->GetMD().DefaultMutate(Data, Size, MaxSize);
+  return fuzzer::CurrentFuzzer()->GetMD().DefaultMutate(Data, Size, MaxSize);
 }
 
 // Experimental
@@ -9,6 +9,7 @@
 // Merging corpora.
 //===----------------------------------------------------------------------===//
 
+#include "FuzzerCheckpoint.h"
 #include "FuzzerCommand.h"
 #include "FuzzerMerge.h"
 #include "FuzzerIO.h"
@@ -16,10 +17,20 @@
 #include "FuzzerTracePC.h"
 #include "FuzzerUtil.h"
 
+#include <atomic>
+#include <cstring>
 #include <fstream>
 #include <iterator>
+#include <numeric>
 #include <set>
 #include <sstream>
+#include <thread>
+#if LIBFUZZER_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace fuzzer {
 
@@ -28,6 +39,17 @@ bool Merger::Parse(const std::string &Str, bool ParseCoverage) {
   return Parse(SS, ParseCoverage);
 }
 
+// The bytes left to read from IS, or SIZE_MAX if it can not seek.
+static size_t BytesLeft(std::istream &IS) {
+  auto *SB = IS.rdbuf();
+  auto Pos = SB->pubseekoff(0, std::ios::cur, std::ios::in);
+  auto End = SB->pubseekoff(0, std::ios::end, std::ios::in);
+  if (Pos == std::streampos(-1) || End == std::streampos(-1))
+    return SIZE_MAX;
+  SB->pubseekpos(Pos, std::ios::in);
+  return static_cast<size_t>(End - Pos);
+}
+
 void Merger::ParseOrExit(std::istream &IS, bool ParseCoverage) {
   if (!Parse(IS, ParseCoverage)) {
     Printf("MERGE: failed to parse the control file (unexpected error)\n");
@@ -48,6 +70,9 @@ void Merger::ParseOrExit(std::istream &IS, bool ParseCoverage) {
 // STARTED 2 567
 // DONE 2 8 9
 bool Merger::Parse(std::istream &IS, bool ParseCoverage) {
+  if (IS.peek() == static_cast<uint8_t>(kMergeControlFileMagic[0]))
+    return ParseBinary(IS, ParseCoverage);
+  Binary = false;
   LastFailure.clear();
   std::string Line;
 
@@ -56,7 +81,8 @@ bool Merger::Parse(std::istream &IS, bool ParseCoverage) {
   std::istringstream L1(Line);
   size_t NumFiles = 0;
   L1 >> NumFiles;
-  if (NumFiles == 0 || NumFiles > 10000000) return false;
+  // Every file name takes a line.
+  if (NumFiles == 0 || NumFiles > BytesLeft(IS)) return false;
 
   // Parse NumFilesInFirstCorpus.
   if (!std::getline(IS, Line, '\n')) return false;
@@ -114,6 +140,217 @@ bool Merger::Parse(std::istream &IS, bool ParseCoverage) {
   return true;
 }
 
+namespace {
+
+const uint32_t kMergeControlFileVersion = 1;
+const uint8_t kStartedRecord = 'S';
+const uint8_t kDoneRecord = 'D';
+const size_t kMaxFileNameSize = 1 << 16;
+
+// Reads LEB128 varints straight from the stream buffer.
+class VarintStream {
+ public:
+  explicit VarintStream(std::istream &IS) : SB(IS.rdbuf()) {}
+
+  // False at the end of the stream or on a malformed varint.
+  bool Read(uint64_t *V) {
+    *V = 0;
+    for (unsigned Shift = 0; Shift < 64; Shift += 7) {
+      auto C = SB->sbumpc();
+      if (C == std::char_traits<char>::eof()) return false;
+      *V |= static_cast<uint64_t>(C & 0x7f) << Shift;
+      if (!(C & 0x80)) return true;
+    }
+    return false;
+  }
+  bool Read(uint64_t *V, uint64_t Max) { return Read(V) && *V <= Max; }
+  bool ReadString(std::string *S, size_t MaxSize) {
+    uint64_t Size;
+    if (!Read(&Size, MaxSize)) return false;
+    S->resize(Size);
+    return SB->sgetn(&(*S)[0], Size) == static_cast<std::streamsize>(Size);
+  }
+  bool AtEnd() {
+    return SB->sgetc() == std::char_traits<char>::eof();
+  }
+
+ private:
+  std::streambuf *SB;
+};
+
+const uint32_t kCoverageSummaryVersion = 1;
+
+struct SummaryHeader {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t Flags;
+  uint64_t NumWords;
+  uint64_t NumFiles;
+};
+
+static_assert(sizeof(SummaryHeader) == 32, "unexpected SummaryHeader layout");
+
+// A read-only view of a whole file; mapped where we can.
+class MappedSummary {
+ public:
+  ~MappedSummary() {
+#if LIBFUZZER_POSIX
+    if (Data) munmap(const_cast<uint8_t *>(Data), Size);
+#endif
+  }
+  bool Map(const std::string &Path) {
+#if LIBFUZZER_POSIX
+    int Fd = open(Path.c_str(), O_RDONLY);
+    if (Fd < 0) return false;
+    struct stat St;
+    if (fstat(Fd, &St) || !St.st_size) {
+      close(Fd);
+      return false;
+    }
+    void *Map = mmap(nullptr, St.st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+    close(Fd);
+    if (Map == MAP_FAILED) return false;
+    Data = static_cast<const uint8_t *>(Map);
+    Size = St.st_size;
+#else
+    Copy = FileToVector(Path, 0, /*ExitOnError=*/false);
+    Data = Copy.data();
+    Size = Copy.size();
+#endif
+    return Size;
+  }
+
+  const uint8_t *Data = nullptr;
+  size_t Size = 0;
+
+ private:
+#if !LIBFUZZER_POSIX
+  Unit Copy;
+#endif
+};
+
+}  // namespace
+
+// The binary counterpart of the text format above:
+//
+// kMergeControlFileMagic, version
+// NumFiles NumFilesInFirstCorpus
+// length, bytes of file0, ...
+// 'S' FileID FileSize
+// 'D' FileID NumFeatures Feature1 Feature2-Feature1 ...
+//
+// A record cut short, by a crash while it was written, counts as missing.
+bool Merger::ParseBinary(std::istream &IS, bool ParseCoverage) {
+  Binary = true;
+  LastFailure.clear();
+  char Magic[sizeof(kMergeControlFileMagic)];
+  if (!IS.read(Magic, sizeof(Magic)) ||
+      memcmp(Magic, kMergeControlFileMagic, sizeof(Magic)))
+    return false;
+  VarintStream VS(IS);
+  uint64_t Version, NumFiles, NumFirst;
+  if (!VS.Read(&Version) || Version != kMergeControlFileVersion ||
+      !VS.Read(&NumFiles) || !NumFiles ||
+      !VS.Read(&NumFirst, NumFiles) ||
+      NumFiles > BytesLeft(IS))  // Every file name takes a byte or more.
+    return false;
+  NumFilesInFirstCorpus = NumFirst;
+  Files.clear();
+  Files.resize(NumFiles);
+  for (auto &MFI : Files)
+    if (!VS.ReadString(&MFI.Name, kMaxFileNameSize))
+      return false;
+
+  size_t ExpectedStartMarker = 0;
+  const size_t kInvalidStartMarker = -1;
+  size_t LastSeenStartMarker = kInvalidStartMarker;
+  uint64_t Tag, N, Size, NumFeatures, Feature;
+  while (VS.Read(&Tag)) {
+    if (Tag == kStartedRecord) {
+      if (!VS.Read(&N) || !VS.Read(&Size)) break;
+      if (N != ExpectedStartMarker || N >= Files.size())
+        return false;
+      Files[N].Size = Size;
+      LastSeenStartMarker = ExpectedStartMarker++;
+    } else if (Tag == kDoneRecord) {
+      if (!VS.Read(&N) || !VS.Read(&NumFeatures, UINT32_MAX)) break;
+      if (N != LastSeenStartMarker)
+        return false;
+      auto &Features = Files[N].Features;
+      Features.clear();
+      Feature = 0;
+      bool Complete = true;
+      for (size_t i = 0; i < NumFeatures && Complete; i++) {
+        uint64_t Delta;
+        Complete = VS.Read(&Delta);
+        Feature += Delta;
+        if (ParseCoverage)
+          Features.push_back(static_cast<uint32_t>(Feature));
+      }
+      if (!Complete) {
+        Features.clear();
+        break;
+      }
+      LastSeenStartMarker = kInvalidStartMarker;
+    } else {
+      return false;
+    }
+  }
+  if (LastSeenStartMarker != kInvalidStartMarker)
+    LastFailure = Files[LastSeenStartMarker].Name;
+  FirstNotProcessedFile = ExpectedStartMarker;
+  return true;
+}
+
+void WriteMergeControlFileHeader(std::ostream &OS,
+                                 const Vector<std::string> &Files,
+                                 size_t NumFilesInFirstCorpus, bool Binary) {
+  if (!Binary) {
+    OS << Files.size() << "\n";
+    OS << NumFilesInFirstCorpus << "\n";
+    for (auto &File : Files)
+      OS << File << "\n";
+    return;
+  }
+  OS.write(kMergeControlFileMagic, sizeof(kMergeControlFileMagic));
+  CheckpointWriter W;
+  W.Varint(kMergeControlFileVersion);
+  W.Varint(Files.size());
+  W.Varint(NumFilesInFirstCorpus);
+  for (auto &File : Files)
+    W.Bytes(reinterpret_cast<const uint8_t *>(File.data()), File.size());
+  OS.write(reinterpret_cast<const char *>(W.Data().data()), W.Data().size());
+}
+
+void WriteMergeStarted(std::ostream &OS, bool Binary, size_t FileIdx,
+                       size_t FileSize) {
+  if (!Binary) {
+    OS << "STARTED " << std::dec << FileIdx << " " << FileSize << "\n";
+    return;
+  }
+  CheckpointWriter W;
+  W.Varint(kStartedRecord);
+  W.Varint(FileIdx);
+  W.Varint(FileSize);
+  OS.write(reinterpret_cast<const char *>(W.Data().data()), W.Data().size());
+}
+
+void WriteMergeDone(std::ostream &OS, bool Binary, size_t FileIdx,
+                    const Vector<uint32_t> &Features) {
+  if (!Binary) {
+    OS << "DONE " << std::dec << FileIdx;
+    for (auto F : Features)
+      OS << " " << std::hex << F;
+    OS << "\n";
+    return;
+  }
+  CheckpointWriter W;
+  W.Varint(kDoneRecord);
+  W.Varint(FileIdx);
+  W.SortedSet({Features.data(), Features.size()});
+  OS.write(reinterpret_cast<const char *>(W.Data().data()), W.Data().size());
+}
+
 size_t Merger::ApproximateMemoryConsumption() const  {
   size_t Res = 0;
   for (const auto &F: Files)
@@ -123,50 +360,98 @@ size_t Merger::ApproximateMemoryConsumption() const  {
 
 // Decides which files need to be merged (add thost to NewFiles).
 // Returns the number of new features added.
+static void SetBit(Vector<uint64_t> *Bitmap, uint32_t Feature) {
+  if (Feature / 64 >= Bitmap->size())
+    Bitmap->resize(Feature / 64 + 1);
+  (*Bitmap)[Feature / 64] |= 1ULL << (Feature % 64);
+}
+
+static size_t CountBits(const Vector<uint64_t> &Bitmap) {
+  size_t Res = 0;
+  for (auto Word : Bitmap)
+    Res += __builtin_popcountll(Word);
+  return Res;
+}
+
 size_t Merger::Merge(const Set<uint32_t> &InitialFeatures,
-                     Vector<std::string> *NewFiles) {
+                     Vector<std::string> *NewFiles, bool Weighted) {
+  Vector<uint64_t> Bitmap;
+  for (auto Feature : InitialFeatures)
+    SetBit(&Bitmap, Feature);
+  return Merge(Bitmap, NewFiles, Weighted);
+}
+
+size_t Merger::Merge(const Vector<uint64_t> &InitialFeatures,
+                     Vector<std::string> *NewFiles, bool Weighted) {
   NewFiles->clear();
   assert(NumFilesInFirstCorpus <= Files.size());
-  Set<uint32_t> AllFeatures(InitialFeatures);
+  // The features are dense enough for a bitset over [0, MaxFeature].
+  uint32_t MaxFeature = 0;
+  for (auto &File : Files)
+    if (!File.Features.empty())
+      MaxFeature = std::max(MaxFeature, File.Features.back());
+  Vector<uint64_t> AllFeatures(InitialFeatures);
+  if (AllFeatures.size() <= MaxFeature / 64)
+    AllFeatures.resize(MaxFeature / 64 + 1);
+  size_t NumFeatures = CountBits(AllFeatures);
+  auto Insert = [&](uint32_t Feature) {
+    uint64_t &Word = AllFeatures[Feature / 64];
+    uint64_t Bit = 1ULL << (Feature % 64);
+    if (Word & Bit) return false;
+    Word |= Bit;
+    NumFeatures++;
+    return true;
+  };
 
   // What features are in the initial corpus?
-  for (size_t i = 0; i < NumFilesInFirstCorpus; i++) {
-    auto &Cur = Files[i].Features;
-    AllFeatures.insert(Cur.begin(), Cur.end());
-  }
-  size_t InitialNumFeatures = AllFeatures.size();
+  for (size_t i = 0; i < NumFilesInFirstCorpus; i++)
+    for (auto Feature : Files[i].Features)
+      Insert(Feature);
+  size_t InitialNumFeatures = NumFeatures;
 
   // Remove all features that we already know from all other inputs.
   for (size_t i = NumFilesInFirstCorpus; i < Files.size(); i++) {
     auto &Cur = Files[i].Features;
-    Vector<uint32_t> Tmp;
-    std::set_difference(Cur.begin(), Cur.end(), AllFeatures.begin(),
-                        AllFeatures.end(), std::inserter(Tmp, Tmp.begin()));
-    Cur.swap(Tmp);
+    Cur.erase(std::remove_if(Cur.begin(), Cur.end(),
+                             [&](uint32_t Feature) {
+                               return AllFeatures[Feature / 64] &
+                                      (1ULL << (Feature % 64));
+                             }),
+              Cur.end());
   }
 
   // Sort. Give preference to
   //   * smaller files
   //   * files with more features.
-  std::sort(Files.begin() + NumFilesInFirstCorpus, Files.end(),
-            [&](const MergeFileInfo &a, const MergeFileInfo &b) -> bool {
-              if (a.Size != b.Size)
-                return a.Size < b.Size;
-              return a.Features.size() > b.Features.size();
-            });
+  // or, if Weighted, to files with more features per byte.
+  auto BySize = [&](const MergeFileInfo &a, const MergeFileInfo &b) -> bool {
+    if (a.Size != b.Size)
+      return a.Size < b.Size;
+    return a.Features.size() > b.Features.size();
+  };
+  auto ByDensity = [&](const MergeFileInfo &a, const MergeFileInfo &b) {
+    // a.Features.size() / a.Size > b.Features.size() / b.Size
+    uint64_t A = a.Features.size() * std::max<uint64_t>(b.Size, 1);
+    uint64_t B = b.Features.size() * std::max<uint64_t>(a.Size, 1);
+    if (A != B)
+      return A > B;
+    return BySize(a, b);
+  };
+  if (Weighted)
+    std::sort(Files.begin() + NumFilesInFirstCorpus, Files.end(), ByDensity);
+  else
+    std::sort(Files.begin() + NumFilesInFirstCorpus, Files.end(), BySize);
 
   // One greedy pass: add the file's features to AllFeatures.
   // If new features were added, add this file to NewFiles.
   for (size_t i = NumFilesInFirstCorpus; i < Files.size(); i++) {
-    auto &Cur = Files[i].Features;
-    // Printf("%s -> sz %zd ft %zd\n", Files[i].Name.c_str(),
-    //       Files[i].Size, Cur.size());
-    size_t OldSize = AllFeatures.size();
-    AllFeatures.insert(Cur.begin(), Cur.end());
-    if (AllFeatures.size() > OldSize)
+    bool HasNewFeatures = false;
+    for (auto Feature : Files[i].Features)
+      HasNewFeatures |= Insert(Feature);
+    if (HasNewFeatures)
       NewFiles->push_back(Files[i].Name);
   }
-  return AllFeatures.size() - InitialNumFeatures;
+  return NumFeatures - InitialNumFeatures;
 }
 
 void Merger::PrintSummary(std::ostream &OS) {
@@ -186,6 +471,132 @@ Set<uint32_t> Merger::AllFeatures() const {
   return S;
 }
 
+void Merger::Combine(Vector<Merger> *Shards) {
+  Files.clear();
+  NumFilesInFirstCorpus = 0;
+  for (auto &Shard : *Shards) {
+    Files.insert(Files.end(), std::make_move_iterator(Shard.Files.begin()),
+                 std::make_move_iterator(Shard.Files.begin() +
+                                         Shard.NumFilesInFirstCorpus));
+    NumFilesInFirstCorpus += Shard.NumFilesInFirstCorpus;
+  }
+  for (auto &Shard : *Shards)
+    Files.insert(Files.end(),
+                 std::make_move_iterator(Shard.Files.begin() +
+                                         Shard.NumFilesInFirstCorpus),
+                 std::make_move_iterator(Shard.Files.end()));
+  FirstNotProcessedFile = Files.size();
+  Shards->clear();
+}
+
+// Files may be null.
+static void WriteSummary(std::ostream &OS, const Vector<uint64_t> &Bitmap,
+                         const Vector<MergeFileInfo> *Files) {
+  SummaryHeader SH;
+  memcpy(SH.Magic, kCoverageSummaryMagic, sizeof(SH.Magic));
+  SH.Version = kCoverageSummaryVersion;
+  SH.Flags = Files ? kSummaryHasFiles : 0;
+  SH.NumWords = Bitmap.size();
+  SH.NumFiles = Files ? Files->size() : 0;
+  OS.write(reinterpret_cast<const char *>(&SH), sizeof(SH));
+  OS.write(reinterpret_cast<const char *>(Bitmap.data()),
+           Bitmap.size() * sizeof(Bitmap[0]));
+  if (!Files)
+    return;
+  for (auto &File : *Files) {
+    CheckpointWriter W;
+    W.Bytes(reinterpret_cast<const uint8_t *>(File.Name.data()),
+            File.Name.size());
+    W.Varint(File.Size);
+    W.SortedSet({File.Features.data(), File.Features.size()});
+    OS.write(reinterpret_cast<const char *>(W.Data().data()), W.Data().size());
+  }
+}
+
+void Merger::WriteBinarySummary(std::ostream &OS, bool WithFiles) const {
+  Vector<uint64_t> Bitmap;
+  for (auto &File : Files)
+    for (auto Feature : File.Features)
+      SetBit(&Bitmap, Feature);
+  WriteSummary(OS, Bitmap, WithFiles ? &Files : nullptr);
+}
+
+bool ReadCoverageSummary(const std::string &Path, Vector<uint64_t> *Bitmap,
+                         Vector<MergeFileInfo> *Files) {
+  if (!IsFile(Path))
+    return false;
+  {
+    std::ifstream IF(Path, std::ios::binary);
+    if (IF.peek() != static_cast<uint8_t>(kCoverageSummaryMagic[0])) {
+      Merger M;
+      for (auto Feature : M.ParseSummary(IF))
+        SetBit(Bitmap, Feature);
+      return true;
+    }
+  }
+  MappedSummary MS;
+  if (!MS.Map(Path))
+    return false;
+  SummaryHeader SH;
+  if (MS.Size < sizeof(SH))
+    return false;
+  memcpy(&SH, MS.Data, sizeof(SH));
+  size_t BitmapBytes = SH.NumWords * sizeof(uint64_t);
+  if (memcmp(SH.Magic, kCoverageSummaryMagic, sizeof(SH.Magic)) ||
+      SH.Version != kCoverageSummaryVersion ||
+      SH.NumWords > (MS.Size - sizeof(SH)) / sizeof(uint64_t))
+    return false;
+  if (Bitmap->size() < SH.NumWords)
+    Bitmap->resize(SH.NumWords);
+  // The header keeps the bitmap 8-byte aligned in the mapping.
+  auto Words = reinterpret_cast<const uint64_t *>(MS.Data + sizeof(SH));
+  for (size_t i = 0; i < SH.NumWords; i++)
+    (*Bitmap)[i] |= Words[i];
+  if (!Files || !(SH.Flags & kSummaryHasFiles))
+    return true;
+  size_t FilesBegin = sizeof(SH) + BitmapBytes;
+  CheckpointReader R(MS.Data + FilesBegin, MS.Size - FilesBegin);
+  for (size_t i = 0; i < SH.NumFiles && !R.Failed(); i++) {
+    MergeFileInfo MFI;
+    Unit Name = R.Bytes();
+    MFI.Name.assign(Name.begin(), Name.end());
+    MFI.Size = R.Varint();
+    MFI.Features = R.SortedSet();
+    Files->push_back(std::move(MFI));
+  }
+  return !R.Failed();
+}
+
+int MergeCoverageSummaries(const std::string &OutPath,
+                           const Vector<std::string> &Inputs) {
+  Vector<uint64_t> Bitmap;
+  for (auto &Path : Inputs) {
+    if (!ReadCoverageSummary(Path, &Bitmap)) {
+      Printf("ERROR: %s is not a coverage summary\n", Path.c_str());
+      return 1;
+    }
+  }
+  // The files of the inputs are not kept.
+  std::string TmpPath = OutPath + ".tmp." + std::to_string(GetPid());
+  {
+    std::ofstream OS(TmpPath, std::ios::binary);
+    WriteSummary(OS, Bitmap, nullptr);
+    if (!OS) {
+      Printf("ERROR: failed to write %s\n", TmpPath.c_str());
+      RemoveFile(TmpPath);
+      return 1;
+    }
+  }
+  if (std::rename(TmpPath.c_str(), OutPath.c_str())) {
+    Printf("ERROR: failed to write %s\n", OutPath.c_str());
+    RemoveFile(TmpPath);
+    return 1;
+  }
+  Printf("INFO: %zd summaries merged into %s: %zd features\n", Inputs.size(),
+         OutPath.c_str(), CountBits(Bitmap));
+  return 0;
+}
+
 Set<uint32_t> Merger::ParseSummary(std::istream &IS) {
   std::string Line, Tmp;
   Set<uint32_t> Res;
@@ -209,7 +620,7 @@ Set<uint32_t> Merger::ParseSummary(std::istream &IS) {
 void Fuzzer::CrashResistantMergeInternalStep(const std::string &CFPath) {
   Printf("MERGE-INNER: using the control file '%s'\n", CFPath.c_str());
   Merger M;
-  std::ifstream IF(CFPath);
+  std::ifstream IF(CFPath, std::ios::binary);
   M.ParseOrExit(IF, false);
   IF.close();
   if (!M.LastFailure.empty())
@@ -221,8 +632,11 @@ void Fuzzer::CrashResistantMergeInternalStep(const std::string &CFPath) {
          M.Files.size(), M.FirstNotProcessedFile,
          M.Files.size() - M.FirstNotProcessedFile);
 
-  std::ofstream OF(CFPath, std::ofstream::out | std::ofstream::app);
-  Set<size_t> AllFeatures;
+  std::ofstream OF(CFPath, std::ofstream::out | std::ofstream::app |
+                              std::ofstream::binary);
+  StartFeatureCache();
+  Set<uint32_t> AllFeatures;
+  Vector<uint32_t> UniqFeatures;
   for (size_t i = M.FirstNotProcessedFile; i < M.Files.size(); i++) {
     MaybeExitGracefully();
     auto U = FileToVector(M.Files[i].Name);
@@ -230,9 +644,8 @@ void Fuzzer::CrashResistantMergeInternalStep(const std::string &CFPath) {
       U.resize(MaxInputLen);
       U.shrink_to_fit();
     }
-    std::ostringstream StartedLine;
     // Write the pre-run marker.
-    OF << "STARTED " << std::dec << i << " " << U.size() << "\n";
+    WriteMergeStarted(OF, M.Binary, i, U.size());
     OF.flush();  // Flush is important since Command::Execute may crash.
     // Run.
     TPC.ResetMaps();
@@ -242,32 +655,30 @@ void Fuzzer::CrashResistantMergeInternalStep(const std::string &CFPath) {
     // * Then, all other files, smallest first.
     // So it makes no sense to record all features for all files, instead we
     // only record features that were not seen before.
-    Set<size_t> UniqFeatures;
-    TPC.CollectFeatures([&](size_t Feature) {
+    CollectAllFeatures();
+    UniqFeatures.clear();
+    for (auto Feature : AllFeaturesTmp)
       if (AllFeatures.insert(Feature).second)
-        UniqFeatures.insert(Feature);
-    });
+        UniqFeatures.push_back(Feature);
+    // The cache gets all of them: next time the order may differ.
+    if (InputFeatureCache)
+      InputFeatureCache->Append(ComputeDigest(U), U.size(), AllFeaturesTmp);
     // Show stats.
     if (!(TotalNumberOfRuns & (TotalNumberOfRuns - 1)))
       PrintStats("pulse ");
     // Write the post-run marker and the coverage.
-    OF << "DONE " << i;
-    for (size_t F : UniqFeatures)
-      OF << " " << std::hex << F;
-    OF << "\n";
+    WriteMergeDone(OF, M.Binary, i, UniqFeatures);
     OF.flush();
   }
 }
 
 static void WriteNewControlFile(const std::string &CFPath,
-                                const Vector<SizedFile> &AllFiles,
+                                const Vector<std::string> &AllFiles,
                                 size_t NumFilesInFirstCorpus) {
   RemoveFile(CFPath);
-  std::ofstream ControlFile(CFPath);
-  ControlFile << AllFiles.size() << "\n";
-  ControlFile << NumFilesInFirstCorpus << "\n";
-  for (auto &SF: AllFiles)
-    ControlFile << SF.File << "\n";
+  std::ofstream ControlFile(CFPath, std::ios::binary);
+  WriteMergeControlFileHeader(ControlFile, AllFiles, NumFilesInFirstCorpus,
+                              /*Binary=*/true);
   if (!ControlFile) {
     Printf("MERGE-OUTER: failed to write to the control file: %s\n",
            CFPath.c_str());
@@ -275,6 +686,109 @@ static void WriteNewControlFile(const std::string &CFPath,
   }
 }
 
+static std::string ShardControlFile(const std::string &CFPath, size_t Shard) {
+  return CFPath + "." + std::to_string(Shard);
+}
+
+// Deals the files of the control file CFPath to NumShards control files,
+// keeping the progress of those left by an earlier merge with as many shards.
+// Returns for every shard the number of files left to process.
+static Vector<size_t> PrepareShards(const std::string &CFPath,
+                                    size_t NumShards) {
+  Merger M;
+  std::ifstream IF(CFPath, std::ios::binary);
+  M.ParseOrExit(IF, /*ParseCoverage=*/false);
+  Vector<size_t> Remaining(NumShards);
+  for (size_t Shard = 0; Shard < NumShards; Shard++) {
+    Vector<std::string> Files;
+    size_t NumFilesInFirstCorpus = 0;
+    for (size_t i = Shard; i < M.Files.size(); i += NumShards) {
+      Files.push_back(M.Files[i].Name);
+      NumFilesInFirstCorpus += i < M.NumFilesInFirstCorpus;
+    }
+    auto Path = ShardControlFile(CFPath, Shard);
+    Merger Old;
+    std::ifstream ShardIF(Path, std::ios::binary);
+    if (Old.Parse(ShardIF, /*ParseCoverage=*/false) &&
+        Old.NumFilesInFirstCorpus == NumFilesInFirstCorpus &&
+        Old.Files.size() == Files.size() &&
+        std::equal(Files.begin(), Files.end(), Old.Files.begin(),
+                   [](const std::string &Name, const MergeFileInfo &MFI) {
+                     return Name == MFI.Name;
+                   })) {
+      if (!Old.LastFailure.empty())
+        Printf("MERGE-OUTER: '%s' will be skipped as unlucky "
+               "(merge has stumbled on it the last time)\n",
+               Old.LastFailure.c_str());
+      Remaining[Shard] = Files.size() - Old.FirstNotProcessedFile;
+      continue;
+    }
+    WriteNewControlFile(Path, Files, NumFilesInFirstCorpus);
+    Remaining[Shard] = Files.size();
+  }
+  return Remaining;
+}
+
+// Executes the inner process on CFPath until it passes. Every inner process
+// should execute at least one input.
+// Only the outer process writes the feature cache: an inner process opening
+// it may rewrite it while the others append. They write to a cache of their
+// own instead, which the outer process collects.
+static std::string InnerFeatureCache(const std::string &CFPath) {
+  return CFPath + ".features";
+}
+
+void Fuzzer::CollectInnerFeatureCache(const std::string &CFPath) {
+  if (!InputFeatureCache)
+    return;
+  std::string Path = InnerFeatureCache(CFPath);
+  if (!FileSize(Path))
+    return;
+  UnitDigest Key;
+  FeatureCache Inner;
+  if (GetBuildKey(&Key) && Inner.Open(Path, Key))
+    InputFeatureCache->AppendAll(Inner);
+  RemoveFile(Path);
+}
+
+bool Fuzzer::RunInnerMerge(const Command &BaseCmd, const std::string &CFPath,
+                           size_t NumAttempts, const std::string &Name) {
+  for (size_t Attempt = 1; Attempt <= NumAttempts; Attempt++) {
+    MaybeExitGracefully();
+    Printf("MERGE-OUTER: %sattempt %zd\n", Name.c_str(), Attempt);
+    Command Cmd(BaseCmd);
+    Cmd.addFlag("merge_control_file", CFPath);
+    Cmd.addFlag("merge_inner", "1");
+    if (InputFeatureCache)
+      Cmd.addFlag("feature_cache", InnerFeatureCache(CFPath));
+    auto ExitCode = ExecuteCommand(Cmd);
+    if (!ExitCode) {
+      Printf("MERGE-OUTER: %ssuccesfull in %zd attempt(s)\n", Name.c_str(),
+             Attempt);
+      CollectInnerFeatureCache(CFPath);
+      return true;
+    }
+  }
+  CollectInnerFeatureCache(CFPath);
+  return false;
+}
+
+// Adds File to Cached if the cache has its features, reading it the way the
+// inner process would. The files of the first corpus must come first.
+static bool TakeCachedFile(const FeatureCache &Cache, const std::string &File,
+                           bool InFirstCorpus, size_t MaxLen, Merger *Cached) {
+  Unit U = FileToVector(File, MaxLen, /*ExitOnError=*/false);
+  MergeFileInfo MFI;
+  if (U.empty() || !Cache.Lookup(ComputeDigest(U), U.size(), &MFI.Features))
+    return false;
+  assert(!InFirstCorpus || Cached->NumFilesInFirstCorpus == Cached->Files.size());
+  MFI.Name = File;
+  MFI.Size = U.size();
+  Cached->Files.push_back(std::move(MFI));
+  Cached->NumFilesInFirstCorpus += InFirstCorpus;
+  return true;
+}
+
 // Outer process. Does not call the target code and thus sohuld not fail.
 void Fuzzer::CrashResistantMerge(const Vector<std::string> &Args,
                                  const Vector<std::string> &Corpora,
@@ -292,11 +806,11 @@ void Fuzzer::CrashResistantMerge(const Vector<std::string> &Args,
                         "libFuzzerTemp." + std::to_string(GetPid()) + ".txt");
 
   size_t NumAttempts = 0;
+  Merger M;
   if (MergeControlFilePathOrNull && FileSize(MergeControlFilePathOrNull)) {
     Printf("MERGE-OUTER: non-empty control file provided: '%s'\n",
            MergeControlFilePathOrNull);
-    Merger M;
-    std::ifstream IF(MergeControlFilePathOrNull);
+    std::ifstream IF(MergeControlFilePathOrNull, std::ios::binary);
     if (M.Parse(IF, /*ParseCoverage=*/false)) {
       Printf("MERGE-OUTER: control file ok, %zd files total,"
              " first not processed file %zd\n",
@@ -316,75 +830,178 @@ void Fuzzer::CrashResistantMerge(const Vector<std::string> &Args,
     }
   }
 
-  if (!NumAttempts) {
-    // The supplied control file is empty or bad, create a fresh one.
-    Vector<SizedFile> AllFiles;
+  // With -feature_cache the files whose features are cached are not
+  // executed; they go to Cached instead of the control file.
+  StartFeatureCache();
+  size_t MaxLen = Options.MaxLen ? Options.MaxLen : kDefaultMaxMergeLen;
+  Merger Cached;
+  Vector<SizedFile> AllFiles;
+  size_t NumFilesInFirstCorpus = 0;
+  if (!NumAttempts || InputFeatureCache) {
     GetSizedFilesFromDir(Corpora[0], &AllFiles);
-    size_t NumFilesInFirstCorpus = AllFiles.size();
+    NumFilesInFirstCorpus = AllFiles.size();
     std::sort(AllFiles.begin(), AllFiles.end());
     for (size_t i = 1; i < Corpora.size(); i++)
       GetSizedFilesFromDir(Corpora[i], &AllFiles);
     std::sort(AllFiles.begin() + NumFilesInFirstCorpus, AllFiles.end());
+  }
+  if (!NumAttempts) {
+    // The supplied control file is empty or bad, create a fresh one.
     Printf("MERGE-OUTER: %zd files, %zd in the initial corpus\n",
            AllFiles.size(), NumFilesInFirstCorpus);
-    WriteNewControlFile(CFPath, AllFiles, NumFilesInFirstCorpus);
-    NumAttempts = AllFiles.size();
+    Vector<std::string> FileNames;
+    size_t NumFileNamesInFirstCorpus = 0;
+    for (size_t i = 0; i < AllFiles.size(); i++) {
+      if (InputFeatureCache &&
+          TakeCachedFile(*InputFeatureCache, AllFiles[i].File,
+                         i < NumFilesInFirstCorpus, MaxLen, &Cached))
+        continue;
+      FileNames.push_back(AllFiles[i].File);
+      NumFileNamesInFirstCorpus += i < NumFilesInFirstCorpus;
+    }
+    if (InputFeatureCache)
+      Printf("MERGE-OUTER: %zd files with cached features, %zd to execute\n",
+             Cached.Files.size(), FileNames.size());
+    if (!FileNames.empty())
+      WriteNewControlFile(CFPath, FileNames, NumFileNamesInFirstCorpus);
+    NumAttempts = FileNames.size();
+  } else if (InputFeatureCache) {
+    // Resuming: the files left out of the control file were cached then.
+    Set<std::string> InControlFile;
+    for (auto &MFI : M.Files)
+      InControlFile.insert(MFI.Name);
+    size_t NumUnknown = 0;
+    for (size_t i = 0; i < AllFiles.size(); i++)
+      if (!InControlFile.count(AllFiles[i].File) &&
+          !TakeCachedFile(*InputFeatureCache, AllFiles[i].File,
+                          i < NumFilesInFirstCorpus, MaxLen, &Cached))
+        NumUnknown++;
+    if (NumUnknown)
+      Printf("MERGE-OUTER: %zd files are neither in the control file nor in "
+             "the feature cache, they will not be merged\n",
+             NumUnknown);
   }
 
-  // Execute the inner process until it passes.
-  // Every inner process should execute at least one input.
   Command BaseCmd(Args);
   BaseCmd.removeFlag("merge");
-  bool Success = false;
-  for (size_t Attempt = 1; Attempt <= NumAttempts; Attempt++) {
-    MaybeExitGracefully();
-    Printf("MERGE-OUTER: attempt %zd\n", Attempt);
-    Command Cmd(BaseCmd);
-    Cmd.addFlag("merge_control_file", CFPath);
-    Cmd.addFlag("merge_inner", "1");
-    auto ExitCode = ExecuteCommand(Cmd);
-    if (!ExitCode) {
-      Printf("MERGE-OUTER: succesfull in %zd attempt(s)\n", Attempt);
-      Success = true;
-      break;
+  BaseCmd.removeFlag("merge_jobs");
+  BaseCmd.removeFlag("feature_cache");
+  // Shards are dealt from the file list, so there are at most as many as
+  // there were files to process.
+  size_t NumShards = std::min(Options.MergeJobs, NumAttempts);
+  Vector<std::string> ShardPaths;
+  if (!NumAttempts) {
+    // Every file was cached.
+  } else if (NumShards <= 1) {
+    if (!RunInnerMerge(BaseCmd, CFPath, NumAttempts, "")) {
+      Printf("MERGE-OUTER: zero succesfull attempts, exiting\n");
+      exit(1);
+    }
+    ShardPaths.push_back(CFPath);
+  } else {
+    if (TPC.GetBuildId().empty())
+      Printf("WARNING: the features of a trace-pc build depend on where it is "
+             "loaded; with -merge_jobs the merge may keep redundant inputs\n");
+    auto Remaining = PrepareShards(CFPath, NumShards);
+    Printf("MERGE-OUTER: %zd shards, %zd files left to process\n", NumShards,
+           std::accumulate(Remaining.begin(), Remaining.end(), (size_t)0));
+    Vector<std::thread> Threads;
+    std::atomic<size_t> NumFailedShards(0);
+    for (size_t Shard = 0; Shard < NumShards; Shard++) {
+      ShardPaths.push_back(ShardControlFile(CFPath, Shard));
+      if (!Remaining[Shard]) continue;
+      Threads.push_back(std::thread([&, Shard]() {
+        // The inner processes of all the shards would write to the terminal
+        // at once.
+        Command ShardCmd(BaseCmd);
+        ShardCmd.setOutputFile(ShardPaths[Shard] + ".log");
+        ShardCmd.combineOutAndErr();
+        std::string Name = "shard " + std::to_string(Shard) + ": ";
+        if (!RunInnerMerge(ShardCmd, ShardPaths[Shard], Remaining[Shard],
+                           Name)) {
+          Printf("MERGE-OUTER: %szero succesfull attempts, see %s.log\n",
+                 Name.c_str(), ShardPaths[Shard].c_str());
+          NumFailedShards++;
+        } else {
+          RemoveFile(ShardPaths[Shard] + ".log");
+        }
+      }));
+    }
+    for (auto &T : Threads)
+      T.join();
+    if (NumFailedShards) {
+      Printf("MERGE-OUTER: %zd shard(s) failed, exiting\n",
+             NumFailedShards.load());
+      exit(1);
     }
   }
-  if (!Success) {
-    Printf("MERGE-OUTER: zero succesfull attempts, exiting\n");
-    exit(1);
+  // Read the control files and do the merge.
+  Vector<Merger> Shards(ShardPaths.size());
+  size_t ControlFileBytes = 0;
+  for (size_t Shard = 0; Shard < ShardPaths.size(); Shard++) {
+    std::ifstream IF(ShardPaths[Shard], std::ios::binary);
+    IF.seekg(0, IF.end);
+    ControlFileBytes += IF.tellg();
+    IF.seekg(0, IF.beg);
+    Shards[Shard].ParseOrExit(IF, true);
   }
-  // Read the control file and do the merge.
-  Merger M;
-  std::ifstream IF(CFPath);
-  IF.seekg(0, IF.end);
-  Printf("MERGE-OUTER: the control file has %zd bytes\n", (size_t)IF.tellg());
-  IF.seekg(0, IF.beg);
-  M.ParseOrExit(IF, true);
-  IF.close();
+  Printf("MERGE-OUTER: the control file has %zd bytes\n", ControlFileBytes);
+  Shards.push_back(std::move(Cached));
+  M.Combine(&Shards);
   Printf("MERGE-OUTER: consumed %zdMb (%zdMb rss) to parse the control file\n",
          M.ApproximateMemoryConsumption() >> 20, GetPeakRSSMb());
   if (CoverageSummaryOutputPathOrNull) {
     Printf("MERGE-OUTER: writing coverage summary for %zd files to %s\n",
            M.Files.size(), CoverageSummaryOutputPathOrNull);
-    std::ofstream SummaryOut(CoverageSummaryOutputPathOrNull);
-    M.PrintSummary(SummaryOut);
+    std::ofstream SummaryOut(CoverageSummaryOutputPathOrNull,
+                             std::ios::binary);
+    if (Options.BinaryCoverageSummary)
+      M.WriteBinarySummary(SummaryOut, Options.SummaryFileFeatures);
+    else
+      M.PrintSummary(SummaryOut);
   }
   Vector<std::string> NewFiles;
-  Set<uint32_t> InitialFeatures;
+  Vector<uint64_t> InitialFeatures;
   if (CoverageSummaryInputPathOrNull) {
-    std::ifstream SummaryIn(CoverageSummaryInputPathOrNull);
-    InitialFeatures = M.ParseSummary(SummaryIn);
+    if (!ReadCoverageSummary(CoverageSummaryInputPathOrNull,
+                             &InitialFeatures)) {
+      Printf("MERGE-OUTER: can't read the coverage summary %s\n",
+             CoverageSummaryInputPathOrNull);
+      exit(1);
+    }
     Printf("MERGE-OUTER: coverage summary loaded from %s, %zd features found\n",
-           CoverageSummaryInputPathOrNull, InitialFeatures.size());
+           CoverageSummaryInputPathOrNull, CountBits(InitialFeatures));
   }
-  size_t NumNewFeatures = M.Merge(InitialFeatures, &NewFiles);
+  size_t NumNewFeatures =
+      M.Merge(InitialFeatures, &NewFiles, Options.MergeWeighted);
   Printf("MERGE-OUTER: %zd new files with %zd new features added\n",
          NewFiles.size(), NumNewFeatures);
-  for (auto &F: NewFiles)
-    WriteToOutputCorpus(FileToVector(F, MaxInputLen));
-  // We are done, delete the control file if it was a temporary one.
-  if (!MergeControlFilePathOrNull)
+  // Hash the files in batches with the multi-buffer SHA1.
+  const size_t kBatchSize = 64;
+  for (size_t Begin = 0; Begin < NewFiles.size(); Begin += kBatchSize) {
+    size_t N = std::min(kBatchSize, NewFiles.size() - Begin);
+    Vector<Unit> Units(N);
+    Vector<const uint8_t *> Data(N);
+    Vector<size_t> Sizes(N);
+    Vector<uint8_t> Sha1s(N * kSHA1NumBytes);
+    Vector<uint8_t *> Out(N);
+    for (size_t i = 0; i < N; i++) {
+      Units[i] = FileToVector(NewFiles[Begin + i], MaxInputLen);
+      Data[i] = Units[i].data();
+      Sizes[i] = Units[i].size();
+      Out[i] = Sha1s.data() + i * kSHA1NumBytes;
+    }
+    ComputeSHA1MultiBuffer(Data.data(), Sizes.data(), N, Out.data());
+    for (size_t i = 0; i < N; i++)
+      WriteToOutputCorpus(Units[i], Out[i]);
+  }
+  // We are done, delete the control files if they were temporary ones.
+  if (!MergeControlFilePathOrNull) {
     RemoveFile(CFPath);
+    if (ShardPaths.size() > 1)
+      for (auto &Path : ShardPaths)
+        RemoveFile(Path);
+  }
 }
 
 } // namespace fuzzer
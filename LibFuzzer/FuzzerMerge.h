@@ -29,11 +29,26 @@
 //   file will be "STARTED INPUT_ID" and so the next process will know
 //   where to resume.
 //
+//   With -merge_jobs=N the inputs are dealt round-robin to N shards, each with
+//   its own control file (CFPath.0, CFPath.1, ...) and its own inner
+//   processes, restarted independently. A shard records the features that
+//   are new to the shard, so an input may record features that another shard
+//   has seen; the greedy pass below does not care.
+//
+//   The control files written by the outer process are binary: they start
+//   with kMergeControlFileMagic, then the numbers above and the file names,
+//   then the STARTED and DONE records, made of LEB128 varints, the features
+//   of a DONE record being a list of deltas. The inner process appends
+//   records in the format of the control file, so text control files are
+//   still read and resumed.
+//
 //   Once all inputs are processed by the innner process(es) the outer process
 //   reads the control files and does the merge based entirely on the contents
 //   of control file.
 //   It uses a single pass greedy algorithm choosing first the smallest inputs
-//   within the same size the inputs that have more new features.
+//   within the same size the inputs that have more new features. With
+//   -merge_weighted=1 it chooses first the inputs with the most new features
+//   per byte instead. The features seen so far are kept in a dense bitset.
 //
 //===----------------------------------------------------------------------===//
 
@@ -49,6 +64,23 @@
 
 namespace fuzzer {
 
+// Can't start a text control file, which starts with a number.
+static const char kMergeControlFileMagic[8] = {'\xff', 'L', 'F', 'M',
+                                               'E', 'R', 'G', 'E'};
+
+// Binary coverage summaries start with a 32-byte header (kCoverageSummaryMagic,
+// a version, flags, the number of 64-bit words of the bitmap and of files),
+// followed by the bitmap of all the features, in host byte order, so that a
+// summary can be mapped and ORed into another. With kSummaryHasFiles the
+// bitmap is followed by the name, the size and the features of every file,
+// encoded as in the binary control files.
+static const char kCoverageSummaryMagic[8] = {'\xff', 'L', 'F', 'S',
+                                              'U', 'M', 'R', 'Y'};
+const uint32_t kSummaryHasFiles = 1;
+
+// What the inner process reads of the files when -max_len is not given.
+const size_t kDefaultMaxMergeLen = 1 << 20;
+
 struct MergeFileInfo {
   std::string Name;
   size_t Size = 0;
@@ -60,21 +92,48 @@ struct Merger {
   size_t NumFilesInFirstCorpus = 0;
   size_t FirstNotProcessedFile = 0;
   std::string LastFailure;
+  bool Binary = false;  // The format of the last parsed control file.
 
+  // Reads both formats; the binary one a record at a time.
   bool Parse(std::istream &IS, bool ParseCoverage);
   bool Parse(const std::string &Str, bool ParseCoverage);
   void ParseOrExit(std::istream &IS, bool ParseCoverage);
   void PrintSummary(std::ostream &OS);
   Set<uint32_t> ParseSummary(std::istream &IS);
   size_t Merge(const Set<uint32_t> &InitialFeatures,
-               Vector<std::string> *NewFiles);
+               Vector<std::string> *NewFiles, bool Weighted = false);
+  // InitialFeatures is a bitmap, as read by ReadCoverageSummary.
+  size_t Merge(const Vector<uint64_t> &InitialFeatures,
+               Vector<std::string> *NewFiles, bool Weighted = false);
   size_t Merge(Vector<std::string> *NewFiles) {
     return Merge(Set<uint32_t>{}, NewFiles);
   }
   size_t ApproximateMemoryConsumption() const;
   Set<uint32_t> AllFeatures() const;
+  void WriteBinarySummary(std::ostream &OS, bool WithFiles) const;
+  // Joins the files of the shards of a merge, those of the first corpus first.
+  void Combine(Vector<Merger> *Shards);
+  bool ParseBinary(std::istream &IS, bool ParseCoverage);
 };
 
+// Write the parts of a control file, Binary or not.
+void WriteMergeControlFileHeader(std::ostream &OS,
+                                 const Vector<std::string> &Files,
+                                 size_t NumFilesInFirstCorpus, bool Binary);
+void WriteMergeStarted(std::ostream &OS, bool Binary, size_t FileIdx,
+                       size_t FileSize);
+// Features must be sorted.
+void WriteMergeDone(std::ostream &OS, bool Binary, size_t FileIdx,
+                    const Vector<uint32_t> &Features);
+
+// ORs the features of the summary at Path, binary or text, into Bitmap, and
+// appends its files to Files if it has them and Files is not null.
+bool ReadCoverageSummary(const std::string &Path, Vector<uint64_t> *Bitmap,
+                         Vector<MergeFileInfo> *Files = nullptr);
+// -merge_summaries: writes the union of the Inputs summaries to OutPath.
+int MergeCoverageSummaries(const std::string &OutPath,
+                           const Vector<std::string> &Inputs);
+
 }  // namespace fuzzer
 
 #endif  // LLVM_FUZZER_MERGE_H
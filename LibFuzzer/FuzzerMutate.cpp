@@ -15,6 +15,7 @@
 #include "FuzzerExtFunctions.h"
 #include "FuzzerIO.h"
 #include "FuzzerOptions.h"
+#include <algorithm>
 
 namespace fuzzer {
 
@@ -58,6 +59,12 @@ MutationDispatcher::MutationDispatcher(Random &Rand,
   if (EF->LLVMFuzzerCustomCrossOver)
     Mutators.push_back(
         {&MutationDispatcher::Mutate_CustomCrossOver, "CustomCrossOver"});
+
+  size_t N = Mutators.size();
+  MutatorYields.resize((N + 1) * N);
+  // Uniform until there is something to learn from.
+  for (size_t i = 0; i < MutatorYields.size(); i++)
+    MutatorWeights.push_back(i % N + 1);
 }
 
 static char RandCh(Random &Rand) {
@@ -66,6 +73,17 @@ static char RandCh(Random &Rand) {
   return Special[Rand(sizeof(Special) - 1)];
 }
 
+bool MutationDispatcher::CopyCrossOverUnit() {
+  std::unique_lock<std::mutex> Lock;
+  if (CorpusMutex)
+    Lock = std::unique_lock<std::mutex>(*CorpusMutex);
+  if (Corpus->size() < 2)
+    return false;
+  auto Other = (*Corpus)[Rand(Corpus->size())];
+  CrossOverWith.assign(Other.begin(), Other.end());
+  return !CrossOverWith.empty();
+}
+
 size_t MutationDispatcher::Mutate_Custom(uint8_t *Data, size_t Size,
                                          size_t MaxSize) {
   return EF->LLVMFuzzerCustomMutator(Data, Size, MaxSize, Rand.Rand());
@@ -73,12 +91,9 @@ size_t MutationDispatcher::Mutate_Custom(uint8_t *Data, size_t Size,
 
 size_t MutationDispatcher::Mutate_CustomCrossOver(uint8_t *Data, size_t Size,
                                                   size_t MaxSize) {
-  if (!Corpus || Corpus->size() < 2 || Size == 0)
-    return 0;
-  size_t Idx = Rand(Corpus->size());
-  const Unit &Other = (*Corpus)[Idx];
-  if (Other.empty())
+  if (!Corpus || Size == 0 || !CopyCrossOverUnit())
     return 0;
+  auto &Other = CrossOverWith;
   CustomCrossOverInPlaceHere.resize(MaxSize);
   auto &U = CustomCrossOverInPlaceHere;
   size_t NewSize = EF->LLVMFuzzerCustomCrossOver(
@@ -421,10 +436,8 @@ size_t MutationDispatcher::Mutate_ChangeBinaryInteger(uint8_t *Data,
 size_t MutationDispatcher::Mutate_CrossOver(uint8_t *Data, size_t Size,
                                             size_t MaxSize) {
   if (Size > MaxSize) return 0;
-  if (!Corpus || Corpus->size() < 2 || Size == 0) return 0;
-  size_t Idx = Rand(Corpus->size());
-  const Unit &O = (*Corpus)[Idx];
-  if (O.empty()) return 0;
+  if (!Corpus || Size == 0 || !CopyCrossOverUnit()) return 0;
+  auto &O = CrossOverWith;
   MutateInPlaceHere.resize(MaxSize);
   auto &U = MutateInPlaceHere;
   size_t NewSize = 0;
@@ -451,6 +464,7 @@ size_t MutationDispatcher::Mutate_CrossOver(uint8_t *Data, size_t Size,
 void MutationDispatcher::StartMutationSequence() {
   CurrentMutatorSequence.clear();
   CurrentDictionaryEntrySequence.clear();
+  PrevMutator = LastMutator = kNoMutator;
 }
 
 // Copy successful dictionary entries to PersistentAutoDictionary.
@@ -511,20 +525,189 @@ size_t MutationDispatcher::MutateImpl(uint8_t *Data, size_t Size,
   // Some mutations may fail (e.g. can't insert more bytes if Size == MaxSize),
   // in which case they will return 0.
   // Try several times before returning un-mutated data.
+  // Only the configured mutators are scheduled by their yield, not the
+  // default ones a custom mutator may call through LLVMFuzzerMutate.
+  bool Scheduled = &Mutators == &this->Mutators;
   for (int Iter = 0; Iter < 100; Iter++) {
-    auto M = Mutators[Rand(Mutators.size())];
+    size_t Idx = Scheduled && Options.AdaptiveMutators
+                     ? PickMutator()
+                     : Rand(Mutators.size());
+    auto M = Mutators[Idx];
     size_t NewSize = (this->*(M.Fn))(Data, Size, MaxSize);
     if (NewSize && NewSize <= MaxSize) {
       if (Options.OnlyASCII)
         ToASCII(Data, NewSize);
       CurrentMutatorSequence.push_back(M);
+      if (Scheduled)
+        LastMutator = Idx;
       return NewSize;
     }
+    if (Scheduled) {
+      size_t Row = PrevMutator == kNoMutator ? 0 : PrevMutator + 1;
+      auto &Y = MutatorYields[Row * Mutators.size() + Idx];
+      Y.Failures++;
+      Y.TotalFailures++;
+    }
   }
   *Data = ' ';
   return 1;   // Fallback, should not happen frequently.
 }
 
+size_t MutationDispatcher::PickMutator() {
+  size_t N = Mutators.size();
+  size_t RowIdx = PrevMutator == kNoMutator ? 0 : PrevMutator + 1;
+  auto Row = MutatorWeights.begin() + RowIdx * N;
+  return std::upper_bound(Row, Row + N, Rand(Row[N - 1])) - Row;
+}
+
+void MutationDispatcher::RecordMutationYield(size_t NumNewFeatures) {
+  if (LastMutator == kNoMutator)
+    return;  // Not mutated by one of Mutators.
+  size_t Row = PrevMutator == kNoMutator ? 0 : PrevMutator + 1;
+  auto &Y = MutatorYields[Row * Mutators.size() + LastMutator];
+  Y.Runs++;
+  Y.NewFeatures += NumNewFeatures;
+  Y.TotalRuns++;
+  Y.TotalNewFeatures += NumNewFeatures;
+  PrevMutator = LastMutator;
+  LastMutator = kNoMutator;
+  const size_t kRunsPerUpdate = 1 << 13;
+  if (Options.AdaptiveMutators && ++RunsSinceWeightsUpdate >= kRunsPerUpdate) {
+    RunsSinceWeightsUpdate = 0;
+    UpdateMutatorWeights();
+  }
+}
+
+// A bandit over the mutators: M is picked after Prev with a probability that
+// follows the recent yield of M after Prev, shrunk towards the yield of M
+// after any mutator, itself shrunk towards the yield of all the mutators.
+// An attempt that did not mutate counts as an execution without yield.
+// A share of the picks stays uniform so that no mutator starves, and the
+// yields are halved at every update so that the weights follow the corpus.
+void MutationDispatcher::UpdateMutatorWeights() {
+  const double kPriorRuns = 64;
+  const double kExploration = 0.1;
+  const double kScale = 1 << 20;
+  size_t N = Mutators.size();
+  Vector<double> Runs(N), NewFeatures(N);
+  double AllRuns = 0, AllNewFeatures = 0;
+  for (size_t i = 0; i < MutatorYields.size(); i++) {
+    auto &Y = MutatorYields[i];
+    Runs[i % N] += Y.Runs + Y.Failures;
+    NewFeatures[i % N] += Y.NewFeatures;
+    AllRuns += Y.Runs + Y.Failures;
+    AllNewFeatures += Y.NewFeatures;
+  }
+  if (!AllNewFeatures)
+    return;  // Nothing to learn from yet.
+  double Overall = AllNewFeatures / AllRuns;
+  Vector<double> Yield(N), Score(N);
+  for (size_t M = 0; M < N; M++)
+    Yield[M] = (NewFeatures[M] + kPriorRuns * Overall) / (Runs[M] + kPriorRuns);
+  for (size_t Row = 0; Row <= N; Row++) {
+    double Sum = 0;
+    for (size_t M = 0; M < N; M++) {
+      auto &Y = MutatorYields[Row * N + M];
+      Score[M] = (Y.NewFeatures + kPriorRuns * Yield[M]) /
+                 (Y.Runs + Y.Failures + kPriorRuns);
+      Sum += Score[M];
+    }
+    uint32_t Cumulative = 0;
+    for (size_t M = 0; M < N; M++) {
+      double P = (1 - kExploration) * Score[M] / Sum + kExploration / N;
+      Cumulative += 1 + static_cast<uint32_t>(P * kScale);
+      MutatorWeights[Row * N + M] = Cumulative;
+    }
+  }
+  for (auto &Y : MutatorYields) {
+    Y.Runs /= 2;
+    Y.NewFeatures /= 2;
+    Y.Failures /= 2;
+  }
+}
+
+double MutationDispatcher::MutatorProbability(size_t Prev, size_t M) const {
+  size_t N = Mutators.size();
+  size_t RowIdx = Prev == kNoMutator ? 0 : Prev + 1;
+  auto Row = MutatorWeights.begin() + RowIdx * N;
+  return static_cast<double>(Row[M] - (M ? Row[M - 1] : 0)) / Row[N - 1];
+}
+
+void MutationDispatcher::PrintMutatorStats() {
+  size_t N = Mutators.size();
+  Vector<size_t> Runs(N), NewFeatures(N), Failures(N);
+  for (size_t i = 0; i < MutatorYields.size(); i++) {
+    Runs[i % N] += MutatorYields[i].TotalRuns;
+    NewFeatures[i % N] += MutatorYields[i].TotalNewFeatures;
+    Failures[i % N] += MutatorYields[i].TotalFailures;
+  }
+  Printf("###### Mutator stats (%s scheduling) ######\n",
+         Options.AdaptiveMutators ? "adaptive" : "uniform");
+  Printf("%-20s %12s %8s %12s %12s %7s\n", "mutator", "runs", "new_ft",
+         "new_ft/Mrun", "no-op", "first%");
+  for (size_t M = 0; M < N; M++)
+    Printf("%-20s %12zd %8zd %12.1f %12zd %7.2f\n", Mutators[M].Name, Runs[M],
+           NewFeatures[M], Runs[M] ? 1e6 * NewFeatures[M] / Runs[M] : 0.0,
+           Failures[M], 100.0 * MutatorProbability(kNoMutator, M));
+  Printf("first%%: probability of being picked as the first mutation of a "
+         "sequence\n");
+  // The pairs that found the most new features per execution.
+  const size_t kMinPairRuns = 1000;
+  const size_t kMaxPairs = 10;
+  Vector<size_t> Pairs;
+  for (size_t i = N; i < MutatorYields.size(); i++)
+    if (MutatorYields[i].TotalRuns >= kMinPairRuns &&
+        MutatorYields[i].TotalNewFeatures)
+      Pairs.push_back(i);
+  auto PairYield = [&](size_t i) {
+    return static_cast<double>(MutatorYields[i].TotalNewFeatures) /
+           MutatorYields[i].TotalRuns;
+  };
+  std::sort(Pairs.begin(), Pairs.end(), [&](size_t A, size_t B) {
+    return PairYield(A) > PairYield(B);
+  });
+  if (Pairs.size() > kMaxPairs)
+    Pairs.resize(kMaxPairs);
+  if (!Pairs.empty())
+    Printf("Most productive pairs (at least %zd runs):\n", kMinPairRuns);
+  for (auto i : Pairs) {
+    auto &Y = MutatorYields[i];
+    Printf("  %s-%s: %zd runs, %zd new_ft, %.1f new_ft/Mrun\n",
+           Mutators[i / N - 1].Name, Mutators[i % N].Name, Y.TotalRuns,
+           Y.TotalNewFeatures, 1e6 * PairYield(i));
+  }
+  Printf("###### End of mutator stats ######\n");
+}
+
+void MutationDispatcher::SaveState(CheckpointWriter *W) const {
+  W->Varint(PersistentAutoDictionary.size());
+  for (auto &DE : PersistentAutoDictionary) {
+    W->Bytes(DE.GetW().data(), DE.GetW().size());
+    W->Varint(DE.HasPositionHint());
+    if (DE.HasPositionHint())
+      W->Varint(DE.GetPositionHint());
+    W->Varint(DE.GetUseCount());
+    W->Varint(DE.GetSuccessCount());
+  }
+}
+
+bool MutationDispatcher::LoadState(CheckpointReader *R) {
+  PersistentAutoDictionary.clear();
+  size_t N = R->Varint(Dictionary::kMaxDictSize);
+  for (size_t i = 0; i < N && !R->Failed(); i++) {
+    Unit U = R->Bytes();
+    if (U.size() > Word::GetMaxSize())
+      return false;
+    DictionaryEntry DE(Word(U.data(), U.size()));
+    if (R->Varint(1))
+      DE = DictionaryEntry(DE.GetW(), R->Varint());
+    size_t UseCount = R->Varint();
+    DE.SetCounts(UseCount, R->Varint());
+    PersistentAutoDictionary.push_back(DE);
+  }
+  return !R->Failed();
+}
+
 void MutationDispatcher::AddWordToManualDictionary(const Word &W) {
   ManualDictionary.push_back(
       {W, std::numeric_limits<size_t>::max()});
@@ -12,10 +12,12 @@
 #ifndef LLVM_FUZZER_MUTATE_H
 #define LLVM_FUZZER_MUTATE_H
 
+#include "FuzzerCheckpoint.h"
 #include "FuzzerDefs.h"
 #include "FuzzerDictionary.h"
 #include "FuzzerOptions.h"
 #include "FuzzerRandom.h"
+#include <mutex>
 
 namespace fuzzer {
 
@@ -29,6 +31,19 @@ public:
   void PrintMutationSequence();
   /// Indicate that the current sequence of mutations was successfull.
   void RecordSuccessfulMutationSequence();
+  /// Credit the last mutation with the new features found by executing it.
+  void RecordMutationYield(size_t NumNewFeatures);
+  /// Print the yield of the mutators and of the pairs of mutators.
+  void PrintMutatorStats();
+  /// The mutators Mutate picks from.
+  size_t NumMutators() const { return Mutators.size(); }
+  const char *MutatorName(size_t M) const { return Mutators[M].Name; }
+  /// The mutator applied by the last Mutate, until its yield is recorded.
+  size_t LastMutatorApplied() const { return LastMutator; }
+  /// The probability that M is picked after Prev, or as the first mutation of
+  /// a sequence if Prev is kNoMutator.
+  double MutatorProbability(size_t Prev, size_t M) const;
+  static const size_t kNoMutator = ~static_cast<size_t>(0);
   /// Mutates data by invoking user-provided mutator.
   size_t Mutate_Custom(uint8_t *Data, size_t Size, size_t MaxSize);
   /// Mutates data by invoking user-provided crossover.
@@ -82,7 +97,15 @@ public:
 
   void PrintRecommendedDictionary();
 
-  void SetCorpus(const InputCorpus *Corpus) { this->Corpus = Corpus; }
+  // -checkpoint: the persistent auto dictionary with its stats.
+  void SaveState(CheckpointWriter *W) const;
+  bool LoadState(CheckpointReader *R);
+
+  // With -threads=N, Mutex guards Corpus against the other fuzzing threads.
+  void SetCorpus(const InputCorpus *Corpus, std::mutex *Mutex = nullptr) {
+    this->Corpus = Corpus;
+    CorpusMutex = Mutex;
+  }
 
   Random &GetRand() { return Rand; }
 
@@ -97,6 +120,8 @@ private:
                                size_t MaxSize);
   size_t MutateImpl(uint8_t *Data, size_t Size, size_t MaxSize,
                     Vector<Mutator> &Mutators);
+  size_t PickMutator();
+  void UpdateMutatorWeights();
 
   size_t InsertPartOf(const uint8_t *From, size_t FromSize, uint8_t *To,
                       size_t ToSize, size_t MaxToSize);
@@ -135,7 +160,13 @@ private:
   DictionaryEntry CmpDictionaryEntriesDeque[kCmpDictionaryEntriesDequeSize];
   size_t CmpDictionaryEntriesDequeIdx = 0;
 
+  // Copies a random element of Corpus into CrossOverWith, so that the
+  // cross-over itself runs without holding CorpusMutex.
+  bool CopyCrossOverUnit();
+
   const InputCorpus *Corpus = nullptr;
+  std::mutex *CorpusMutex = nullptr;
+  Unit CrossOverWith;
   Vector<uint8_t> MutateInPlaceHere;
   // CustomCrossOver needs its own buffer as a custom implementation may call
   // LLVMFuzzerMutate, which in turn may resize MutateInPlaceHere.
@@ -143,6 +174,26 @@ private:
 
   Vector<Mutator> Mutators;
   Vector<Mutator> DefaultMutators;
+
+  // The executions of the inputs made by each of Mutators, the new features
+  // they found and the attempts that did not mutate, per previous mutator of
+  // the sequence: the yield of M after Prev is at
+  // MutatorYields[(Prev + 1) * N + M], the first row being for the first
+  // mutation of a sequence.
+  struct MutatorYield {
+    double Runs = 0;  // Halved at every update of the weights.
+    double NewFeatures = 0;
+    double Failures = 0;
+    size_t TotalRuns = 0;
+    size_t TotalNewFeatures = 0;
+    size_t TotalFailures = 0;
+  };
+  Vector<MutatorYield> MutatorYields;
+  // Laid out like MutatorYields, cumulative along every row.
+  Vector<uint32_t> MutatorWeights;
+  size_t RunsSinceWeightsUpdate = 0;
+  size_t PrevMutator = kNoMutator;
+  size_t LastMutator = kNoMutator;
 };
 
 }  // namespace fuzzer
@@ -28,6 +28,7 @@ struct FuzzingOptions {
   bool DoCrossOver = true;
   int MutateDepth = 5;
   bool ReduceDepth = false;
+  bool AdaptiveMutators = true;
   bool UseCounters = false;
   bool UseMemmem = true;
   bool UseCmp = false;
@@ -35,12 +36,22 @@ struct FuzzingOptions {
   bool Shrink = false;
   bool ReduceInputs = false;
   int ReloadIntervalSec = 1;
+  bool WatchCorpus = true;
   bool ShuffleAtStartUp = true;
   bool PreferSmall = true;
+  size_t SeedLoaderThreads = 4;
+  size_t SeedPrefetch = 64;
   size_t MaxNumberOfRuns = -1L;
   int ReportSlowUnits = 10;
   bool OnlyASCII = false;
   std::string OutputCorpus;
+  std::string FeatureCache;
+  std::string Checkpoint;
+  int CheckpointIntervalSec = 300;
+  size_t MergeJobs = 1;
+  bool MergeWeighted = false;
+  bool BinaryCoverageSummary = false;
+  bool SummaryFileFeatures = false;
   std::string ArtifactPrefix = "./";
   std::string ExactArtifactPath;
   std::string ExitOnSrcPos;
@@ -51,9 +62,12 @@ struct FuzzingOptions {
   int PrintNewCovFuncs = 0;
   bool PrintFinalStats = false;
   bool PrintCorpusStats = false;
+  bool PrintMutatorStats = false;
   bool PrintCoverage = false;
   bool DumpCoverage = false;
   bool UseClangCoverage = false;
+  bool SparseReset = true;
+  bool MmapCorpus = false;
   bool DetectLeaks = true;
   int PurgeAllocatorIntervalSec = 1;
   int UseFeatureFrequency = false;
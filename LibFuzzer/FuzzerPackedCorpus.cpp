@@ -0,0 +1,431 @@
+//===- FuzzerPackedCorpus.cpp - Packed corpora ----------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Reading, writing and converting packed corpora.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerPackedCorpus.h"
+#include "FuzzerDigest.h"
+#include "FuzzerIO.h"
+#include <cstdlib>
+#include <map>
+#if LIBFUZZER_POSIX
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fuzzer {
+
+namespace {
+
+const uint32_t kPackedCorpusVersion = 1;
+const uint32_t kPackedInput = 1;
+const uint32_t kPackedDeletion = 2;
+
+struct FileHeader {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t Reserved;
+};
+
+struct RecordHeader {
+  uint32_t Kind;
+  uint32_t Size;
+  uint32_t NumFeatures;
+  uint8_t Sha1[kSHA1NumBytes];
+};
+
+static_assert(sizeof(FileHeader) == 16, "FileHeader must be 16 bytes");
+static_assert(sizeof(RecordHeader) == 32, "RecordHeader must be 32 bytes");
+
+size_t PaddedSize(size_t Size) { return (Size + 3) & ~size_t(3); }
+
+size_t RecordSize(const RecordHeader &RH) {
+  return sizeof(RH) + PaddedSize(RH.Size) +
+         size_t(RH.NumFeatures) * sizeof(uint32_t);
+}
+
+bool IsValidKind(uint32_t Kind) {
+  return Kind == kPackedInput || Kind == kPackedDeletion;
+}
+
+}  // namespace
+
+bool IsPackedCorpus(const std::string &Path) {
+  if (!IsFile(Path)) return false;
+  FILE *F = fopen(Path.c_str(), "rb");
+  if (!F) return false;
+  char Magic[sizeof(kPackedCorpusMagic)];
+  bool Res = fread(Magic, 1, sizeof(Magic), F) == sizeof(Magic) &&
+             !memcmp(Magic, kPackedCorpusMagic, sizeof(Magic));
+  fclose(F);
+  return Res;
+}
+
+PackedCorpus::~PackedCorpus() {
+#if LIBFUZZER_POSIX
+  if (Mapped) {
+    munmap(Base, Size);
+    return;
+  }
+#endif
+  free(Base);
+}
+
+bool PackedCorpus::Open(const std::string &P) {
+  assert(!Base);
+  Path = P;
+#if LIBFUZZER_POSIX
+  int Fd = open(Path.c_str(), O_RDONLY);
+  if (Fd < 0) return false;
+  struct stat St;
+  if (fstat(Fd, &St) || St.st_size < (off_t)sizeof(FileHeader)) {
+    close(Fd);
+    return false;
+  }
+  Size = St.st_size;
+  void *Map = mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, Fd, 0);
+  close(Fd);
+  if (Map == MAP_FAILED) return false;
+  Base = static_cast<uint8_t *>(Map);
+  Mapped = true;
+#else
+  FILE *F = fopen(Path.c_str(), "rb");
+  if (!F) return false;
+  fseek(F, 0, SEEK_END);
+  long FileSize = ftell(F);
+  fseek(F, 0, SEEK_SET);
+  if (FileSize < (long)sizeof(FileHeader)) {
+    fclose(F);
+    return false;
+  }
+  Size = FileSize;
+  Base = static_cast<uint8_t *>(malloc(Size));
+  bool ReadOk = Base && fread(Base, 1, Size, F) == Size;
+  fclose(F);
+  if (!ReadOk) return false;
+#endif
+  FileHeader FH;
+  memcpy(&FH, Base, sizeof(FH));
+  if (memcmp(FH.Magic, kPackedCorpusMagic, sizeof(FH.Magic)) ||
+      FH.Version != kPackedCorpusVersion) {
+    Printf("WARNING: %s is not a packed corpus of version %u\n", Path.c_str(),
+           kPackedCorpusVersion);
+    return false;
+  }
+
+  Vector<Entry> All;
+  bool HasDeletions = false;
+  size_t Pos = sizeof(FileHeader);
+  while (Pos < Size) {
+    RecordHeader RH;
+    if (Size - Pos < sizeof(RH)) break;
+    memcpy(&RH, Base + Pos, sizeof(RH));
+    if (!IsValidKind(RH.Kind) || Size - Pos < RecordSize(RH))
+      break;
+    const uint8_t *Payload = Base + Pos + sizeof(RH);
+    Entry E;
+    E.Data = Payload;
+    E.Size = RH.Kind == kPackedInput ? RH.Size : 0;
+    E.Sha1 = Base + Pos + offsetof(RecordHeader, Sha1);
+    E.Features = Span<uint32_t>(
+        reinterpret_cast<const uint32_t *>(Payload + PaddedSize(RH.Size)),
+        RH.NumFeatures);
+    E.Offset = Pos;
+    HasDeletions |= RH.Kind == kPackedDeletion;
+    if (RH.Kind == kPackedInput || HasDeletions)
+      All.push_back(E);
+    Pos += RecordSize(RH);
+  }
+  if (Pos != Size)
+    Printf("WARNING: ignoring the truncated or corrupt tail of %s at %zd\n",
+           Path.c_str(), Pos);
+
+  if (!HasDeletions) {
+    LiveEntries.swap(All);
+    return true;
+  }
+  // Deletion records have Size 0; drop them and the inputs they delete.
+  Vector<uint8_t> Live(All.size());
+  std::map<std::string, size_t> LastInput;
+  for (size_t i = 0; i < All.size(); i++) {
+    std::string Key(reinterpret_cast<const char *>(All[i].Sha1),
+                    kSHA1NumBytes);
+    RecordHeader RH;
+    memcpy(&RH, Base + All[i].Offset, sizeof(RH));
+    if (RH.Kind == kPackedInput) {
+      Live[i] = true;
+      LastInput[Key] = i;
+      continue;
+    }
+    auto It = LastInput.find(Key);
+    if (It == LastInput.end()) continue;
+    Live[It->second] = false;
+    LastInput.erase(It);
+  }
+  for (size_t i = 0; i < All.size(); i++)
+    if (Live[i])
+      LiveEntries.push_back(All[i]);
+  return true;
+}
+
+std::string PackedCorpus::EntryPath(const Entry &E) const {
+  return Path + "@" + std::to_string(E.Offset);
+}
+
+static std::mutex PackedCorporaMutex;
+static std::map<std::string, PackedCorpus *> *PackedCorpora;
+
+const PackedCorpus *GetPackedCorpus(const std::string &Path) {
+  std::lock_guard<std::mutex> Lock(PackedCorporaMutex);
+  if (!PackedCorpora)
+    PackedCorpora = new std::map<std::string, PackedCorpus *>;
+  auto It = PackedCorpora->find(Path);
+  if (It != PackedCorpora->end())
+    return It->second;
+  PackedCorpus *PC = new PackedCorpus;
+  if (!PC->Open(Path)) {
+    delete PC;
+    PC = nullptr;
+  }
+  (*PackedCorpora)[Path] = PC;
+  return PC;
+}
+
+bool ReadPackedCorpusEntry(const std::string &Path, size_t MaxSize, Unit *U) {
+  size_t At = Path.rfind('@');
+  if (At == std::string::npos || At + 1 == Path.size()) return false;
+  char *End = nullptr;
+  size_t Offset = strtoull(Path.c_str() + At + 1, &End, 10);
+  if (*End) return false;
+  auto PC = GetPackedCorpus(Path.substr(0, At));
+  if (!PC) return false;
+  auto &Entries = PC->Entries();
+  auto It = std::lower_bound(
+      Entries.begin(), Entries.end(), Offset,
+      [](const PackedCorpus::Entry &E, size_t O) { return E.Offset < O; });
+  if (It == Entries.end() || It->Offset != Offset) return false;
+  size_t Size = MaxSize ? std::min(It->Size, MaxSize) : It->Size;
+  U->assign(It->Data, It->Data + Size);
+  return true;
+}
+
+bool ReadPackedCorpusTail(const std::string &Path, size_t *Offset,
+                          size_t MaxSize, Vector<Unit> *V) {
+  FILE *F = fopen(Path.c_str(), "rb");
+  if (!F) return false;
+  size_t Pos = *Offset;
+  bool Ok = true;
+  if (!Pos) {
+    FileHeader FH;
+    Ok = fread(&FH, sizeof(FH), 1, F) == 1 &&
+         !memcmp(FH.Magic, kPackedCorpusMagic, sizeof(FH.Magic)) &&
+         FH.Version == kPackedCorpusVersion;
+    Pos = sizeof(FH);
+  } else {
+    Ok = !fseek(F, Pos, SEEK_SET);
+  }
+  RecordHeader RH;
+  Vector<uint8_t> Payload;
+  while (Ok && fread(&RH, sizeof(RH), 1, F) == 1) {
+    if (!IsValidKind(RH.Kind)) break;
+    size_t Rest = RecordSize(RH) - sizeof(RH);
+    Payload.resize(Rest);
+    // A record still being appended is read on the next call.
+    if (fread(Payload.data(), 1, Rest, F) != Rest) break;
+    Pos += sizeof(RH) + Rest;
+    if (RH.Kind == kPackedInput && RH.Size)
+      V->push_back(Unit(Payload.begin(),
+                        Payload.begin() +
+                            (MaxSize ? std::min(size_t(RH.Size), MaxSize)
+                                     : RH.Size)));
+  }
+  fclose(F);
+  if (Ok)
+    *Offset = Pos;
+  return Ok;
+}
+
+PackedCorpusWriter::~PackedCorpusWriter() {
+  if (Out)
+    fclose(Out);
+}
+
+// The offset past the last complete record of the packed corpus at Path.
+static size_t CompleteRecordsEnd(const std::string &Path, size_t FileSize) {
+  FILE *F = fopen(Path.c_str(), "rb");
+  if (!F) return 0;
+  size_t Pos = sizeof(FileHeader);
+  RecordHeader RH;
+  while (!fseek(F, Pos, SEEK_SET) && fread(&RH, sizeof(RH), 1, F) == 1 &&
+         IsValidKind(RH.Kind) && FileSize - Pos >= RecordSize(RH))
+    Pos += RecordSize(RH);
+  fclose(F);
+  return Pos;
+}
+
+// Appends Size bytes to F with one write, under an exclusive flock() that
+// the other writers of the file respect.
+static bool AppendLocked(FILE *F, const void *Data, size_t Size) {
+#if LIBFUZZER_POSIX
+  int Fd = fileno(F);
+  if (flock(Fd, LOCK_EX)) return false;
+  bool Ok = write(Fd, Data, Size) == (ssize_t)Size;
+  flock(Fd, LOCK_UN);
+  return Ok;
+#else
+  // TODO: lock the file on other platforms.
+  return fwrite(Data, 1, Size, F) == Size && !fflush(F);
+#endif
+}
+
+bool PackedCorpusWriter::Open(const std::string &Path) {
+  assert(!Out);
+  bool Exists = IsFile(Path);
+  if (Exists && !IsPackedCorpus(Path)) {
+    Printf("ERROR: %s exists and is not a packed corpus\n", Path.c_str());
+    return false;
+  }
+  Out = fopen(Path.c_str(), "ab");
+  if (!Out) return false;
+  FileHeader FH;
+  memcpy(FH.Magic, kPackedCorpusMagic, sizeof(FH.Magic));
+  FH.Version = kPackedCorpusVersion;
+  FH.Reserved = 0;
+#if LIBFUZZER_POSIX
+  // The records after a torn one would be read as a part of it.
+  int Fd = fileno(Out);
+  if (flock(Fd, LOCK_EX)) {
+    fclose(Out);
+    Out = nullptr;
+    return false;
+  }
+  size_t Size = FileSize(Path);
+  bool Ok = true;
+  if (!Size) {
+    Ok = write(Fd, &FH, sizeof(FH)) == (ssize_t)sizeof(FH);
+  } else {
+    size_t End = CompleteRecordsEnd(Path, Size);
+    if (End < Size) {
+      Printf("WARNING: truncating the torn tail of %s at %zd\n", Path.c_str(),
+             End);
+      Ok = !ftruncate(Fd, End);
+    }
+  }
+  flock(Fd, LOCK_UN);
+  if (!Ok) {
+    fclose(Out);
+    Out = nullptr;
+  }
+  return Ok;
+#else
+  // TODO: truncate the torn tail on other platforms.
+  if (!Exists || !FileSize(Path))
+    AppendLocked(Out, &FH, sizeof(FH));
+  return true;
+#endif
+}
+
+void PackedCorpusWriter::WriteRecord(uint32_t Kind, const uint8_t *Data,
+                                     size_t Size, const uint8_t *Sha1,
+                                     const Vector<uint32_t> *Features) {
+  RecordHeader RH;
+  RH.Kind = Kind;
+  RH.Size = Size;
+  RH.NumFeatures = Features ? Features->size() : 0;
+  if (Sha1)
+    memcpy(RH.Sha1, Sha1, kSHA1NumBytes);
+  else
+    ComputeSHA1(Data, Size, RH.Sha1);
+  Vector<uint8_t> Record(RecordSize(RH));
+  memcpy(Record.data(), &RH, sizeof(RH));
+  if (Size)
+    memcpy(Record.data() + sizeof(RH), Data, Size);
+  if (RH.NumFeatures)
+    memcpy(Record.data() + sizeof(RH) + PaddedSize(Size), Features->data(),
+           RH.NumFeatures * sizeof(uint32_t));
+  std::lock_guard<std::mutex> Lock(Mutex);
+  if (!Out) return;
+  AppendLocked(Out, Record.data(), Record.size());
+}
+
+void PackedCorpusWriter::Append(const uint8_t *Data, size_t Size,
+                                const uint8_t *Sha1,
+                                const Vector<uint32_t> *Features) {
+  WriteRecord(kPackedInput, Data, Size, Sha1, Features);
+}
+
+void PackedCorpusWriter::Delete(const uint8_t *Sha1) {
+  WriteRecord(kPackedDeletion, nullptr, 0, Sha1, nullptr);
+}
+
+int PackCorpus(const std::string &OutPath, const Vector<std::string> &Dirs) {
+  PackedCorpusWriter W;
+  if (!W.Open(OutPath)) {
+    Printf("ERROR: can't open %s for writing\n", OutPath.c_str());
+    return 1;
+  }
+  Vector<SizedFile> Files;
+  for (auto &Dir : Dirs)
+    GetSizedFilesFromDir(Dir, &Files);
+  // Hash in batches with the multi-buffer SHA1, skipping duplicates.
+  const size_t kBatchSize = 64;
+  DigestSet Seen;
+  size_t NumPacked = 0;
+  for (size_t Begin = 0; Begin < Files.size(); Begin += kBatchSize) {
+    size_t N = std::min(kBatchSize, Files.size() - Begin);
+    Vector<Unit> Units(N);
+    Vector<const uint8_t *> Data(N);
+    Vector<size_t> Sizes(N);
+    Vector<uint8_t> Sha1s(N * kSHA1NumBytes);
+    Vector<uint8_t *> Out(N);
+    for (size_t i = 0; i < N; i++) {
+      auto &SF = Files[Begin + i];
+      if (SF.Data) {
+        Data[i] = SF.Data;
+      } else {
+        Units[i] = FileToVector(SF.File, 0, /*ExitOnError=*/false);
+        Data[i] = Units[i].data();
+      }
+      Sizes[i] = SF.Data ? SF.Size : Units[i].size();
+      Out[i] = Sha1s.data() + i * kSHA1NumBytes;
+    }
+    ComputeSHA1MultiBuffer(Data.data(), Sizes.data(), N, Out.data());
+    for (size_t i = 0; i < N; i++) {
+      if (!Sizes[i] || !Seen.insert(ComputeDigest(Data[i], Sizes[i])))
+        continue;
+      W.Append(Data[i], Sizes[i], Out[i]);
+      NumPacked++;
+    }
+  }
+  Printf("INFO: packed %zd inputs into %s\n", NumPacked, OutPath.c_str());
+  return 0;
+}
+
+int UnpackCorpus(const std::string &OutDir, const Vector<std::string> &Packs) {
+  size_t NumUnpacked = 0;
+  for (auto &Path : Packs) {
+    auto PC = GetPackedCorpus(Path);
+    if (!PC) {
+      Printf("ERROR: %s is not a packed corpus\n", Path.c_str());
+      return 1;
+    }
+    for (auto &E : PC->Entries()) {
+      WriteToFile(Unit(E.Data, E.Data + E.Size),
+                  DirPlusFile(OutDir, Sha1ToString(E.Sha1)));
+      NumUnpacked++;
+    }
+  }
+  Printf("INFO: unpacked %zd inputs into %s\n", NumUnpacked, OutDir.c_str());
+  return 0;
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,112 @@
+//===- FuzzerPackedCorpus.h - Internal header for the Fuzzer ----*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Packed corpora: a whole corpus in one append-only file.
+//
+// The file starts with a 16-byte header (kPackedCorpusMagic, a version),
+// followed by records, all in host byte order:
+//   uint32_t Kind;         // kPackedInput or kPackedDeletion.
+//   uint32_t Size;         // Of the payload.
+//   uint32_t NumFeatures;  // Of the cached feature set, may be 0.
+//   uint8_t  Sha1[20];     // Of the payload (of the deleted input).
+//   payload, padded to 4 bytes, then NumFeatures uint32_t features.
+// A deletion record removes the latest earlier input with its SHA1. The
+// index is built by walking the record headers of the mapped file; a
+// truncated last record (e.g. after a crash) is ignored, and cut off by the
+// next writer that opens the file.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_PACKED_CORPUS_H
+#define LLVM_FUZZER_PACKED_CORPUS_H
+
+#include "FuzzerArena.h"
+#include "FuzzerDefs.h"
+#include "FuzzerSHA1.h"
+#include <cstdio>
+#include <mutex>
+
+namespace fuzzer {
+
+static const char kPackedCorpusMagic[8] = {'L', 'F', 'C', 'O',
+                                           'R', 'P', 'U', 'S'};
+
+// True if Path is a regular file that starts with kPackedCorpusMagic.
+bool IsPackedCorpus(const std::string &Path);
+
+class PackedCorpus {
+ public:
+  struct Entry {
+    const uint8_t *Data;
+    size_t Size;
+    const uint8_t *Sha1;
+    Span<uint32_t> Features;
+    size_t Offset;  // Of the record in the file.
+  };
+
+  ~PackedCorpus();
+  // Maps the file and indexes its live inputs.
+  bool Open(const std::string &Path);
+  const std::string &GetPath() const { return Path; }
+  const Vector<Entry> &Entries() const { return LiveEntries; }
+
+  // "Path@Offset", a name for an entry that FileToVector understands.
+  std::string EntryPath(const Entry &E) const;
+
+ private:
+  std::string Path;
+  uint8_t *Base = nullptr;
+  size_t Size = 0;
+  bool Mapped = false;
+  Vector<Entry> LiveEntries;
+};
+
+// Returns the packed corpus at Path, opened once per process and never
+// closed, so that the entries stay valid. Returns nullptr on failure.
+const PackedCorpus *GetPackedCorpus(const std::string &Path);
+
+// Reads the entry named by PackedCorpus::EntryPath. Returns false if Path
+// does not name one.
+bool ReadPackedCorpusEntry(const std::string &Path, size_t MaxSize, Unit *U);
+
+// Reads the inputs appended to the packed corpus Path at or after *Offset
+// (0 for the whole file) and moves *Offset past the last complete record.
+// Deletion records are skipped. Returns false if Path can not be read.
+bool ReadPackedCorpusTail(const std::string &Path, size_t *Offset,
+                          size_t MaxSize, Vector<Unit> *V);
+
+// Appends records to a packed corpus. Every record is appended with one
+// write under an exclusive flock() on Posix, so that the records of the -jobs
+// workers sharing the file never interleave. Thread-safe.
+class PackedCorpusWriter {
+ public:
+  ~PackedCorpusWriter();
+  // Creates the file if it does not exist, or truncates it to its last
+  // complete record.
+  bool Open(const std::string &Path);
+  // Sha1 and Features are optional.
+  void Append(const uint8_t *Data, size_t Size, const uint8_t *Sha1 = nullptr,
+              const Vector<uint32_t> *Features = nullptr);
+  void Delete(const uint8_t *Sha1);
+
+ private:
+  void WriteRecord(uint32_t Kind, const uint8_t *Data, size_t Size,
+                   const uint8_t *Sha1, const Vector<uint32_t> *Features);
+  FILE *Out = nullptr;
+  std::mutex Mutex;
+};
+
+// -pack_corpus: appends the inputs in Dirs (directories or packed corpora)
+// to the packed corpus OutPath.
+int PackCorpus(const std::string &OutPath, const Vector<std::string> &Dirs);
+// -unpack_corpus: writes the inputs of the packed corpora in Packs to the
+// directory OutDir, one file per input, named by its SHA1.
+int UnpackCorpus(const std::string &OutDir, const Vector<std::string> &Packs);
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_PACKED_CORPUS_H
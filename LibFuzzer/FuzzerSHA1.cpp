@@ -23,175 +23,263 @@
  * placed in the public domain by Wei Dai and other contributors.
  */
 
-#include <iomanip>
-#include <sstream>
+#include <algorithm>
+#include <atomic>
 #include <stdint.h>
 #include <string.h>
 
-namespace {  // Added for LibFuzzer
-
-#ifdef __BIG_ENDIAN__
-# define SHA_BIG_ENDIAN
-#elif defined __LITTLE_ENDIAN__
-/* override */
-#elif defined __BYTE_ORDER
-# if __BYTE_ORDER__ ==  __ORDER_BIG_ENDIAN__
-# define SHA_BIG_ENDIAN
-# endif
-#else // ! defined __LITTLE_ENDIAN__
-# include <endian.h> // machine/endian.h
-# if __BYTE_ORDER__ ==  __ORDER_BIG_ENDIAN__
-#  define SHA_BIG_ENDIAN
-# endif
+#if defined(__x86_64) && __has_attribute(target)
+#define SHA_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define SHA_X86 0
 #endif
 
-
-/* header */
+namespace {  // Added for LibFuzzer
 
 #define HASH_LENGTH 20
 #define BLOCK_LENGTH 64
 
-typedef struct sha1nfo {
-	uint32_t buffer[BLOCK_LENGTH/4];
-	uint32_t state[HASH_LENGTH/4];
-	uint32_t byteCount;
-	uint8_t bufferOffset;
-	uint8_t keyBuffer[BLOCK_LENGTH];
-	uint8_t innerHash[HASH_LENGTH];
-} sha1nfo;
-
-/* public API - prototypes - TODO: doxygen*/
-
-/**
- */
-void sha1_init(sha1nfo *s);
-/**
- */
-void sha1_writebyte(sha1nfo *s, uint8_t data);
-/**
- */
-void sha1_write(sha1nfo *s, const char *data, size_t len);
-/**
- */
-uint8_t* sha1_result(sha1nfo *s);
-
-
-/* code */
 #define SHA1_K0  0x5a827999
 #define SHA1_K20 0x6ed9eba1
 #define SHA1_K40 0x8f1bbcdc
 #define SHA1_K60 0xca62c1d6
 
-void sha1_init(sha1nfo *s) {
-	s->state[0] = 0x67452301;
-	s->state[1] = 0xefcdab89;
-	s->state[2] = 0x98badcfe;
-	s->state[3] = 0x10325476;
-	s->state[4] = 0xc3d2e1f0;
-	s->byteCount = 0;
-	s->bufferOffset = 0;
-}
+const uint32_t kSha1Init[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+                               0xc3d2e1f0};
 
-uint32_t sha1_rol32(uint32_t number, uint8_t bits) {
+inline uint32_t sha1_rol32(uint32_t number, uint8_t bits) {
 	return ((number << bits) | (number >> (32-bits)));
 }
 
-void sha1_hashBlock(sha1nfo *s) {
-	uint8_t i;
-	uint32_t a,b,c,d,e,t;
+inline uint32_t sha1_load_be32(const uint8_t *p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+	       (uint32_t)p[3];
+}
 
-	a=s->state[0];
-	b=s->state[1];
-	c=s->state[2];
-	d=s->state[3];
-	e=s->state[4];
-	for (i=0; i<80; i++) {
-		if (i>=16) {
-			t = s->buffer[(i+13)&15] ^ s->buffer[(i+8)&15] ^ s->buffer[(i+2)&15] ^ s->buffer[i&15];
-			s->buffer[i&15] = sha1_rol32(t,1);
-		}
-		if (i<20) {
-			t = (d ^ (b & (c ^ d))) + SHA1_K0;
-		} else if (i<40) {
-			t = (b ^ c ^ d) + SHA1_K20;
-		} else if (i<60) {
-			t = ((b & c) | (d & (b | c))) + SHA1_K40;
-		} else {
-			t = (b ^ c ^ d) + SHA1_K60;
+inline void sha1_store_be32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+// Hashes 'blocks' whole blocks of 'data' into 'state'.
+void sha1_compress_scalar(uint32_t state[5], const uint8_t *data,
+                          size_t blocks) {
+	uint32_t buffer[16];
+	for (; blocks--; data += BLOCK_LENGTH) {
+		uint32_t a,b,c,d,e,t;
+		for (int i=0; i<16; i++)
+			buffer[i] = sha1_load_be32(data + 4*i);
+		a=state[0];
+		b=state[1];
+		c=state[2];
+		d=state[3];
+		e=state[4];
+		for (int i=0; i<80; i++) {
+			if (i>=16) {
+				t = buffer[(i+13)&15] ^ buffer[(i+8)&15] ^ buffer[(i+2)&15] ^ buffer[i&15];
+				buffer[i&15] = sha1_rol32(t,1);
+			}
+			if (i<20) {
+				t = (d ^ (b & (c ^ d))) + SHA1_K0;
+			} else if (i<40) {
+				t = (b ^ c ^ d) + SHA1_K20;
+			} else if (i<60) {
+				t = ((b & c) | (d & (b | c))) + SHA1_K40;
+			} else {
+				t = (b ^ c ^ d) + SHA1_K60;
+			}
+			t+=sha1_rol32(a,5) + e + buffer[i&15];
+			e=d;
+			d=c;
+			c=sha1_rol32(b,30);
+			b=a;
+			a=t;
 		}
-		t+=sha1_rol32(a,5) + e + s->buffer[i&15];
-		e=d;
-		d=c;
-		c=sha1_rol32(b,30);
-		b=a;
-		a=t;
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
 	}
-	s->state[0] += a;
-	s->state[1] += b;
-	s->state[2] += c;
-	s->state[3] += d;
-	s->state[4] += e;
 }
 
-void sha1_addUncounted(sha1nfo *s, uint8_t data) {
-	uint8_t * const b = (uint8_t*) s->buffer;
-#ifdef SHA_BIG_ENDIAN
-	b[s->bufferOffset] = data;
-#else
-	b[s->bufferOffset ^ 3] = data;
-#endif
-	s->bufferOffset++;
-	if (s->bufferOffset == BLOCK_LENGTH) {
-		sha1_hashBlock(s);
-		s->bufferOffset = 0;
+#if SHA_X86
+
+// Four rounds with the SHA extensions; G is the number of the group of four
+// rounds, 0 to 19. Message words are loaded for the first four groups. The
+// schedule updates of the first and last groups compute values that are
+// never used, which keeps all groups the same.
+#define SHA1_NI_ROUNDS4(G)                                                     \
+	do {                                                                       \
+		if ((G) < 4)                                                           \
+			MSG[(G)] = _mm_shuffle_epi8(                                       \
+			    _mm_loadu_si128((const __m128i *)(data + 16 * (G))), MASK);    \
+		E[(G)&1] = (G) ? _mm_sha1nexte_epu32(E[(G)&1], MSG[(G)%4])             \
+		               : _mm_add_epi32(E[0], MSG[0]);                          \
+		E[((G)+1)&1] = ABCD;                                                   \
+		MSG[((G)+1)%4] = _mm_sha1msg2_epu32(MSG[((G)+1)%4], MSG[(G)%4]);       \
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E[(G)&1], (G)/5);                     \
+		MSG[((G)+3)%4] = _mm_sha1msg1_epu32(MSG[((G)+3)%4], MSG[(G)%4]);       \
+		MSG[((G)+2)%4] = _mm_xor_si128(MSG[((G)+2)%4], MSG[(G)%4]);            \
+	} while (0)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+void sha1_compress_shani(uint32_t state[5], const uint8_t *data,
+                         size_t blocks) {
+	const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL,
+	                                    0x08090a0b0c0d0e0fULL);
+	__m128i ABCD = _mm_shuffle_epi32(
+	    _mm_loadu_si128((const __m128i *)state), 0x1B);
+	__m128i E0 = _mm_set_epi32(state[4], 0, 0, 0);
+	__m128i MSG[4] = {_mm_setzero_si128(), _mm_setzero_si128(),
+	                  _mm_setzero_si128(), _mm_setzero_si128()};
+	for (; blocks--; data += BLOCK_LENGTH) {
+		__m128i ABCD_SAVE = ABCD, E0_SAVE = E0;
+		__m128i E[2] = {E0, _mm_setzero_si128()};
+		SHA1_NI_ROUNDS4(0);  SHA1_NI_ROUNDS4(1);  SHA1_NI_ROUNDS4(2);
+		SHA1_NI_ROUNDS4(3);  SHA1_NI_ROUNDS4(4);  SHA1_NI_ROUNDS4(5);
+		SHA1_NI_ROUNDS4(6);  SHA1_NI_ROUNDS4(7);  SHA1_NI_ROUNDS4(8);
+		SHA1_NI_ROUNDS4(9);  SHA1_NI_ROUNDS4(10); SHA1_NI_ROUNDS4(11);
+		SHA1_NI_ROUNDS4(12); SHA1_NI_ROUNDS4(13); SHA1_NI_ROUNDS4(14);
+		SHA1_NI_ROUNDS4(15); SHA1_NI_ROUNDS4(16); SHA1_NI_ROUNDS4(17);
+		SHA1_NI_ROUNDS4(18); SHA1_NI_ROUNDS4(19);
+		// After group 19 E[0] holds ABCD of group 18, whose A is the next E.
+		E0 = _mm_sha1nexte_epu32(E[0], E0_SAVE);
+		ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
 	}
+	_mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(ABCD, 0x1B));
+	state[4] = _mm_extract_epi32(E0, 3);
 }
 
-void sha1_writebyte(sha1nfo *s, uint8_t data) {
-	++s->byteCount;
-	sha1_addUncounted(s, data);
+#undef SHA1_NI_ROUNDS4
+
+const int kNumLanes = 8;
+
+#define SHA1_AVX2_ROL(X, N) \
+	_mm256_or_si256(_mm256_slli_epi32((X), (N)), _mm256_srli_epi32((X), 32 - (N)))
+
+// Hashes one block of each of the 8 lanes: lane l reads blocks[l] and
+// updates state[0..4][l].
+__attribute__((target("avx2")))
+void sha1_compress_avx2x8(uint32_t state[5][kNumLanes],
+                          const uint8_t *const blocks[kNumLanes]) {
+	uint32_t words[16][kNumLanes];
+	for (int l = 0; l < kNumLanes; l++)
+		for (int i = 0; i < 16; i++)
+			words[i][l] = sha1_load_be32(blocks[l] + 4*i);
+	__m256i w[16];
+	for (int i = 0; i < 16; i++)
+		w[i] = _mm256_loadu_si256((const __m256i *)words[i]);
+	__m256i s[5];
+	for (int i = 0; i < 5; i++)
+		s[i] = _mm256_loadu_si256((const __m256i *)state[i]);
+	__m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4];
+	for (int i = 0; i < 80; i++) {
+		if (i >= 16) {
+			__m256i t = _mm256_xor_si256(
+			    _mm256_xor_si256(w[(i+13)&15], w[(i+8)&15]),
+			    _mm256_xor_si256(w[(i+2)&15], w[i&15]));
+			w[i&15] = SHA1_AVX2_ROL(t, 1);
+		}
+		__m256i f;
+		if (i < 20) {
+			f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+			f = _mm256_add_epi32(f, _mm256_set1_epi32(SHA1_K0));
+		} else if (i < 40) {
+			f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+			f = _mm256_add_epi32(f, _mm256_set1_epi32(SHA1_K20));
+		} else if (i < 60) {
+			f = _mm256_or_si256(_mm256_and_si256(b, c),
+			                    _mm256_and_si256(d, _mm256_or_si256(b, c)));
+			f = _mm256_add_epi32(f, _mm256_set1_epi32((int)SHA1_K40));
+		} else {
+			f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+			f = _mm256_add_epi32(f, _mm256_set1_epi32((int)SHA1_K60));
+		}
+		__m256i t = _mm256_add_epi32(
+		    _mm256_add_epi32(f, SHA1_AVX2_ROL(a, 5)),
+		    _mm256_add_epi32(e, w[i&15]));
+		e = d;
+		d = c;
+		c = SHA1_AVX2_ROL(b, 30);
+		b = a;
+		a = t;
+	}
+	s[0] = _mm256_add_epi32(s[0], a);
+	s[1] = _mm256_add_epi32(s[1], b);
+	s[2] = _mm256_add_epi32(s[2], c);
+	s[3] = _mm256_add_epi32(s[3], d);
+	s[4] = _mm256_add_epi32(s[4], e);
+	for (int i = 0; i < 5; i++)
+		_mm256_storeu_si256((__m256i *)state[i], s[i]);
 }
 
-void sha1_write(sha1nfo *s, const char *data, size_t len) {
-	for (;len--;) sha1_writebyte(s, (uint8_t) *data++);
+#undef SHA1_AVX2_ROL
+
+int sha1_detect() {
+	unsigned a, b, c, d;
+	int res = fuzzer::SHA1_SCALAR;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		res = fuzzer::SHA1_AVX2;
+	if (__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3") &&
+	    __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1 << 29)))
+		res = fuzzer::SHA1_NI;
+	return res;
 }
 
-void sha1_pad(sha1nfo *s) {
-	// Implement SHA-1 padding (fips180-2 §5.1.1)
-
-	// Pad with 0x80 followed by 0x00 until the end of the block
-	sha1_addUncounted(s, 0x80);
-	while (s->bufferOffset != 56) sha1_addUncounted(s, 0x00);
+#endif  // SHA_X86
 
-	// Append length in the last 8 bytes
-	sha1_addUncounted(s, 0); // We're only using 32 bit lengths
-	sha1_addUncounted(s, 0); // But SHA-1 supports 64 bit lengths
-	sha1_addUncounted(s, 0); // So zero pad the top bits
-	sha1_addUncounted(s, s->byteCount >> 29); // Shifting to multiply by 8
-	sha1_addUncounted(s, s->byteCount >> 21); // as SHA-1 supports bitstreams as well as
-	sha1_addUncounted(s, s->byteCount >> 13); // byte.
-	sha1_addUncounted(s, s->byteCount >> 5);
-	sha1_addUncounted(s, s->byteCount << 3);
+int sha1_best_level() {
+#if SHA_X86
+	static int level = sha1_detect();
+	return level;
+#else
+	return fuzzer::SHA1_SCALAR;
+#endif
 }
 
-uint8_t* sha1_result(sha1nfo *s) {
-	// Pad to complete the last block
-	sha1_pad(s);
+// -1 until the first use.
+std::atomic<int> sha1_current_level(-1);
 
-#ifndef SHA_BIG_ENDIAN
-	// Swap byte order back
-	int i;
-	for (i=0; i<5; i++) {
-		s->state[i]=
-			  (((s->state[i])<<24)& 0xff000000)
-			| (((s->state[i])<<8) & 0x00ff0000)
-			| (((s->state[i])>>8) & 0x0000ff00)
-			| (((s->state[i])>>24)& 0x000000ff);
+int sha1_level() {
+	int level = sha1_current_level.load(std::memory_order_relaxed);
+	if (level < 0) {
+		level = sha1_best_level();
+		sha1_current_level.store(level, std::memory_order_relaxed);
 	}
+	return level;
+}
+
+void sha1_compress(uint32_t state[5], const uint8_t *data, size_t blocks) {
+#if SHA_X86
+	if (sha1_level() == fuzzer::SHA1_NI)
+		return sha1_compress_shani(state, data, blocks);
 #endif
+	sha1_compress_scalar(state, data, blocks);
+}
 
-	// Return pointer to hash (20 characters)
-	return (uint8_t*) s->state;
+// Writes the padded last bytes of a message of 'len' bytes to 'tail',
+// returns the number of blocks written (1 or 2).
+size_t sha1_tail(const uint8_t *data, size_t len, uint8_t tail[2 * BLOCK_LENGTH]) {
+	size_t rest = len % BLOCK_LENGTH;
+	size_t blocks = rest < 56 ? 1 : 2;
+	memset(tail, 0, blocks * BLOCK_LENGTH);
+	memcpy(tail, data + len - rest, rest);
+	tail[rest] = 0x80;
+	uint64_t bits = (uint64_t)len * 8;
+	sha1_store_be32(tail + blocks * BLOCK_LENGTH - 8, bits >> 32);
+	sha1_store_be32(tail + blocks * BLOCK_LENGTH - 4, bits);
+	return blocks;
+}
+
+void sha1_result(const uint32_t state[5], uint8_t *out) {
+	for (int i = 0; i < 5; i++)
+		sha1_store_be32(out + 4*i, state[i]);
 }
 
 }  // namespace; Added for LibFuzzer
@@ -200,17 +288,86 @@ namespace fuzzer {
 
 // The rest is added for LibFuzzer
 void ComputeSHA1(const uint8_t *Data, size_t Len, uint8_t *Out) {
-  sha1nfo s;
-  sha1_init(&s);
-  sha1_write(&s, (const char*)Data, Len);
-  memcpy(Out, sha1_result(&s), HASH_LENGTH);
+  uint32_t State[5];
+  memcpy(State, kSha1Init, sizeof(State));
+  sha1_compress(State, Data, Len / BLOCK_LENGTH);
+  uint8_t Tail[2 * BLOCK_LENGTH];
+  sha1_compress(State, Tail, sha1_tail(Data, Len, Tail));
+  sha1_result(State, Out);
+}
+
+void ComputeSHA1MultiBuffer(const uint8_t *const *Data, const size_t *Sizes,
+                            size_t N, uint8_t *const *Out) {
+#if SHA_X86
+  if (sha1_level() == fuzzer::SHA1_AVX2 && N > 1) {
+    // Each lane hashes one buffer at a time and takes the next pending one
+    // when it is done. Idle lanes hash a dummy block.
+    struct Lane {
+      size_t Buf;  // Index of the buffer, N if idle.
+      size_t Block, NumFullBlocks, NumBlocks;
+      uint8_t Tail[2 * BLOCK_LENGTH];
+    } Lanes[kNumLanes];
+    static const uint8_t Dummy[BLOCK_LENGTH] = {};
+    uint32_t LaneState[5][kNumLanes];
+    size_t NextBuf = 0, NumBusy = 0;
+    auto Refill = [&](int L) {
+      Lane &Ln = Lanes[L];
+      Ln.Buf = NextBuf < N ? NextBuf++ : N;
+      for (int i = 0; i < 5; i++)
+        LaneState[i][L] = kSha1Init[i];
+      if (Ln.Buf == N) return;
+      NumBusy++;
+      Ln.Block = 0;
+      Ln.NumFullBlocks = Sizes[Ln.Buf] / BLOCK_LENGTH;
+      Ln.NumBlocks =
+          Ln.NumFullBlocks + sha1_tail(Data[Ln.Buf], Sizes[Ln.Buf], Ln.Tail);
+    };
+    for (int L = 0; L < kNumLanes; L++)
+      Refill(L);
+    while (NumBusy) {
+      const uint8_t *Blocks[kNumLanes];
+      for (int L = 0; L < kNumLanes; L++) {
+        Lane &Ln = Lanes[L];
+        if (Ln.Buf == N)
+          Blocks[L] = Dummy;
+        else if (Ln.Block < Ln.NumFullBlocks)
+          Blocks[L] = Data[Ln.Buf] + Ln.Block * BLOCK_LENGTH;
+        else
+          Blocks[L] = Ln.Tail + (Ln.Block - Ln.NumFullBlocks) * BLOCK_LENGTH;
+      }
+      sha1_compress_avx2x8(LaneState, Blocks);
+      for (int L = 0; L < kNumLanes; L++) {
+        Lane &Ln = Lanes[L];
+        if (Ln.Buf == N || ++Ln.Block < Ln.NumBlocks) continue;
+        uint32_t Res[5];
+        for (int i = 0; i < 5; i++)
+          Res[i] = LaneState[i][L];
+        sha1_result(Res, Out[Ln.Buf]);
+        NumBusy--;
+        Refill(L);
+      }
+    }
+    return;
+  }
+#endif
+  for (size_t i = 0; i < N; i++)
+    ComputeSHA1(Data[i], Sizes[i], Out[i]);
+}
+
+SHA1Impl SetSHA1Impl(SHA1Impl I) {
+  I = std::min(I, static_cast<SHA1Impl>(sha1_best_level()));
+  sha1_current_level.store(I, std::memory_order_relaxed);
+  return I;
 }
 
 std::string Sha1ToString(const uint8_t Sha1[kSHA1NumBytes]) {
-  std::stringstream SS;
-  for (int i = 0; i < kSHA1NumBytes; i++)
-    SS << std::hex << std::setfill('0') << std::setw(2) << (unsigned)Sha1[i];
-  return SS.str();
+  static const char kHex[] = "0123456789abcdef";
+  std::string Res(2 * kSHA1NumBytes, '0');
+  for (int i = 0; i < kSHA1NumBytes; i++) {
+    Res[2 * i] = kHex[Sha1[i] >> 4];
+    Res[2 * i + 1] = kHex[Sha1[i] & 15];
+  }
+  return Res;
 }
 
 std::string Hash(const Unit &U) {
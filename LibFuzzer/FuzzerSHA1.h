@@ -24,6 +24,22 @@ static const int kSHA1NumBytes = 20;
 // Computes SHA1 hash of 'Len' bytes in 'Data', writes kSHA1NumBytes to 'Out'.
 void ComputeSHA1(const uint8_t *Data, size_t Len, uint8_t *Out);
 
+// Computes the SHA1 of N buffers at once: Out[i] = SHA1(Data[i], Sizes[i]).
+// Without the SHA extensions, up to 8 buffers are hashed in parallel with
+// AVX2.
+void ComputeSHA1MultiBuffer(const uint8_t *const *Data, const size_t *Sizes,
+                            size_t N, uint8_t *const *Out);
+
+enum SHA1Impl {
+  SHA1_SCALAR = 0,
+  SHA1_AVX2 = 1,  // Only used by ComputeSHA1MultiBuffer.
+  SHA1_NI = 2,
+};
+
+// Uses min(I, <best supported implementation>) from now on and returns it.
+// For tests.
+SHA1Impl SetSHA1Impl(SHA1Impl I);
+
 std::string Sha1ToString(const uint8_t Sha1[kSHA1NumBytes]);
 
 std::string Hash(const Unit &U);
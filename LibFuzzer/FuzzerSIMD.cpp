@@ -0,0 +1,189 @@
+//===- FuzzerSIMD.cpp - Vectorized coverage map scanning ------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Scalar, AVX2 and AVX-512 versions of the scanning kernels.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerSIMD.h"
+#include "FuzzerTracePC.h"
+#include <atomic>
+#include <cstring>
+
+#if defined(__x86_64) && __has_attribute(target)
+#define LIBFUZZER_X86_SIMD 1
+#include <immintrin.h>
+#define ATTRIBUTE_TARGET_AVX2 __attribute__((target("avx2")))
+#define ATTRIBUTE_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#else
+#define LIBFUZZER_X86_SIMD 0
+#endif
+
+namespace fuzzer {
+
+// -1 until the first use.
+static std::atomic<int> CurrentSIMDLevel(-1);
+
+static SIMDLevel BestSupportedSIMDLevel() {
+#if LIBFUZZER_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw"))
+    return SIMD_AVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return SIMD_AVX2;
+#endif
+  return SIMD_NONE;
+}
+
+SIMDLevel GetSIMDLevel() {
+  int L = CurrentSIMDLevel.load(std::memory_order_relaxed);
+  if (L < 0) {
+    L = BestSupportedSIMDLevel();
+    CurrentSIMDLevel.store(L, std::memory_order_relaxed);
+  }
+  return static_cast<SIMDLevel>(L);
+}
+
+SIMDLevel SetSIMDLevel(SIMDLevel L) {
+  L = std::min(L, BestSupportedSIMDLevel());
+  CurrentSIMDLevel.store(L, std::memory_order_relaxed);
+  return L;
+}
+
+ATTRIBUTE_NO_SANITIZE_ALL
+static const uint8_t *FindNonZeroBlockScalar(const uint8_t *Begin,
+                                             const uint8_t *End,
+                                             uint64_t *Mask) {
+  for (const uint8_t *P = Begin; P < End; P += kSIMDBlockSize) {
+    const uint64_t *W = reinterpret_cast<const uint64_t *>(P);
+    uint64_t Any = 0;
+    for (size_t i = 0; i < kSIMDBlockSize / 8; i++)
+      Any |= W[i];
+    if (!Any) continue;
+    uint64_t M = 0;
+    for (size_t i = 0; i < kSIMDBlockSize; i++)
+      if (P[i])
+        M |= 1ULL << i;
+    *Mask = M;
+    return P;
+  }
+  return End;
+}
+
+static void ClassifyCountersScalar(const uint8_t *Counters, uint8_t *Buckets,
+                                   size_t N) {
+  for (size_t i = 0; i < N; i++)
+    Buckets[i] = Counters[i] ? CounterToFeature(Counters[i]) : 0;
+}
+
+#if LIBFUZZER_X86_SIMD
+
+// The lower bounds of the CounterToFeature buckets 1..7: the bucket of a
+// counter is the number of bounds it reaches.
+static const uint8_t kBucketBounds[] = {2, 3, 4, 8, 16, 32, 128};
+
+ATTRIBUTE_NO_SANITIZE_ALL ATTRIBUTE_TARGET_AVX2
+static const uint8_t *FindNonZeroBlockAVX2(const uint8_t *Begin,
+                                           const uint8_t *End, uint64_t *Mask) {
+  const __m256i Zero = _mm256_setzero_si256();
+  for (const uint8_t *P = Begin; P < End; P += kSIMDBlockSize) {
+    __m256i A = _mm256_load_si256(reinterpret_cast<const __m256i *>(P));
+    __m256i B = _mm256_load_si256(reinterpret_cast<const __m256i *>(P + 32));
+    __m256i AB = _mm256_or_si256(A, B);
+    if (_mm256_testz_si256(AB, AB)) continue;
+    uint32_t ZA = _mm256_movemask_epi8(_mm256_cmpeq_epi8(A, Zero));
+    uint32_t ZB = _mm256_movemask_epi8(_mm256_cmpeq_epi8(B, Zero));
+    *Mask = ~(static_cast<uint64_t>(ZB) << 32 | ZA);
+    return P;
+  }
+  return End;
+}
+
+// Classifies 32 counters at a time.
+ATTRIBUTE_TARGET_AVX2
+static void ClassifyCountersAVX2(const uint8_t *Counters, uint8_t *Buckets,
+                                 size_t N) {
+  size_t i = 0;
+  for (; i + 32 <= N; i += 32) {
+    __m256i C =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(Counters + i));
+    __m256i Res = _mm256_setzero_si256();
+    for (uint8_t Bound : kBucketBounds) {
+      // C >= Bound <=> max(C, Bound) == C; the comparison yields -1.
+      __m256i Max = _mm256_max_epu8(C, _mm256_set1_epi8(Bound));
+      __m256i GE = _mm256_cmpeq_epi8(Max, C);
+      Res = _mm256_sub_epi8(Res, GE);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(Buckets + i), Res);
+  }
+  ClassifyCountersScalar(Counters + i, Buckets + i, N - i);
+}
+
+ATTRIBUTE_NO_SANITIZE_ALL ATTRIBUTE_TARGET_AVX512
+static const uint8_t *FindNonZeroBlockAVX512(const uint8_t *Begin,
+                                             const uint8_t *End,
+                                             uint64_t *Mask) {
+  for (const uint8_t *P = Begin; P < End; P += kSIMDBlockSize) {
+    __m512i V = _mm512_load_si512(reinterpret_cast<const void *>(P));
+    if (uint64_t M = _mm512_test_epi8_mask(V, V)) {
+      *Mask = M;
+      return P;
+    }
+  }
+  return End;
+}
+
+ATTRIBUTE_TARGET_AVX512
+static void ClassifyCountersAVX512(const uint8_t *Counters, uint8_t *Buckets,
+                                   size_t N) {
+  const __m512i One = _mm512_set1_epi8(1);
+  size_t i = 0;
+  for (; i + 64 <= N; i += 64) {
+    __m512i C =
+        _mm512_loadu_si512(reinterpret_cast<const void *>(Counters + i));
+    __m512i Res = _mm512_setzero_si512();
+    for (uint8_t Bound : kBucketBounds) {
+      __mmask64 GE = _mm512_cmpge_epu8_mask(C, _mm512_set1_epi8(Bound));
+      Res = _mm512_mask_add_epi8(Res, GE, Res, One);
+    }
+    _mm512_storeu_si512(reinterpret_cast<void *>(Buckets + i), Res);
+  }
+  ClassifyCountersAVX2(Counters + i, Buckets + i, N - i);
+}
+
+#endif  // LIBFUZZER_X86_SIMD
+
+const uint8_t *FindNonZeroBlock(const uint8_t *Begin, const uint8_t *End,
+                                uint64_t *Mask) {
+  assert(!(reinterpret_cast<uintptr_t>(Begin) % kSIMDBlockSize));
+  assert(!(reinterpret_cast<uintptr_t>(End) % kSIMDBlockSize));
+  switch (GetSIMDLevel()) {
+#if LIBFUZZER_X86_SIMD
+  case SIMD_AVX512:
+    return FindNonZeroBlockAVX512(Begin, End, Mask);
+  case SIMD_AVX2:
+    return FindNonZeroBlockAVX2(Begin, End, Mask);
+#endif
+  default:
+    return FindNonZeroBlockScalar(Begin, End, Mask);
+  }
+}
+
+void ClassifyCounters(const uint8_t *Counters, uint8_t *Buckets, size_t N) {
+  switch (GetSIMDLevel()) {
+#if LIBFUZZER_X86_SIMD
+  case SIMD_AVX512:
+    return ClassifyCountersAVX512(Counters, Buckets, N);
+  case SIMD_AVX2:
+    return ClassifyCountersAVX2(Counters, Buckets, N);
+#endif
+  default:
+    return ClassifyCountersScalar(Counters, Buckets, N);
+  }
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,47 @@
+//===- FuzzerSIMD.h - Internal header for the Fuzzer ------------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Vectorized scanning of the coverage maps, dispatched at run time to the
+// best instruction set supported by the CPU.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_SIMD_H
+#define LLVM_FUZZER_SIMD_H
+
+#include "FuzzerDefs.h"
+
+namespace fuzzer {
+
+enum SIMDLevel {
+  SIMD_NONE = 0,
+  SIMD_AVX2 = 1,
+  SIMD_AVX512 = 2,
+};
+
+// The blocks scanned by FindNonZeroBlock, one bit of the mask per byte.
+static const size_t kSIMDBlockSize = 64;
+
+// The level used by the kernels below, the best one the CPU supports unless
+// changed by SetSIMDLevel.
+SIMDLevel GetSIMDLevel();
+// Uses min(L, <best supported level>) from now on and returns it.
+SIMDLevel SetSIMDLevel(SIMDLevel L);
+
+// Begin and End must be kSIMDBlockSize-aligned. Returns the first block in
+// [Begin, End) that has a non-zero byte and stores in *Mask which of its
+// bytes are non-zero, or returns End.
+const uint8_t *FindNonZeroBlock(const uint8_t *Begin, const uint8_t *End,
+                                uint64_t *Mask);
+
+// Buckets[i] = CounterToFeature(Counters[i]) for the non-zero counters,
+// Buckets[i] = 0 for the zero ones.
+void ClassifyCounters(const uint8_t *Counters, uint8_t *Buckets, size_t N);
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_SIMD_H
@@ -0,0 +1,107 @@
+//===- FuzzerSeedLoader.cpp - Prefetching seed corpus loader --------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// SeedLoader. The I/O threads take the files in order under the mutex but
+// read and hash them without it, so several reads are in flight at once;
+// the entry of a file is only reused once the consumer is past it.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerSeedLoader.h"
+#include <algorithm>
+
+namespace fuzzer {
+
+SeedLoader::SeedLoader(const Vector<SizedFile> &Files, size_t MaxSize,
+                       size_t NumThreads, size_t Window)
+    : Files(Files), MaxSize(MaxSize) {
+  if (!NumThreads) Window = 1;
+  Ring.resize(std::max<size_t>(Window, 1));
+  NumThreads = std::min(NumThreads, Files.size());
+  for (size_t i = 0; i < NumThreads; i++)
+    Threads.push_back(std::thread([this] { IOThread(); }));
+}
+
+SeedLoader::~SeedLoader() {
+  {
+    std::lock_guard<std::mutex> Lock(Mu);
+    Stopping = true;
+  }
+  Consumed.notify_all();
+  for (auto &T : Threads)
+    T.join();
+}
+
+void SeedLoader::Load(size_t Idx, Entry *E) {
+  const SizedFile &SF = Files[Idx];
+  if (SF.Data) {
+    E->Data = SF.Data;
+    E->Size = std::min(SF.Size, MaxSize);
+  } else {
+    E->U = FileToVector(SF.File, MaxSize, /*ExitOnError=*/false);
+    E->Data = E->U.data();
+    E->Size = E->U.size();
+  }
+  E->Digest = ComputeDigest(E->Data, E->Size);
+}
+
+void SeedLoader::IOThread() {
+  std::unique_lock<std::mutex> Lock(Mu);
+  while (true) {
+    Consumed.wait(Lock, [&] {
+      return Stopping || NextToLoad >= Files.size() ||
+             NextToLoad < NextToConsume + Ring.size();
+    });
+    if (Stopping || NextToLoad >= Files.size())
+      return;
+    size_t Idx = NextToLoad++;
+    Entry *E = &Ring[Idx % Ring.size()];
+    Lock.unlock();
+    Load(Idx, E);
+    Lock.lock();
+    E->Ready = true;
+    if (Idx == NextToConsume)
+      Loaded.notify_one();
+  }
+}
+
+void SeedLoader::Release() {
+  Entry &E = Ring[NextToConsume % Ring.size()];
+  Unit().swap(E.U);
+  E.Ready = false;
+  NextToConsume++;
+  HoldingEntry = false;
+}
+
+bool SeedLoader::Next(const uint8_t **Data, size_t *Size) {
+  std::unique_lock<std::mutex> Lock(Mu);
+  if (HoldingEntry) {
+    Release();
+    Consumed.notify_all();
+  }
+  while (NextToConsume < Files.size()) {
+    Entry &E = Ring[NextToConsume % Ring.size()];
+    if (Threads.empty()) {
+      NextToLoad++;
+      Load(NextToConsume, &E);
+      E.Ready = true;
+    }
+    Loaded.wait(Lock, [&] { return E.Ready; });
+    if (Seen.insert(E.Digest)) {
+      HoldingEntry = true;
+      *Data = E.Data;
+      *Size = E.Size;
+      return true;
+    }
+    Duplicates++;
+    Release();
+    Consumed.notify_all();
+  }
+  return false;
+}
+
+}  // namespace fuzzer
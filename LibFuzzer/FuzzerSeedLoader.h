@@ -0,0 +1,74 @@
+//===- FuzzerSeedLoader.h - Internal header for the Fuzzer ------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::SeedLoader: reads the seed corpus ahead of its execution.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_SEED_LOADER_H
+#define LLVM_FUZZER_SEED_LOADER_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerDigest.h"
+#include "FuzzerIO.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace fuzzer {
+
+// I/O threads read and hash the files of Files in order, at most Window
+// files ahead of the consumer, which gets them in the same order with the
+// exact duplicates left out. The inputs of packed corpora are hashed in
+// place. With no I/O threads the files are read by Next itself.
+class SeedLoader {
+ public:
+  // Files must outlive the loader. Inputs are truncated to MaxSize bytes.
+  SeedLoader(const Vector<SizedFile> &Files, size_t MaxSize,
+             size_t NumThreads, size_t Window);
+  ~SeedLoader();
+
+  // Returns false when all the files were consumed. The data stays valid
+  // until the next call.
+  bool Next(const uint8_t **Data, size_t *Size);
+
+  // Of the input returned by the last call to Next.
+  const UnitDigest &Digest() const {
+    return Ring[NextToConsume % Ring.size()].Digest;
+  }
+  size_t NumDuplicates() const { return Duplicates; }
+
+ private:
+  struct Entry {
+    Unit U;
+    const uint8_t *Data = nullptr;
+    size_t Size = 0;
+    UnitDigest Digest;
+    bool Ready = false;
+  };
+
+  void Load(size_t Idx, Entry *E);
+  void IOThread();
+  void Release();
+
+  const Vector<SizedFile> &Files;
+  const size_t MaxSize;
+  Vector<Entry> Ring;  // Window entries; file Idx goes to Ring[Idx % Window].
+  Vector<std::thread> Threads;
+  std::mutex Mu;
+  std::condition_variable Loaded, Consumed;
+  size_t NextToLoad = 0;  // Guarded by Mu.
+  size_t NextToConsume = 0;
+  bool HoldingEntry = false;
+  bool Stopping = false;  // Guarded by Mu.
+  DigestSet Seen;
+  size_t Duplicates = 0;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_SEED_LOADER_H
@@ -0,0 +1,200 @@
+//===- FuzzerSharedCorpus.cpp - Shared-memory corpus ring -----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// SharedCorpusRing. The region is laid out as a RingHeader followed by
+// NumSlots slots of SlotSize bytes; a slot is a SlotHeader followed by room
+// for MaxFeatures features and then for MaxUnitSize bytes of unit.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerSharedCorpus.h"
+#include "FuzzerDigest.h"
+#include "FuzzerIO.h"
+#include <atomic>
+#include <new>
+
+namespace fuzzer {
+
+namespace {
+
+const uint64_t kRingMagic = 0x474e495250524f43ULL;  // "CORPRING".
+// A bigger feature set is published without its features.
+const size_t kMaxSharedFeatures = 1 << 14;
+const size_t kMinSlots = 16;
+// How long a reader waits for a slot whose ticket was taken but that is
+// still being written before skipping it.
+const int kPendingTimeoutMs = 1000;
+
+size_t RoundUp(size_t X, size_t Align) {
+  return (X + Align - 1) & ~(Align - 1);
+}
+
+}  // namespace
+
+struct SharedCorpusRing::RingHeader {
+  uint64_t Magic;
+  uint32_t NumSlots;
+  uint32_t SlotSize;
+  uint32_t MaxUnitSize;
+  uint32_t MaxFeatures;
+  // Every Create or Open gets its own publisher id.
+  std::atomic<uint32_t> PublisherIds;
+  // The next ticket to give to a publisher.
+  alignas(64) std::atomic<uint64_t> Tickets;
+};
+
+struct SharedCorpusRing::SlotHeader {
+  // 0 if never written, 2 * Ticket + 1 while the record of Ticket is being
+  // written, 2 * Ticket + 2 once it is complete.
+  std::atomic<uint64_t> Seq;
+  UnitDigest Digest;
+  uint32_t Publisher;
+  uint32_t Size;
+  uint32_t NumFeatures;
+  uint32_t FeaturesKnown;
+
+  uint32_t *Features() { return reinterpret_cast<uint32_t *>(this + 1); }
+  uint8_t *Data(size_t MaxFeatures) {
+    return reinterpret_cast<uint8_t *>(Features() + MaxFeatures);
+  }
+};
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t),
+              "the ring needs address-free 64-bit atomics");
+
+SharedCorpusRing::RingHeader *SharedCorpusRing::Header() const {
+  return reinterpret_cast<RingHeader *>(
+      const_cast<SharedMemoryRegion &>(Region).GetData());
+}
+
+SharedCorpusRing::SlotHeader *SharedCorpusRing::Slot(uint64_t Ticket) const {
+  RingHeader *H = Header();
+  uint8_t *Slots = reinterpret_cast<uint8_t *>(H) + RoundUp(sizeof(*H), 64);
+  return reinterpret_cast<SlotHeader *>(Slots + (Ticket % H->NumSlots) *
+                                                    H->SlotSize);
+}
+
+size_t SharedCorpusRing::NumSlots() const { return Header()->NumSlots; }
+
+size_t SharedCorpusRing::MaxUnitSize() const { return Header()->MaxUnitSize; }
+
+bool SharedCorpusRing::Create(const char *Name, size_t Bytes,
+                              size_t MaxUnitSize) {
+  size_t SlotSize = RoundUp(sizeof(SlotHeader) +
+                                kMaxSharedFeatures * sizeof(uint32_t) +
+                                MaxUnitSize, 64);
+  size_t NumSlots = std::max(kMinSlots, Bytes / SlotSize);
+  if (SlotSize > UINT32_MAX || NumSlots > UINT32_MAX)
+    return false;
+  Region.Destroy(Name);
+  if (!Region.Create(Name, RoundUp(sizeof(RingHeader), 64) +
+                               NumSlots * SlotSize,
+                     /*WithSemaphores*/ false))
+    return false;
+  // The region is zero-filled: all the slots are empty.
+  RingHeader *H = new (Region.GetData()) RingHeader;
+  H->NumSlots = NumSlots;
+  H->SlotSize = SlotSize;
+  H->MaxUnitSize = MaxUnitSize;
+  H->MaxFeatures = kMaxSharedFeatures;
+  H->PublisherIds.store(0);
+  H->Tickets.store(0);
+  H->Magic = kRingMagic;
+  Id = H->PublisherIds.fetch_add(1);
+  return true;
+}
+
+bool SharedCorpusRing::Open(const char *Name) {
+  if (!Region.Open(Name, /*WithSemaphores*/ false))
+    return false;
+  RingHeader *H = Header();
+  if (Region.GetSize() < sizeof(RingHeader) || H->Magic != kRingMagic ||
+      Region.GetSize() < RoundUp(sizeof(RingHeader), 64) +
+                             (size_t)H->NumSlots * H->SlotSize)
+    return false;
+  Id = H->PublisherIds.fetch_add(1);
+  // Start with what is still in the ring.
+  uint64_t End = H->Tickets.load();
+  NextTicket = End > H->NumSlots ? End - H->NumSlots : 0;
+  return true;
+}
+
+bool SharedCorpusRing::Publish(const uint8_t *Data, size_t Size,
+                               const Vector<uint32_t> *Features) {
+  RingHeader *H = Header();
+  if (Size > H->MaxUnitSize)
+    return false;
+  bool Known = Features && Features->size() <= H->MaxFeatures;
+  uint64_t Ticket = H->Tickets.fetch_add(1);
+  SlotHeader *S = Slot(Ticket);
+  // Claim the slot unless another publisher is in it or already wrote a
+  // later ticket there.
+  uint64_t Seq = S->Seq.load(std::memory_order_relaxed);
+  if ((Seq & 1) || Seq > 2 * Ticket ||
+      !S->Seq.compare_exchange_strong(Seq, 2 * Ticket + 1,
+                                      std::memory_order_relaxed))
+    return false;
+  std::atomic_thread_fence(std::memory_order_release);
+  S->Digest = ComputeDigest(Data, Size);
+  S->Publisher = Id;
+  S->Size = Size;
+  S->NumFeatures = Known ? Features->size() : 0;
+  S->FeaturesKnown = Known;
+  if (Known)
+    memcpy(S->Features(), Features->data(),
+           Features->size() * sizeof(uint32_t));
+  memcpy(S->Data(H->MaxFeatures), Data, Size);
+  S->Seq.store(2 * Ticket + 2, std::memory_order_release);
+  return true;
+}
+
+size_t SharedCorpusRing::Consume(Vector<SharedUnit> *Units, size_t Max) {
+  RingHeader *H = Header();
+  uint64_t End = H->Tickets.load(std::memory_order_acquire);
+  if (End - NextTicket > H->NumSlots)
+    NextTicket = End - H->NumSlots;  // The older ones were overwritten.
+  size_t NumConsumed = 0;
+  for (; NextTicket < End && NumConsumed < Max; NextTicket++) {
+    uint64_t Ticket = NextTicket;
+    SlotHeader *S = Slot(Ticket);
+    uint64_t Seq = S->Seq.load(std::memory_order_acquire);
+    if (Seq < 2 * Ticket + 2) {
+      // Being written, or dropped by its publisher.
+      auto Now = std::chrono::steady_clock::now();
+      if (PendingTicket != Ticket) {
+        PendingTicket = Ticket;
+        PendingSince = Now;
+        break;
+      }
+      if (std::chrono::duration_cast<std::chrono::milliseconds>(
+              Now - PendingSince).count() < kPendingTimeoutMs)
+        break;
+      continue;
+    }
+    if (Seq != 2 * Ticket + 2 || S->Publisher == Id)
+      continue;
+    size_t Size = S->Size, NumFeatures = S->NumFeatures;
+    UnitDigest Digest = S->Digest;
+    bool Known = S->FeaturesKnown;
+    if (Size > H->MaxUnitSize || NumFeatures > H->MaxFeatures)
+      continue;
+    SharedUnit SU;
+    const uint8_t *Data = S->Data(H->MaxFeatures);
+    SU.U.assign(Data, Data + Size);
+    SU.Features.assign(S->Features(), S->Features() + NumFeatures);
+    SU.FeaturesKnown = Known;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (S->Seq.load(std::memory_order_relaxed) != Seq ||
+        ComputeDigest(SU.U) != Digest)
+      continue;  // Overwritten while we copied it.
+    Units->push_back(std::move(SU));
+    NumConsumed++;
+  }
+  return NumConsumed;
+}
+
+}  // namespace fuzzer
@@ -0,0 +1,74 @@
+//===- FuzzerSharedCorpus.h - Internal header for the Fuzzer ----*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::SharedCorpusRing: the -jobs workers publish the units they add to
+// their corpus, with their features, in a shared-memory ring.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_SHARED_CORPUS_H
+#define LLVM_FUZZER_SHARED_CORPUS_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerShmem.h"
+#include <chrono>
+
+namespace fuzzer {
+
+struct SharedUnit {
+  Unit U;
+  // All the features of U; only valid if FeaturesKnown.
+  Vector<uint32_t> Features;
+  bool FeaturesKnown;
+};
+
+// A broadcast ring of fixed-size slots. Publishers take a ticket with an
+// atomic increment and write the slot of the ticket under a per-slot
+// sequence lock; every reader keeps its own position and validates what it
+// copied against the sequence and the digest of the unit. Nobody ever
+// waits: a publisher finding its slot being written drops its record, and a
+// reader that falls behind by more than the ring size skips the records
+// that were overwritten. Newly started workers begin with the records still
+// in the ring.
+class SharedCorpusRing {
+ public:
+  // Creates a ring of about Bytes bytes whose slots hold units of up to
+  // MaxUnitSize bytes.
+  bool Create(const char *Name, size_t Bytes, size_t MaxUnitSize);
+  bool Open(const char *Name);
+  bool Destroy(const char *Name) { return Region.Destroy(Name); }
+
+  size_t NumSlots() const;
+  size_t MaxUnitSize() const;
+
+  // Features are the sorted features of the unit, or nullptr if they are
+  // unknown (e.g. too many for a slot); readers then execute the unit.
+  // Returns false if the record was dropped.
+  bool Publish(const uint8_t *Data, size_t Size,
+               const Vector<uint32_t> *Features);
+
+  // Appends to Units at most Max records published through other
+  // SharedCorpusRing objects since the last call.
+  size_t Consume(Vector<SharedUnit> *Units, size_t Max);
+
+ private:
+  struct RingHeader;
+  struct SlotHeader;
+  RingHeader *Header() const;
+  SlotHeader *Slot(uint64_t Ticket) const;
+
+  SharedMemoryRegion Region;
+  uint32_t Id = 0;
+  uint64_t NextTicket = 0;
+  // The first ticket found still being written, and since when.
+  uint64_t PendingTicket = ~0ULL;
+  std::chrono::steady_clock::time_point PendingSince;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_SHARED_CORPUS_H
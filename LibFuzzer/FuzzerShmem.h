@@ -22,17 +22,21 @@ namespace fuzzer {
 
 class SharedMemoryRegion {
  public:
-  bool Create(const char *Name);
-  bool Open(const char *Name);
+  // Regions that are only accessed with atomics (see SharedCorpusRing) do
+  // not need the semaphores.
+  bool Create(const char *Name, size_t Size = kShmemSize,
+              bool WithSemaphores = true);
+  bool Open(const char *Name, bool WithSemaphores = true);
   bool Destroy(const char *Name);
   uint8_t *GetData() { return Data; }
+  size_t GetSize() const { return Size; }
   void PostServer() {Post(0);}
   void WaitServer() {Wait(0);}
   void PostClient() {Post(1);}
   void WaitClient() {Wait(1);}
 
   size_t WriteByteArray(const uint8_t *Bytes, size_t N) {
-    assert(N <= kShmemSize - sizeof(N));
+    assert(N <= Size - sizeof(N));
     memcpy(GetData(), &N, sizeof(N));
     memcpy(GetData() + sizeof(N), Bytes, N);
     assert(N == ReadByteArraySize());
@@ -52,6 +56,7 @@ private:
 
   static const size_t kShmemSize = 1 << 22;
   bool IAmServer;
+  size_t Size = kShmemSize;
   std::string Path(const char *Name);
   std::string SemName(const char *Name, int Idx);
   void Post(int Idx);
@@ -37,19 +37,21 @@ std::string SharedMemoryRegion::SemName(const char *Name, int Idx) {
 
 bool SharedMemoryRegion::Map(int fd) {
   Data =
-      (uint8_t *)mmap(0, kShmemSize, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
+      (uint8_t *)mmap(0, Size, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
   if (Data == (uint8_t*)-1)
     return false;
   return true;
 }
 
-bool SharedMemoryRegion::Create(const char *Name) {
+bool SharedMemoryRegion::Create(const char *Name, size_t Size,
+                                bool WithSemaphores) {
   int fd = open(Path(Name).c_str(), O_CREAT | O_RDWR, 0777);
   if (fd < 0) return false;
-  if (ftruncate(fd, kShmemSize) < 0) return false;
+  this->Size = Size;
+  if (ftruncate(fd, Size) < 0) return false;
   if (!Map(fd))
     return false;
-  for (int i = 0; i < 2; i++) {
+  for (int i = 0; i < 2 && WithSemaphores; i++) {
     sem_unlink(SemName(Name, i).c_str());
     Semaphore[i] = sem_open(SemName(Name, i).c_str(), O_CREAT, 0644, 0);
     if (Semaphore[i] == (void *)-1)
@@ -59,16 +61,17 @@ bool SharedMemoryRegion::Create(const char *Name) {
   return true;
 }
 
-bool SharedMemoryRegion::Open(const char *Name) {
+bool SharedMemoryRegion::Open(const char *Name, bool WithSemaphores) {
   int fd = open(Path(Name).c_str(), O_RDWR);
   if (fd < 0) return false;
   struct stat stat_res;
   if (0 != fstat(fd, &stat_res))
     return false;
-  assert(stat_res.st_size == kShmemSize);
+  assert(!WithSemaphores || stat_res.st_size == kShmemSize);
+  Size = stat_res.st_size;
   if (!Map(fd))
     return false;
-  for (int i = 0; i < 2; i++) {
+  for (int i = 0; i < 2 && WithSemaphores; i++) {
     Semaphore[i] = sem_open(SemName(Name, i).c_str(), 0);
     if (Semaphore[i] == (void *)-1)
       return false;
@@ -35,12 +35,13 @@ bool SharedMemoryRegion::Map(int fd) {
   return false;
 }
 
-bool SharedMemoryRegion::Create(const char *Name) {
+bool SharedMemoryRegion::Create(const char *Name, size_t Size,
+                                bool WithSemaphores) {
   assert(0 && "UNIMPLEMENTED");
   return false;
 }
 
-bool SharedMemoryRegion::Open(const char *Name) {
+bool SharedMemoryRegion::Open(const char *Name, bool WithSemaphores) {
   assert(0 && "UNIMPLEMENTED");
   return false;
 }
@@ -16,6 +16,7 @@
 #include "FuzzerCorpus.h"
 #include "FuzzerDefs.h"
 #include "FuzzerDictionary.h"
+#include "FuzzerDigest.h"
 #include "FuzzerExtFunctions.h"
 #include "FuzzerIO.h"
 #include "FuzzerUtil.h"
@@ -39,10 +40,19 @@ namespace fuzzer {
 
 TracePC TPC;
 
-int ScopedDoingMyOwnMemOrStr::DoingMyOwnMemOrStr;
+thread_local int ScopedDoingMyOwnMemOrStr::DoingMyOwnMemOrStr;
+
+static ValueBitMap ValueProfileMaps[TracePC::kMaxNumThreads];
+
+thread_local uint8_t *ThreadCounters = __sancov_trace_pc_guard_8bit_counters;
+thread_local ValueBitMap *ThreadValueProfileMap = &ValueProfileMaps[0];
+
+static thread_local uintptr_t InitialStack;
+
+static thread_local DirtyList *ThreadDirtyList;
 
 uint8_t *TracePC::Counters() const {
-  return __sancov_trace_pc_guard_8bit_counters;
+  return ThreadCounters;
 }
 
 uintptr_t *TracePC::PCs() const {
@@ -60,6 +70,19 @@ size_t TracePC::GetTotalPCCoverage() {
 }
 
 
+bool TracePC::SupportsThreadShards() const {
+  return !NumInline8bitCounters && ClangCountersBegin() == ClangCountersEnd() &&
+         ExtraCountersBegin() == ExtraCountersEnd();
+}
+
+void TracePC::CreateThreadShard() {
+  assert(SupportsThreadShards());
+  size_t Idx = ++NumThreadShards;
+  assert(Idx < kMaxNumThreads);
+  ThreadCounters = new uint8_t[GetNumPCs()]();
+  ThreadValueProfileMap = &ValueProfileMaps[Idx];
+}
+
 void TracePC::HandleInline8bitCountersInit(uint8_t *Start, uint8_t *Stop) {
   if (Start == Stop) return;
   if (NumModulesWithInline8bitCounters &&
@@ -97,6 +120,56 @@ void TracePC::HandleInit(uint32_t *Start, uint32_t *Stop) {
   NumModules++;
 }
 
+void TracePC::SaveState(CheckpointWriter *W) const {
+  Vector<uint32_t> Observed;
+  for (size_t i = 0, Idx = 0; i < NumPCTables; i++)
+    for (auto TE = ModulePCTable[i].Start; TE < ModulePCTable[i].Stop;
+         TE++, Idx++)
+      if (ObservedPCs.count(TE->PC))
+        Observed.push_back(Idx);
+  W->SortedSet({Observed.data(), Observed.size()});
+}
+
+bool TracePC::LoadState(CheckpointReader *R) {
+  auto Observed = R->SortedSet();
+  size_t Table = 0, TableBegin = 0;
+  for (auto Idx : Observed) {
+    if (Idx >= NumPCsInPCTables)
+      return false;
+    while (Idx >= TableBegin + (ModulePCTable[Table].Stop -
+                                ModulePCTable[Table].Start)) {
+      TableBegin += ModulePCTable[Table].Stop - ModulePCTable[Table].Start;
+      Table++;
+    }
+    const PCTableEntry &TE = ModulePCTable[Table].Start[Idx - TableBegin];
+    ObservedPCs.insert(TE.PC);
+    if (TE.PCFlags & 1)
+      ObservedFuncs.insert(TE.PC);
+  }
+  return !R->Failed();
+}
+
+std::string TracePC::GetBuildId() const {
+  if (!NumModules && !NumInline8bitCounters)
+    return "";
+  Vector<uintptr_t> Layout = {NumModules, NumModulesWithInline8bitCounters,
+                              NumPCTables};
+  for (size_t i = 0; i < NumModules; i++)
+    Layout.push_back(Modules[i].Stop - Modules[i].Start);
+  for (size_t i = 0; i < NumModulesWithInline8bitCounters; i++)
+    Layout.push_back(ModuleCounters[i].Stop - ModuleCounters[i].Start);
+  // The PCs move with the load address, their offsets do not.
+  for (size_t i = 0; i < NumPCTables; i++)
+    for (auto TE = ModulePCTable[i].Start; TE < ModulePCTable[i].Stop; TE++) {
+      Layout.push_back(TE->PC - ModulePCTable[i].Start->PC);
+      Layout.push_back(TE->PCFlags);
+    }
+  UnitDigest D = ComputeDigest(reinterpret_cast<const uint8_t *>(Layout.data()),
+                               Layout.size() * sizeof(Layout[0]));
+  std::string Res(reinterpret_cast<const char *>(&D), sizeof(D));
+  return Res + GetLoadedBuildIds();
+}
+
 void TracePC::PrintModuleInfo() {
   if (NumGuards) {
     Printf("INFO: Loaded %zd modules   (%zd guards): ", NumModules, NumGuards);
@@ -141,7 +214,7 @@ void TracePC::HandleCallerCallee(uintptr_t Caller, uintptr_t Callee) {
   const uintptr_t kBits = 12;
   const uintptr_t kMask = (1 << kBits) - 1;
   uintptr_t Idx = (Caller & kMask) | ((Callee & kMask) << kBits);
-  ValueProfileMap.AddValueModPrime(Idx);
+  ThreadValueProfileMap->AddValueModPrime(Idx);
 }
 
 void TracePC::UpdateObservedPCs() {
@@ -196,6 +269,37 @@ void TracePC::UpdateObservedPCs() {
   }
 }
 
+void TracePC::UpdateObservedPCs(const Vector<uint32_t> &Features) {
+  // The counters matching the PC tables come first in the feature space, see
+  // CollectFeatures; counter 0 of the guards is not used.
+  size_t FirstCounter;
+  if (NumPCsInPCTables && NumInline8bitCounters == NumPCsInPCTables)
+    FirstCounter = 0;
+  else if (NumPCsInPCTables && NumGuards == NumPCsInPCTables &&
+           NumGuards < kNumPCs)
+    FirstCounter = 1;
+  else
+    return;
+  size_t Table = 0, TableBegin = 0;
+  for (auto Feature : Features) {
+    size_t Idx = UseCounters ? Feature / 8 : Feature;
+    if (Feature >= 8 * (FirstCounter + NumPCsInPCTables))
+      break;
+    if (Idx < FirstCounter || Idx - FirstCounter >= NumPCsInPCTables)
+      continue;
+    Idx -= FirstCounter;
+    while (Idx >= TableBegin + (ModulePCTable[Table].Stop -
+                                ModulePCTable[Table].Start)) {
+      TableBegin += ModulePCTable[Table].Stop - ModulePCTable[Table].Start;
+      Table++;
+    }
+    const PCTableEntry &TE = ModulePCTable[Table].Start[Idx - TableBegin];
+    ObservedPCs.insert(TE.PC);
+    if (TE.PCFlags & 1)
+      ObservedFuncs.insert(TE.PC);
+  }
+}
+
 inline ALWAYS_INLINE uintptr_t GetPreviousInstructionPc(uintptr_t PC) {
   // TODO: this implementation is x86 only.
   // see sanitizer_common GetPreviousInstructionPc for full implementation.
@@ -319,7 +423,7 @@ void TracePC::AddValueForMemcmp(void *caller_pc, const void *s1, const void *s2,
       break;
   size_t PC = reinterpret_cast<size_t>(caller_pc);
   size_t Idx = (PC & 4095) | (I << 12);
-  ValueProfileMap.AddValue(Idx);
+  ThreadValueProfileMap->AddValue(Idx);
   TORCW.Insert(Idx ^ Hash, Word(B1, Len), Word(B2, Len));
 }
 
@@ -334,7 +438,7 @@ void TracePC::HandleCmp(uintptr_t PC, T Arg1, T Arg2) {
       TORC4.Insert(ArgXor, Arg1, Arg2);
   else if (sizeof(T) == 8)
       TORC8.Insert(ArgXor, Arg1, Arg2);
-  ValueProfileMap.AddValue(Idx);
+  ThreadValueProfileMap->AddValue(Idx);
 }
 
 static size_t InternalStrnlen(const char *S, size_t MaxLen) {
@@ -351,6 +455,35 @@ static size_t InternalStrnlen2(const char *S1, const char *S2) {
   return Len;
 }
 
+DirtyList *TracePC::StartDirtyList() const {
+  if (!ThreadDirtyList)
+    ThreadDirtyList = new DirtyList;
+  ThreadDirtyList->Start(true);
+  return ThreadDirtyList;
+}
+
+void TracePC::ResetMaps() {
+  // The clang counters are not tracked by the dirty list.
+  if (UseClangCoverage)
+    ClearClangCounters();
+  // CollectFeatures ignores the guard counters if there are inline counters.
+  bool SkippedGuards = NumModules && NumInline8bitCounters;
+  if (UseSparseReset && ThreadDirtyList && ThreadDirtyList->IsComplete() &&
+      !SkippedGuards) {
+    ThreadDirtyList->Clear();
+    return;
+  }
+  if (ThreadDirtyList)
+    ThreadDirtyList->Start(false);
+  // Nobody reads the value profile map unless it is used.
+  if (UseValueProfile)
+    ThreadValueProfileMap->Reset();
+  if (NumModules)
+    memset(Counters(), 0, GetNumPCs());
+  ClearExtraCounters();
+  ClearInlineCounters();
+}
+
 void TracePC::ClearInlineCounters() {
   for (size_t i = 0; i < NumModulesWithInline8bitCounters; i++) {
     uint8_t *Beg = ModuleCounters[i].Start;
@@ -378,7 +511,7 @@ void __sanitizer_cov_trace_pc_guard(uint32_t *Guard) {
   uintptr_t PC = reinterpret_cast<uintptr_t>(__builtin_return_address(0));
   uint32_t Idx = *Guard;
   __sancov_trace_pc_pcs[Idx] = PC;
-  __sancov_trace_pc_guard_8bit_counters[Idx]++;
+  fuzzer::ThreadCounters[Idx]++;
 }
 
 // Best-effort support for -fsanitize-coverage=trace-pc, which is available
@@ -389,7 +522,7 @@ void __sanitizer_cov_trace_pc() {
   uintptr_t PC = reinterpret_cast<uintptr_t>(__builtin_return_address(0));
   uintptr_t Idx = PC & (((uintptr_t)1 << fuzzer::TracePC::kTracePcBits) - 1);
   __sancov_trace_pc_pcs[Idx] = PC;
-  __sancov_trace_pc_guard_8bit_counters[Idx]++;
+  fuzzer::ThreadCounters[Idx]++;
 }
 
 ATTRIBUTE_INTERFACE
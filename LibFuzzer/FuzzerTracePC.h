@@ -12,10 +12,14 @@
 #ifndef LLVM_FUZZER_TRACE_PC
 #define LLVM_FUZZER_TRACE_PC
 
+#include "FuzzerCheckpoint.h"
 #include "FuzzerDefs.h"
 #include "FuzzerDictionary.h"
+#include "FuzzerSIMD.h"
 #include "FuzzerValueBitMap.h"
 
+#include <algorithm>
+#include <atomic>
 #include <set>
 
 namespace fuzzer {
@@ -67,11 +71,80 @@ struct MemMemTable {
   }
 };
 
+// The coverage maps written by the instrumentation callbacks of the current
+// thread. In the main thread they point to the global maps; the extra
+// fuzzing threads of -threads=N point them to their own shards, see
+// TracePC::CreateThreadShard().
+extern __attribute__((tls_model("initial-exec")))
+thread_local uint8_t *ThreadCounters;
+extern __attribute__((tls_model("initial-exec")))
+thread_local ValueBitMap *ThreadValueProfileMap;
+
+// Locations of the coverage maps of the current thread that were non-zero
+// after the last execution, as seen by TracePC::CollectFeatures. When the
+// list is complete TracePC::ResetMaps clears only these locations instead of
+// the whole maps, which for small targets costs more than running them.
+class DirtyList {
+ public:
+  static const size_t kMaxSize = 1 << 12;
+
+  void Start(bool Enabled) {
+    NumWords = NumBytes = 0;
+    Complete = Enabled;
+  }
+  void AddWord(const uintptr_t *W) {
+    if (NumWords < kMaxSize)
+      Words[NumWords++] = reinterpret_cast<uintptr_t>(W);
+    else
+      Complete = false;
+  }
+  void AddByte(const uint8_t *B) {
+    if (NumBytes < kMaxSize)
+      Bytes[NumBytes++] = reinterpret_cast<uintptr_t>(B);
+    else
+      Complete = false;
+  }
+  // Records the non-zero bytes of a piece found by ForEachNonZeroBlock,
+  // as whole words if the piece is aligned.
+  void AddBlock(const uint8_t *Base, uint64_t Mask, bool Aligned) {
+    if (!Aligned) {
+      for (; Mask; Mask &= Mask - 1)
+        AddByte(Base + __builtin_ctzll(Mask));
+      return;
+    }
+    const size_t kWordBits = sizeof(uintptr_t);  // One mask bit per byte.
+    for (size_t I = 0; Mask; I++, Mask >>= kWordBits)
+      if (Mask & ((1ULL << kWordBits) - 1))
+        AddWord(reinterpret_cast<const uintptr_t *>(Base) + I);
+  }
+  bool IsComplete() const { return Complete; }
+  size_t size() const { return NumWords + NumBytes; }
+
+  // Zeroes all the recorded locations and starts a new, incomplete, list.
+  ATTRIBUTE_NO_SANITIZE_ALL
+  void Clear() {
+    for (size_t i = 0; i < NumWords; i++)
+      *reinterpret_cast<uintptr_t *>(Words[i]) = 0;
+    for (size_t i = 0; i < NumBytes; i++)
+      *reinterpret_cast<uint8_t *>(Bytes[i]) = 0;
+    Start(false);
+  }
+
+ private:
+  uintptr_t Words[kMaxSize];
+  uintptr_t Bytes[kMaxSize];
+  size_t NumWords = 0;
+  size_t NumBytes = 0;
+  bool Complete = false;
+};
+
 class TracePC {
  public:
   static const size_t kNumPCs = 1 << 21;
   // How many bits of PC are used from __sanitizer_cov_trace_pc.
   static const size_t kTracePcBits = 18;
+  // Max number of threads that may have their own coverage shard.
+  static const size_t kMaxNumThreads = 256;
 
   void HandleInit(uint32_t *Start, uint32_t *Stop);
   void HandleInline8bitCountersInit(uint8_t *Start, uint8_t *Stop);
@@ -85,24 +158,37 @@ class TracePC {
   void SetPrintNewPCs(bool P) { DoPrintNewPCs = P; }
   void SetPrintNewFuncs(size_t P) { NumPrintNewFuncs = P; }
   void UpdateObservedPCs();
+  // Same for a unit added with its sorted Features instead of being executed;
+  // only the PCs of the PC tables are known.
+  void UpdateObservedPCs(const Vector<uint32_t> &Features);
+  // -checkpoint: the observed PCs, as indices in the PC tables, which do
+  // not move with the load address.
+  void SaveState(CheckpointWriter *W) const;
+  bool LoadState(CheckpointReader *R);
   template <class Callback> void CollectFeatures(Callback CB) const;
 
-  void ResetMaps() {
-    ValueProfileMap.Reset();
-    if (NumModules)
-      memset(Counters(), 0, GetNumPCs());
-    ClearExtraCounters();
-    ClearInlineCounters();
-    if (UseClangCoverage)
-      ClearClangCounters();
-  }
+  void SetUseSparseReset(bool SR) { UseSparseReset = SR; }
+  void ResetMaps();
 
   void ClearInlineCounters();
 
+  // Per-thread shards only cover the maps written through ThreadCounters and
+  // ThreadValueProfileMap; inline 8-bit counters, clang counters and extra
+  // counters are process-wide arrays.
+  bool SupportsThreadShards() const;
+  // Allocates the coverage shard of the current thread and makes its
+  // instrumentation callbacks write into it.
+  void CreateThreadShard();
+
   void UpdateFeatureSet(size_t CurrentElementIdx, size_t CurrentElementSize);
   void PrintFeatureSet();
 
   void PrintModuleInfo();
+  // Identifies the build for caches of features: the layout of the coverage
+  // modules and PC tables, and the build ids of the loaded objects. Empty if
+  // the features change from run to run (-fsanitize-coverage=trace-pc,
+  // whose features are hashed PCs).
+  std::string GetBuildId() const;
 
   void PrintCoverage();
   void DumpCoverage();
@@ -136,6 +222,7 @@ private:
   bool UseCounters = false;
   bool UseValueProfile = false;
   bool UseClangCoverage = false;
+  bool UseSparseReset = false;
   bool DoPrintNewPCs = false;
   size_t NumPrintNewFuncs = 0;
 
@@ -161,39 +248,68 @@ private:
 
   uint8_t *Counters() const;
   uintptr_t *PCs() const;
+  DirtyList *StartDirtyList() const;
 
   Set<uintptr_t> ObservedPCs;
   Set<uintptr_t> ObservedFuncs;
 
-  ValueBitMap ValueProfileMap;
-  uintptr_t InitialStack;
+  std::atomic<size_t> NumThreadShards;
 };
 
+// Calls HandleBlock(Base, Mask, Aligned) for every piece of [Begin, End)
+// that has non-zero bytes, where bit i of Mask is set iff Base[i] != 0.
+// Aligned pieces are whole kSIMDBlockSize-aligned blocks; the unaligned
+// head and tail of the range are scanned byte by byte.
+template <class Callback>
+// void Callback(const uint8_t *Base, uint64_t Mask, bool Aligned);
+ATTRIBUTE_NO_SANITIZE_ALL
+void ForEachNonZeroBlock(const uint8_t *Begin, const uint8_t *End,
+                         Callback HandleBlock) {
+  auto ScanBytes = [&](const uint8_t *B, const uint8_t *E) {
+    uint64_t Mask = 0;
+    for (const uint8_t *P = B; P < E; P++)
+      if (*P)
+        Mask |= 1ULL << (P - B);
+    if (Mask)
+      HandleBlock(B, Mask, false);
+  };
+  const uintptr_t BlockMask = kSIMDBlockSize - 1;
+  auto AlignedBegin = reinterpret_cast<const uint8_t *>(
+      (reinterpret_cast<uintptr_t>(Begin) + BlockMask) & ~BlockMask);
+  auto AlignedEnd = reinterpret_cast<const uint8_t *>(
+      reinterpret_cast<uintptr_t>(End) & ~BlockMask);
+  if (AlignedBegin >= AlignedEnd) {
+    // No whole block, at most two pieces.
+    const uint8_t *Mid = std::min(AlignedBegin, End);
+    ScanBytes(Begin, Mid);
+    ScanBytes(Mid, End);
+    return;
+  }
+  ScanBytes(Begin, AlignedBegin);
+  for (const uint8_t *P = AlignedBegin; P < AlignedEnd; P += kSIMDBlockSize) {
+    uint64_t Mask;
+    P = FindNonZeroBlock(P, AlignedEnd, &Mask);
+    if (P == AlignedEnd) break;
+    HandleBlock(P, Mask, true);
+  }
+  ScanBytes(AlignedEnd, End);
+}
+
+// If Dirty is not null the non-zero words and bytes are recorded there.
 template <class Callback>
 // void Callback(size_t FirstFeature, size_t Idx, uint8_t Value);
 ATTRIBUTE_NO_SANITIZE_ALL
 void ForEachNonZeroByte(const uint8_t *Begin, const uint8_t *End,
-                        size_t FirstFeature, Callback Handle8bitCounter) {
-  typedef uintptr_t LargeType;
-  const size_t Step = sizeof(LargeType) / sizeof(uint8_t);
-  const size_t StepMask = Step - 1;
-  auto P = Begin;
-  // Iterate by 1 byte until either the alignment boundary or the end.
-  for (; reinterpret_cast<uintptr_t>(P) & StepMask && P < End; P++)
-    if (uint8_t V = *P)
-      Handle8bitCounter(FirstFeature, P - Begin, V);
-
-  // Iterate by Step bytes at a time.
-  for (; P < End; P += Step)
-    if (LargeType Bundle = *reinterpret_cast<const LargeType *>(P))
-      for (size_t I = 0; I < Step; I++, Bundle >>= 8)
-        if (uint8_t V = Bundle & 0xff)
-          Handle8bitCounter(FirstFeature, P - Begin + I, V);
-
-  // Iterate by 1 byte until the end.
-  for (; P < End; P++)
-    if (uint8_t V = *P)
-      Handle8bitCounter(FirstFeature, P - Begin, V);
+                        size_t FirstFeature, Callback Handle8bitCounter,
+                        DirtyList *Dirty = nullptr) {
+  ForEachNonZeroBlock(Begin, End, [&](const uint8_t *Base, uint64_t Mask,
+                                      bool Aligned) {
+    if (Dirty) Dirty->AddBlock(Base, Mask, Aligned);
+    for (; Mask; Mask &= Mask - 1) {
+      size_t I = __builtin_ctzll(Mask);
+      Handle8bitCounter(FirstFeature, Base - Begin + I, Base[I]);
+    }
+  });
 }
 
 // Given a non-zero Counter returns a number in the range [0,7].
@@ -228,25 +344,44 @@ __attribute__((noinline))
 void TracePC::CollectFeatures(Callback HandleFeature) const {
   uint8_t *Counters = this->Counters();
   size_t N = GetNumPCs();
-  auto Handle8bitCounter = [&](size_t FirstFeature,
-                               size_t Idx, uint8_t Counter) {
-    if (UseCounters)
-      HandleFeature(FirstFeature + Idx * 8 + CounterToFeature(Counter));
-    else
-      HandleFeature(FirstFeature + Idx);
-  };
-
+  DirtyList *Dirty = UseSparseReset ? StartDirtyList() : nullptr;
   size_t FirstFeature = 0;
 
+  // Calls HandleFeature for the non-zero counters in [Begin, End), which
+  // start at FirstFeature. With UseCounters whole blocks of counters are
+  // put into buckets at once.
+  auto ForEachCounter = [&](const uint8_t *Begin, const uint8_t *End,
+                            DirtyList *Dirty) {
+    ForEachNonZeroBlock(Begin, End, [&](const uint8_t *Base, uint64_t Mask,
+                                        bool Aligned) {
+      if (Dirty) Dirty->AddBlock(Base, Mask, Aligned);
+      size_t First = FirstFeature + (Base - Begin) * (UseCounters ? 8 : 1);
+      if (!UseCounters) {
+        for (; Mask; Mask &= Mask - 1)
+          HandleFeature(First + __builtin_ctzll(Mask));
+        return;
+      }
+      uint8_t Buckets[kSIMDBlockSize];
+      if (Aligned)
+        ClassifyCounters(Base, Buckets, kSIMDBlockSize);
+      for (; Mask; Mask &= Mask - 1) {
+        size_t I = __builtin_ctzll(Mask);
+        HandleFeature(First + I * 8 +
+                      (Aligned ? Buckets[I] : CounterToFeature(Base[I])));
+      }
+    });
+  };
+
   if (!NumInline8bitCounters) {
-    ForEachNonZeroByte(Counters, Counters + N, FirstFeature, Handle8bitCounter);
+    // Without guards (-fsanitize-coverage=trace-pc) the counters are never
+    // cleared, see ResetMaps.
+    ForEachCounter(Counters, Counters + N, NumModules ? Dirty : nullptr);
     FirstFeature += N * 8;
   }
 
   if (NumInline8bitCounters) {
     for (size_t i = 0; i < NumModulesWithInline8bitCounters; i++) {
-      ForEachNonZeroByte(ModuleCounters[i].Start, ModuleCounters[i].Stop,
-                         FirstFeature, Handle8bitCounter);
+      ForEachCounter(ModuleCounters[i].Start, ModuleCounters[i].Stop, Dirty);
       FirstFeature += 8 * (ModuleCounters[i].Stop - ModuleCounters[i].Start);
     }
   }
@@ -263,15 +398,16 @@ void TracePC::CollectFeatures(Callback HandleFeature) const {
     FirstFeature += NumClangCounters;
   }
 
-  ForEachNonZeroByte(ExtraCountersBegin(), ExtraCountersEnd(), FirstFeature,
-                     Handle8bitCounter);
+  ForEachCounter(ExtraCountersBegin(), ExtraCountersEnd(), Dirty);
   FirstFeature += (ExtraCountersEnd() - ExtraCountersBegin()) * 8;
 
   if (UseValueProfile) {
-    ValueProfileMap.ForEach([&](size_t Idx) {
-      HandleFeature(FirstFeature + Idx);
-    });
-    FirstFeature += ValueProfileMap.SizeInBits();
+    ThreadValueProfileMap->ForEach(
+        [&](size_t Idx) { HandleFeature(FirstFeature + Idx); },
+        [&](const uintptr_t *Word) {
+          if (Dirty) Dirty->AddWord(Word);
+        });
+    FirstFeature += ThreadValueProfileMap->SizeInBits();
   }
 
   // Step function, grows similar to 8 * Log_2(A).
@@ -12,7 +12,9 @@
 #include "FuzzerUtil.h"
 #include "FuzzerIO.h"
 #include "FuzzerInternal.h"
+#include <algorithm>
 #include <cassert>
+#include <cctype>
 #include <chrono>
 #include <cstring>
 #include <errno.h>
@@ -205,6 +207,116 @@ unsigned NumberOfCpuCores() {
   return N;
 }
 
+bool ParseCpuAffinity(const std::string &Spec, Vector<unsigned> *Cpus) {
+  Cpus->clear();
+  if (Spec == "auto") {
+    *Cpus = PhysicalCoreCpus();
+    for (unsigned i = 0, N = NumberOfCpuCores(); Cpus->empty() && i < N; i++)
+      Cpus->push_back(i);
+    return true;
+  }
+  // Comma-separated CPU numbers or ranges of them, like "0,2,8-11".
+  const unsigned kMaxCpu = 1 << 16;
+  auto ParseCpu = [&](const std::string &S, unsigned *Cpu) {
+    if (S.empty() || S.size() > 5)
+      return false;
+    for (char C : S)
+      if (!isdigit(C))
+        return false;
+    *Cpu = std::stoul(S);
+    return *Cpu < kMaxCpu;
+  };
+  for (size_t Beg = 0; Beg <= Spec.size();) {
+    size_t End = std::min(Spec.find(',', Beg), Spec.size());
+    std::string Range = Spec.substr(Beg, End - Beg);
+    size_t Dash = Range.find('-');
+    unsigned First, Last;
+    if (!ParseCpu(Range.substr(0, Dash), &First))
+      return false;
+    Last = First;
+    if (Dash != std::string::npos &&
+        (!ParseCpu(Range.substr(Dash + 1), &Last) || Last < First))
+      return false;
+    for (unsigned Cpu = First; Cpu <= Last; Cpu++)
+      Cpus->push_back(Cpu);
+    Beg = End + 1;
+  }
+  return !Cpus->empty();
+}
+
+Vector<unsigned> WorkerCpus(const Vector<unsigned> &Cpus, size_t Slot,
+                            size_t NumThreads) {
+  Vector<unsigned> Res;
+  for (size_t i = 0; i < NumThreads && !Cpus.empty(); i++)
+    Res.push_back(Cpus[(Slot * NumThreads + i) % Cpus.size()]);
+  return Res;
+}
+
+Unit MinimizeUnit(const Unit &Original, const Vector<Unit> &Dictionary,
+                  const std::function<bool(const Unit &)> &Accept,
+                  const std::function<bool()> &OutOfBudget) {
+  Unit U = Original;
+  auto Try = [&](const Unit &Candidate) {
+    if (!Accept(Candidate))
+      return false;
+    U = Candidate;
+    return true;
+  };
+  Unit Candidate;
+  for (bool Changed = true; Changed && !OutOfBudget();) {
+    Changed = false;
+    // Remove chunks, halving their size down to single bytes.
+    for (size_t Chunk = std::max<size_t>(U.size() / 2, 1);
+         Chunk && !U.empty() && !OutOfBudget(); Chunk /= 2) {
+      for (size_t Beg = 0; Beg < U.size() && !OutOfBudget();) {
+        size_t End = std::min(Beg + Chunk, U.size());
+        Candidate.assign(U.begin(), U.begin() + Beg);
+        Candidate.insert(Candidate.end(), U.begin() + End, U.end());
+        if (Try(Candidate)) {
+          Changed = true;
+          Printf("CRASH_MIN: removed %zd bytes at %zd, %zd bytes left\n",
+                 End - Beg, Beg, U.size());
+        } else {
+          Beg += Chunk;
+        }
+      }
+    }
+    // Replace the remaining bytes with '0'.
+    for (size_t Idx = 0; Idx < U.size() && !OutOfBudget(); Idx++) {
+      if (U[Idx] == '0')
+        continue;
+      Candidate = U;
+      Candidate[Idx] = '0';
+      if (Try(Candidate)) {
+        Changed = true;
+        Printf("CRASH_MIN: simplified byte %zd\n", Idx);
+      }
+    }
+    // Remove the occurrences of the dictionary tokens.
+    for (auto &W : Dictionary) {
+      if (W.empty())
+        continue;
+      for (size_t Pos = 0; Pos < U.size() && !OutOfBudget();) {
+        auto It = std::search(U.begin() + Pos, U.end(), W.begin(), W.end());
+        if (It == U.end())
+          break;
+        Pos = It - U.begin();
+        Candidate = U;
+        Candidate.erase(Candidate.begin() + Pos,
+                        Candidate.begin() + Pos + W.size());
+        if (Try(Candidate)) {
+          Changed = true;
+          Printf("CRASH_MIN: removed a %zd byte token at %zd, %zd bytes left\n",
+                 W.size(), Pos, U.size());
+        } else {
+          Pos++;
+        }
+      }
+    }
+  }
+  return U;
+}
+
 size_t SimpleFastHash(const uint8_t *Data, size_t Size) {
   size_t Res = 0;
   for (size_t i = 0; i < Size; i++)
@@ -14,6 +14,7 @@
 
 #include "FuzzerDefs.h"
 #include "FuzzerCommand.h"
+#include <functional>
 
 namespace fuzzer {
 
@@ -42,6 +43,25 @@ std::string DescribePC(const char *SymbolizedFMT, uintptr_t PC);
 
 unsigned NumberOfCpuCores();
 
+// Parses -cpu_affinity: "auto" or a list of CPUs such as "0,2,8-15". "auto"
+// is one CPU per physical core, see PhysicalCoreCpus, or all the CPUs if the
+// topology is not known.
+bool ParseCpuAffinity(const std::string &Spec, Vector<unsigned> *Cpus);
+
+// The CPUs of -jobs worker Slot when every worker runs NumThreads fuzzing
+// threads: the slices of NumThreads CPUs of the workers are disjoint as long
+// as there are enough Cpus, and wrap around them otherwise.
+Vector<unsigned> WorkerCpus(const Vector<unsigned> &Cpus, size_t Slot,
+                            size_t NumThreads);
+
+// Delta debugging: removes chunks of Original, halving their size down to
+// single bytes, replaces its bytes with '0' and removes the occurrences of
+// the Dictionary words, keeping every change Accept accepts, until nothing
+// changes or OutOfBudget. Returns the smallest unit accepted, or Original.
+Unit MinimizeUnit(const Unit &Original, const Vector<Unit> &Dictionary,
+                  const std::function<bool(const Unit &)> &Accept,
+                  const std::function<bool()> &OutOfBudget);
+
 // Platform specific functions.
 void SetSignalHandler(const FuzzingOptions& Options);
 
@@ -53,6 +73,50 @@ size_t GetPeakRSSMb();
 
 int ExecuteCommand(const Command &Cmd);
 
+// Like ExecuteCommand, but calls OnStart with the pid of the process running
+// Cmd once it started, and with 0 once it exited but before the pid can be
+// reused: KillProcess(Pid) in between kills Cmd and nothing else. OnStart is
+// not called where the pid is not known.
+int ExecuteCommand(const Command &Cmd,
+                   const std::function<void(unsigned long Pid)> &OnStart);
+
+// Whether the wait status returned by ExecuteCommand says that the command
+// was killed by a signal. Exit codes above 128 do not count: the target may
+// exit with those.
+bool ExitedOnSignal(int Status);
+
+bool KillProcess(unsigned long Pid);
+
+// Runs Callback in a fork of this process with its stdout and stderr written
+// to OutputFile and, if TimerSec > 0, the unit timer re-armed to TimerSec.
+// Returns the status of the child in the format of ExecuteCommand, or -1 if
+// the process could not be forked.
+int ExecuteInForkedChild(const std::function<void()> &Callback,
+                         const std::string &OutputFile, int TimerSec);
+
+// Runs Callback with the stderr file descriptor redirected to a temporary
+// file and returns what was written to it, or "" if it can not redirect.
+std::string CaptureStderr(void (*Callback)());
+
+// One CPU of every physical core this process may run on, taking the cores
+// of the NUMA nodes in turn. Empty if the topology is not known.
+Vector<unsigned> PhysicalCoreCpus();
+
+// Pins the calling thread, and the threads it starts later, to Cpu, and
+// makes it allocate its memory on the NUMA node of Cpu.
+bool PinThreadToCpu(unsigned Cpu);
+
+// An opaque id of the calling thread, for SendAlarmToThread.
+uintptr_t GetCurrentThreadHandle();
+
+// Delivers the unit timer signal to the thread with handle T, so that the
+// alarm callback runs in that thread. False if it can not.
+bool SendAlarmToThread(uintptr_t T);
+
+// The build ids (e.g. ELF NT_GNU_BUILD_ID notes) of the executable and of
+// the libraries it has loaded, concatenated. Empty if unknown.
+std::string GetLoadedBuildIds();
+
 FILE *OpenProcessPipe(const char *Command, const char *Mode);
 
 const void *SearchMemory(const void *haystack, size_t haystacklen,
@@ -11,6 +11,7 @@
 #include "FuzzerDefs.h"
 #if LIBFUZZER_APPLE
 #include "FuzzerCommand.h"
+#include "FuzzerForkServer.h"
 #include "FuzzerIO.h"
 #include <mutex>
 #include <signal.h>
@@ -39,6 +40,9 @@ static sigset_t OldBlockedSignalsSet;
 // thread finishes execution of the function and ensures this is not racey by
 // using a mutex.
 int ExecuteCommand(const Command &Cmd) {
+  int Status;
+  if (ExecuteCommandInForkServer(Cmd, &Status))
+    return Status;
   std::string CmdLine = Cmd.toString();
   posix_spawnattr_t SpawnAttributes;
   if (posix_spawnattr_init(&SpawnAttributes))
@@ -157,6 +161,14 @@ int ExecuteCommand(const Command &Cmd) {
   return ProcessStatus;
 }
 
+// TODO: Darwin has no CPU pinning, only affinity tags.
+Vector<unsigned> PhysicalCoreCpus() { return {}; }
+
+bool PinThreadToCpu(unsigned Cpu) { return false; }
+
+// TODO: read the LC_UUID of the loaded images.
+std::string GetLoadedBuildIds() { return ""; }
+
 } // namespace fuzzer
 
 #endif // LIBFUZZER_APPLE
@@ -230,6 +230,42 @@ int ExecuteCommand(const Command &Cmd) {
   return Info.return_code;
 }
 
+// TODO: implement for Fuchsia.
+int ExecuteCommand(const Command &Cmd,
+                   const std::function<void(unsigned long Pid)> &OnStart) {
+  return ExecuteCommand(Cmd);
+}
+
+// ExecuteCommand returns the return code of the process.
+bool ExitedOnSignal(int Status) { return false; }
+
+// TODO: implement for Fuchsia.
+bool KillProcess(unsigned long Pid) { return false; }
+
+// TODO: implement for Fuchsia.
+int ExecuteInForkedChild(const std::function<void()> &Callback,
+                         const std::string &OutputFile, int TimerSec) {
+  return -1;
+}
+
+// TODO: implement for Fuchsia.
+std::string CaptureStderr(void (*Callback)()) {
+  return "";
+}
+
+// TODO: implement for Fuchsia.
+Vector<unsigned> PhysicalCoreCpus() { return {}; }
+
+bool PinThreadToCpu(unsigned Cpu) { return false; }
+
+// TODO: implement for Fuchsia.
+uintptr_t GetCurrentThreadHandle() { return 0; }
+
+bool SendAlarmToThread(uintptr_t T) { return false; }
+
+// TODO: implement for Fuchsia.
+std::string GetLoadedBuildIds() { return ""; }
+
 const void *SearchMemory(const void *Data, size_t DataLen, const void *Patt,
                          size_t PattLen) {
   return memmem(Data, DataLen, Patt, PattLen);
@@ -11,16 +11,159 @@
 #include "FuzzerDefs.h"
 #if LIBFUZZER_LINUX || LIBFUZZER_NETBSD || LIBFUZZER_FREEBSD
 #include "FuzzerCommand.h"
+#include "FuzzerForkServer.h"
 
+#include <algorithm>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#if LIBFUZZER_LINUX
+#include <ctype.h>
+#include <dirent.h>
+#include <link.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace fuzzer {
 
 int ExecuteCommand(const Command &Cmd) {
+  int Status;
+  if (ExecuteCommandInForkServer(Cmd, &Status))
+    return Status;
   std::string CmdLine = Cmd.toString();
   return system(CmdLine.c_str());
 }
 
+#if LIBFUZZER_LINUX
+
+static bool ReadSysfsInt(const std::string &Path, int *Res) {
+  FILE *F = fopen(Path.c_str(), "r");
+  if (!F) return false;
+  bool Ok = fscanf(F, "%d", Res) == 1;
+  fclose(F);
+  return Ok;
+}
+
+static std::string CpuDir(unsigned Cpu) {
+  return "/sys/devices/system/cpu/cpu" + std::to_string(Cpu);
+}
+
+// The NUMA node of Cpu, from its nodeN link in sysfs.
+static int CpuNode(unsigned Cpu) {
+  DIR *D = opendir(CpuDir(Cpu).c_str());
+  if (!D) return -1;
+  int Node = -1;
+  while (auto E = readdir(D))
+    if (!strncmp(E->d_name, "node", 4) && isdigit(E->d_name[4]))
+      Node = atoi(E->d_name + 4);
+  closedir(D);
+  return Node;
+}
+
+Vector<unsigned> PhysicalCoreCpus() {
+  struct Core {
+    int Node, Package, CoreId;
+    unsigned Cpu;
+    size_t IndexInNode;
+  };
+  Vector<Core> Cores;
+  cpu_set_t Allowed;
+  if (sched_getaffinity(0, sizeof(Allowed), &Allowed))
+    return {};
+  for (unsigned Cpu = 0; Cpu < CPU_SETSIZE; Cpu++) {
+    std::string Dir = CpuDir(Cpu);
+    if (access(Dir.c_str(), F_OK)) break;
+    int Online = 1;  // cpu0 has no online file.
+    ReadSysfsInt(Dir + "/online", &Online);
+    if (!Online || !CPU_ISSET(Cpu, &Allowed)) continue;
+    Core C = {CpuNode(Cpu), 0, 0, Cpu, 0};
+    if (!ReadSysfsInt(Dir + "/topology/physical_package_id", &C.Package) ||
+        !ReadSysfsInt(Dir + "/topology/core_id", &C.CoreId))
+      return {};
+    // Skip the other hyperthreads of a core.
+    if (std::none_of(Cores.begin(), Cores.end(), [&](const Core &O) {
+          return O.Package == C.Package && O.CoreId == C.CoreId;
+        }))
+      Cores.push_back(C);
+  }
+  std::stable_sort(Cores.begin(), Cores.end(),
+                   [](const Core &A, const Core &B) { return A.Node < B.Node; });
+  for (size_t i = 1; i < Cores.size(); i++)
+    if (Cores[i].Node == Cores[i - 1].Node)
+      Cores[i].IndexInNode = Cores[i - 1].IndexInNode + 1;
+  std::stable_sort(Cores.begin(), Cores.end(),
+                   [](const Core &A, const Core &B) {
+                     return A.IndexInNode < B.IndexInNode;
+                   });
+  Vector<unsigned> Res;
+  for (auto &C : Cores)
+    Res.push_back(C.Cpu);
+  return Res;
+}
+
+bool PinThreadToCpu(unsigned Cpu) {
+  if (Cpu >= CPU_SETSIZE)
+    return false;
+  cpu_set_t Set;
+  CPU_ZERO(&Set);
+  CPU_SET(Cpu, &Set);
+  if (sched_setaffinity(0, sizeof(Set), &Set))
+    return false;
+  // Prefer the local node for new pages; the kernel falls back to the others
+  // when it is full. set_mempolicy is not in every libc.
+  const int kMpolPreferred = 1;  // MPOL_PREFERRED in <linux/mempolicy.h>.
+  const size_t kMaxNodes = 1024;
+  const size_t kBitsPerWord = 8 * sizeof(unsigned long);
+  int Node = CpuNode(Cpu);
+  if (Node >= 0 && (size_t)Node < kMaxNodes) {
+    unsigned long Mask[kMaxNodes / kBitsPerWord] = {};
+    Mask[Node / kBitsPerWord] |= 1UL << (Node % kBitsPerWord);
+    syscall(SYS_set_mempolicy, kMpolPreferred, Mask, kMaxNodes);
+  }
+  return true;
+}
+
+std::string GetLoadedBuildIds() {
+  std::string Res;
+  auto AddBuildIds = [](struct dl_phdr_info *Info, size_t, void *Arg) {
+    auto Res = static_cast<std::string *>(Arg);
+    for (size_t i = 0; i < Info->dlpi_phnum; i++) {
+      const ElfW(Phdr) &Ph = Info->dlpi_phdr[i];
+      if (Ph.p_type != PT_NOTE)
+        continue;
+      auto P = reinterpret_cast<const uint8_t *>(Info->dlpi_addr + Ph.p_vaddr);
+      auto End = P + Ph.p_memsz;
+      while (P + sizeof(ElfW(Nhdr)) <= End) {
+        auto N = reinterpret_cast<const ElfW(Nhdr) *>(P);
+        const uint8_t *Name = P + sizeof(*N);
+        const uint8_t *Desc = Name + ((N->n_namesz + 3) & ~3U);
+        P = Desc + ((N->n_descsz + 3) & ~3U);
+        if (P > End)
+          break;
+        if (N->n_type == NT_GNU_BUILD_ID && N->n_namesz == 4 &&
+            !memcmp(Name, "GNU", 4))
+          Res->append(reinterpret_cast<const char *>(Desc), N->n_descsz);
+      }
+    }
+    return 0;
+  };
+  dl_iterate_phdr(AddBuildIds, &Res);
+  return Res;
+}
+
+#else
+
+// TODO: implement for NetBSD and FreeBSD.
+Vector<unsigned> PhysicalCoreCpus() { return {}; }
+
+bool PinThreadToCpu(unsigned Cpu) { return false; }
+
+std::string GetLoadedBuildIds() { return ""; }
+
+#endif  // LIBFUZZER_LINUX
+
 } // namespace fuzzer
 
 #endif // LIBFUZZER_LINUX || LIBFUZZER_NETBSD || LIBFUZZER_FREEBSD
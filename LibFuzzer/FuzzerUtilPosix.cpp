@@ -10,19 +10,24 @@
 //===----------------------------------------------------------------------===//
 #include "FuzzerDefs.h"
 #if LIBFUZZER_POSIX
+#include "FuzzerForkServer.h"
 #include "FuzzerIO.h"
 #include "FuzzerInternal.h"
+#include "FuzzerUtil.h"
 #include <cassert>
 #include <chrono>
 #include <cstring>
 #include <errno.h>
+#include <fcntl.h>
 #include <iomanip>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <sys/resource.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <thread>
 #include <unistd.h>
 
@@ -83,6 +88,12 @@ void SetTimer(int Seconds) {
   SetSigaction(SIGALRM, AlarmHandler);
 }
 
+uintptr_t GetCurrentThreadHandle() { return (uintptr_t)pthread_self(); }
+
+bool SendAlarmToThread(uintptr_t T) {
+  return pthread_kill((pthread_t)T, SIGALRM) == 0;
+}
+
 void SetSignalHandler(const FuzzingOptions& Options) {
   if (Options.UnitTimeoutSec > 0)
     SetTimer(Options.UnitTimeoutSec / 2 + 1);
@@ -114,6 +125,109 @@ void SleepSeconds(int Seconds) {
 
 unsigned long GetPid() { return (unsigned long)getpid(); }
 
+bool ExitedOnSignal(int Status) {
+  return Status != -1 && WIFSIGNALED(Status);
+}
+
+bool KillProcess(unsigned long Pid) { return !kill((pid_t)Pid, SIGKILL); }
+
+int ExecuteCommand(const Command &Cmd,
+                   const std::function<void(unsigned long Pid)> &OnStart) {
+  int Status;
+  if (ExecuteCommandInForkServer(Cmd, &Status, OnStart))
+    return Status;
+  // Run the program without a shell, so that the pid is the one of Cmd.
+  // Everything the child uses is prepared before fork().
+  auto &Args = Cmd.getArguments();
+  if (Args.empty())
+    return -1;
+  Vector<char *> Argv;
+  for (auto &Arg : Args)
+    Argv.push_back(const_cast<char *>(Arg.c_str()));
+  Argv.push_back(nullptr);
+  std::string OutputFile = Cmd.hasOutputFile() ? Cmd.getOutputFile() : "";
+  bool CombineOutAndErr = Cmd.isOutAndErrCombined();
+  pid_t Pid = fork();
+  if (Pid < 0)
+    return -1;
+  if (Pid == 0) {
+    if (!OutputFile.empty()) {
+      int OutFd = open(OutputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (OutFd < 0)
+        _exit(127);
+      dup2(OutFd, STDOUT_FILENO);
+      close(OutFd);
+    }
+    if (CombineOutAndErr)
+      dup2(STDOUT_FILENO, STDERR_FILENO);
+    execvp(Argv[0], Argv.data());
+    _exit(127);
+  }
+  OnStart(Pid);
+  // Leave the child a zombie until OnStart(0) returned.
+  siginfo_t Info;
+  while (waitid(P_PID, Pid, &Info, WEXITED | WNOWAIT) < 0 && errno == EINTR) {}
+  OnStart(0);
+  Status = -1;
+  while (waitpid(Pid, &Status, 0) < 0 && errno == EINTR) {}
+  return Status;
+}
+
+int ExecuteInForkedChild(const std::function<void()> &Callback,
+                         const std::string &OutputFile, int TimerSec) {
+  int Fd = open(OutputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (Fd < 0)
+    return -1;
+  fflush(stdout);
+  fflush(stderr);
+  pid_t Pid = fork();
+  if (Pid < 0) {
+    close(Fd);
+    return -1;
+  }
+  if (Pid == 0) {
+    dup2(Fd, STDOUT_FILENO);
+    dup2(Fd, STDERR_FILENO);
+    close(Fd);
+    // Interval timers are not inherited by fork().
+    if (TimerSec > 0)
+      SetTimer(TimerSec);
+    Callback();
+    _Exit(0);
+  }
+  close(Fd);
+  int Status;
+  while (waitpid(Pid, &Status, 0) < 0)
+    if (errno != EINTR)
+      return -1;
+  return Status;
+}
+
+std::string CaptureStderr(void (*Callback)()) {
+  FILE *Tmp = tmpfile();
+  if (!Tmp)
+    return "";
+  fflush(stderr);
+  int Saved = dup(STDERR_FILENO);
+  if (Saved < 0 || dup2(fileno(Tmp), STDERR_FILENO) < 0) {
+    if (Saved >= 0)
+      close(Saved);
+    fclose(Tmp);
+    return "";
+  }
+  Callback();
+  fflush(stderr);
+  dup2(Saved, STDERR_FILENO);
+  close(Saved);
+  std::string Res;
+  char Buf[4096];
+  rewind(Tmp);
+  while (size_t N = fread(Buf, 1, sizeof(Buf), Tmp))
+    Res.append(Buf, N);
+  fclose(Tmp);
+  return Res;
+}
+
 size_t GetPeakRSSMb() {
   struct rusage usage;
   if (getrusage(RUSAGE_SELF, &usage))
@@ -13,6 +13,7 @@
 #include "FuzzerCommand.h"
 #include "FuzzerIO.h"
 #include "FuzzerInternal.h"
+#include "FuzzerUtil.h"
 #include <cassert>
 #include <chrono>
 #include <cstring>
@@ -141,6 +142,47 @@ void SleepSeconds(int Seconds) { Sleep(Seconds * 1000); }
 
 unsigned long GetPid() { return GetCurrentProcessId(); }
 
+// system() returns the exit code of the command.
+bool ExitedOnSignal(int Status) { return false; }
+
+// TODO: implement for Windows.
+int ExecuteInForkedChild(const std::function<void()> &Callback,
+                         const std::string &OutputFile, int TimerSec) {
+  return -1;
+}
+
+// TODO: implement for Windows.
+std::string CaptureStderr(void (*Callback)()) {
+  return "";
+}
+
+bool KillProcess(unsigned long Pid) {
+  HANDLE Process = OpenProcess(PROCESS_TERMINATE, FALSE, Pid);
+  if (!Process)
+    return false;
+  bool Res = TerminateProcess(Process, 1);
+  CloseHandle(Process);
+  return Res;
+}
+
+// TODO: use GetLogicalProcessorInformationEx.
+Vector<unsigned> PhysicalCoreCpus() { return {}; }
+
+// NUMA placement is left to the system.
+bool PinThreadToCpu(unsigned Cpu) {
+  if (Cpu >= 8 * sizeof(DWORD_PTR))
+    return false;
+  return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << Cpu) != 0;
+}
+
+// The timer thread runs the alarm callback, see Fuzzer::AlarmCallback.
+uintptr_t GetCurrentThreadHandle() { return 0; }
+
+bool SendAlarmToThread(uintptr_t T) { return false; }
+
+// TODO: read the CodeView GUIDs of the loaded modules.
+std::string GetLoadedBuildIds() { return ""; }
+
 size_t GetPeakRSSMb() {
   PROCESS_MEMORY_COUNTERS info;
   if (!GetProcessMemoryInfo(GetCurrentProcess(), &info, sizeof(info)))
@@ -152,6 +194,12 @@ FILE *OpenProcessPipe(const char *Command, const char *Mode) {
   return _popen(Command, Mode);
 }
 
+// TODO: implement for Windows.
+int ExecuteCommand(const Command &Cmd,
+                   const std::function<void(unsigned long Pid)> &OnStart) {
+  return ExecuteCommand(Cmd);
+}
+
 int ExecuteCommand(const Command &Cmd) {
   std::string CmdLine = Cmd.toString();
   return system(CmdLine.c_str());
@@ -13,6 +13,7 @@
 #define LLVM_FUZZER_VALUE_BIT_MAP_H
 
 #include "FuzzerDefs.h"
+#include "FuzzerSIMD.h"
 
 namespace fuzzer {
 
@@ -57,11 +58,29 @@ struct ValueBitMap {
   template <class Callback>
   ATTRIBUTE_NO_SANITIZE_ALL
   void ForEach(Callback CB) const {
-    for (size_t i = 0; i < kMapSizeInWords; i++)
-      if (uintptr_t M = Map[i])
-        for (size_t j = 0; j < sizeof(M) * 8; j++)
-          if (M & ((uintptr_t)1 << j))
-            CB(i * sizeof(M) * 8 + j);
+    ForEach(CB, [](const uintptr_t *) {});
+  }
+
+  // Same as above, also calls HandleWord for every non-zero word of the map.
+  // The map is scanned for non-zero blocks first, see FindNonZeroBlock.
+  template <class Callback, class WordCallback>
+  ATTRIBUTE_NO_SANITIZE_ALL
+  void ForEach(Callback CB, WordCallback HandleWord) const {
+    const uint8_t *Begin = reinterpret_cast<const uint8_t *>(Map);
+    const uint8_t *End = Begin + sizeof(Map);
+    const size_t kWordsInBlock = kSIMDBlockSize / sizeof(uintptr_t);
+    for (const uint8_t *P = Begin; P < End; P += kSIMDBlockSize) {
+      uint64_t Mask;
+      P = FindNonZeroBlock(P, End, &Mask);
+      if (P == End) break;
+      size_t FirstWord = (P - Begin) / sizeof(uintptr_t);
+      for (size_t i = FirstWord; i < FirstWord + kWordsInBlock; i++)
+        if (uintptr_t M = Map[i]) {
+          HandleWord(&Map[i]);
+          for (; M; M &= M - 1)
+            CB(i * kBitsInWord + __builtin_ctzll(M));
+        }
+    }
   }
 
  private:
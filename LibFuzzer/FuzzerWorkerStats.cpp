@@ -0,0 +1,74 @@
+//===- FuzzerWorkerStats.cpp - Shared-memory worker statistics ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// WorkerStatsTable. The region has a header of kSlotSize bytes (magic and
+// number of slots) followed by the slots, one cache line each.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerWorkerStats.h"
+
+namespace fuzzer {
+
+namespace {
+
+const uint64_t kTableMagic = 0x5354415453524b57ULL;  // "WKRSTATS".
+const size_t kSlotSize = 64;
+const size_t kNumFields = sizeof(WorkerStatus) / sizeof(uint64_t);
+static_assert(kNumFields * sizeof(uint64_t) <= kSlotSize,
+              "WorkerStatus does not fit in a slot");
+
+}  // namespace
+
+uint64_t *WorkerStatsTable::Fields(size_t Slot) const {
+  uint8_t *Data = const_cast<SharedMemoryRegion &>(Region).GetData();
+  return reinterpret_cast<uint64_t *>(Data + kSlotSize * (Slot + 1));
+}
+
+size_t WorkerStatsTable::size() const {
+  return reinterpret_cast<const uint64_t *>(
+      const_cast<SharedMemoryRegion &>(Region).GetData())[1];
+}
+
+bool WorkerStatsTable::Create(const char *Name, size_t NumSlots) {
+  Region.Destroy(Name);
+  if (!Region.Create(Name, kSlotSize * (NumSlots + 1),
+                     /*WithSemaphores*/ false))
+    return false;
+  auto *Header = reinterpret_cast<uint64_t *>(Region.GetData());
+  Header[0] = kTableMagic;
+  Header[1] = NumSlots;
+  return true;
+}
+
+bool WorkerStatsTable::Open(const char *Name) {
+  if (!Region.Open(Name, /*WithSemaphores*/ false))
+    return false;
+  auto *Header = reinterpret_cast<uint64_t *>(Region.GetData());
+  return Region.GetSize() >= kSlotSize && Header[0] == kTableMagic &&
+         Region.GetSize() >= kSlotSize * (Header[1] + 1);
+}
+
+void WorkerStatsTable::Write(size_t Slot, const WorkerStatus &S) {
+  assert(Slot < size());
+  const uint64_t *Src = reinterpret_cast<const uint64_t *>(&S);
+  uint64_t *Dst = Fields(Slot);
+  for (size_t i = 0; i < kNumFields; i++)
+    __atomic_store_n(&Dst[i], Src[i], __ATOMIC_RELAXED);
+}
+
+WorkerStatus WorkerStatsTable::Read(size_t Slot) const {
+  assert(Slot < size());
+  WorkerStatus S;
+  uint64_t *Dst = reinterpret_cast<uint64_t *>(&S);
+  const uint64_t *Src = Fields(Slot);
+  for (size_t i = 0; i < kNumFields; i++)
+    Dst[i] = __atomic_load_n(&Src[i], __ATOMIC_RELAXED);
+  return S;
+}
+
+}  // namespace fuzzer
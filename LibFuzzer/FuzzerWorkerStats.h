@@ -0,0 +1,55 @@
+//===- FuzzerWorkerStats.h - Internal header for the Fuzzer -----*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// fuzzer::WorkerStatsTable: the -jobs workers report their progress to the
+// supervising process through shared memory.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_WORKER_STATS_H
+#define LLVM_FUZZER_WORKER_STATS_H
+
+#include "FuzzerDefs.h"
+#include "FuzzerShmem.h"
+
+namespace fuzzer {
+
+struct WorkerStatus {
+  uint64_t Pid;  // 0 until the worker process reports.
+  uint64_t Runs;
+  uint64_t Coverage;
+  uint64_t Features;
+  uint64_t CorpusUnits;
+  uint64_t CorpusBytes;
+  uint64_t PeakRssMb;
+};
+
+// One slot per worker thread of the supervisor. A slot is only written by
+// the worker process running in it, field by field with relaxed atomics:
+// readers may see a mix of two consecutive updates, which is fine for
+// statistics.
+class WorkerStatsTable {
+ public:
+  bool Create(const char *Name, size_t NumSlots);
+  bool Open(const char *Name);
+  bool Destroy(const char *Name) { return Region.Destroy(Name); }
+
+  size_t size() const;
+  void Write(size_t Slot, const WorkerStatus &S);
+  WorkerStatus Read(size_t Slot) const;
+  // Called before a new worker process starts in Slot.
+  void Clear(size_t Slot) { Write(Slot, WorkerStatus()); }
+
+ private:
+  uint64_t *Fields(size_t Slot) const;
+
+  SharedMemoryRegion Region;
+};
+
+}  // namespace fuzzer
+
+#endif  // LLVM_FUZZER_WORKER_STATS_H
@@ -8,17 +8,33 @@
 // Do not attempt to use LLVM ostream from gtest.
 #define GTEST_NO_LLVM_RAW_OSTREAM 1
 
+#include "FuzzerAsyncWriter.h"
+#include "FuzzerCheckpoint.h"
 #include "FuzzerCorpus.h"
+#include "FuzzerCorpusWatcher.h"
+#include "FuzzerCrashDb.h"
 #include "FuzzerDictionary.h"
+#include "FuzzerFeatureCache.h"
 #include "FuzzerInternal.h"
 #include "FuzzerMerge.h"
 #include "FuzzerMutate.h"
+#include "FuzzerPackedCorpus.h"
 #include "FuzzerRandom.h"
+#include "FuzzerSeedLoader.h"
+#include "FuzzerSharedCorpus.h"
 #include "FuzzerTracePC.h"
+#include "FuzzerWorkerStats.h"
 #include "gtest/gtest.h"
+#include <fstream>
 #include <memory>
 #include <set>
 #include <sstream>
+#include <thread>
+#if LIBFUZZER_POSIX
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace fuzzer;
 
@@ -95,6 +111,91 @@ TEST(Fuzzer, Hash) {
   EXPECT_EQ("81fe8bfe87576c3ecb22426f8e57847382917acf", fuzzer::Hash(U));
 }
 
+TEST(Fuzzer, SHA1MultiBuffer) {
+  // Sizes around the padding boundaries, then random ones.
+  Vector<size_t> Sizes = {0, 1, 55, 56, 63, 64, 65, 119, 120, 128};
+  Random Rand(0);
+  for (int i = 0; i < 40; i++)
+    Sizes.push_back(Rand(301));
+  Vector<Unit> Units;
+  Vector<const uint8_t *> Data;
+  for (size_t Size : Sizes) {
+    Unit U(Size);
+    for (auto &B : U)
+      B = Rand(256);
+    Units.push_back(U);
+  }
+  for (auto &U : Units)
+    Data.push_back(U.data());
+  Vector<std::string> Expected;
+  SetSHA1Impl(SHA1_SCALAR);
+  for (auto &U : Units)
+    Expected.push_back(Hash(U));
+  SHA1Impl Best = SetSHA1Impl(SHA1_NI);
+  for (int L = SHA1_SCALAR; L <= Best; L++) {
+    SetSHA1Impl(static_cast<SHA1Impl>(L));
+    for (size_t i = 0; i < Units.size(); i++)
+      EXPECT_EQ(Expected[i], Hash(Units[i]));
+    Vector<uint8_t> Res(Units.size() * kSHA1NumBytes);
+    Vector<uint8_t *> Out;
+    for (size_t i = 0; i < Units.size(); i++)
+      Out.push_back(Res.data() + i * kSHA1NumBytes);
+    ComputeSHA1MultiBuffer(Data.data(), Sizes.data(), Units.size(),
+                           Out.data());
+    for (size_t i = 0; i < Units.size(); i++)
+      EXPECT_EQ(Expected[i], Sha1ToString(Out[i]));
+  }
+  SetSHA1Impl(Best);
+}
+
+TEST(Fuzzer, Digest) {
+  // Reference values of MurmurHash3_x64_128 with seed 0.
+  UnitDigest D = ComputeDigest(Unit());
+  EXPECT_EQ(D.Lo, 0ULL);
+  EXPECT_EQ(D.Hi, 0ULL);
+  const char *Hello = "hello";
+  D = ComputeDigest(reinterpret_cast<const uint8_t *>(Hello), 5);
+  EXPECT_EQ(D.Lo, 0xcbd8a7b341bd9b02ULL);
+  EXPECT_EQ(D.Hi, 0x5b1e906a48ae1d19ULL);
+
+  // All tail lengths.
+  Set<std::pair<uint64_t, uint64_t>> Seen;
+  Unit U;
+  for (size_t i = 0; i < 40; i++) {
+    D = ComputeDigest(U);
+    EXPECT_TRUE(Seen.insert({D.Lo, D.Hi}).second);
+    U.push_back(0);
+  }
+}
+
+TEST(Fuzzer, DigestSet) {
+  Random Rand(0);
+  DigestSet S;
+  Set<uint64_t> Expected;
+  auto MakeDigest = [](uint64_t X) {
+    UnitDigest D;
+    // Few distinct low bits to get long clusters.
+    D.Lo = X % 7;
+    D.Hi = X;
+    return D;
+  };
+  for (int Iter = 0; Iter < 10000; Iter++) {
+    uint64_t X = Rand(300);
+    if (Rand(2)) {
+      EXPECT_EQ(S.insert(MakeDigest(X)), Expected.insert(X).second);
+    } else {
+      EXPECT_EQ(S.erase(MakeDigest(X)), Expected.erase(X) == 1);
+    }
+    EXPECT_EQ(S.size(), Expected.size());
+    uint64_t Y = Rand(300);
+    EXPECT_EQ(S.count(MakeDigest(Y)), Expected.count(Y) == 1);
+  }
+  S.clear();
+  EXPECT_TRUE(S.empty());
+  EXPECT_FALSE(S.count(MakeDigest(*Expected.begin())));
+  EXPECT_TRUE(S.insert(MakeDigest(*Expected.begin())));
+}
+
 typedef size_t (MutationDispatcher::*Mutator)(uint8_t *Data, size_t Size,
                                               size_t MaxSize);
 
@@ -496,6 +597,84 @@ TEST(FuzzerMutate, ChangeBinaryInteger2) {
   TestChangeBinaryInteger(&MutationDispatcher::Mutate, 1 << 15);
 }
 
+TEST(FuzzerMutate, AdaptiveMutators) {
+  std::unique_ptr<ExternalFunctions> t(new ExternalFunctions());
+  fuzzer::EF = t.get();
+  Random Rand(0);
+  std::unique_ptr<MutationDispatcher> MD(new MutationDispatcher(Rand, {}));
+  size_t N = MD->NumMutators();
+  auto Find = [&](const char *Name) {
+    for (size_t M = 0; M < N; M++)
+      if (!strcmp(MD->MutatorName(M), Name))
+        return M;
+    return N;
+  };
+  const size_t kNo = MutationDispatcher::kNoMutator;
+  size_t ChangeByte = Find("ChangeByte"), EraseBytes = Find("EraseBytes"),
+         ShuffleBytes = Find("ShuffleBytes"), ASCIIInt = Find("ChangeASCIIInt");
+  ASSERT_LT(ChangeByte, N);
+  ASSERT_LT(EraseBytes, N);
+  ASSERT_LT(ShuffleBytes, N);
+  ASSERT_LT(ASCIIInt, N);
+  for (size_t M = 0; M < N; M++)
+    EXPECT_DOUBLE_EQ(MD->MutatorProbability(kNo, M), 1.0 / N);
+
+  // ChangeByte finds new features as the first mutation of a sequence,
+  // EraseBytes only right after ChangeByte. ChangeASCIIInt never mutates the
+  // input, which has no digits.
+  for (int i = 0; i < 5 << 13; i++) {
+    uint8_t T[8];
+    memcpy(T, "abcdefgh", 8);
+    size_t Size = sizeof(T);
+    size_t Prev = kNo;
+    MD->StartMutationSequence();
+    for (int j = 0; j < 2; j++) {
+      Size = MD->Mutate(T, Size, sizeof(T));
+      size_t M = MD->LastMutatorApplied();
+      ASSERT_LT(M, N);
+      if (Prev == kNo)
+        ASSERT_NE(M, ASCIIInt);
+      bool New = Prev == kNo ? M == ChangeByte
+                             : Prev == ChangeByte && M == EraseBytes;
+      MD->RecordMutationYield(New);
+      Prev = M;
+    }
+  }
+
+  // The picks shift towards the productive mutators, the others keep at least
+  // the exploration share.
+  double First = MD->MutatorProbability(kNo, ChangeByte);
+  EXPECT_GT(First, 0.5);
+  for (size_t M = 0; M < N; M++) {
+    EXPECT_GE(MD->MutatorProbability(kNo, M), 0.099 / N);
+    if (M != ChangeByte)
+      EXPECT_LT(MD->MutatorProbability(kNo, M), First);
+  }
+  // Pair rows: EraseBytes is favored right after ChangeByte only.
+  EXPECT_GT(MD->MutatorProbability(ChangeByte, EraseBytes), 0.5);
+  EXPECT_LT(MD->MutatorProbability(ShuffleBytes, EraseBytes), 0.5);
+  EXPECT_LT(MD->MutatorProbability(kNo, EraseBytes), 1.0 / N);
+  // The attempts of ChangeASCIIInt count as executions without yield: it drops
+  // like the unproductive ShuffleBytes instead of keeping its prior, but never
+  // to 0.
+  double ASCIIIntP = MD->MutatorProbability(kNo, ASCIIInt);
+  EXPECT_LT(ASCIIIntP, 1.0 / N);
+  EXPECT_GT(ASCIIIntP, 0);
+  EXPECT_LT(ASCIIIntP, 2 * MD->MutatorProbability(kNo, ShuffleBytes));
+
+  // PickMutator follows the weights.
+  const int kPicks = 10000;
+  int ChangeBytePicks = 0;
+  for (int i = 0; i < kPicks; i++) {
+    uint8_t T[8];
+    memcpy(T, "abcdefgh", 8);
+    MD->StartMutationSequence();
+    MD->Mutate(T, sizeof(T), sizeof(T));
+    ChangeBytePicks += MD->LastMutatorApplied() == ChangeByte;
+  }
+  EXPECT_GT(ChangeBytePicks, First * kPicks * 0.9);
+}
+
 
 TEST(FuzzerDictionary, ParseOneDictionaryEntry) {
   Unit U;
@@ -558,6 +737,71 @@ TEST(FuzzerUtil, Base64) {
   EXPECT_EQ("YWJjeHl6", Base64({'a', 'b', 'c', 'x', 'y', 'z'}));
 }
 
+TEST(FuzzerUtil, ParseCpuAffinity) {
+  Vector<unsigned> Cpus;
+  EXPECT_TRUE(ParseCpuAffinity("3", &Cpus));
+  EXPECT_EQ(Cpus, Vector<unsigned>({3}));
+  EXPECT_TRUE(ParseCpuAffinity("0,2,8-10", &Cpus));
+  EXPECT_EQ(Cpus, Vector<unsigned>({0, 2, 8, 9, 10}));
+  for (auto Bad : {"", "x", "1,", "1,,2", "3-1", "1-", "1x", "-1"})
+    EXPECT_FALSE(ParseCpuAffinity(Bad, &Cpus)) << Bad;
+  EXPECT_TRUE(ParseCpuAffinity("auto", &Cpus));
+  EXPECT_FALSE(Cpus.empty());
+  EXPECT_EQ(std::set<unsigned>(Cpus.begin(), Cpus.end()).size(), Cpus.size());
+}
+
+TEST(FuzzerUtil, WorkerCpus) {
+  Vector<unsigned> Cpus = {0, 1, 2, 3, 4, 5, 6, 7};
+  EXPECT_EQ(WorkerCpus(Cpus, 0, 1), Vector<unsigned>({0}));
+  EXPECT_EQ(WorkerCpus(Cpus, 5, 1), Vector<unsigned>({5}));
+  // Disjoint slices of -threads CPUs.
+  EXPECT_EQ(WorkerCpus(Cpus, 0, 3), Vector<unsigned>({0, 1, 2}));
+  EXPECT_EQ(WorkerCpus(Cpus, 1, 3), Vector<unsigned>({3, 4, 5}));
+  std::set<unsigned> Seen;
+  for (size_t Slot = 0; Slot < 4; Slot++)
+    for (auto Cpu : WorkerCpus(Cpus, Slot, 2))
+      EXPECT_TRUE(Seen.insert(Cpu).second) << Cpu;
+  EXPECT_EQ(Seen.size(), Cpus.size());
+  // More threads than CPUs wrap around them.
+  EXPECT_EQ(WorkerCpus(Cpus, 2, 3), Vector<unsigned>({6, 7, 0}));
+  EXPECT_EQ(WorkerCpus({4}, 1, 2), Vector<unsigned>({4, 4}));
+  EXPECT_TRUE(WorkerCpus({}, 1, 2).empty());
+}
+
+TEST(FuzzerUtil, MinimizeUnit) {
+  auto ToUnit = [](const char *S) { return Unit(S, S + strlen(S)); };
+  auto Has = [](const Unit &U, const char *S) {
+    return std::search(U.begin(), U.end(), S, S + strlen(S)) != U.end();
+  };
+  auto Never = []() { return false; };
+  size_t Runs = 0;
+  // Chunks and single bytes are removed, the other bytes become '0'.
+  auto Boom = [&](const Unit &U) {
+    Runs++;
+    return Has(U, "BOOM") && U.size() >= 6;
+  };
+  EXPECT_EQ(MinimizeUnit(ToUnit("xxxxxBOOMyyyyyyyyyyyyyzzz"), {}, Boom, Never),
+            ToUnit("00BOOM"));
+  EXPECT_EQ(MinimizeUnit(ToUnit("BOOM"), {}, Boom, Never), ToUnit("BOOM"));
+  // A token the chunks do not line up with is removed through the dictionary.
+  auto XY = [&](const Unit &U) {
+    Runs++;
+    return U.size() >= 2 && U.front() == 'x' && U.back() == 'y' &&
+           U.size() % 2 == 0 && !Has(U, "0");
+  };
+  EXPECT_EQ(MinimizeUnit(ToUnit("xABy"), {}, XY, Never), ToUnit("xABy"));
+  EXPECT_EQ(MinimizeUnit(ToUnit("xABy"), {ToUnit("AB")}, XY, Never),
+            ToUnit("xy"));
+  // It stops when out of budget, with the smallest unit accepted so far.
+  Runs = 0;
+  auto ThreeRuns = [&]() { return Runs >= 3; };
+  Unit U = MinimizeUnit(ToUnit("xxxxxBOOMyyyyyyyyyyyyyzzz"), {}, Boom,
+                        ThreeRuns);
+  EXPECT_EQ(Runs, 3U);
+  EXPECT_TRUE(Boom(U));
+  EXPECT_GT(U.size(), 6U);
+}
+
 TEST(Corpus, Distribution) {
   Random Rand(0);
   std::unique_ptr<InputCorpus> C(new InputCorpus(""));
@@ -576,6 +820,668 @@ TEST(Corpus, Distribution) {
   }
 }
 
+TEST(Corpus, HasUnit) {
+  Random Rand(0);
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  Unit A = {'a', 'b', 'c'}, B = {'a', 'b', 'c', 'd'}, AB = {'a', 'b'};
+  EXPECT_FALSE(C->HasUnit(A));
+  C->AddToCorpus(B, 1, false, {});
+  EXPECT_TRUE(C->HasUnit(B));
+  EXPECT_FALSE(C->HasUnit(A));
+  EXPECT_TRUE(C->HasUnit("81fe8bfe87576c3ecb22426f8e57847382917acf"));
+  EXPECT_FALSE(C->HasUnit("a9993e364706816aba3e25717850c26c9cd0d89d"));
+  C->Replace(&C->ChooseUnitToMutate(Rand), A);
+  EXPECT_FALSE(C->HasUnit(B));
+  EXPECT_TRUE(C->HasUnit(A));
+  EXPECT_TRUE(C->HasUnit("a9993e364706816aba3e25717850c26c9cd0d89d"));
+  EXPECT_FALSE(C->HasUnit(AB));
+}
+
+TEST(Corpus, Arena) {
+  for (bool UseMmap : {false, true}) {
+    CorpusArena A(UseMmap);
+    Random Rand(0);
+    Vector<Unit> Units;
+    Vector<ArenaSlot> Slots;
+    for (int i = 0; i < 1000; i++) {
+      Units.push_back(Unit(Rand(6000), static_cast<uint8_t>(i)));
+      Slots.push_back(A.Append(Units.back().data(), Units.back().size()));
+    }
+    Vector<ArenaSlot *> Live;
+    for (size_t i = 0; i < Units.size(); i++) {
+      EXPECT_EQ(A.Get<uint8_t>(Slots[i]).ToVector(), Units[i]);
+      if (i % 4)
+        A.Free(Slots[i]);
+      else
+        Live.push_back(&Slots[i]);
+    }
+    EXPECT_TRUE(A.NeedsCompaction());
+    size_t Capacity = A.CapacityBytes();
+    A.Compact(Live);
+    EXPECT_FALSE(A.NeedsCompaction());
+    EXPECT_EQ(A.UsedBytes(), A.LiveBytesCount());
+    EXPECT_LT(A.CapacityBytes(), Capacity);
+    for (size_t i = 0; i < Units.size(); i += 4)
+      EXPECT_EQ(A.Get<uint8_t>(Slots[i]).ToVector(), Units[i]);
+  }
+}
+
+TEST(Corpus, ArenaCompaction) {
+  Random Rand(0);
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  Vector<Unit> Units;
+  size_t Size = 0;
+  for (size_t i = 0; i < 100; i++) {
+    Units.push_back(Unit(20000 + i, static_cast<uint8_t>(i)));
+    C->AddToCorpus(Units.back(), 1, false, {uint32_t(i + 2), uint32_t(i)});
+    Size += Units.back().size();
+  }
+  EXPECT_EQ(C->SizeInBytes(), Size);
+  // Shrinking every unit leaves enough garbage to compact the arena.
+  size_t Used = C->GetArena().UsedBytes();
+  for (size_t i = 0; i < 100; i++) {
+    InputInfo &II = C->ChooseUnitToMutate(Rand);
+    Unit &U = Units[II.U()[0]];
+    U.resize(U.size() / 2);
+    C->Replace(&II, U);
+  }
+  EXPECT_LT(C->GetArena().UsedBytes(), Used);
+  Size = 0;
+  for (size_t i = 0; i < 100; i++) {
+    EXPECT_EQ((*C)[i].ToVector(), Units[i]);
+    EXPECT_TRUE(C->HasUnit(Units[i]));
+    Size += Units[i].size();
+    InputInfo &II = C->ChooseUnitToMutate(Rand);
+    Vector<uint32_t> Expected = {uint32_t(II.U()[0]), uint32_t(II.U()[0] + 2)};
+    EXPECT_EQ(II.UniqFeatureSet().ToVector(), Expected);
+  }
+  EXPECT_EQ(C->SizeInBytes(), Size);
+}
+
+TEST(Corpus, WeightedSampler) {
+  Random Rand(0);
+  WeightedSampler S;
+  Vector<uint64_t> W;
+  for (int Iter = 0; Iter < 2000; Iter++) {
+    if (W.empty() || Rand(3) == 0) {
+      W.push_back(Rand(4) ? Rand(100) : 0);
+      S.push_back(W.back());
+    } else {
+      size_t Idx = Rand(W.size());
+      W[Idx] = Rand(4) ? Rand(100) : 0;
+      S.Set(Idx, W[Idx]);
+    }
+    uint64_t Total = 0;
+    for (auto X : W) Total += X;
+    ASSERT_EQ(S.Total(), Total);
+    if (!Total) continue;
+    // Every X must fall into the bucket of the weight that covers it.
+    uint64_t X = Rand(Total);
+    size_t Idx = 0;
+    for (uint64_t Sum = W[0]; Sum <= X; Sum += W[++Idx]) {}
+    EXPECT_EQ(S.Find(X), Idx);
+  }
+
+  // Weights changed in place are reflected in the draws.
+  WeightedSampler S2;
+  for (int i = 0; i < 4; i++)
+    S2.push_back(1);
+  S2.Set(2, 0);
+  S2.Set(3, 2);
+  Vector<size_t> Hist(4);
+  for (int i = 0; i < 40000; i++)
+    Hist[S2.Sample(Rand)]++;
+  EXPECT_EQ(Hist[2], 0U);
+  EXPECT_GT(Hist[3], Hist[0] * 3 / 2);
+  EXPECT_GT(Hist[0], 8000U);
+  EXPECT_GT(Hist[1], 8000U);
+}
+
+TEST(Corpus, AddFeature) {
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  EXPECT_EQ(C->GetFeatureFrequency(5), 0);
+  // Features are kept for the smallest inputs that have them.
+  EXPECT_TRUE(C->AddFeature(5, 10, /*Shrink=*/true));
+  C->AddToCorpus(Unit(10, 'a'), 1, false, {5});
+  EXPECT_FALSE(C->AddFeature(5, 10, true));
+  EXPECT_FALSE(C->AddFeature(5, 5, /*Shrink=*/false));
+  EXPECT_TRUE(C->AddFeature(5, 5, true));
+  C->AddToCorpus(Unit(5, 'b'), 1, false, {5});
+  // Feature indices wrap around.
+  EXPECT_TRUE(C->AddFeature(6 + (1 << 21), 3, true));
+  EXPECT_FALSE(C->AddFeature(6, 3, true));
+  EXPECT_EQ(C->NumFeatures(), 2U);
+  EXPECT_EQ(C->NumFeatureUpdates(), 3U);
+
+  C->UpdateFeatureFrequency(5);
+  C->UpdateFeatureFrequency(5 + (1 << 21));
+  EXPECT_EQ(C->GetFeatureFrequency(5), 2);
+  EXPECT_EQ(C->GetFeatureFrequency(6), 0);
+}
+
+TEST(Corpus, PackedCorpus) {
+  std::string Path = DirPlusFile(TmpDir(), "libfuzzer-test-packed-corpus");
+  RemoveFile(Path);
+  EXPECT_FALSE(IsPackedCorpus(Path));
+  Unit A = {'a', 'b', 'c'}, B = {'x'}, C(100, 'c');
+  {
+    PackedCorpusWriter W;
+    ASSERT_TRUE(W.Open(Path));
+    W.Append(A.data(), A.size());
+    Vector<uint32_t> Features = {7, 8};
+    W.Append(B.data(), B.size(), nullptr, &Features);
+    W.Append(C.data(), C.size());
+    uint8_t Sha1[kSHA1NumBytes];
+    ComputeSHA1(A.data(), A.size(), Sha1);
+    W.Delete(Sha1);
+  }
+  // A torn record at the end is ignored.
+  FILE *F = fopen(Path.c_str(), "ab");
+  fwrite("\1\0\0\0\x40", 1, 5, F);
+  fclose(F);
+  EXPECT_TRUE(IsPackedCorpus(Path));
+
+  PackedCorpus PC;
+  ASSERT_TRUE(PC.Open(Path));
+  auto &Entries = PC.Entries();
+  ASSERT_EQ(Entries.size(), 2U);
+  EXPECT_EQ(Unit(Entries[0].Data, Entries[0].Data + Entries[0].Size), B);
+  EXPECT_EQ(Entries[0].Features.ToVector(), Vector<uint32_t>({7, 8}));
+  EXPECT_EQ(Sha1ToString(Entries[1].Sha1), Hash(C));
+  EXPECT_TRUE(Entries[1].Features.empty());
+
+  Vector<SizedFile> Files;
+  GetSizedFilesFromDir(Path, &Files);
+  ASSERT_EQ(Files.size(), 2U);
+  EXPECT_EQ(FileToVector(Files[1].File), C);
+  EXPECT_EQ(FileToVector(Files[1].File, 10), Unit(10, 'c'));
+  EXPECT_EQ(Files[1].Size, 100U);
+  Unit U;
+  EXPECT_FALSE(ReadPackedCorpusEntry(Path + "@1", 0, &U));
+
+  // The next writer cuts the torn record off before appending.
+  {
+    PackedCorpusWriter W;
+    ASSERT_TRUE(W.Open(Path));
+    W.Append(A.data(), A.size());
+  }
+  PackedCorpus PC2;
+  ASSERT_TRUE(PC2.Open(Path));
+  ASSERT_EQ(PC2.Entries().size(), 3U);
+  auto &E = PC2.Entries()[2];
+  EXPECT_EQ(Unit(E.Data, E.Data + E.Size), A);
+  EXPECT_EQ(E.Offset + 32 + 4, FileSize(Path));
+  RemoveFile(Path);
+}
+
+TEST(Corpus, PackedCorpusConcurrentWriters) {
+  std::string Path = DirPlusFile(TmpDir(), "libfuzzer-test-packed-writers");
+  RemoveFile(Path);
+  // Every writer has its own file, as the -jobs workers do.
+  const size_t kWriters = 4, kRecords = 200;
+  Vector<std::thread> Threads;
+  for (size_t T = 0; T < kWriters; T++)
+    Threads.push_back(std::thread([&, T]() {
+      PackedCorpusWriter W;
+      ASSERT_TRUE(W.Open(Path));
+      for (size_t i = 0; i < kRecords; i++) {
+        Unit U(1 + (i * 37 + T) % 5000, static_cast<uint8_t>(T));
+        W.Append(U.data(), U.size());
+      }
+    }));
+  for (auto &T : Threads)
+    T.join();
+  PackedCorpus PC;
+  ASSERT_TRUE(PC.Open(Path));
+  ASSERT_EQ(PC.Entries().size(), kWriters * kRecords);
+  for (auto &E : PC.Entries())
+    EXPECT_EQ(Sha1ToString(E.Sha1), Hash(Unit(E.Data, E.Data + E.Size)));
+  RemoveFile(Path);
+}
+
+TEST(Corpus, PackedCorpusTail) {
+  std::string Path = DirPlusFile(TmpDir(), "libfuzzer-test-packed-tail");
+  RemoveFile(Path);
+  Unit A = {'a', 'b', 'c'}, B = {'x'}, C(100, 'c');
+  PackedCorpusWriter W;
+  ASSERT_TRUE(W.Open(Path));
+  W.Append(A.data(), A.size());
+  uint8_t Sha1[kSHA1NumBytes];
+  ComputeSHA1(A.data(), A.size(), Sha1);
+  W.Delete(Sha1);
+  size_t Offset = 0;
+  Vector<Unit> Tail;
+  EXPECT_TRUE(ReadPackedCorpusTail(Path, &Offset, 0, &Tail));
+  EXPECT_EQ(Tail, Vector<Unit>({A}));
+  EXPECT_EQ(Offset, FileSize(Path));
+
+  // Only what was appended since, up to the torn record.
+  W.Append(B.data(), B.size());
+  W.Append(C.data(), C.size());
+  size_t Complete = FileSize(Path);
+  FILE *F = fopen(Path.c_str(), "ab");
+  fwrite("\1\0\0\0\x40", 1, 5, F);
+  fclose(F);
+  Tail.clear();
+  EXPECT_TRUE(ReadPackedCorpusTail(Path, &Offset, 10, &Tail));
+  EXPECT_EQ(Tail, Vector<Unit>({B, Unit(10, 'c')}));
+  EXPECT_EQ(Offset, Complete);
+  Tail.clear();
+  EXPECT_TRUE(ReadPackedCorpusTail(Path, &Offset, 0, &Tail));
+  EXPECT_TRUE(Tail.empty());
+  EXPECT_FALSE(ReadPackedCorpusTail(Path + "-missing", &Offset, 0, &Tail));
+  RemoveFile(Path);
+}
+
+TEST(Fuzzer, NormalizeStackTrace) {
+  const char *Trace =
+      "==1== ERROR: libFuzzer: deadly signal\n"
+      "    #0 0x7f58 in __sanitizer_print_stack_trace asan_stack.cpp:87\n"
+      "    #1 0x5617 in fuzzer::Fuzzer::CrashCallback() FuzzerLoop.cpp:280\n"
+      "    #2 0x7f58  (/lib/x86_64-linux-gnu/libc.so.6+0x3c04f)\n"
+      "    #3 0x7f58 in raise (/lib/x86_64-linux-gnu/libc.so.6+0x3bfb1)\n"
+      "    #4 0x7f58 in abort (/lib/x86_64-linux-gnu/libc.so.6+0x26471)\n"
+      "    #5 0x5617 in Parse(char const*, unsigned long) parse.cc:7:3\n"
+      "    #6 0x5617 in LLVMFuzzerTestOneInput /src/fuzz.cc:12\n"
+      "    #7 0x5617 in fuzzer::Fuzzer::ExecuteCallback(unsigned char const*, "
+      "unsigned long) FuzzerLoop.cpp:804\n"
+      "    #8 0x5617 in main FuzzerMain.cpp:20\n"
+      "\n"
+      "DEDUP_TOKEN: __sanitizer_print_stack_trace--fuzzer::Fuzzer\n";
+  EXPECT_EQ(NormalizeStackTrace(Trace, 3),
+            "Parse(char const*, unsigned long)\nLLVMFuzzerTestOneInput\n");
+  EXPECT_EQ(NormalizeStackTrace(Trace, 1),
+            "Parse(char const*, unsigned long)\n");
+  EXPECT_EQ(NormalizeStackTrace("    #0 0x5617  (/tmp/a.out+0x1234)\n", 3),
+            "");
+  // The signal trampolines between the handler and the crashing frame.
+  for (auto *Trampoline : {"__restore_rt", "_sigtramp"}) {
+    std::string Signal =
+        "    #0 0x5617 in fuzzer::Fuzzer::StaticCrashSignalCallback()\n"
+        "    #1 0x7f58 in " + std::string(Trampoline) + " libc.so.6\n"
+        "    #2 0x5617 in Parse(char const*, unsigned long) parse.cc:7:3\n"
+        "    #3 0x5617 in LLVMFuzzerTestOneInput /src/fuzz.cc:12\n";
+    EXPECT_EQ(NormalizeStackTrace(Signal, 3),
+              "Parse(char const*, unsigned long)\nLLVMFuzzerTestOneInput\n");
+  }
+}
+
+#if LIBFUZZER_POSIX
+TEST(Corpus, SharedCorpusRing) {
+  const char *Name = "libFuzzer-test-shared-corpus";
+  SharedCorpusRing A, B;
+  ASSERT_TRUE(A.Create(Name, 0, 16));  // The minimal number of slots.
+  ASSERT_TRUE(B.Open(Name));
+  const size_t NumSlots = A.NumSlots();
+  Unit U1 = {1, 2, 3}, U2 = {4};
+  Vector<uint32_t> F1 = {10, 20, 30};
+  EXPECT_TRUE(A.Publish(U1.data(), U1.size(), &F1));
+  EXPECT_TRUE(A.Publish(U2.data(), U2.size(), nullptr));
+  Unit Big(17, 'x');
+  EXPECT_FALSE(A.Publish(Big.data(), Big.size(), nullptr));
+
+  Vector<SharedUnit> Units;
+  EXPECT_EQ(A.Consume(&Units, 100), 0U);  // Not our own records.
+  EXPECT_EQ(B.Consume(&Units, 1), 1U);
+  EXPECT_EQ(B.Consume(&Units, 100), 1U);
+  ASSERT_EQ(Units.size(), 2U);
+  EXPECT_EQ(Units[0].U, U1);
+  EXPECT_TRUE(Units[0].FeaturesKnown);
+  EXPECT_EQ(Units[0].Features, F1);
+  EXPECT_EQ(Units[1].U, U2);
+  EXPECT_FALSE(Units[1].FeaturesKnown);
+
+  // A reader that falls behind gets the records that were not overwritten,
+  // and so does a reader that joins late.
+  for (size_t i = 0; i < NumSlots * 3; i++) {
+    Unit U(1, static_cast<uint8_t>(i));
+    EXPECT_TRUE(B.Publish(U.data(), U.size(), nullptr));
+  }
+  SharedCorpusRing C;
+  ASSERT_TRUE(C.Open(Name));
+  for (auto *R : {&A, &C}) {
+    Units.clear();
+    EXPECT_EQ(R->Consume(&Units, 1000), NumSlots);
+    EXPECT_EQ(Units.front().U, Unit(1, static_cast<uint8_t>(NumSlots * 2)));
+    EXPECT_EQ(Units.back().U, Unit(1, static_cast<uint8_t>(NumSlots * 3 - 1)));
+  }
+  EXPECT_TRUE(A.Destroy(Name));
+}
+
+TEST(Fuzzer, WorkerStatsTable) {
+  const char *Name = "libFuzzer-test-worker-stats";
+  WorkerStatsTable Supervisor, Worker;
+  ASSERT_TRUE(Supervisor.Create(Name, 3));
+  ASSERT_TRUE(Worker.Open(Name));
+  EXPECT_EQ(Worker.size(), 3U);
+  WorkerStatus S = {42, 1000, 10, 20, 5, 50, 7};
+  Worker.Write(1, S);
+  WorkerStatus R = Supervisor.Read(1);
+  EXPECT_EQ(memcmp(&R, &S, sizeof(S)), 0);
+  EXPECT_EQ(Supervisor.Read(0).Pid, 0U);
+  EXPECT_EQ(Supervisor.Read(2).Runs, 0U);
+  Supervisor.Clear(1);
+  EXPECT_EQ(Worker.Read(1).Runs, 0U);
+  EXPECT_TRUE(Supervisor.Destroy(Name));
+}
+
+TEST(FuzzerUtil, ExecuteInForkedChild) {
+  std::string Path = DirPlusFile(TmpDir(), "libfuzzer-test-forked-child");
+  int X = 1;
+  int Status = ExecuteInForkedChild([&]() {
+    X = 2;
+    Printf("output of the child\n");
+  }, Path, 0);
+  EXPECT_EQ(Status, 0);
+  EXPECT_EQ(X, 1);  // The child has its own copy of the memory.
+  EXPECT_EQ(FileToString(Path), "output of the child\n");
+
+  Status = ExecuteInForkedChild([]() { _exit(77); }, Path, 0);
+  EXPECT_NE(Status, 0);
+  EXPECT_EQ(Status, ExecuteInForkedChild([]() { _exit(77); }, Path, 0));
+  EXPECT_TRUE(FileToString(Path).empty());
+
+  // Only a real signal counts, not an exit code above 128.
+  EXPECT_FALSE(ExitedOnSignal(Status));
+  EXPECT_FALSE(ExitedOnSignal(
+      ExecuteInForkedChild([]() { _exit(137); }, Path, 0)));
+  EXPECT_TRUE(ExitedOnSignal(
+      ExecuteInForkedChild([]() { kill(getpid(), SIGKILL); }, Path, 0)));
+  RemoveFile(Path);
+}
+
+TEST(Fuzzer, CrashDb) {
+  std::string Dir = DirPlusFile(TmpDir(), "libfuzzer-test-crash-db-XXXXXX");
+  ASSERT_NE(mkdtemp(&Dir[0]), nullptr);
+  CrashDb Db;
+  ASSERT_TRUE(Db.Open(Dir));
+  CrashBucket B;
+  bool Saved;
+  EXPECT_TRUE(Db.Add("crash-", "f\ng\n", Unit(10, 'a'), &B, &Saved));
+  EXPECT_TRUE(Saved);
+  EXPECT_EQ(B.NumCrashes, 1U);
+  EXPECT_TRUE(Db.Add("crash-", "f\ng\n", Unit(5, 'b'), &B, &Saved));
+  EXPECT_TRUE(Saved);
+  EXPECT_TRUE(Db.Add("crash-", "f\ng\n", Unit(7, 'c'), &B, &Saved));
+  EXPECT_FALSE(Saved);
+  EXPECT_EQ(B.NumCrashes, 3U);
+  EXPECT_EQ(FileSize(B.ReproPath + ".hits"), 3 * 62U);
+  EXPECT_EQ(B.ReproSize, 5U);
+  EXPECT_EQ(FileToVector(B.ReproPath), Unit(5, 'b'));
+  // Another stack, or another kind of failure, is another bucket.
+  EXPECT_TRUE(Db.Add("crash-", "g\n", Unit(20, 'd'), &B, &Saved));
+  EXPECT_TRUE(Db.Add("timeout-", "g\n", Unit(20, 'e'), &B, &Saved));
+  EXPECT_TRUE(Db.Add("timeout-", "g\n", Unit(30, 'e'), &B, &Saved));
+
+  auto Buckets = Db.List();
+  ASSERT_EQ(Buckets.size(), 3U);
+  EXPECT_EQ(Buckets[0].NumCrashes, 3U);
+  EXPECT_EQ(Buckets[0].Stack, "f\ng\n");
+  EXPECT_EQ(Buckets[0].ReproSize, 5U);
+  EXPECT_EQ(Buckets[1].NumCrashes, 2U);
+  EXPECT_EQ(Buckets[1].Name.substr(0, 8), "timeout-");
+  EXPECT_EQ(Buckets[1].ReproSize, 20U);
+  EXPECT_EQ(Buckets[2].NumCrashes, 1U);
+  for (auto &B : Buckets)
+    for (auto *Suffix : {"", ".stack", ".hits"})
+      RemoveFile(B.ReproPath + Suffix);
+  EXPECT_EQ(rmdir(Dir.c_str()), 0);
+}
+#endif
+
+TEST(Fuzzer, AsyncWriter) {
+  std::string Prefix = DirPlusFile(TmpDir(), "libfuzzer-test-async-");
+  // Writes before the start are synchronous.
+  WriteToFileAsync({'s'}, Prefix + "sync");
+  EXPECT_EQ(FileToVector(Prefix + "sync"), Unit({'s'}));
+  RemoveFileAsync(Prefix + "sync");
+  EXPECT_FALSE(IsFile(Prefix + "sync"));
+
+  StartAsyncWriter(FSYNC_NONE);
+  // More requests than the queue holds; the removals of the odd files must
+  // come after their writes.
+  const size_t N = 3000;
+  for (size_t i = 0; i < N; i++) {
+    WriteToFileAsync(Unit(i % 7 + 1, static_cast<uint8_t>(i)),
+                     Prefix + std::to_string(i));
+    if (i % 2)
+      RemoveFileAsync(Prefix + std::to_string(i));
+  }
+  DrainAsyncWriter(60000);
+  for (size_t i = 0; i < N; i++) {
+    std::string Path = Prefix + std::to_string(i);
+    if (i % 2) {
+      EXPECT_FALSE(IsFile(Path));
+    } else {
+      EXPECT_EQ(FileToVector(Path),
+                Unit(i % 7 + 1, static_cast<uint8_t>(i)));
+      RemoveFile(Path);
+    }
+  }
+}
+
+#if LIBFUZZER_LINUX
+TEST(Fuzzer, CorpusWatcher) {
+  std::string Dir = DirPlusFile(TmpDir(), "libfuzzer-test-watch-XXXXXX");
+  ASSERT_NE(mkdtemp(&Dir[0]), nullptr);
+  std::string Sub = DirPlusFile(Dir, "sub");
+  CorpusWatcher W;
+  if (W.Start(Dir)) {  // Not if TmpDir is on a network file system.
+    Vector<std::string> NewFiles;
+    EXPECT_TRUE(W.Poll(&NewFiles));
+    EXPECT_TRUE(NewFiles.empty());
+    // The files of a new subdir are reported even if they were written
+    // before the subdir is watched.
+    ASSERT_EQ(mkdir(Sub.c_str(), 0700), 0);
+    WriteToFile({'a'}, DirPlusFile(Dir, "a"));
+    WriteToFile({'b'}, DirPlusFile(Sub, "b"));
+    EXPECT_TRUE(W.Poll(&NewFiles));
+    std::sort(NewFiles.begin(), NewFiles.end());
+    EXPECT_EQ(NewFiles, Vector<std::string>({DirPlusFile(Dir, "a"),
+                                             DirPlusFile(Sub, "b")}));
+    NewFiles.clear();
+    WriteToFile({'c'}, DirPlusFile(Sub, "c"));
+    EXPECT_TRUE(W.Poll(&NewFiles));
+    EXPECT_EQ(NewFiles, Vector<std::string>({DirPlusFile(Sub, "c")}));
+    for (auto &Path : {DirPlusFile(Dir, "a"), DirPlusFile(Sub, "b"),
+                       DirPlusFile(Sub, "c")})
+      RemoveFile(Path);
+    rmdir(Sub.c_str());
+  }
+  rmdir(Dir.c_str());
+}
+#endif
+
+TEST(Fuzzer, SeedLoader) {
+  std::string Prefix = DirPlusFile(TmpDir(), "libfuzzer-test-seed-loader-");
+  const uint8_t Packed[] = {'x', 'y', 'z', 'w'};
+  Vector<SizedFile> Files;
+  Vector<Unit> Contents = {{'a'}, {'b', 'c'}, {'a'}, {'d', 'e', 'f', 'g'},
+                           {'b', 'c'}, {}, {'x', 'y', 'z'}};
+  for (size_t i = 0; i < Contents.size(); i++) {
+    std::string Path = Prefix + std::to_string(i);
+    WriteToFile(Contents[i], Path);
+    Files.push_back({Path, Contents[i].size(), nullptr});
+  }
+  // Truncated to the same contents as the last file.
+  Files.push_back({"", sizeof(Packed), Packed});
+  Vector<Unit> Expected = {{'a'}, {'b', 'c'}, {'d', 'e', 'f'}, {},
+                           {'x', 'y', 'z'}};
+  for (size_t NumThreads : {0, 1, 3}) {
+    for (size_t Window : {1, 2, 16}) {
+      SeedLoader Loader(Files, 3, NumThreads, Window);
+      Vector<Unit> Loaded;
+      const uint8_t *Data;
+      size_t Size;
+      while (Loader.Next(&Data, &Size))
+        Loaded.push_back(Unit(Data, Data + Size));
+      EXPECT_EQ(Loaded, Expected);
+      EXPECT_EQ(Loader.NumDuplicates(), 3U);
+    }
+  }
+  // The loader may be destroyed before all the files are consumed.
+  {
+    SeedLoader Loader(Files, 3, 2, 2);
+    const uint8_t *Data;
+    size_t Size;
+    EXPECT_TRUE(Loader.Next(&Data, &Size));
+  }
+  for (size_t i = 0; i < Contents.size(); i++)
+    RemoveFile(Prefix + std::to_string(i));
+}
+
+TEST(Fuzzer, FeatureCache) {
+  std::string Path = DirPlusFile(TmpDir(), "libfuzzer-test-feature-cache-" +
+                                               std::to_string(GetPid()));
+  RemoveFile(Path);
+  Unit A = {'a'}, B = {'b', 'b'};
+  UnitDigest Key = ComputeDigest({'k'}), OtherKey = ComputeDigest({'o'});
+  Vector<uint32_t> Features;
+  {
+    FeatureCache C;
+    ASSERT_TRUE(C.Open(Path, Key));
+    EXPECT_EQ(C.size(), 0U);
+    C.Append(ComputeDigest(A), A.size(), {1, 5, 9});
+    C.Append(ComputeDigest(B), B.size(), {});
+    C.Append(ComputeDigest(A), A.size(), {2});  // Already there.
+    // Only what was in the file when it was opened is looked up.
+    EXPECT_FALSE(C.Lookup(ComputeDigest(A), A.size(), &Features));
+  }
+  // A record cut short by a crash is dropped.
+  Unit File = FileToVector(Path);
+  File.resize(File.size() + 10, 0xff);
+  WriteToFile(File, Path);
+  {
+    FeatureCache C;
+    ASSERT_TRUE(C.Open(Path, Key));
+    EXPECT_EQ(C.size(), 2U);
+    EXPECT_TRUE(C.Lookup(ComputeDigest(A), A.size(), &Features));
+    EXPECT_EQ(Features, Vector<uint32_t>({1, 5, 9}));
+    EXPECT_TRUE(C.Lookup(ComputeDigest(B), B.size(), &Features));
+    EXPECT_TRUE(Features.empty());
+    EXPECT_FALSE(C.Lookup(ComputeDigest(A), 2, &Features));
+    EXPECT_FALSE(C.Lookup(ComputeDigest({'c'}), 1, &Features));
+
+    // The records of C go to another cache, except those it has.
+    std::string OtherPath = Path + ".other";
+    RemoveFile(OtherPath);
+    {
+      FeatureCache O;
+      ASSERT_TRUE(O.Open(OtherPath, Key));
+      O.Append(ComputeDigest(B), B.size(), {3});
+      O.AppendAll(C);
+    }
+    FeatureCache O;
+    ASSERT_TRUE(O.Open(OtherPath, Key));
+    EXPECT_EQ(O.size(), 2U);
+    EXPECT_TRUE(O.Lookup(ComputeDigest(A), A.size(), &Features));
+    EXPECT_EQ(Features, Vector<uint32_t>({1, 5, 9}));
+    EXPECT_TRUE(O.Lookup(ComputeDigest(B), B.size(), &Features));
+    EXPECT_EQ(Features, Vector<uint32_t>({3}));
+    RemoveFile(OtherPath);
+  }
+  EXPECT_EQ(FileSize(Path), File.size() - 10);
+  {
+    // The torn tail is cut off in place: a process that already has the
+    // file open keeps appending to it.
+    Unit C = {'c'}, D = {'d'};
+    FeatureCache Old;
+    ASSERT_TRUE(Old.Open(Path, Key));
+    Old.Append(ComputeDigest(C), C.size(), {4});
+    File = FileToVector(Path);
+    File.resize(File.size() + 10, 0xff);
+    WriteToFile(File, Path);
+    FeatureCache New;
+    ASSERT_TRUE(New.Open(Path, Key));
+    EXPECT_EQ(New.size(), 3U);
+    Old.Append(ComputeDigest(D), D.size(), {5});
+    FeatureCache All;
+    ASSERT_TRUE(All.Open(Path, Key));
+    EXPECT_EQ(All.size(), 4U);
+    EXPECT_TRUE(All.Lookup(ComputeDigest(D), D.size(), &Features));
+    EXPECT_EQ(Features, Vector<uint32_t>({5}));
+  }
+  {
+    // Another build: the cache is stale.
+    FeatureCache C;
+    ASSERT_TRUE(C.Open(Path, OtherKey));
+    EXPECT_EQ(C.size(), 0U);
+    EXPECT_FALSE(C.Lookup(ComputeDigest(A), A.size(), &Features));
+  }
+  RemoveFile(Path);
+}
+
+TEST(Corpus, Checkpoint) {
+  std::unique_ptr<InputCorpus> C(new InputCorpus(""));
+  EXPECT_TRUE(C->AddFeature(3, 2, false));
+  C->AddToCorpus({'a', 'b'}, 2, false, {7, 3});
+  EXPECT_TRUE(C->AddFeature(100000, 1, false));
+  C->AddToCorpus({'c'}, 1, true, {100000});
+  C->UpdateFeatureFrequency(3);
+  CheckpointWriter W;
+  C->SaveState(&W);
+
+  std::unique_ptr<InputCorpus> Restored(new InputCorpus(""));
+  CheckpointReader R(W.Data().data(), W.Data().size());
+  EXPECT_TRUE(Restored->LoadState(&R));
+  EXPECT_TRUE(R.AtEnd());
+  EXPECT_EQ(Restored->size(), 2U);
+  EXPECT_EQ(Restored->NumFeatures(), 2U);
+  EXPECT_TRUE(Restored->HasUnit(Unit({'c'})));
+  CheckpointWriter W2;
+  Restored->SaveState(&W2);
+  EXPECT_EQ(W.Data(), W2.Data());
+
+  // A payload cut short does not load.
+  for (size_t Size = 0; Size < W.Data().size(); Size += 7) {
+    std::unique_ptr<InputCorpus> Partial(new InputCorpus(""));
+    CheckpointReader Short(W.Data().data(), Size);
+    EXPECT_FALSE(Partial->LoadState(&Short)) << Size;
+  }
+}
+
+TEST(Fuzzer, CheckpointFile) {
+  std::string Path = DirPlusFile(TmpDir(), "libfuzzer-test-checkpoint-" +
+                                               std::to_string(GetPid()));
+  RemoveFile(Path);
+  UnitDigest Key = ComputeDigest({'k'}), OtherKey = ComputeDigest({'o'});
+  CheckpointWriter W;
+  W.Varint(0);
+  W.Varint(300);
+  W.Varint(UINT64_MAX);
+  W.Float(0.25);
+  W.Bytes(reinterpret_cast<const uint8_t *>("xyz"), 3);
+  Vector<uint32_t> Set = {1, 2, 1000, UINT32_MAX};
+  W.SortedSet(Span<uint32_t>(Set.data(), Set.size()));
+  Unit Payload;
+  EXPECT_FALSE(ReadCheckpointFile(Path, Key, &Payload));
+  ASSERT_TRUE(WriteCheckpointFile(Path, Key, W.Data()));
+  EXPECT_FALSE(ReadCheckpointFile(Path, OtherKey, &Payload));
+  ASSERT_TRUE(ReadCheckpointFile(Path, Key, &Payload));
+  EXPECT_EQ(Payload, W.Data());
+
+  CheckpointReader R(Payload.data(), Payload.size());
+  EXPECT_EQ(R.Varint(), 0U);
+  EXPECT_EQ(R.Varint(299), 0U);  // Out of range.
+  EXPECT_TRUE(R.Failed());
+  CheckpointReader R2(Payload.data(), Payload.size());
+  R2.Varint();
+  EXPECT_EQ(R2.Varint(300), 300U);
+  EXPECT_EQ(R2.Varint(), UINT64_MAX);
+  EXPECT_EQ(R2.Float(), 0.25);
+  EXPECT_EQ(R2.Bytes(), Unit({'x', 'y', 'z'}));
+  EXPECT_EQ(R2.SortedSet(), Set);
+  EXPECT_TRUE(R2.AtEnd());
+  EXPECT_FALSE(R2.Failed());
+
+  // A damaged payload is rejected.
+  Unit File = FileToVector(Path);
+  File.back() ^= 1;
+  WriteToFile(File, Path);
+  EXPECT_FALSE(ReadCheckpointFile(Path, Key, &Payload));
+  RemoveFile(Path);
+}
+
 TEST(Merge, Bad) {
   const char *kInvalidInputs[] = {
     "",
@@ -701,6 +1607,227 @@ TEST(Merge, Good) {
   EQ(NewFiles, {"B"});
 }
 
+TEST(Merge, Binary) {
+  // The control file of Merge.Good, in both formats.
+  for (bool Binary : {false, true}) {
+    std::ostringstream OS;
+    WriteMergeControlFileHeader(OS, {"A", "B", "C"}, 1, Binary);
+    WriteMergeStarted(OS, Binary, 0, 1000);
+    WriteMergeDone(OS, Binary, 0, {1, 2, 3});
+    WriteMergeStarted(OS, Binary, 1, 1001);
+    WriteMergeDone(OS, Binary, 1, {4, 5, 6, 300000});
+    WriteMergeStarted(OS, Binary, 2, 1002);
+    std::string CF = OS.str();
+    EXPECT_EQ(CF[0] == kMergeControlFileMagic[0], Binary);
+    Merger M;
+    EXPECT_TRUE(M.Parse(CF, true));
+    EXPECT_EQ(M.Binary, Binary);
+    EXPECT_EQ(M.Files.size(), 3U);
+    EXPECT_EQ(M.NumFilesInFirstCorpus, 1U);
+    EXPECT_EQ(M.Files[2].Name, "C");
+    EXPECT_EQ(M.Files[2].Size, 1002U);
+    EXPECT_EQ(M.LastFailure, "C");
+    EXPECT_EQ(M.FirstNotProcessedFile, 3U);
+    EQ(M.Files[1].Features, {4, 5, 6, 300000});
+    if (!Binary) continue;
+
+    // A DONE record cut short counts as missing.
+    std::ostringstream Done;
+    WriteMergeDone(Done, Binary, 2, {1, 3, 6});
+    for (size_t Size = 0; Size < Done.str().size(); Size++) {
+      EXPECT_TRUE(M.Parse(CF + Done.str().substr(0, Size), true));
+      EXPECT_EQ(M.LastFailure, "C");
+    }
+    EXPECT_TRUE(M.Parse(CF + Done.str(), true));
+    EXPECT_TRUE(M.LastFailure.empty());
+    EQ(M.Files[2].Features, {1, 3, 6});
+    Vector<std::string> NewFiles;
+    EXPECT_EQ(4U, M.Merge(&NewFiles));
+    EQ(NewFiles, {"B"});
+
+    EXPECT_FALSE(M.Parse(CF.substr(0, 10), false));
+    EXPECT_FALSE(M.Parse(CF + "X", false));
+    std::ostringstream Bad;
+    WriteMergeStarted(Bad, Binary, 5, 1);
+    EXPECT_FALSE(M.Parse(CF + Bad.str(), false));
+  }
+}
+
+TEST(Merge, NumFiles) {
+  // The number of files is bounded by the size of the control file only.
+  Merger M;
+  EXPECT_FALSE(M.Parse("100000000000\n0\nA\n", false));
+  EXPECT_FALSE(M.Parse("3\n0\nA\nB", false));
+  EXPECT_TRUE(M.Parse("3\n0\nA\nB\n\n", false));
+  EXPECT_EQ(M.Files.size(), 3U);
+  std::string Magic(kMergeControlFileMagic, sizeof(kMergeControlFileMagic));
+  // Version 1, 2^32 - 1 files, none in the first corpus, "A".
+  EXPECT_FALSE(M.Parse(Magic + "\x01\xff\xff\xff\xff\x0f" +
+                           std::string(1, '\0') + "\x01" "A",
+                       false));
+  EXPECT_TRUE(M.Parse(Magic + "\x01\x01" + std::string(1, '\0') +
+                          "\x01" "A",
+                      false));
+  EXPECT_EQ(M.Files.size(), 1U);
+}
+
+TEST(Merge, Weighted) {
+  Merger M;
+  // B has 2 features in 10 bytes, C 3 in 100.
+  EXPECT_TRUE(M.Parse("3\n0\nA\nB\nC\n"
+                      "STARTED 0 1\nDONE 0 1\n"
+                      "STARTED 1 10\nDONE 1 2 3\n"
+                      "STARTED 2 100\nDONE 2 1 2 3 4\n",
+                      true));
+  Vector<std::string> NewFiles;
+  EXPECT_EQ(4U, M.Merge(Set<uint32_t>(), &NewFiles, /*Weighted=*/true));
+  EXPECT_EQ(NewFiles, Vector<std::string>({"A", "B", "C"}));
+  EXPECT_TRUE(M.Parse("2\n0\nB\nC\n"
+                      "STARTED 0 10\nDONE 0 2\n"
+                      "STARTED 1 11\nDONE 1 2 3 4 5\n",
+                      true));
+  EXPECT_EQ(4U, M.Merge(Set<uint32_t>(), &NewFiles, /*Weighted=*/true));
+  EXPECT_EQ(NewFiles, Vector<std::string>({"C"}));
+  EXPECT_TRUE(M.Parse("2\n0\nB\nC\n"
+                      "STARTED 0 10\nDONE 0 2\n"
+                      "STARTED 1 11\nDONE 1 2 3 4 5\n",
+                      true));
+  EXPECT_EQ(4U, M.Merge(Set<uint32_t>(), &NewFiles));
+  EXPECT_EQ(NewFiles, Vector<std::string>({"B", "C"}));
+}
+
+TEST(Merge, BinarySummary) {
+  std::string Dir = TmpDir(), Pid = std::to_string(GetPid());
+  std::string A = DirPlusFile(Dir, "libfuzzer-test-summary-a-" + Pid),
+              B = DirPlusFile(Dir, "libfuzzer-test-summary-b-" + Pid),
+              Text = DirPlusFile(Dir, "libfuzzer-test-summary-t-" + Pid),
+              Union = DirPlusFile(Dir, "libfuzzer-test-summary-u-" + Pid);
+  Merger M;
+  EXPECT_TRUE(M.Parse("2\n0\nX\nY\n"
+                      "STARTED 0 10\nDONE 0 1 2 100\n"
+                      "STARTED 1 20\nDONE 1 3 64\n",
+                      true));
+  {
+    std::ofstream OS(A, std::ios::binary);
+    M.WriteBinarySummary(OS, /*WithFiles=*/true);
+    std::ofstream TOS(Text);
+    M.PrintSummary(TOS);
+  }
+  EXPECT_TRUE(M.Parse("1\n0\nZ\nSTARTED 0 5\nDONE 0 2 200\n", true));
+  {
+    std::ofstream OS(B, std::ios::binary);
+    M.WriteBinarySummary(OS, /*WithFiles=*/false);
+  }
+
+  Vector<uint64_t> Bitmap;
+  Vector<MergeFileInfo> Files;
+  EXPECT_TRUE(ReadCoverageSummary(A, &Bitmap, &Files));
+  ASSERT_EQ(Files.size(), 2U);
+  EXPECT_EQ(Files[1].Name, "Y");
+  EXPECT_EQ(Files[1].Size, 20U);
+  EQ(Files[1].Features, {3, 0x64});  // Hex in the control file.
+  Vector<uint64_t> TextBitmap;
+  EXPECT_TRUE(ReadCoverageSummary(Text, &TextBitmap));
+  EXPECT_EQ(Bitmap, TextBitmap);
+  EXPECT_TRUE(ReadCoverageSummary(B, &Bitmap, &Files));
+  EXPECT_EQ(Files.size(), 2U);
+
+  EXPECT_EQ(MergeCoverageSummaries(Union, {A, B}), 0);
+  Vector<uint64_t> UnionBitmap;
+  EXPECT_TRUE(ReadCoverageSummary(Union, &UnionBitmap));
+  EXPECT_EQ(UnionBitmap, Bitmap);
+  Vector<uint32_t> Features;
+  for (size_t i = 0; i < UnionBitmap.size() * 64; i++)
+    if (UnionBitmap[i / 64] & (1ULL << (i % 64)))
+      Features.push_back(i);
+  EQ(Features, {1, 2, 3, 0x64, 0x100, 0x200});
+
+  // The summary counts as the first corpus.
+  EXPECT_TRUE(M.Parse("2\n0\nP\nQ\n"
+                      "STARTED 0 1\nDONE 0 1 200\n"
+                      "STARTED 1 2\nDONE 1 5\n",
+                      true));
+  Vector<std::string> NewFiles;
+  EXPECT_EQ(1U, M.Merge(UnionBitmap, &NewFiles));
+  EXPECT_EQ(NewFiles, Vector<std::string>({"Q"}));
+
+  WriteToFile(Unit({0xff, 'x'}), B);
+  EXPECT_FALSE(ReadCoverageSummary(B, &Bitmap));
+  EXPECT_NE(MergeCoverageSummaries(Union, {A, B}), 0);
+  for (auto &Path : {A, B, Text, Union})
+    RemoveFile(Path);
+}
+
+TEST(Merge, Combine) {
+  // Files A and C of the first corpus and D, F of the second went to shard 0.
+  Vector<Merger> Shards(2);
+  EXPECT_TRUE(Shards[0].Parse("4\n2\nA\nC\nD\nF\n"
+                              "STARTED 0 1\nDONE 0 1 2\n"
+                              "STARTED 1 1\nDONE 1 3\n"
+                              "STARTED 2 2\nDONE 2 4\n"
+                              "STARTED 3 3\nDONE 3 5\n",
+                              true));
+  EXPECT_TRUE(Shards[1].Parse("2\n1\nB\nE\n"
+                              "STARTED 0 1\nDONE 0 1\n"
+                              "STARTED 1 2\nDONE 1 4 6\n",
+                              true));
+  Merger M;
+  M.Combine(&Shards);
+  EXPECT_TRUE(Shards.empty());
+  ASSERT_EQ(M.Files.size(), 6U);
+  EXPECT_EQ(M.NumFilesInFirstCorpus, 3U);
+  Vector<std::string> Names;
+  for (auto &MFI : M.Files)
+    Names.push_back(MFI.Name);
+  EXPECT_EQ(Names, Vector<std::string>({"A", "C", "B", "D", "F", "E"}));
+  EXPECT_EQ(M.Files[1].Features, Vector<uint32_t>({3}));
+  Vector<std::string> NewFiles;
+  // Feature 4 is in D and E, which have the same size; E has more features.
+  EXPECT_EQ(3U, M.Merge(&NewFiles));
+  EXPECT_EQ(NewFiles, Vector<std::string>({"E", "F"}));
+}
+
+TEST(Merge, FeatureCache) {
+  // A is the first corpus. The features of A..F are {1, 2}, {2, 3}, {3, 4},
+  // {5}, {1, 5} and {4, 6, 7}; the control file has those not seen in the
+  // files before. E adds nothing.
+  Merger Uncached;
+  EXPECT_TRUE(Uncached.Parse("6\n1\nA\nB\nC\nD\nE\nF\n"
+                             "STARTED 0 1\nDONE 0 1 2\n"
+                             "STARTED 1 1\nDONE 1 3\n"
+                             "STARTED 2 2\nDONE 2 4\n"
+                             "STARTED 3 2\nDONE 3 5\n"
+                             "STARTED 4 3\nDONE 4\n"
+                             "STARTED 5 4\nDONE 5 6 7\n",
+                             true));
+  Vector<std::string> Expected;
+  Uncached.Merge(&Expected);
+  EXPECT_EQ(Expected, Vector<std::string>({"B", "C", "D", "F"}));
+
+  // B and E are in the feature cache, with all of their features, the way
+  // CrashResistantMerge takes them; the others are executed.
+  Vector<Merger> Shards(2);
+  EXPECT_TRUE(Shards[0].Parse("4\n1\nA\nC\nD\nF\n"
+                              "STARTED 0 1\nDONE 0 1 2\n"
+                              "STARTED 1 2\nDONE 1 3 4\n"
+                              "STARTED 2 2\nDONE 2 5\n"
+                              "STARTED 3 4\nDONE 3 6 7\n",
+                              true));
+  MergeFileInfo B, E;
+  B.Name = "B";
+  B.Size = 1;
+  B.Features = {2, 3};
+  E.Name = "E";
+  E.Size = 3;
+  E.Features = {1, 5};
+  Shards[1].Files = {B, E};
+  Merger M;
+  M.Combine(&Shards);
+  Vector<std::string> NewFiles;
+  M.Merge(&NewFiles);
+  EXPECT_EQ(NewFiles, Expected);
+}
+
 TEST(Merge, Merge) {
 
   Merge("3\n1\nA\nB\nC\n"
@@ -764,6 +1891,164 @@ TEST(Fuzzer, ForEachNonZeroByte) {
   Expected = {          {109, 2}, {118, 3}, {120, 4},
               {135, 5}, {137, 6}, {146, 7}};
   EXPECT_EQ(Res, Expected);
+
+  // Random arrays and ranges, every SIMD level against a plain loop.
+  SIMDLevel Best = GetSIMDLevel();
+  Random Rand(0);
+  const size_t M = 1000;
+  alignas(64) uint8_t Big[M];
+  for (int Iter = 0; Iter < 300; Iter++) {
+    size_t Density = Rand(100) + 1;
+    for (size_t i = 0; i < M; i++)
+      Big[i] = Rand(100) < Density ? Rand(256) : 0;
+    size_t B = Rand(M), E = B + Rand(M - B + 1);
+    Expected.clear();
+    for (size_t i = B; i < E; i++)
+      if (Big[i])
+        Expected.push_back({7 + i - B, Big[i]});
+    for (int L = SIMD_NONE; L <= Best; L++) {
+      EXPECT_EQ(SetSIMDLevel(static_cast<SIMDLevel>(L)), L);
+      Res.clear();
+      ForEachNonZeroByte(Big + B, Big + E, 7, CB);
+      EXPECT_EQ(Res, Expected);
+    }
+  }
+  SetSIMDLevel(Best);
+}
+
+TEST(Fuzzer, ClassifyCounters) {
+  SIMDLevel Best = GetSIMDLevel();
+  uint8_t Counters[300], Buckets[301];
+  for (size_t i = 0; i < sizeof(Counters); i++)
+    Counters[i] = i % 256;
+  for (int L = SIMD_NONE; L <= Best; L++) {
+    SetSIMDLevel(static_cast<SIMDLevel>(L));
+    for (size_t N : {0, 1, 31, 32, 33, 64, 100, 256, 300}) {
+      memset(Buckets, 0xff, sizeof(Buckets));
+      ClassifyCounters(Counters, Buckets, N);
+      for (size_t i = 0; i < N; i++)
+        EXPECT_EQ(Buckets[i], Counters[i] ? CounterToFeature(Counters[i]) : 0);
+      EXPECT_EQ(Buckets[N], 0xff);
+    }
+  }
+  SetSIMDLevel(Best);
+}
+
+TEST(Fuzzer, ValueBitMapForEach) {
+  SIMDLevel Best = GetSIMDLevel();
+  Random Rand(0);
+  // Static to get the alignment of the real maps.
+  static ValueBitMap Map;
+  for (int Iter = 0; Iter < 100; Iter++) {
+    Map.Reset();
+    Set<size_t> Expected;
+    for (size_t i = 0, N = Rand(1000); i < N; i++) {
+      size_t Idx = Rand(Map.SizeInBits());
+      Map.AddValue(Idx);
+      Expected.insert(Idx);
+    }
+    for (int L = SIMD_NONE; L <= Best; L++) {
+      SetSIMDLevel(static_cast<SIMDLevel>(L));
+      Vector<size_t> Res;
+      Map.ForEach([&](size_t Idx) { Res.push_back(Idx); });
+      EXPECT_EQ(Res, Vector<size_t>(Expected.begin(), Expected.end()));
+    }
+  }
+  SetSIMDLevel(Best);
+}
+
+TEST(TracePC, DirtyList) {
+  const size_t N = 1000;
+  alignas(64) uint8_t Ar[N] = {};
+  size_t Idx[] = {0, 3, 8, 9, 100, 511, 512, 998, 999};
+  for (size_t I : Idx)
+    Ar[I] = I % 255 + 1;
+  size_t NumFound = 0;
+  auto CB = [&](size_t FirstFeature, size_t Idx, uint8_t V) { NumFound++; };
+  std::unique_ptr<DirtyList> Dirty(new DirtyList);
+  for (size_t Offset = 0; Offset < 8; Offset++) {
+    uint8_t Copy[N];
+    memcpy(Copy, Ar, N);
+    NumFound = 0;
+    Dirty->Start(true);
+    ForEachNonZeroByte(Copy + Offset, Copy + N - Offset, 0, CB, Dirty.get());
+    EXPECT_TRUE(Dirty->IsComplete());
+    EXPECT_LE(Dirty->size(), NumFound);
+    Dirty->Clear();
+    EXPECT_FALSE(Dirty->IsComplete());
+    // Only the scanned range is cleared.
+    for (size_t i = 0; i < N; i++)
+      EXPECT_EQ(Copy[i], (i >= Offset && i < N - Offset) ? 0 : Ar[i]);
+  }
+
+  // A list that overflows is not complete.
+  const size_t Big = DirtyList::kMaxSize * 8 + 256;
+  Vector<uint8_t> Many(Big, 1);
+  Dirty->Start(true);
+  ForEachNonZeroByte(Many.data(), Many.data() + Big, 0, CB, Dirty.get());
+  EXPECT_FALSE(Dirty->IsComplete());
+}
+
+TEST(TracePC, ThreadShard) {
+  uint8_t *MainCounters = ThreadCounters;
+  ValueBitMap *MainValueProfileMap = ThreadValueProfileMap;
+  uint8_t *ShardCounters = nullptr;
+  ValueBitMap *ShardValueProfileMap = nullptr;
+  std::thread T([&]() {
+    EXPECT_EQ(ThreadCounters, MainCounters);
+    TPC.CreateThreadShard();
+    ShardCounters = ThreadCounters;
+    ShardValueProfileMap = ThreadValueProfileMap;
+    ShardValueProfileMap->AddValue(42);
+  });
+  T.join();
+  EXPECT_NE(ShardCounters, MainCounters);
+  EXPECT_NE(ShardValueProfileMap, MainValueProfileMap);
+  EXPECT_EQ(ThreadCounters, MainCounters);
+  EXPECT_TRUE(ShardValueProfileMap->Get(42));
+  EXPECT_FALSE(MainValueProfileMap->Get(42));
+}
+
+extern "C" void __sanitizer_cov_trace_cmp1(uint8_t Arg1, uint8_t Arg2);
+
+// Value profile turns the compares into the features of this target.
+static int ThreadsTestCallback(const uint8_t *Data, size_t Size) {
+  if (Size >= 1)
+    __sanitizer_cov_trace_cmp1(Data[0], 'F');
+  if (Size >= 2)
+    __sanitizer_cov_trace_cmp1(Data[1], 'U');
+  if (Size >= 3)
+    __sanitizer_cov_trace_cmp1(Data[2], 'Z');
+  if (Size >= 4)
+    __sanitizer_cov_trace_cmp1(Data[3], 'Z');
+  return 0;
+}
+
+TEST(Fuzzer, Threads) {
+  std::unique_ptr<ExternalFunctions> t(new ExternalFunctions());
+  fuzzer::EF = t.get();
+  FuzzingOptions Options;
+  Options.MaxLen = 16;
+  Options.MaxNumberOfRuns = 30000;
+  Options.UseValueProfile = true;
+  Options.ReduceInputs = false;
+  Options.Verbosity = 0;
+  Options.PrintFinalStats = false;
+  // Leaked like in FuzzerDriver: the fuzzers stay registered for the signal
+  // handlers.
+  auto *MD = new MutationDispatcher(*new Random(0), Options);
+  auto *Corpus = new InputCorpus("");
+  auto *F = new Fuzzer(ThreadsTestCallback, *Corpus, *MD, Options);
+  for (int i = 1; i < 3; i++) {
+    auto *ThreadMD = new MutationDispatcher(*new Random(i), Options);
+    F->AddFuzzingThread(
+        new Fuzzer(ThreadsTestCallback, *Corpus, *ThreadMD, Options));
+  }
+  F->Loop({});
+  EXPECT_GE(F->getTotalNumberOfRuns(), Options.MaxNumberOfRuns);
+  EXPECT_GT(Corpus->size(), 1U);
+  // Every unit but the initial "\n" was added by one of the threads.
+  EXPECT_EQ(F->getTotalNumberOfNewUnitsAdded(), Corpus->size() - 1);
 }
 
 // FuzzerCommand unit tests. The arguments in the two helper methods below must